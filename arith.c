@@ -0,0 +1,397 @@
+/*--------------------------------------------------------------------
+  arith.c
+  Author: Nate Wilson
+  Description: evaluates $(( )) expressions by recursive descent, one
+  function per precedence level, straight from the text without
+  building a tree
+  --------------------------------------------------------------------*/
+
+#include "arith.h"
+#include "ish.h"
+#include "var.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* where an evaluation is up to */
+struct Arith
+{
+   /* the whole expression, for messages */
+   const char *pcExpr;
+   /* the next char to read */
+   const char *pcNext;
+   /* has an error been reported? */
+   int iFailed;
+};
+
+static long arith_parseConditional(struct Arith *psArith);
+
+/* report pcMessage about psArith's expression, unless an error has
+   been reported already. return 0, a value for the failed part */
+static long arith_fail(struct Arith *psArith, const char *pcMessage)
+{
+   assert(psArith != NULL);
+   assert(pcMessage != NULL);
+
+   if (! psArith->iFailed)
+      fprintf(stderr, "%s: %s: %s\n", getPgmName(), psArith->pcExpr,
+              pcMessage);
+   psArith->iFailed = TRUE;
+   return 0;
+}
+
+/* skip white space in psArith */
+static void arith_skipSpace(struct Arith *psArith)
+{
+   while (isspace((unsigned char)*psArith->pcNext))
+      psArith->pcNext++;
+}
+
+/* if the next thing in psArith is the operator pcOperator, skip it and
+   return TRUE. return FALSE otherwise. an operator that is the start of a
+   longer one, like < of <=, doesn't match */
+static int arith_accept(struct Arith *psArith, const char *pcOperator)
+{
+   size_t uLength;
+   char cAfter;
+
+   arith_skipSpace(psArith);
+   uLength = strlen(pcOperator);
+   if (strncmp(psArith->pcNext, pcOperator, uLength) != 0)
+      return FALSE;
+   cAfter = psArith->pcNext[uLength];
+   if ((uLength == 1) && (cAfter == '=') &&
+       (strchr("<>=!", *pcOperator) != NULL))
+      return FALSE;
+   if ((uLength == 1) && (cAfter == *pcOperator) &&
+       (strchr("&|<>", *pcOperator) != NULL))
+      return FALSE;
+   psArith->pcNext += uLength;
+   return TRUE;
+}
+
+/* variable: name, $name or ${name}, whose value is a number. an unset
+   or empty variable is 0 */
+static long arith_parseVariable(struct Arith *psArith)
+{
+   const char *pcName;
+   const char *pcValue;
+   char *pcEnd;
+   size_t uLength = 0;
+   int iBraced = FALSE;
+   long lValue;
+
+   if (*psArith->pcNext == '$')
+   {
+      psArith->pcNext++;
+      iBraced = (*psArith->pcNext == '{');
+      if (iBraced)
+         psArith->pcNext++;
+   }
+   pcName = psArith->pcNext;
+   if ((*pcName == '?') || (*pcName == '$'))
+      uLength = 1;
+   else if (isalpha((unsigned char)*pcName) || (*pcName == '_'))
+      while (isalnum((unsigned char)pcName[uLength]) ||
+             (pcName[uLength] == '_'))
+         uLength++;
+   if (uLength == 0)
+      return arith_fail(psArith, "syntax error");
+   psArith->pcNext += uLength;
+   if (iBraced && (*psArith->pcNext++ != '}'))
+      return arith_fail(psArith, "bad substitution");
+
+   pcValue = Var_get(pcName, uLength);
+   if (pcValue == NULL)
+      return 0;
+   while (isspace((unsigned char)*pcValue))
+      pcValue++;
+   if (*pcValue == '\0')
+      return 0;
+   errno = 0;
+   lValue = strtol(pcValue, &pcEnd, 0);
+   while (isspace((unsigned char)*pcEnd))
+      pcEnd++;
+   if ((*pcEnd != '\0') || (errno == ERANGE))
+      return arith_fail(psArith, "bad number");
+   return lValue;
+}
+
+/* primary: a number, a variable or a parenthesized expression */
+static long arith_parsePrimary(struct Arith *psArith)
+{
+   char *pcEnd;
+   long lValue;
+
+   arith_skipSpace(psArith);
+   if (arith_accept(psArith, "("))
+   {
+      lValue = arith_parseConditional(psArith);
+      if (! arith_accept(psArith, ")"))
+         return arith_fail(psArith, "missing ')'");
+      return lValue;
+   }
+   if (! isdigit((unsigned char)*psArith->pcNext))
+      return arith_parseVariable(psArith);
+   errno = 0;
+   lValue = strtol(psArith->pcNext, &pcEnd, 0);
+   if (errno == ERANGE)
+      return arith_fail(psArith, "number too large");
+   if (isalnum((unsigned char)*pcEnd))
+      return arith_fail(psArith, "bad number");
+   psArith->pcNext = pcEnd;
+   return lValue;
+}
+
+/* unary: - + ! ~ applied to a unary, or a primary */
+static long arith_parseUnary(struct Arith *psArith)
+{
+   long lValue;
+
+   if (arith_accept(psArith, "-"))
+   {
+      lValue = arith_parseUnary(psArith);
+      return (long)(0UL - (unsigned long)lValue);
+   }
+   if (arith_accept(psArith, "+"))
+      return arith_parseUnary(psArith);
+   if (arith_accept(psArith, "!"))
+      return ! arith_parseUnary(psArith);
+   if (arith_accept(psArith, "~"))
+      return ~ arith_parseUnary(psArith);
+   return arith_parsePrimary(psArith);
+}
+
+/* multiplicative: unaries joined by * / %. arithmetic wraps rather
+   than overflowing */
+static long arith_parseProduct(struct Arith *psArith)
+{
+   long lValue;
+   long lRight;
+   char cOperator;
+
+   lValue = arith_parseUnary(psArith);
+   for (;;)
+   {
+      if (arith_accept(psArith, "*"))
+         cOperator = '*';
+      else if (arith_accept(psArith, "/"))
+         cOperator = '/';
+      else if (arith_accept(psArith, "%"))
+         cOperator = '%';
+      else
+         return lValue;
+      lRight = arith_parseUnary(psArith);
+      if (cOperator == '*')
+         lValue = (long)((unsigned long)lValue * (unsigned long)lRight);
+      else if (lRight == 0)
+         return arith_fail(psArith, "division by zero");
+      else if ((lValue == LONG_MIN) && (lRight == -1))
+         lValue = (cOperator == '/') ? LONG_MIN : 0;
+      else
+         lValue = (cOperator == '/') ? lValue / lRight : lValue % lRight;
+   }
+}
+
+/* additive: products joined by + - */
+static long arith_parseSum(struct Arith *psArith)
+{
+   long lValue;
+
+   lValue = arith_parseProduct(psArith);
+   for (;;)
+   {
+      if (arith_accept(psArith, "+"))
+         lValue = (long)((unsigned long)lValue +
+                         (unsigned long)arith_parseProduct(psArith));
+      else if (arith_accept(psArith, "-"))
+         lValue = (long)((unsigned long)lValue -
+                         (unsigned long)arith_parseProduct(psArith));
+      else
+         return lValue;
+   }
+}
+
+/* shift: sums joined by << >>. the count is taken modulo the width
+   of a long, as the hardware does, rather than being undefined */
+static long arith_parseShift(struct Arith *psArith)
+{
+   const unsigned long ulCountMask = sizeof(long) * CHAR_BIT - 1;
+
+   long lValue;
+   unsigned long ulCount;
+
+   lValue = arith_parseSum(psArith);
+   for (;;)
+   {
+      if (arith_accept(psArith, "<<"))
+      {
+         ulCount = (unsigned long)arith_parseSum(psArith) & ulCountMask;
+         lValue = (long)((unsigned long)lValue << ulCount);
+      }
+      else if (arith_accept(psArith, ">>"))
+      {
+         ulCount = (unsigned long)arith_parseSum(psArith) & ulCountMask;
+         lValue = lValue >> ulCount;
+      }
+      else
+         return lValue;
+   }
+}
+
+/* relational: shifts joined by < <= > >= */
+static long arith_parseRelation(struct Arith *psArith)
+{
+   long lValue;
+
+   lValue = arith_parseShift(psArith);
+   for (;;)
+   {
+      if (arith_accept(psArith, "<="))
+         lValue = lValue <= arith_parseShift(psArith);
+      else if (arith_accept(psArith, ">="))
+         lValue = lValue >= arith_parseShift(psArith);
+      else if (arith_accept(psArith, "<"))
+         lValue = lValue < arith_parseShift(psArith);
+      else if (arith_accept(psArith, ">"))
+         lValue = lValue > arith_parseShift(psArith);
+      else
+         return lValue;
+   }
+}
+
+/* equality: relations joined by == != */
+static long arith_parseEquality(struct Arith *psArith)
+{
+   long lValue;
+
+   lValue = arith_parseRelation(psArith);
+   for (;;)
+   {
+      if (arith_accept(psArith, "=="))
+         lValue = lValue == arith_parseRelation(psArith);
+      else if (arith_accept(psArith, "!="))
+         lValue = lValue != arith_parseRelation(psArith);
+      else
+         return lValue;
+   }
+}
+
+/* bitwise and: equalities joined by & */
+static long arith_parseBitAnd(struct Arith *psArith)
+{
+   long lValue;
+
+   lValue = arith_parseEquality(psArith);
+   while (arith_accept(psArith, "&"))
+      lValue &= arith_parseEquality(psArith);
+   return lValue;
+}
+
+/* bitwise exclusive or: bitwise ands joined by ^ */
+static long arith_parseBitXor(struct Arith *psArith)
+{
+   long lValue;
+
+   lValue = arith_parseBitAnd(psArith);
+   while (arith_accept(psArith, "^"))
+      lValue ^= arith_parseBitAnd(psArith);
+   return lValue;
+}
+
+/* bitwise or: bitwise exclusive ors joined by | */
+static long arith_parseBitOr(struct Arith *psArith)
+{
+   long lValue;
+
+   lValue = arith_parseBitXor(psArith);
+   while (arith_accept(psArith, "|"))
+      lValue |= arith_parseBitXor(psArith);
+   return lValue;
+}
+
+/* logical and: bitwise ors joined by &&. both sides are always
+   evaluated, there being no side effects to skip */
+static long arith_parseAnd(struct Arith *psArith)
+{
+   long lValue;
+   long lRight;
+
+   lValue = arith_parseBitOr(psArith);
+   while (arith_accept(psArith, "&&"))
+   {
+      lRight = arith_parseBitOr(psArith);
+      lValue = lValue && lRight;
+   }
+   return lValue;
+}
+
+/* logical or: ands joined by || */
+static long arith_parseOr(struct Arith *psArith)
+{
+   long lValue;
+   long lRight;
+
+   lValue = arith_parseAnd(psArith);
+   while (arith_accept(psArith, "||"))
+   {
+      lRight = arith_parseAnd(psArith);
+      lValue = lValue || lRight;
+   }
+   return lValue;
+}
+
+/* conditional: an or, or an or ? expression : conditional. both
+   branches are evaluated, as both sides of && are */
+static long arith_parseConditional(struct Arith *psArith)
+{
+   long lValue;
+   long lTrue;
+   long lFalse;
+
+   lValue = arith_parseOr(psArith);
+   if (! arith_accept(psArith, "?"))
+      return lValue;
+   lTrue = arith_parseConditional(psArith);
+   if (! arith_accept(psArith, ":"))
+      return arith_fail(psArith, "missing ':'");
+   lFalse = arith_parseConditional(psArith);
+   return lValue ? lTrue : lFalse;
+}
+
+/* evaluate pcExpr into *plResult */
+int Arith_evaluate(const char *pcExpr, long *plResult)
+{
+   struct Arith sArith;
+   long lValue;
+
+   assert(pcExpr != NULL);
+   assert(plResult != NULL);
+
+   sArith.pcExpr = pcExpr;
+   sArith.pcNext = pcExpr;
+   sArith.iFailed = FALSE;
+
+   /* an empty expression is 0, as in other shells */
+   arith_skipSpace(&sArith);
+   if (*sArith.pcNext == '\0')
+   {
+      *plResult = 0;
+      return 0;
+   }
+   lValue = arith_parseConditional(&sArith);
+   arith_skipSpace(&sArith);
+   if (*sArith.pcNext != '\0')
+      (void)arith_fail(&sArith, "syntax error");
+   if (sArith.iFailed)
+      return -1;
+   *plResult = lValue;
+   return 0;
+}
@@ -0,0 +1,21 @@
+/*--------------------------------------------------------------------*/
+/* arith.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef ARITH_INCLUDED
+#define ARITH_INCLUDED
+
+/* evaluate the integer expression pcExpr, the inside of a $(( ))
+   expansion, and store its value in *plResult. expressions have
+   decimal, octal (0 prefix) and hex (0x prefix) numbers, variables
+   (name, $name or ${name}) holding numbers, parentheses and C's
+   operators with C's precedence, from tightest to loosest:
+      unary - + ! ~    * / %    + -    << >>    < <= > >=    == !=
+      &    ^    |    &&    ||    ?:
+   comparisons and logic give 1 or 0. there is no assignment or
+   comma operator. return 0 if successful, or -1 after writing a
+   message to stderr */
+int Arith_evaluate(const char *pcExpr, long *plResult);
+
+#endif
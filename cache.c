@@ -0,0 +1,735 @@
+/*--------------------------------------------------------------------
+  cache.c
+  Author: Nate Wilson
+  Description: the cache builtin. a command's stdout is kept in an
+  on-disk store under a key made of everything the command is taken
+  to depend on, and a later run with the same key gets the kept
+  output copied into place in the kernel, by a reflink where the file
+  system has them and copy_file_range otherwise, without a fork or an
+  exec
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "cache.h"
+#include "command.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "redirect.h"
+#include "event.h"
+#include "mem.h"
+#include "var.h"
+#include "path.h"
+#include "spawn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* exit statuses, same as timeout */
+enum {CACHE_FAILED = 125, CACHE_SIGNALED = 128};
+
+/* the most bytes the store keeps, unless ISH_CACHE_MAX says
+   otherwise, and the size of each read when a copy can't be done in
+   the kernel */
+enum {CACHE_MAX = 67108864, CACHE_CHUNK = 65536};
+
+/* the room a key, or the directory in it, starts with */
+enum {CACHE_KEY_LENGTH = 256};
+
+/* an entry's name is two 32-bit hashes of its key in hex */
+enum {CACHE_NAME_LENGTH = 16};
+
+/* The permissions of the store and its files. */
+enum {CACHE_DIR_PERMISSIONS = 0700, CACHE_PERMISSIONS = 0600};
+
+/* a key as it is built, '\0' separated strings */
+struct CacheKey
+{
+   char *pcText;
+   size_t uLength;
+   size_t uPhysLength;
+};
+
+/* the command being run */
+struct CacheChild
+{
+   /* has it been reaped? */
+   int iExited;
+   /* its wait status, once reaped */
+   int iStatus;
+};
+
+/* an entry of the store, when choosing which to remove */
+struct CacheEntry
+{
+   char acName[CACHE_NAME_LENGTH + 1];
+   /* when it was last stored or used */
+   struct timespec sUsed;
+   /* the size of its output */
+   off_t iSize;
+};
+
+/* append the uLength chars at pcChars to psKey */
+static void cache_append(struct CacheKey *psKey, const char *pcChars,
+                         size_t uLength)
+{
+   assert(psKey != NULL);
+   assert(pcChars != NULL);
+
+   if (psKey->uLength + uLength > psKey->uPhysLength)
+   {
+      while (psKey->uLength + uLength > psKey->uPhysLength)
+         psKey->uPhysLength *= 2;
+      psKey->pcText = (char*)Mem_realloc(MEM_CACHE, psKey->pcText,
+                                         psKey->uPhysLength);
+   }
+   memcpy(psKey->pcText + psKey->uLength, pcChars, uLength);
+   psKey->uLength += uLength;
+}
+
+/* append pcString and its '\0' to psKey */
+static void cache_appendString(struct CacheKey *psKey,
+                               const char *pcString)
+{
+   cache_append(psKey, pcString, strlen(pcString) + 1);
+}
+
+/* append the redirection oRedirect to psKey: its kind and fds, and
+   what it reads. return 0 if successful, or -1 if it reads something
+   that isn't a plain file, whose contents can't be told apart */
+static int cache_appendRedirect(struct CacheKey *psKey,
+                                Redirect_T oRedirect)
+{
+   enum {MAX_LINE_LENGTH = 128};
+   char acLine[MAX_LINE_LENGTH];
+   struct stat sStat;
+
+   assert(oRedirect != NULL);
+
+   sprintf(acLine, "redirect %d %d %d", (int)Redirect_getType(oRedirect),
+           Redirect_getFd(oRedirect), Redirect_getSourceFd(oRedirect));
+   cache_appendString(psKey, acLine);
+   switch (Redirect_getType(oRedirect))
+   {
+      case REDIRECT_INPUT:
+         /* the file is known by its identity and mtime, which is
+            cheaper than hashing what it holds */
+         if ((stat(Redirect_getWord(oRedirect), &sStat) == -1) ||
+             (! S_ISREG(sStat.st_mode)))
+            return -1;
+         sprintf(acLine, "%lu %lu %ld %ld %ld",
+                 (unsigned long)sStat.st_dev, (unsigned long)sStat.st_ino,
+                 (long)sStat.st_size, (long)sStat.st_mtim.tv_sec,
+                 (long)sStat.st_mtim.tv_nsec);
+         cache_appendString(psKey, acLine);
+         break;
+      case REDIRECT_HEREDOC:
+      case REDIRECT_HERESTRING:
+         cache_appendString(psKey, Redirect_getBody(oRedirect));
+         break;
+      default:
+         break;
+   }
+   return 0;
+}
+
+/* fill psKey for oCommand, whose command is at token uCmdIndex and
+   whose -e names come before it. return 0 if successful, or -1 if
+   oCommand's output can't be kept */
+static int cache_buildKey(Command_T oCommand, size_t uCmdIndex,
+                          struct CacheKey *psKey)
+{
+   DynArray_T oTokens;
+   DynArray_T oRedirects;
+   const char *pcName;
+   const char *pcValue;
+   char *pcDir;
+   size_t uDirLength;
+   size_t uIndex;
+
+   assert(oCommand != NULL);
+   assert(psKey != NULL);
+
+   psKey->uLength = 0;
+   psKey->uPhysLength = CACHE_KEY_LENGTH;
+   psKey->pcText = (char*)Mem_alloc(MEM_CACHE, psKey->uPhysLength);
+   cache_appendString(psKey, "ish cache 1");
+
+   uDirLength = CACHE_KEY_LENGTH;
+   pcDir = (char*)Mem_alloc(MEM_CACHE, uDirLength);
+   while (getcwd(pcDir, uDirLength) == NULL)
+   {
+      if (errno != ERANGE)
+      {
+         Mem_free(pcDir);
+         return -1;
+      }
+      uDirLength *= 2;
+      pcDir = (char*)Mem_realloc(MEM_CACHE, pcDir, uDirLength);
+   }
+   cache_appendString(psKey, pcDir);
+   Mem_free(pcDir);
+
+   /* PATH picks the command, and -e names the rest */
+   oTokens = Command_getTokens(oCommand);
+   pcValue = Var_get("PATH", strlen("PATH"));
+   cache_appendString(psKey, (pcValue != NULL) ? pcValue : "");
+   for (uIndex = 2; uIndex < uCmdIndex; uIndex += 2)
+   {
+      pcName = Token_getValue(DynArray_get(oTokens, uIndex));
+      pcValue = Var_get(pcName, strlen(pcName));
+      cache_appendString(psKey, pcName);
+      if (pcValue == NULL)
+         cache_append(psKey, "", 1);
+      else
+      {
+         cache_append(psKey, "=", 1);
+         cache_appendString(psKey, pcValue);
+      }
+   }
+
+   for (uIndex = uCmdIndex; uIndex < DynArray_getLength(oTokens);
+        uIndex++)
+      cache_appendString(psKey,
+                         Token_getValue(DynArray_get(oTokens, uIndex)));
+
+   oRedirects = Command_getRedirects(oCommand);
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+      if (cache_appendRedirect(psKey,
+                               DynArray_get(oRedirects, uIndex)) == -1)
+         return -1;
+   return 0;
+}
+
+/* store the name of psKey's entry, two 32-bit FNV-1a hashes of it with
+   different offsets, in acName */
+static void cache_nameKey(const struct CacheKey *psKey, char acName[])
+{
+   const unsigned long ulFnvPrime = 16777619UL;
+
+   unsigned long ulHigh = 2166136261UL;
+   unsigned long ulLow = 84696351UL;
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < psKey->uLength; uIndex++)
+   {
+      ulHigh ^= (unsigned long)(unsigned char)psKey->pcText[uIndex];
+      ulHigh = (ulHigh * ulFnvPrime) & 0xffffffffUL;
+      ulLow ^= (unsigned long)(unsigned char)psKey->pcText[uIndex];
+      ulLow = (ulLow * ulFnvPrime) & 0xffffffffUL;
+   }
+   sprintf(acName, "%08lx%08lx", ulHigh, ulLow);
+}
+
+/* return the store's directory, which the caller owns, creating it if
+   need be, or NULL if there is none */
+static char *cache_getDir(void)
+{
+   const char *pcDir;
+   const char *pcHome;
+   char *pcPath;
+
+   pcDir = Var_get("ISH_CACHE_DIR", strlen("ISH_CACHE_DIR"));
+   if ((pcDir != NULL) && (*pcDir != '\0'))
+   {
+      pcPath = (char*)Mem_alloc(MEM_CACHE, strlen(pcDir) + 1);
+      strcpy(pcPath, pcDir);
+   }
+   else
+   {
+      pcHome = Var_get("HOME", strlen("HOME"));
+      if ((pcHome == NULL) || (*pcHome == '\0'))
+         return NULL;
+      pcPath = (char*)Mem_alloc(MEM_CACHE,
+                                strlen(pcHome) + sizeof("/.cache/ish"));
+      sprintf(pcPath, "%s/.cache", pcHome);
+      (void)mkdir(pcPath, CACHE_DIR_PERMISSIONS);
+      strcat(pcPath, "/ish");
+   }
+   if ((mkdir(pcPath, CACHE_DIR_PERMISSIONS) == -1) && (errno != EEXIST))
+   {
+      Mem_free(pcPath);
+      return NULL;
+   }
+   return pcPath;
+}
+
+/* return the bound on the store's size that ISH_CACHE_MAX sets, or the
+   default if it isn't set to a number */
+static off_t cache_getMax(void)
+{
+   const char *pcMax;
+   char *pcEnd;
+   long lMax;
+
+   pcMax = Var_get("ISH_CACHE_MAX", strlen("ISH_CACHE_MAX"));
+   if ((pcMax == NULL) || (*pcMax == '\0'))
+      return CACHE_MAX;
+   errno = 0;
+   lMax = strtol(pcMax, &pcEnd, 10);
+   if ((*pcEnd != '\0') || (errno == ERANGE) || (lMax < 0))
+      return CACHE_MAX;
+   return (off_t)lMax;
+}
+
+/* return a path to the file of entry pcName in the store pcDir whose
+   name ends in pcSuffix, which the caller owns */
+static char *cache_getPath(const char *pcDir, const char *pcName,
+                           const char *pcSuffix)
+{
+   char *pcPath;
+
+   pcPath = (char*)Mem_alloc(MEM_CACHE, strlen(pcDir) + strlen(pcName)
+                             + strlen(pcSuffix) + 2);
+   sprintf(pcPath, "%s/%s%s", pcDir, pcName, pcSuffix);
+   return pcPath;
+}
+
+/* copy uLength bytes from iFromFd, starting at iOffset, to the end of
+   iToFd, in the kernel if the file systems allow and iToFd isn't
+   opened for appending. return 0 if
+   successful, or -1 with errno set otherwise */
+static int cache_copy(int iFromFd, off_t iOffset, off_t uLength,
+                      int iToFd)
+{
+   char acBuffer[CACHE_CHUNK];
+   ssize_t iCopied;
+   ssize_t iWritten;
+   ssize_t iDone;
+   int iInKernel = TRUE;
+
+   while (uLength > 0)
+   {
+      iCopied = -1;
+      if (iInKernel)
+      {
+         iCopied = copy_file_range(iFromFd, &iOffset, iToFd, NULL,
+                                   (size_t)uLength, 0);
+         if ((iCopied == -1) &&
+             ((errno == EXDEV) || (errno == EINVAL) || (errno == ENOSYS) ||
+              (errno == EOPNOTSUPP) || (errno == EBADF)))
+            iInKernel = FALSE;
+      }
+      if (! iInKernel)
+      {  /* a file system that can't, so through the buffer */
+         iCopied = pread(iFromFd, acBuffer,
+                         (uLength < CACHE_CHUNK) ? (size_t)uLength
+                                                 : CACHE_CHUNK,
+                         iOffset);
+         for (iDone = 0; iDone < iCopied; iDone += iWritten)
+         {
+            iWritten = write(iToFd, acBuffer + iDone,
+                             (size_t)(iCopied - iDone));
+            if (iWritten == -1)
+               return -1;
+         }
+         if (iCopied > 0)
+            iOffset += iCopied;
+      }
+      if (iCopied == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      if (iCopied == 0) /* the file got shorter */
+         return 0;
+      uLength -= iCopied;
+   }
+   return 0;
+}
+
+/* if the store pcDir has the entry pcName for psKey, copy its output
+   to iOutFd and return TRUE, else return FALSE */
+static int cache_replay(const char *pcDir, const char *pcName,
+                        const struct CacheKey *psKey, int iOutFd)
+{
+   struct stat sStat;
+   char *pcPath;
+   char *pcStored;
+   int iKeyFd;
+   int iFd;
+   int iHit;
+
+   pcPath = cache_getPath(pcDir, pcName, ".key");
+   iKeyFd = open(pcPath, O_RDONLY | O_CLOEXEC);
+   Mem_free(pcPath);
+   if (iKeyFd == -1)
+      return FALSE;
+
+   /* the name is a hash, so the whole key must match */
+   iHit = FALSE;
+   if ((fstat(iKeyFd, &sStat) == 0) &&
+       (sStat.st_size == (off_t)psKey->uLength))
+   {
+      pcStored = (char*)Mem_alloc(MEM_CACHE, psKey->uLength + 1);
+      iHit = (pread(iKeyFd, pcStored, psKey->uLength, 0) ==
+              (ssize_t)psKey->uLength) &&
+             (memcmp(pcStored, psKey->pcText, psKey->uLength) == 0);
+      Mem_free(pcStored);
+   }
+   if (! iHit)
+   {
+      (void)close(iKeyFd);
+      return FALSE;
+   }
+
+   pcPath = cache_getPath(pcDir, pcName, ".out");
+   iFd = open(pcPath, O_RDONLY | O_CLOEXEC);
+   Mem_free(pcPath);
+   if ((iFd == -1) || (fstat(iFd, &sStat) == -1))
+   {
+      if (iFd != -1)
+         (void)close(iFd);
+      (void)close(iKeyFd);
+      return FALSE;
+   }
+
+   /* an empty file takes a reflink of the whole entry, sharing its
+      blocks, if the file system can */
+   iHit = ((lseek(iOutFd, 0, SEEK_END) == 0) &&
+           (ioctl(iOutFd, FICLONE, iFd) == 0));
+   if ((! iHit) && (cache_copy(iFd, 0, sStat.st_size, iOutFd) == 0))
+      iHit = TRUE;
+   if (! iHit)
+      perror(getPgmName());
+   else /* the mtime of the key is when it was last used */
+      (void)futimens(iKeyFd, NULL);
+   (void)close(iFd);
+   (void)close(iKeyFd);
+   return iHit;
+}
+
+/* order psLeft and psRight, struct CacheEntry, from least to most
+   recently used */
+static int cache_compareEntries(const void *pvLeft, const void *pvRight)
+{
+   const struct CacheEntry *psLeft = (const struct CacheEntry*)pvLeft;
+   const struct CacheEntry *psRight = (const struct CacheEntry*)pvRight;
+
+   if (psLeft->sUsed.tv_sec != psRight->sUsed.tv_sec)
+      return (psLeft->sUsed.tv_sec < psRight->sUsed.tv_sec) ? -1 : 1;
+   if (psLeft->sUsed.tv_nsec != psRight->sUsed.tv_nsec)
+      return (psLeft->sUsed.tv_nsec < psRight->sUsed.tv_nsec) ? -1 : 1;
+   return 0;
+}
+
+/* remove the least recently used entries of the store pcDir until the
+   outputs left take at most iMax bytes */
+static void cache_evict(const char *pcDir, off_t iMax)
+{
+   struct CacheEntry *psEntries;
+   struct dirent *psDirent;
+   struct stat sStat;
+   DIR *psDir;
+   char *pcPath;
+   size_t uLength = 0;
+   size_t uPhysLength = 64;
+   size_t uIndex;
+   off_t iTotal = 0;
+
+   psDir = opendir(pcDir);
+   if (psDir == NULL)
+      return;
+   psEntries = (struct CacheEntry*)Mem_alloc(MEM_CACHE,
+                                             uPhysLength *
+                                             sizeof(*psEntries));
+   while ((psDirent = readdir(psDir)) != NULL)
+   {
+      if ((strlen(psDirent->d_name) != CACHE_NAME_LENGTH + 4) ||
+          (strcmp(psDirent->d_name + CACHE_NAME_LENGTH, ".key") != 0))
+         continue;
+      if (uLength == uPhysLength)
+      {
+         uPhysLength *= 2;
+         psEntries = (struct CacheEntry*)Mem_realloc(MEM_CACHE,
+            psEntries, uPhysLength * sizeof(*psEntries));
+      }
+      memcpy(psEntries[uLength].acName, psDirent->d_name,
+             CACHE_NAME_LENGTH);
+      psEntries[uLength].acName[CACHE_NAME_LENGTH] = '\0';
+      pcPath = cache_getPath(pcDir, psEntries[uLength].acName, ".key");
+      if (stat(pcPath, &sStat) == -1)
+      {
+         Mem_free(pcPath);
+         continue;
+      }
+      psEntries[uLength].sUsed = sStat.st_mtim;
+      Mem_free(pcPath);
+      pcPath = cache_getPath(pcDir, psEntries[uLength].acName, ".out");
+      psEntries[uLength].iSize = (stat(pcPath, &sStat) == 0)
+                                 ? sStat.st_size : 0;
+      Mem_free(pcPath);
+      iTotal += psEntries[uLength].iSize;
+      uLength++;
+   }
+   (void)closedir(psDir);
+
+   qsort(psEntries, uLength, sizeof(*psEntries), cache_compareEntries);
+   for (uIndex = 0; (uIndex < uLength) && (iTotal > iMax); uIndex++)
+   {  /* the key goes first, so no key is left without its output */
+      pcPath = cache_getPath(pcDir, psEntries[uIndex].acName, ".key");
+      (void)unlink(pcPath);
+      Mem_free(pcPath);
+      pcPath = cache_getPath(pcDir, psEntries[uIndex].acName, ".out");
+      (void)unlink(pcPath);
+      Mem_free(pcPath);
+      iTotal -= psEntries[uIndex].iSize;
+   }
+   Mem_free(psEntries);
+}
+
+/* write the uLength chars at pcData to the new file pcPath, by way of a
+   temporary file so that the entry is never seen half written. copy
+   iLength bytes at iOffset of iFromFd instead if pcData is NULL.
+   return 0 if successful, or -1 with errno set otherwise */
+static int cache_writeFile(const char *pcPath, const char *pcData,
+                           size_t uLength, int iFromFd, off_t iOffset,
+                           off_t iLength)
+{
+   char *pcTemp;
+   ssize_t iWritten;
+   int iFd;
+   int iRet = 0;
+
+   pcTemp = (char*)Mem_alloc(MEM_CACHE, strlen(pcPath) + 32);
+   sprintf(pcTemp, "%s.%ld", pcPath, (long)getpid());
+   iFd = open(pcTemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              CACHE_PERMISSIONS);
+   if (iFd == -1)
+   {
+      Mem_free(pcTemp);
+      return -1;
+   }
+   if (pcData == NULL)
+      iRet = cache_copy(iFromFd, iOffset, iLength, iFd);
+   else
+      for (; (uLength > 0) && (iRet == 0); uLength -= (size_t)iWritten)
+      {
+         iWritten = write(iFd, pcData, uLength);
+         if (iWritten == -1)
+            iRet = -1;
+         else
+            pcData += iWritten;
+      }
+   if ((close(iFd) == -1) || (iRet == -1) ||
+       (rename(pcTemp, pcPath) == -1))
+   {
+      (void)unlink(pcTemp);
+      iRet = -1;
+   }
+   Mem_free(pcTemp);
+   return iRet;
+}
+
+/* keep what the command appended to pcOutPath, its stdout iOutFd,
+   from iOffset on as the output of entry pcName in the store pcDir,
+   under psKey, then bound the store */
+static void cache_store(const char *pcDir, const char *pcName,
+                        const struct CacheKey *psKey,
+                        const char *pcOutPath, int iOutFd, off_t iOffset)
+{
+   struct stat sOutStat;
+   struct stat sStat;
+   char *pcPath;
+   int iFd;
+   int iRet;
+
+   /* iOutFd is write only, so the output is read through its path,
+      as long as that is still the same file */
+   iFd = open(pcOutPath, O_RDONLY | O_CLOEXEC);
+   if (iFd == -1)
+      return;
+   if ((fstat(iOutFd, &sOutStat) == -1) || (fstat(iFd, &sStat) == -1) ||
+       (sStat.st_dev != sOutStat.st_dev) ||
+       (sStat.st_ino != sOutStat.st_ino) || (sStat.st_size < iOffset))
+   {
+      (void)close(iFd);
+      return;
+   }
+
+   /* the output goes first, so no key is seen without it */
+   pcPath = cache_getPath(pcDir, pcName, ".out");
+   iRet = cache_writeFile(pcPath, NULL, 0, iFd, iOffset,
+                          sStat.st_size - iOffset);
+   Mem_free(pcPath);
+   (void)close(iFd);
+   if (iRet == 0)
+   {
+      pcPath = cache_getPath(pcDir, pcName, ".key");
+      iRet = cache_writeFile(pcPath, psKey->pcText, psKey->uLength, -1,
+                             0, 0);
+      Mem_free(pcPath);
+   }
+   if (iRet == -1)
+      fprintf(stderr, "%s: cache: %s: %s\n", getPgmName(), pcDir,
+              strerror(errno));
+   cache_evict(pcDir, cache_getMax());
+}
+
+/* the event loop's handler for the command exiting with wait status
+   iStatus: record it in the struct CacheChild pvExtra */
+static void cache_reap(pid_t iPid, int iStatus, void *pvExtra)
+{
+   struct CacheChild *psChild = (struct CacheChild*)pvExtra;
+
+   (void)iPid;
+   assert(psChild != NULL);
+
+   psChild->iExited = TRUE;
+   psChild->iStatus = iStatus;
+}
+
+/* return the index into oTokens of the command after the -e options,
+   or 0 after writing a message to stderr if they are malformed */
+static size_t cache_parseOptions(DynArray_T oTokens)
+{
+   size_t uIndex;
+   size_t uLength;
+   const char *pcOption;
+   const char *pcPgmName = getPgmName();
+
+   uLength = DynArray_getLength(oTokens);
+   /* token 0 is "cache" itself */
+   for (uIndex = 1; uIndex < uLength; uIndex += 2)
+   {
+      pcOption = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (pcOption[0] != '-')
+         break;
+      if (strcmp(pcOption, "-e") != 0)
+      {
+         fprintf(stderr, "%s: cache: invalid option %s\n", pcPgmName,
+                 pcOption);
+         return 0;
+      }
+      if (uIndex + 1 == uLength)
+      {
+         fprintf(stderr, "%s: cache: option -e requires a value\n",
+                 pcPgmName);
+         return 0;
+      }
+   }
+   if (uIndex >= uLength)
+   {
+      fprintf(stderr, "%s: cache: missing command\n", pcPgmName);
+      return 0;
+   }
+   return uIndex;
+}
+
+/* run the cache builtin described by oCommand, with oEvent watching
+   the command. return the command's exit status, 0 if its output was
+   copied from the store, or a timeout style exit status */
+int Cache_run(Command_T oCommand, Event_T oEvent)
+{
+   char acName[CACHE_NAME_LENGTH + 1];
+   struct CacheKey sKey;
+   struct CacheChild sChild;
+   struct stat sStat;
+   DynArray_T oTokens;
+   RedirectPlan_T oPlan;
+   char **apcArgv;
+   char *pcDir = NULL;
+   size_t uCmdIndex;
+   size_t uLength;
+   size_t uIndex;
+   off_t iStart = 0;
+   pid_t iPid;
+   int iOutFd;
+   int iCacheable;
+   const char *pcPgmName = getPgmName();
+
+   assert(oCommand != NULL);
+
+   oTokens = Command_getTokens(oCommand);
+   uCmdIndex = cache_parseOptions(oTokens);
+   if (uCmdIndex == 0)
+      return CACHE_FAILED;
+
+   oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if (oPlan == NULL)
+      return CACHE_FAILED;
+   if (Redirect_watchPlan(oPlan, oEvent) == -1)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      return CACHE_FAILED;
+   }
+
+   /* only stdout into one plain file is kept */
+   iOutFd = Redirect_getPlanFd(oPlan, 1);
+   iCacheable = (Command_getStdout(oCommand) != NULL) && (iOutFd != -1) &&
+                (fstat(iOutFd, &sStat) == 0) && S_ISREG(sStat.st_mode);
+   if (iCacheable)
+   {  /* ">>" keeps what is appended */
+      iStart = sStat.st_size;
+      iCacheable = (cache_buildKey(oCommand, uCmdIndex, &sKey) == 0);
+      if (iCacheable)
+         pcDir = cache_getDir();
+      if (pcDir == NULL)
+      {
+         Mem_free(sKey.pcText);
+         iCacheable = FALSE;
+      }
+   }
+   if (iCacheable)
+   {
+      cache_nameKey(&sKey, acName);
+      if (cache_replay(pcDir, acName, &sKey, iOutFd))
+      {  /* no fork, no exec */
+         Redirect_freePlan(oPlan);
+         Mem_free(sKey.pcText);
+         Mem_free(pcDir);
+         return 0;
+      }
+   }
+
+   uLength = DynArray_getLength(oTokens) - uCmdIndex;
+   apcArgv = (char**)Mem_alloc(MEM_CACHE,
+                               sizeof(char *) * (uLength + 1));
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+      apcArgv[uIndex] = (char*)Token_getValue(
+         DynArray_get(oTokens, uCmdIndex + uIndex));
+   apcArgv[uLength] = NULL;
+   iPid = Spawn_command(apcArgv, Path_find(apcArgv[0]), NULL, oPlan,
+                        NULL, NULL);
+   if (iPid == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   Mem_free(apcArgv);
+
+   sChild.iExited = FALSE;
+   if (Event_reapChild(oEvent, iPid, cache_reap, &sChild) == -1)
+   {perror(pcPgmName); exit(EXIT_FAILURE); }
+   while (! sChild.iExited)
+      if (Event_runOnce(oEvent, -1) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE); }
+
+   /* only a run that succeeded is kept */
+   if (iCacheable && WIFEXITED(sChild.iStatus) &&
+       (WEXITSTATUS(sChild.iStatus) == 0))
+      cache_store(pcDir, acName, &sKey, Command_getStdout(oCommand),
+                  iOutFd, iStart);
+   if (iCacheable)
+   {
+      Mem_free(sKey.pcText);
+      Mem_free(pcDir);
+   }
+   Redirect_freePlan(oPlan);
+
+   if (WIFSIGNALED(sChild.iStatus))
+      return CACHE_SIGNALED + WTERMSIG(sChild.iStatus);
+   return WEXITSTATUS(sChild.iStatus);
+}
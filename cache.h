@@ -0,0 +1,28 @@
+/*--------------------------------------------------------------------*/
+/* cache.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef CACHE_INCLUDED
+#define CACHE_INCLUDED
+
+#include "command.h"
+#include "event.h"
+
+/* run the cache builtin described by oCommand:
+      cache [-e name]... cmd [args] [< in] > out
+   run cmd as if cache weren't there, and if it succeeds keep a copy of
+   what it wrote to the file out. the copy is keyed by cmd and its
+   args, the directory, PATH, the variables named with -e, and the
+   identity and mtime of each input file (or the text of each
+   here-document). a later run with the same key copies the kept
+   output into out instead of running cmd. only stdout is kept, and a
+   command whose stdout isn't one plain file, or whose input isn't
+   one, always runs. the copies are kept in ISH_CACHE_DIR, or
+   ~/.cache/ish, and the least recently used are removed once they
+   take more than ISH_CACHE_MAX bytes (64 MiB by default). oEvent
+   watches cmd. return cmd's exit status, 0 for a copy, or a timeout
+   style exit status if it could not be run */
+int Cache_run(Command_T oCommand, Event_T oEvent);
+
+#endif
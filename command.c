@@ -2,7 +2,7 @@
   command.c                                                          
   Author: Nate Wilson                                                
   Description: ADT representing a shell command, with information 
-  about the command's name, arguments and input/output redirection
+  about the command's name, arguments and redirections
   --------------------------------------------------------------------*/
 
 #include "token.h"
@@ -10,38 +10,134 @@
 #include "ish.h"
 #include "dynarray.h"
 #include "lex.h"
+#include "redirect.h"
+#include "mem.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
 /* structure that will be used to store command name, args, and 
    input output redirection */
 struct Command
 {
     /* first item is cmd name, all following items are cmd args */ 
    DynArray_T oTokens;
-    /* string representation of stdin redirection */
-   char *pcStdin;
-    /* string representation of stdout redirection */
-   char *pcStdout;
+    /* Redirect_T redirections, in command line order */
+   DynArray_T oRedirects;
+    /* run in the background, i.e. did the command end with '&'? */
+   int iBackground;
 };
 
-/* return pcStdin of oCommand */
+/* return the first redirection of oCommand that targets iFd and is
+   of type eType or eOtherType, or NULL if there is none */
+static Redirect_T command_findRedirect(Command_T oCommand, int iFd,
+                                       enum RedirectType eType,
+                                       enum RedirectType eOtherType)
+{
+   size_t uIndex;
+   Redirect_T oRedirect;
+
+   assert(oCommand != NULL);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oCommand->oRedirects);
+        uIndex++)
+   {
+      oRedirect = DynArray_get(oCommand->oRedirects, uIndex);
+      if ((Redirect_getFd(oRedirect) == iFd) &&
+          ((Redirect_getType(oRedirect) == eType) ||
+           (Redirect_getType(oRedirect) == eOtherType)))
+         return oRedirect;
+   }
+   return NULL;
+}
+
+/* return the file oCommand redirects stdin from, or NULL if none */
 char *Command_getStdin(Command_T oCommand)
 {
+   Redirect_T oRedirect;
+
    assert(oCommand != NULL);
-   
-   return oCommand->pcStdin;
+
+   oRedirect = command_findRedirect(oCommand, 0, REDIRECT_INPUT,
+                                    REDIRECT_INPUT);
+   if (oRedirect == NULL)
+      return NULL;
+   return Redirect_getWord(oRedirect);
 }
 
-/* return pcStdout of oCommand */
+/* return the file oCommand redirects stdout to, truncating or
+   appending, or NULL if none */
 char *Command_getStdout(Command_T oCommand)
 {
+   Redirect_T oRedirect;
+
    assert(oCommand != NULL);
-   
-   return oCommand->pcStdout;
+
+   oRedirect = command_findRedirect(oCommand, 1, REDIRECT_OUTPUT,
+                                    REDIRECT_APPEND);
+   if (oRedirect == NULL)
+      return NULL;
+   return Redirect_getWord(oRedirect);
+}
+
+/* return the first here-document of oCommand whose body is yet to be
+   read, or NULL if there is none */
+static Redirect_T command_findPendingHere(Command_T oCommand)
+{
+   size_t uIndex;
+   Redirect_T oRedirect;
+
+   assert(oCommand != NULL);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oCommand->oRedirects);
+        uIndex++)
+   {
+      oRedirect = DynArray_get(oCommand->oRedirects, uIndex);
+      if ((Redirect_getType(oRedirect) == REDIRECT_HEREDOC) &&
+          (Redirect_getBody(oRedirect) == NULL))
+         return oRedirect;
+   }
+   return NULL;
+}
+
+/* return the delimiter of oCommand's first pending here-document */
+char *Command_getHereDelimiter(Command_T oCommand)
+{
+   Redirect_T oRedirect;
+
+   assert(oCommand != NULL);
+
+   oRedirect = command_findPendingHere(oCommand);
+   if (oRedirect == NULL)
+      return NULL;
+   return Redirect_getWord(oRedirect);
+}
+
+/* give oCommand pcBody, the body of its first pending here-document.
+   oCommand takes ownership of pcBody */
+void Command_setHereBody(Command_T oCommand, char *pcBody)
+{
+   Redirect_T oRedirect;
+
+   assert(oCommand != NULL);
+   assert(pcBody != NULL);
+
+   oRedirect = command_findPendingHere(oCommand);
+   assert(oRedirect != NULL);
+   Redirect_setBody(oRedirect, pcBody);
+}
+
+/* return oRedirects of oCommand */
+DynArray_T Command_getRedirects(Command_T oCommand)
+{
+   assert(oCommand != NULL);
+
+   return oCommand->oRedirects;
 }
 
 /* return oTokens of oCommand,
@@ -56,11 +152,42 @@ DynArray_T Command_getTokens(Command_T oCommand)
 /* free dynamically allocated memory associated with oCommand */
 void Command_freeCommand(Command_T oCommand)
 {
+   size_t uIndex;
+
+   assert(oCommand != NULL);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oCommand->oRedirects);
+        uIndex++)
+      Redirect_free(DynArray_get(oCommand->oRedirects, uIndex));
+   DynArray_free(oCommand->oRedirects);
+   Mem_free(oCommand);
+}
+
+/* free the command pvExtra, built part way when memory ran out, but
+   not the tokens it was made from, which its caller still owns */
+static void command_undo(void *pvExtra)
+{
+   Command_T oCommand = (Command_T)pvExtra;
+   size_t uIndex;
+
    assert(oCommand != NULL);
-   /* from free man page: If ptr is NULL, no operation is performed. */
-   free(oCommand->pcStdin);
-   free(oCommand->pcStdout);
-   free(oCommand);
+
+   if (oCommand->oRedirects != NULL)
+   {
+      for (uIndex = 0;
+           uIndex < DynArray_getLength(oCommand->oRedirects); uIndex++)
+         Redirect_free(DynArray_get(oCommand->oRedirects, uIndex));
+      DynArray_free(oCommand->oRedirects);
+   }
+   Mem_free(oCommand);
+}
+
+/* return TRUE if oCommand runs in the background */
+int Command_isBackground(Command_T oCommand)
+{
+   assert(oCommand != NULL);
+
+   return oCommand->iBackground;
 }
 
 /* write oCommand to stdout according to spec at
@@ -71,6 +198,9 @@ void Command_writeCommand(Command_T oCommand)
    size_t uLength; /* length of cmd token array */
    size_t uIndex; /* index used for looping*/
    Token_T oToken; /* current token, multiple uses*/
+   Redirect_T oStdin; /* stdin file redirection, if any */
+   Redirect_T oStdout; /* stdout file redirection, if any */
+   Redirect_T oRedirect; /* current redirection */
    
    assert(oCommand != NULL);
    
@@ -89,11 +219,141 @@ void Command_writeCommand(Command_T oCommand)
       printf("Command arg: %s\n", Token_getValue(oToken));
    }
    
-   /* print stdin/stdout */
-   if (oCommand->pcStdin != NULL)
-      printf("Command stdin: %s\n", oCommand->pcStdin);
-   if (oCommand->pcStdout != NULL)
-      printf("Command stdout: %s\n", oCommand->pcStdout);
+   /* print stdin/stdout, then any other redirections in order */
+   oStdin = command_findRedirect(oCommand, 0, REDIRECT_INPUT,
+                                 REDIRECT_INPUT);
+   oStdout = command_findRedirect(oCommand, 1, REDIRECT_OUTPUT,
+                                  REDIRECT_OUTPUT);
+   if (oStdin != NULL)
+      Redirect_write(oStdin);
+   if (oStdout != NULL)
+      Redirect_write(oStdout);
+   for (uIndex = 0; uIndex < DynArray_getLength(oCommand->oRedirects);
+        uIndex++)
+   {
+      oRedirect = DynArray_get(oCommand->oRedirects, uIndex);
+      if ((oRedirect != oStdin) && (oRedirect != oStdout))
+         Redirect_write(oRedirect);
+   }
+   if (oCommand->iBackground)
+      printf("Command background\n");
+}
+
+/* write the error for the redirection operator pcOperator appearing
+   without the word that should follow it */
+static void command_writeMissingWord(const char *pcOperator)
+{
+   const char *pcKind;
+   int iFd;
+   const char *pcPgmName = getPgmName();
+
+   assert(pcOperator != NULL);
+
+   iFd = Redirect_getOperatorFd(pcOperator);
+   pcKind = pcOperator;
+   while (isdigit((unsigned char)*pcKind))
+      pcKind++;
+
+   if (strcmp(pcKind, "<<") == 0)
+      fprintf(stderr, "%s: here-document without delimiter\n",
+              pcPgmName);
+   else if (strcmp(pcKind, "<<<") == 0)
+      fprintf(stderr, "%s: here-string without word\n", pcPgmName);
+   else if (strchr(pcKind, '&') != NULL)
+      fprintf(stderr,
+              "%s: file descriptor duplication without file descriptor\n",
+              pcPgmName);
+   else if (iFd == 0)
+      fprintf(stderr,
+              "%s: standard input redirection without file name\n",
+              pcPgmName);
+   else if (iFd == 1)
+      fprintf(stderr,
+              "%s: standard output redirection without file name\n",
+              pcPgmName);
+   else
+      fprintf(stderr,
+              "%s: redirection of file descriptor %d without file name\n",
+              pcPgmName, iFd);
+}
+
+/* return TRUE if the redirection operator pcOperator sends its fd
+   into a file, i.e. is N> or N>> */
+static int command_isFileOutput(const char *pcOperator)
+{
+   assert(pcOperator != NULL);
+
+   while (isdigit((unsigned char)*pcOperator))
+      pcOperator++;
+   return (strcmp(pcOperator, ">") == 0) ||
+          (strcmp(pcOperator, ">>") == 0);
+}
+
+/* check that no fd is the target of more than one of the redirection
+   operators in oTokens, unless all of them send it into files, which
+   fans it out into every one of them. return TRUE if so, otherwise
+   write a message to stderr and return FALSE */
+static int command_checkMultipleRedirection(DynArray_T oTokens)
+{
+   size_t uIndex, uOther; /* used for looping */
+   size_t uLength; /* length of cmd token array */
+   size_t uStdinTokenCount = 0, uStdoutTokenCount = 0;
+   size_t uStdoutFileCount = 0;
+   Token_T oToken, oOtherToken;
+   int iFd;
+   const char *pcPgmName = getPgmName();
+
+   assert(oTokens != NULL);
+
+   uLength = DynArray_getLength(oTokens);
+   for (uIndex = 0; uIndex < uLength; uIndex++) {
+      oToken = DynArray_get(oTokens, uIndex);
+      if (Token_isSpecial(oToken)) {
+         iFd = Redirect_getOperatorFd(Token_getValue(oToken));
+         if (iFd == 0)
+            uStdinTokenCount++;
+         else if (iFd == 1) {
+            uStdoutTokenCount++;
+            if (command_isFileOutput(Token_getValue(oToken)))
+               uStdoutFileCount++;
+         }
+      }
+   }
+   if (uStdinTokenCount > 1)
+   {
+      fprintf(stderr, "%s: multiple redirection of standard input\n",
+              pcPgmName);
+      return FALSE;
+   }
+   if ((uStdoutTokenCount > 1) && (uStdoutFileCount < uStdoutTokenCount))
+   {
+      fprintf(stderr, "%s: multiple redirection of standard output\n",
+              pcPgmName);
+      return FALSE;
+   }
+
+   /* any other fd */
+   for (uIndex = 0; uIndex < uLength; uIndex++) {
+      oToken = DynArray_get(oTokens, uIndex);
+      if (! Token_isSpecial(oToken))
+         continue;
+      iFd = Redirect_getOperatorFd(Token_getValue(oToken));
+      for (uOther = uIndex + 1; uOther < uLength; uOther++) {
+         oOtherToken = DynArray_get(oTokens, uOther);
+         if (Token_isSpecial(oOtherToken) &&
+             (Redirect_getOperatorFd(Token_getValue(oOtherToken)) ==
+              iFd) &&
+             ! (command_isFileOutput(Token_getValue(oToken)) &&
+                command_isFileOutput(Token_getValue(oOtherToken))))
+         {
+            fprintf(stderr,
+                    "%s: multiple redirection of file descriptor %d\n",
+                    pcPgmName, iFd);
+            return FALSE;
+         }
+      }
+   }
+   return TRUE;
 }
 
 /* take a token array created by the lexical analyzer, 
@@ -103,11 +363,12 @@ Command_T Command_createCommand(DynArray_T oTokens)
 {
    size_t uIndex; /* used for looping */
    size_t uLength; /* length of cmd token array */
-   size_t uStdinTokenCount, uStdoutTokenCount; /* n stdin/out tokens */
    Token_T oToken, oNextToken; /* token pointers  */
    Command_T oCommand; /* command to create and return*/
-   char *pcStdinReferenceString  = "<"; /* used for string comparing */
+   Redirect_T oRedirect; /* redirection made from a special token */
+   int iBackground = FALSE; /* did the command end with '&'? */
    const char *pcPgmName; /* the program name */
+   struct MemUndo sUndo; /* frees the command if memory runs out */
    
    assert(oTokens != NULL);
 
@@ -123,113 +384,83 @@ Command_T Command_createCommand(DynArray_T oTokens)
       fprintf(stderr, "%s: missing command name\n", pcPgmName);
       return NULL;
    }
-   /* it is also an error for a DynArray to end with a special token*/
+   /* a trailing '&' isn't part of the command, it runs it in the
+      background */
    oToken = DynArray_get(oTokens, uLength - 1);
-   if (Token_isSpecial(oToken))
+   if (Token_isSpecial(oToken) &&
+       (strcmp(Token_getValue(oToken), "&") == 0))
    {
-      if (strcmp(Token_getValue(oToken), pcStdinReferenceString) == 0)
-      {  
-         fprintf(stderr,
-                 "%s: standard input redirection without file name\n",
-                 pcPgmName);
-         return NULL;
-      }
-      else
+      (void) DynArray_removeAt(oTokens, uLength - 1);
+      Token_free(oToken);
+      uLength--;
+      iBackground = TRUE;
+   }
+   /* '&' anywhere else is an error */
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+   {
+      oToken = DynArray_get(oTokens, uIndex);
+      if (Token_isSpecial(oToken) &&
+          (strcmp(Token_getValue(oToken), "&") == 0))
       {
-         fprintf(stderr,
-                 "%s: standard output redirection without file name\n",
-                 pcPgmName);
+         fprintf(stderr, "%s: '&' must end the command\n", pcPgmName);
          return NULL;
-      }  
-   }
-   /* past initial error checking, now build the command */
-   /* allocate command struct, set address to oCommand*/
-   oCommand = (struct Command*)malloc(sizeof(struct Command));
-   if (oCommand == NULL)
-   {perror(pcPgmName); exit(EXIT_FAILURE);}
-   /* set tokens array */
-   oCommand->oTokens = oTokens;
-   /* initialize stdin and out strings*/
-   oCommand->pcStdin = NULL;
-   oCommand->pcStdout = NULL;
-   /* multiple redirection check */
-   uStdinTokenCount = 0;
-   uStdoutTokenCount = 0;
-   /* now check for only one std in and one stdout token */
-   for (uIndex = 0; uIndex < uLength; uIndex++) {
-      oToken = DynArray_get(oCommand->oTokens, uIndex);
-      if (Token_isSpecial(oToken)) {
-         if (strcmp(Token_getValue(oToken), pcStdinReferenceString) == 0)
-            uStdinTokenCount++;
-         else
-            uStdoutTokenCount++;
-      }                
+      }
    }
-   if (uStdinTokenCount > 1)
+   /* it is also an error for a DynArray to end with a special token*/
+   oToken = DynArray_get(oTokens, uLength - 1);
+   if (Token_isSpecial(oToken))
    {
-      fprintf(stderr, "%s: multiple redirection of standard input\n",
-              pcPgmName);
-      free(oCommand);
+      command_writeMissingWord(Token_getValue(oToken));
       return NULL;
    }
-   if (uStdoutTokenCount > 1)
-   {
-      fprintf(stderr, "%s: multiple redirection of standard output\n",
-              pcPgmName);
-      free(oCommand);
+   /* multiple redirection check */
+   if (! command_checkMultipleRedirection(oTokens))
       return NULL;
-   }
+   /* past initial error checking, now build the command */
+   /* allocate command struct, set address to oCommand*/
+   oCommand = (struct Command*)Mem_alloc(MEM_COMMAND,
+                                         sizeof(struct Command));
+   /* set tokens array */
+   oCommand->oTokens = oTokens;
+   oCommand->iBackground = iBackground;
+   /* initialize the redirections */
+   oCommand->oRedirects = NULL;
+   Mem_pushUndo(&sUndo, command_undo, oCommand);
+   oCommand->oRedirects = DynArray_new(0);
+   if (oCommand->oRedirects == NULL)
+      Mem_fail();
 
    /* command creation loop */
    /* we can stop checking at length - 1 because we checked the end 
       of the array above */
-   /* for each element, if special, check special type,allocate
-      for proper string size and set accordingly */
+   /* for each element, if special, make a redirection from it and
+      the word after it */
    for (uIndex = 0; uIndex < uLength-1; uIndex++)
    {  
       oToken = DynArray_get(oCommand->oTokens, uIndex);
       if (Token_isSpecial(oToken))
-      {  /*if special get the next token, the redirect string*/
+      {  /*if special get the next token, the redirect word*/
          oNextToken = DynArray_get(oCommand->oTokens, uIndex+1);
          /* do not allow a special token immediately after a special token */
          if (Token_isSpecial(oNextToken))
-         {   /* if stdin  */
-            if (strcmp(Token_getValue(oToken),
-                       pcStdinReferenceString) == 0) {
-               fprintf(stderr,
-                   "%s: standard output redirection without file name",
-                       pcPgmName);
-               free(oCommand);
-               return NULL; }
-            else /* if stdout*/ {
-               fprintf(stderr,
-                    "%s: standard input redirection without file name",
-                       pcPgmName);
-               free(oCommand);
-               return NULL; }
+         {
+            command_writeMissingWord(Token_getValue(oToken));
+            Mem_popUndo(&sUndo);
+            Command_freeCommand(oCommand);
+            return NULL;
          }
-         /* if curr special token is stdin, set stdin in of command */
-         if (strcmp(Token_getValue(oToken), pcStdinReferenceString) == 0)
-         {         
-            oCommand->pcStdin =
-               (char*)malloc(strlen(Token_getValue(oNextToken)) + 1);
-            if (oCommand->pcStdin == NULL) {
-               perror(pcPgmName);
-               free(oCommand);
-               exit(EXIT_FAILURE);
-            }
-            strcpy(oCommand->pcStdin, Token_getValue(oNextToken));
+         oRedirect = Redirect_new(Token_getValue(oToken),
+                                  Token_getValue(oNextToken));
+         if (oRedirect == NULL)
+         {
+            Mem_popUndo(&sUndo);
+            Command_freeCommand(oCommand);
+            return NULL;
          }
-         else /*else it is stdout*/
+         if (! DynArray_add(oCommand->oRedirects, oRedirect))
          {
-            oCommand->pcStdout =
-               (char*)malloc(strlen(Token_getValue(oNextToken)) + 1);
-            if (oCommand->pcStdout == NULL) {
-               perror(pcPgmName);
-               free(oCommand);
-               exit(EXIT_FAILURE);
-            }
-            strcpy(oCommand->pcStdout, Token_getValue(oNextToken));
+            Redirect_free(oRedirect);
+            Mem_fail();
          }
          /* remove the special token and the one following it */
          (void) DynArray_removeAt(oCommand->oTokens, uIndex);
@@ -242,5 +473,6 @@ Command_T Command_createCommand(DynArray_T oTokens)
          uIndex = uIndex - 1;
       }
    }
+   Mem_popUndo(&sUndo);
    return oCommand;
 }
@@ -25,10 +25,26 @@ DynArray_T Command_getTokens(Command_T oCommand);
    return null if stdin  */
 char *Command_getStdin(Command_T oCommand);
 
-/* return a string name representing oCommand output redirection. 
-   return null if stdout  */
+/* return a string name representing oCommand output redirection,
+   whether truncating or appending. return null if stdout  */
 char *Command_getStdout(Command_T oCommand);
 
+/* return the array of oCommand's redirections, Redirect_T objects in
+   command line order */
+DynArray_T Command_getRedirects(Command_T oCommand);
+
+/* return the delimiter of oCommand's first here-document whose body
+   has not been read yet, or NULL if there is none */
+char *Command_getHereDelimiter(Command_T oCommand);
+
+/* give oCommand pcBody, the body read for its first pending
+   here-document. oCommand takes ownership of pcBody */
+void Command_setHereBody(Command_T oCommand, char *pcBody);
+
+/* return 1 (TRUE) if oCommand ended with '&', so that the shell
+   shouldn't wait for it */
+int Command_isBackground(Command_T oCommand);
+
 /* take a dynarray oTokens and create the return a command_t */
 Command_T Command_createCommand(DynArray_T oTokens);
 
@@ -4,6 +4,7 @@
 /*--------------------------------------------------------------------*/
 
 #include "dynarray.h"
+#include "mem.h"
 #include <assert.h>
 #include <stdlib.h>
 
@@ -66,7 +67,8 @@ static int DynArray_grow(DynArray_T oDynArray)
    uNewLength = GROWTH_FACTOR * oDynArray->uPhysLength;
 
    ppvNewArray = (const void**)
-      realloc(oDynArray->ppvArray, sizeof(void*) * uNewLength);
+      Mem_tryRealloc(MEM_DYNARRAY,
+                     oDynArray->ppvArray, sizeof(void*) * uNewLength);
    if (ppvNewArray == NULL)
       return 0;
 
@@ -81,7 +83,8 @@ DynArray_T DynArray_new(size_t uLength)
 {
    DynArray_T oDynArray;
 
-   oDynArray = (struct DynArray*)malloc(sizeof(struct DynArray));
+   oDynArray = (struct DynArray*)Mem_tryAlloc(MEM_DYNARRAY,
+                                              sizeof(struct DynArray));
    if (oDynArray == NULL)
       return NULL;
 
@@ -92,10 +95,11 @@ DynArray_T DynArray_new(size_t uLength)
       oDynArray->uPhysLength = MIN_PHYS_LENGTH;
 
    oDynArray->ppvArray =
-      (const void**)calloc(oDynArray->uPhysLength, sizeof(void*));
+      (const void**)Mem_tryCalloc(MEM_DYNARRAY,
+                                  oDynArray->uPhysLength, sizeof(void*));
    if (oDynArray->ppvArray == NULL)
    {
-      free(oDynArray);
+      Mem_free(oDynArray);
       return NULL;
    }
 
@@ -109,8 +113,8 @@ void DynArray_free(DynArray_T oDynArray)
    assert(oDynArray != NULL);
    assert(DynArray_isValid(oDynArray));
 
-   free(oDynArray->ppvArray);
-   free(oDynArray);
+   Mem_free(oDynArray->ppvArray);
+   Mem_free(oDynArray);
 }
 
 /*--------------------------------------------------------------------*/
@@ -0,0 +1,357 @@
+/*--------------------------------------------------------------------
+  event.c
+  Author: Nate Wilson
+  Description: the shell's event loop. fds and children (through
+  their pidfds) are all registered with one epoll instance, and each
+  watch is found from its fd with a table lookup, so an event costs the
+  same whether the shell watches one thing or thousands
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "event.h"
+#include "ish.h"
+#include "mem.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+/* most events taken from the kernel per epoll_wait */
+enum {MAX_EVENTS = 64};
+
+/* one fd or child being watched */
+struct Watch
+{
+   /* the fd watched, the pidfd for a child */
+   int iFd;
+   /* the child watched, 0 for a plain fd */
+   pid_t iPid;
+   /* called when a plain fd is readable */
+   void (*pfReady)(int iFd, void *pvExtra);
+   /* called when a child has been reaped, if not NULL */
+   void (*pfExited)(pid_t iPid, int iStatus, void *pvExtra);
+   /* passed to the handler */
+   void *pvExtra;
+};
+
+/* an epoll instance and the watches registered with it */
+struct Event
+{
+   /* the epoll instance */
+   int iEpollFd;
+   /* number of watches */
+   size_t uWatchCount;
+   /* physical length of apsWatches */
+   size_t uPhysLength;
+   /* the watch for each fd, NULL if the fd isn't watched */
+   struct Watch **apsWatches;
+   /* the resources used by the child last reaped */
+   struct rusage sUsage;
+};
+
+/* create and return an event loop watching nothing */
+Event_T Event_new(void)
+{
+   enum {INITIAL_PHYS_LENGTH = 64};
+
+   Event_T oEvent;
+
+   oEvent = (struct Event*)Mem_tryAlloc(MEM_EVENT, sizeof(struct Event));
+   if (oEvent == NULL)
+   {
+      errno = ENOMEM;
+      return NULL;
+   }
+   oEvent->apsWatches = (struct Watch**)Mem_tryCalloc(
+      MEM_EVENT, INITIAL_PHYS_LENGTH, sizeof(struct Watch*));
+   if (oEvent->apsWatches == NULL)
+   {
+      Mem_free(oEvent);
+      errno = ENOMEM;
+      return NULL;
+   }
+   oEvent->iEpollFd = epoll_create1(EPOLL_CLOEXEC);
+   if (oEvent->iEpollFd == -1)
+   {
+      Mem_free(oEvent->apsWatches);
+      Mem_free(oEvent);
+      return NULL;
+   }
+   oEvent->uWatchCount = 0;
+   memset(&oEvent->sUsage, 0, sizeof(oEvent->sUsage));
+   oEvent->uPhysLength = INITIAL_PHYS_LENGTH;
+   return oEvent;
+}
+
+/* register psWatch with oEvent under its fd. return 0 if successful,
+   -1 otherwise */
+static int event_addWatch(Event_T oEvent, struct Watch *psWatch)
+{
+   enum {GROWTH_FACTOR = 2};
+
+   struct epoll_event sEvent;
+   struct Watch **apsWatches;
+   size_t uPhysLength;
+
+   assert(oEvent != NULL);
+   assert(psWatch != NULL);
+   assert(psWatch->iFd >= 0);
+
+   if ((size_t)psWatch->iFd >= oEvent->uPhysLength)
+   {
+      uPhysLength = oEvent->uPhysLength;
+      while ((size_t)psWatch->iFd >= uPhysLength)
+         uPhysLength *= GROWTH_FACTOR;
+      apsWatches = (struct Watch**)Mem_tryRealloc(
+         MEM_EVENT, oEvent->apsWatches,
+         sizeof(struct Watch*) * uPhysLength);
+      if (apsWatches == NULL)
+      {
+         errno = ENOMEM;
+         return -1;
+      }
+      memset(apsWatches + oEvent->uPhysLength, 0,
+             sizeof(struct Watch*) * (uPhysLength - oEvent->uPhysLength));
+      oEvent->apsWatches = apsWatches;
+      oEvent->uPhysLength = uPhysLength;
+   }
+   assert(oEvent->apsWatches[psWatch->iFd] == NULL);
+
+   memset(&sEvent, 0, sizeof(sEvent));
+   sEvent.events = EPOLLIN;
+   sEvent.data.fd = psWatch->iFd;
+   if (epoll_ctl(oEvent->iEpollFd, EPOLL_CTL_ADD, psWatch->iFd,
+                 &sEvent) == -1)
+      return -1;
+   oEvent->apsWatches[psWatch->iFd] = psWatch;
+   oEvent->uWatchCount++;
+   return 0;
+}
+
+/* unregister the watch for iFd from oEvent and free it */
+static void event_removeWatch(Event_T oEvent, int iFd)
+{
+   assert(oEvent != NULL);
+   assert((iFd >= 0) && ((size_t)iFd < oEvent->uPhysLength));
+   assert(oEvent->apsWatches[iFd] != NULL);
+
+   (void)epoll_ctl(oEvent->iEpollFd, EPOLL_CTL_DEL, iFd, NULL);
+   Mem_free(oEvent->apsWatches[iFd]);
+   oEvent->apsWatches[iFd] = NULL;
+   oEvent->uWatchCount--;
+}
+
+/* return a new watch with no handlers, or NULL with errno set if
+   there isn't enough memory. the caller owns it */
+static struct Watch *event_newWatch(int iFd, pid_t iPid, void *pvExtra)
+{
+   struct Watch *psWatch;
+
+   psWatch = (struct Watch*)Mem_tryAlloc(MEM_EVENT,
+                                         sizeof(struct Watch));
+   if (psWatch == NULL)
+   {
+      errno = ENOMEM;
+      return NULL;
+   }
+   psWatch->iFd = iFd;
+   psWatch->iPid = iPid;
+   psWatch->pfReady = NULL;
+   psWatch->pfExited = NULL;
+   psWatch->pvExtra = pvExtra;
+   return psWatch;
+}
+
+/* have oEvent call pfReady each time iFd is readable */
+int Event_watchFd(Event_T oEvent, int iFd,
+                  void (*pfReady)(int iFd, void *pvExtra),
+                  void *pvExtra)
+{
+   struct Watch *psWatch;
+
+   assert(oEvent != NULL);
+   assert(pfReady != NULL);
+
+   psWatch = event_newWatch(iFd, 0, pvExtra);
+   if (psWatch == NULL)
+      return -1;
+   psWatch->pfReady = pfReady;
+   if (event_addWatch(oEvent, psWatch) == -1)
+   {
+      Mem_free(psWatch);
+      return -1;
+   }
+   return 0;
+}
+
+/* stop watching iFd */
+void Event_unwatchFd(Event_T oEvent, int iFd)
+{
+   assert(oEvent != NULL);
+   assert(oEvent->apsWatches[iFd]->iPid == 0);
+
+   event_removeWatch(oEvent, iFd);
+}
+
+/* have oEvent reap child iPid once it exits, then call pfExited. the
+   child's pidfd turns readable when it exits */
+int Event_watchChild(Event_T oEvent, pid_t iPid,
+                     void (*pfExited)(pid_t iPid, int iStatus,
+                                      void *pvExtra),
+                     void *pvExtra)
+{
+   struct Watch *psWatch;
+   int iPidFd;
+   int iSavedErrno;
+
+   assert(oEvent != NULL);
+   assert(iPid > 0);
+
+   /* pidfds are always close-on-exec */
+   iPidFd = (int)syscall(SYS_pidfd_open, iPid, 0);
+   if (iPidFd == -1)
+      return -1;
+   psWatch = event_newWatch(iPidFd, iPid, pvExtra);
+   if (psWatch != NULL)
+      psWatch->pfExited = pfExited;
+   if ((psWatch == NULL) || (event_addWatch(oEvent, psWatch) == -1))
+   {
+      iSavedErrno = errno;
+      Mem_free(psWatch);
+      (void)close(iPidFd);
+      errno = iSavedErrno;
+      return -1;
+   }
+   return 0;
+}
+
+/* have oEvent reap child iPid, or reap it here if it can't be
+   watched */
+int Event_reapChild(Event_T oEvent, pid_t iPid,
+                    void (*pfExited)(pid_t iPid, int iStatus,
+                                     void *pvExtra),
+                    void *pvExtra)
+{
+   int iStatus;
+
+   assert(oEvent != NULL);
+   assert(iPid > 0);
+
+   if (Event_watchChild(oEvent, iPid, pfExited, pvExtra) == 0)
+      return 0;
+   /* can't watch it, so wait for it now */
+   while (wait4(iPid, &iStatus, 0, &oEvent->sUsage) == -1)
+      if (errno != EINTR)
+         return -1;
+   Trace_mark(TRACE_EXIT, (int)iPid, iStatus);
+   if (pfExited != NULL)
+      (*pfExited)(iPid, iStatus, pvExtra);
+   return 0;
+}
+
+/* return the number of fds and children oEvent is watching */
+size_t Event_getWatchCount(Event_T oEvent)
+{
+   assert(oEvent != NULL);
+
+   return oEvent->uWatchCount;
+}
+
+/* handle the watch for the ready fd iFd */
+static void event_dispatch(Event_T oEvent, int iFd)
+{
+   struct Watch *psWatch;
+   void (*pfExited)(pid_t iPid, int iStatus, void *pvExtra);
+   void *pvExtra;
+   pid_t iPid;
+   pid_t iRet;
+   int iStatus;
+
+   assert(oEvent != NULL);
+
+   /* an earlier handler in the same batch may have removed it */
+   if ((size_t)iFd >= oEvent->uPhysLength)
+      return;
+   psWatch = oEvent->apsWatches[iFd];
+   if (psWatch == NULL)
+      return;
+
+   if (psWatch->iPid == 0)
+   {
+      (*psWatch->pfReady)(iFd, psWatch->pvExtra);
+      return;
+   }
+
+   /* a reused fd may carry a stale event, so don't block */
+   iPid = psWatch->iPid;
+   iRet = wait4(iPid, &iStatus, WNOHANG, &oEvent->sUsage);
+   if (iRet == 0)
+      return;
+   if (iRet == -1)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   pfExited = psWatch->pfExited;
+   pvExtra = psWatch->pvExtra;
+   event_removeWatch(oEvent, iFd);
+   (void)close(iFd);
+   Trace_mark(TRACE_EXIT, (int)iPid, iStatus);
+   if (pfExited != NULL)
+      (*pfExited)(iPid, iStatus, pvExtra);
+}
+
+/* store the resources used by the child oEvent last reaped in
+   *psUsage */
+void Event_getUsage(Event_T oEvent, struct rusage *psUsage)
+{
+   assert(oEvent != NULL);
+   assert(psUsage != NULL);
+
+   *psUsage = oEvent->sUsage;
+}
+
+/* wait up to iMillis milliseconds for events and handle them */
+int Event_runOnce(Event_T oEvent, int iMillis)
+{
+   struct epoll_event asEvents[MAX_EVENTS];
+   int iCount;
+   int iIndex;
+
+   assert(oEvent != NULL);
+
+   iCount = epoll_wait(oEvent->iEpollFd, asEvents, MAX_EVENTS, iMillis);
+   if (iCount == -1)
+      return (errno == EINTR) ? 0 : -1;
+   for (iIndex = 0; iIndex < iCount; iIndex++)
+      event_dispatch(oEvent, asEvents[iIndex].data.fd);
+   return iCount;
+}
+
+/* stop watching everything and free oEvent */
+void Event_free(Event_T oEvent)
+{
+   size_t uIndex;
+   int iIsChild;
+
+   assert(oEvent != NULL);
+
+   for (uIndex = 0; uIndex < oEvent->uPhysLength; uIndex++)
+      if (oEvent->apsWatches[uIndex] != NULL)
+      {
+         iIsChild = (oEvent->apsWatches[uIndex]->iPid != 0);
+         event_removeWatch(oEvent, (int)uIndex);
+         if (iIsChild)
+            (void)close((int)uIndex);
+      }
+   (void)close(oEvent->iEpollFd);
+   Mem_free(oEvent->apsWatches);
+   Mem_free(oEvent);
+}
@@ -0,0 +1,71 @@
+/*--------------------------------------------------------------------*/
+/* event.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef EVENT_INCLUDED
+#define EVENT_INCLUDED
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* Event_T will be an object to the user but is in reality a pointer
+   to an event structure, the shell's event loop. it watches fds and
+   children together through one epoll instance, so the cost of each
+   event doesn't depend on how many things are being watched */
+typedef struct Event *Event_T;
+
+/* create and return an event loop watching nothing. return NULL with
+   errno set if the loop can't be made. the caller owns the loop */
+Event_T Event_new(void);
+
+/* have oEvent call (*pfReady)(iFd, pvExtra) each time iFd is
+   readable, until Event_unwatchFd is called for it. return 0 if
+   successful, or -1 with errno set otherwise */
+int Event_watchFd(Event_T oEvent, int iFd,
+                  void (*pfReady)(int iFd, void *pvExtra),
+                  void *pvExtra);
+
+/* stop watching iFd, which oEvent must be watching. iFd stays open */
+void Event_unwatchFd(Event_T oEvent, int iFd);
+
+/* have oEvent reap child iPid once it exits and then, unless pfExited
+   is NULL, call (*pfExited)(iPid, iStatus, pvExtra) with its wait
+   status. return 0 if successful, or -1 with errno set if iPid can't
+   be watched */
+int Event_watchChild(Event_T oEvent, pid_t iPid,
+                     void (*pfExited)(pid_t iPid, int iStatus,
+                                      void *pvExtra),
+                     void *pvExtra);
+
+/* watch child iPid as Event_watchChild does or, if it can't be
+   watched, wait for it now and then reap it just the same, calling
+   pfExited before returning. return 0 if successful, or -1 with errno
+   set if iPid could be neither watched nor waited for */
+int Event_reapChild(Event_T oEvent, pid_t iPid,
+                    void (*pfExited)(pid_t iPid, int iStatus,
+                                     void *pvExtra),
+                    void *pvExtra);
+
+/* store the resources used by the child oEvent last reaped, as wait4
+   gave them, in *psUsage. called from a pfExited handler, that is the
+   child the handler is called for */
+void Event_getUsage(Event_T oEvent, struct rusage *psUsage);
+
+/* return the number of fds and children oEvent is watching */
+size_t Event_getWatchCount(Event_T oEvent);
+
+/* wait up to iMillis milliseconds (forever if -1, not at all if 0)
+   for something oEvent watches to be ready, and handle everything
+   that is. return the number of events handled, 0 if none came in
+   time or a signal interrupted the wait, or -1 with errno set on
+   error */
+int Event_runOnce(Event_T oEvent, int iMillis);
+
+/* stop watching everything and free oEvent. children it was watching
+   are left unreaped */
+void Event_free(Event_T oEvent);
+
+#endif
@@ -0,0 +1,490 @@
+/*--------------------------------------------------------------------
+  glob.c
+  Author: Nate Wilson
+  Description: pathname expansion. directories are read with
+  getdents64 into a large buffer, so that a directory of hundreds of
+  thousands of entries takes few system calls, and the entry types it
+  returns save a stat per entry. listings are cached by path and
+  reused until the directory's mtime changes
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "glob.h"
+#include "token.h"
+#include "dynarray.h"
+#include "ish.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* how many bytes of entries one getdents64 call may return */
+enum {GLOB_DENTS_LENGTH = 262144};
+
+/* where the fields of a struct linux_dirent64 are, the kernel's
+   layout, which no libc header declares */
+enum {DIRENT_RECLEN = 16, DIRENT_TYPE = 18, DIRENT_NAME = 19};
+
+/* how many listings the cache keeps, the least recently used going
+   first */
+enum {GLOB_CACHED_DIRS = 32};
+
+/* a listing is only reused if its directory's mtime was at least this
+   many seconds old when it was read. a change within the same clock
+   tick as the last one could otherwise leave the mtime as it was */
+enum {GLOB_SETTLED_SECONDS = 1};
+
+/* the initial sizes of a listing's arrays, which double as needed */
+enum {GLOB_INITIAL_ENTRIES = 64, GLOB_INITIAL_NAMES = 1024};
+
+/* the wildcards */
+static const char pcGlobWildcards[] = "*?[";
+
+/* a directory's listing */
+struct GlobDir
+{
+   /* the path it was read through, "." for the cwd */
+   char *pcPath;
+   /* the directory and its mtime when it was read */
+   dev_t iDev;
+   ino_t iIno;
+   long lMtime;
+   long lMtimeNsec;
+   /* was the directory changed too recently for the listing to be
+      reused? */
+   int iRacy;
+   /* the entries' names, packed one after another, then each name's
+      offset in them and each entry's d_type */
+   char *pcNames;
+   size_t uNamesLength;
+   size_t uPhysNamesLength;
+   size_t *puOffsets;
+   unsigned char *pucTypes;
+   size_t uCount;
+   size_t uPhysCount;
+   /* the next listing in the cache */
+   struct GlobDir *psNext;
+};
+
+/* the cache, the most recently used listing first */
+static struct GlobDir *psGlobCache;
+static size_t uGlobCached;
+
+/*--------------------------------------------------------------------*/
+
+/* free psDir */
+static void glob_freeDir(struct GlobDir *psDir)
+{
+   assert(psDir != NULL);
+
+   Mem_free(psDir->pcPath);
+   Mem_free(psDir->pcNames);
+   Mem_free(psDir->puOffsets);
+   Mem_free(psDir->pucTypes);
+   Mem_free(psDir);
+}
+
+/* add the entry pcName, whose d_type is ucType, to psDir */
+static void glob_addEntry(struct GlobDir *psDir, const char *pcName,
+                          unsigned char ucType)
+{
+   size_t uLength;
+
+   assert(psDir != NULL);
+   assert(pcName != NULL);
+
+   uLength = strlen(pcName) + 1;
+   if (psDir->uCount == psDir->uPhysCount)
+   {
+      psDir->uPhysCount *= 2;
+      psDir->puOffsets = (size_t*)Mem_realloc(MEM_GLOB,
+         psDir->puOffsets, psDir->uPhysCount * sizeof(size_t));
+      psDir->pucTypes = (unsigned char*)Mem_realloc(MEM_GLOB,
+         psDir->pucTypes, psDir->uPhysCount);
+   }
+   while (psDir->uNamesLength + uLength > psDir->uPhysNamesLength)
+   {
+      psDir->uPhysNamesLength *= 2;
+      psDir->pcNames = (char*)Mem_realloc(MEM_GLOB, psDir->pcNames,
+                                          psDir->uPhysNamesLength);
+   }
+   memcpy(psDir->pcNames + psDir->uNamesLength, pcName, uLength);
+   psDir->puOffsets[psDir->uCount] = psDir->uNamesLength;
+   psDir->pucTypes[psDir->uCount] = ucType;
+   psDir->uNamesLength += uLength;
+   psDir->uCount++;
+}
+
+/* add the entries of the uLength bytes of getdents64 records at
+   pcRecords to psDir, leaving out . and .. */
+static void glob_addRecords(struct GlobDir *psDir,
+                            const char *pcRecords, size_t uLength)
+{
+   unsigned short usRecordLength;
+   const char *pcName;
+   size_t uOffset;
+
+   for (uOffset = 0; uOffset < uLength; uOffset += usRecordLength)
+   {
+      memcpy(&usRecordLength, pcRecords + uOffset + DIRENT_RECLEN,
+             sizeof(usRecordLength));
+      pcName = pcRecords + uOffset + DIRENT_NAME;
+      if ((strcmp(pcName, ".") != 0) && (strcmp(pcName, "..") != 0))
+         glob_addEntry(psDir, pcName,
+                       (unsigned char)pcRecords[uOffset + DIRENT_TYPE]);
+   }
+}
+
+/* read the directory pcPath and return its listing, or NULL with
+   errno set if it can't be read */
+static struct GlobDir *glob_readDir(const char *pcPath)
+{
+   struct GlobDir *psDir;
+   struct timespec sNow;
+   struct stat sStat;
+   char *pcRecords;
+   long lRead;
+   int iFd;
+   int iErrno;
+
+   assert(pcPath != NULL);
+
+   /* the time is taken before reading, so that any change made while
+      reading makes the listing racy */
+   if (clock_gettime(CLOCK_REALTIME, &sNow) == -1)
+      return NULL;
+   iFd = open(pcPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (iFd == -1)
+      return NULL;
+   if (fstat(iFd, &sStat) == -1)
+   {
+      iErrno = errno;
+      (void)close(iFd);
+      errno = iErrno;
+      return NULL;
+   }
+
+   psDir = (struct GlobDir*)Mem_calloc(MEM_GLOB, 1, sizeof(*psDir));
+   psDir->pcPath = (char*)Mem_alloc(MEM_GLOB, strlen(pcPath) + 1);
+   strcpy(psDir->pcPath, pcPath);
+   psDir->iDev = sStat.st_dev;
+   psDir->iIno = sStat.st_ino;
+   psDir->lMtime = (long)sStat.st_mtim.tv_sec;
+   psDir->lMtimeNsec = (long)sStat.st_mtim.tv_nsec;
+   psDir->iRacy = ((long)sNow.tv_sec - psDir->lMtime <
+                   GLOB_SETTLED_SECONDS);
+   psDir->uPhysNamesLength = GLOB_INITIAL_NAMES;
+   psDir->pcNames = (char*)Mem_alloc(MEM_GLOB, psDir->uPhysNamesLength);
+   psDir->uPhysCount = GLOB_INITIAL_ENTRIES;
+   psDir->puOffsets = (size_t*)Mem_alloc(MEM_GLOB,
+      psDir->uPhysCount * sizeof(size_t));
+   psDir->pucTypes = (unsigned char*)Mem_alloc(MEM_GLOB,
+                                               psDir->uPhysCount);
+
+   pcRecords = (char*)Mem_alloc(MEM_GLOB, GLOB_DENTS_LENGTH);
+   for (;;)
+   {
+      lRead = syscall(SYS_getdents64, iFd, pcRecords,
+                      GLOB_DENTS_LENGTH);
+      if ((lRead == -1) && (errno == EINTR))
+         continue;
+      if (lRead <= 0)
+         break;
+      glob_addRecords(psDir, pcRecords, (size_t)lRead);
+   }
+   iErrno = errno;
+   Mem_free(pcRecords);
+   (void)close(iFd);
+   if (lRead == -1)
+   {
+      glob_freeDir(psDir);
+      errno = iErrno;
+      return NULL;
+   }
+   return psDir;
+}
+
+/* return the listing of the directory pcPath, from the cache if it is
+   up to date there, or NULL if it can't be read. the listing stays
+   the cache's, and is good until the next call */
+static struct GlobDir *glob_getDir(const char *pcPath)
+{
+   struct GlobDir **ppsLink;
+   struct GlobDir *psDir;
+   struct stat sStat;
+
+   assert(pcPath != NULL);
+
+   for (ppsLink = &psGlobCache; *ppsLink != NULL;
+        ppsLink = &(*ppsLink)->psNext)
+      if (strcmp((*ppsLink)->pcPath, pcPath) == 0)
+         break;
+   psDir = *ppsLink;
+   if (psDir != NULL)
+   {  /* take it out of the cache, to put back in front if current */
+      *ppsLink = psDir->psNext;
+      uGlobCached--;
+      if ((psDir->iRacy) || (stat(pcPath, &sStat) == -1) ||
+          (sStat.st_dev != psDir->iDev) ||
+          (sStat.st_ino != psDir->iIno) ||
+          ((long)sStat.st_mtim.tv_sec != psDir->lMtime) ||
+          ((long)sStat.st_mtim.tv_nsec != psDir->lMtimeNsec))
+      {
+         glob_freeDir(psDir);
+         psDir = NULL;
+      }
+   }
+   if (psDir == NULL)
+      psDir = glob_readDir(pcPath);
+   if (psDir == NULL)
+      return NULL;
+
+   psDir->psNext = psGlobCache;
+   psGlobCache = psDir;
+   uGlobCached++;
+   if (uGlobCached > GLOB_CACHED_DIRS)
+   {  /* drop the least recently used */
+      for (ppsLink = &psGlobCache; (*ppsLink)->psNext != NULL;
+           ppsLink = &(*ppsLink)->psNext)
+         ;
+      glob_freeDir(*ppsLink);
+      *ppsLink = NULL;
+      uGlobCached--;
+   }
+   return psDir;
+}
+
+/* forget every cached listing */
+void Glob_freeCache(void)
+{
+   struct GlobDir *psNext;
+
+   for (; psGlobCache != NULL; psGlobCache = psNext)
+   {
+      psNext = psGlobCache->psNext;
+      glob_freeDir(psGlobCache);
+   }
+   uGlobCached = 0;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* return the concatenation of pcPrefix, the uLength chars at pcName
+   and pcSuffix, which the caller owns */
+static char *glob_join(const char *pcPrefix, const char *pcName,
+                       size_t uLength, const char *pcSuffix)
+{
+   char *pcPath;
+   size_t uPrefixLength;
+
+   uPrefixLength = strlen(pcPrefix);
+   pcPath = (char*)Mem_alloc(MEM_GLOB, uPrefixLength + uLength +
+                                       strlen(pcSuffix) + 1);
+   memcpy(pcPath, pcPrefix, uPrefixLength);
+   memcpy(pcPath + uPrefixLength, pcName, uLength);
+   strcpy(pcPath + uPrefixLength + uLength, pcSuffix);
+   return pcPath;
+}
+
+/* add pcPath, which oMatches takes ownership of, to oMatches */
+static void glob_addMatch(DynArray_T oMatches, char *pcPath)
+{
+   if (DynArray_add(oMatches, pcPath) == 0)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+}
+
+/* could the entry uIndex of psDir, whose path is pcPath, be a
+   directory? d_type answers without a stat unless the entry is a
+   symlink or the file system doesn't say */
+static int glob_isDir(const struct GlobDir *psDir, size_t uIndex,
+                      const char *pcPath)
+{
+   struct stat sStat;
+
+   switch (psDir->pucTypes[uIndex])
+   {
+      case DT_DIR:
+         return TRUE;
+      case DT_LNK:
+      case DT_UNKNOWN:
+         return (stat(pcPath, &sStat) == 0) && S_ISDIR(sStat.st_mode);
+      default:
+         return FALSE;
+   }
+}
+
+/* add to oMatches the paths that start with pcPrefix, which is empty
+   or ends with '/', and continue with what matches pcPattern */
+static void glob_expand(const char *pcPrefix, const char *pcPattern,
+                        DynArray_T oMatches)
+{
+   struct GlobDir *psDir;
+   DynArray_T oDirs;
+   struct stat sStat;
+   const char *pcSlash;
+   const char *pcRest;
+   const char *pcName;
+   char *pcComponent;
+   char *pcPath;
+   size_t uLength;
+   size_t uIndex;
+
+   assert(pcPrefix != NULL);
+   assert(pcPattern != NULL);
+   assert(oMatches != NULL);
+
+   /* split off the first component, and the rest after its slashes */
+   pcSlash = strchr(pcPattern, '/');
+   uLength = (pcSlash == NULL) ? strlen(pcPattern)
+      : (size_t)(pcSlash - pcPattern);
+   pcRest = NULL;
+   if (pcSlash != NULL)
+   {
+      for (pcRest = pcSlash; *pcRest == '/'; pcRest++)
+         ;
+   }
+
+   pcComponent = glob_join("", pcPattern, uLength, "");
+   if (strpbrk(pcComponent, pcGlobWildcards) == NULL)
+   {  /* no need to read the directory for a plain name */
+      if (pcRest == NULL)
+      {
+         pcPath = glob_join(pcPrefix, pcPattern, uLength, "");
+         if (lstat(pcPath, &sStat) == 0)
+            glob_addMatch(oMatches, pcPath);
+         else
+            Mem_free(pcPath);
+      }
+      else
+      {
+         pcPath = glob_join(pcPrefix, pcPattern, uLength, "/");
+         glob_expand(pcPath, pcRest, oMatches);
+         Mem_free(pcPath);
+      }
+      Mem_free(pcComponent);
+      return;
+   }
+
+   psDir = glob_getDir((*pcPrefix == '\0') ? "." : pcPrefix);
+   if (psDir == NULL)
+   {
+      Mem_free(pcComponent);
+      return;
+   }
+
+   /* the directories to go on into are gathered first, since going
+      into them can drop psDir from the cache */
+   oDirs = DynArray_new(0);
+   if (oDirs == NULL)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   for (uIndex = 0; uIndex < psDir->uCount; uIndex++)
+   {
+      pcName = psDir->pcNames + psDir->puOffsets[uIndex];
+      if ((*pcName == '.') && (*pcComponent != '.'))
+         continue;
+      if (fnmatch(pcComponent, pcName, FNM_NOESCAPE) != 0)
+         continue;
+      pcPath = glob_join(pcPrefix, pcName, strlen(pcName), "");
+      if (pcRest == NULL)
+         glob_addMatch(oMatches, pcPath);
+      else if (glob_isDir(psDir, uIndex, pcPath))
+         glob_addMatch(oDirs, pcPath);
+      else
+         Mem_free(pcPath);
+   }
+   Mem_free(pcComponent);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oDirs); uIndex++)
+   {
+      pcName = DynArray_get(oDirs, uIndex);
+      pcPath = glob_join(pcName, "", 0, "/");
+      glob_expand(pcPath, pcRest, oMatches);
+      Mem_free(pcPath);
+      Mem_free(DynArray_get(oDirs, uIndex));
+   }
+   DynArray_free(oDirs);
+}
+
+/* compare the paths pvPath1 and pvPath2 byte by byte */
+static int glob_comparePaths(const void *pvPath1, const void *pvPath2)
+{
+   return strcmp((const char*)pvPath1, (const char*)pvPath2);
+}
+
+/* is the uIndex'th token of oTokens the target of a redirection? */
+static int glob_isRedirectTarget(DynArray_T oTokens, size_t uIndex)
+{
+   Token_T oPrevious;
+
+   if (uIndex == 0)
+      return FALSE;
+   oPrevious = DynArray_get(oTokens, uIndex - 1);
+   return Token_isSpecial(oPrevious) &&
+      (strcmp(Token_getValue(oPrevious), "&") != 0);
+}
+
+/* replace each pattern token of oTokens by the paths it matches */
+void Glob_expandTokens(DynArray_T oTokens)
+{
+   DynArray_T oMatches;
+   Token_T oToken;
+   const char *pcPattern;
+   char *pcMatch;
+   size_t uIndex;
+   size_t uMatch;
+   size_t uCount;
+
+   assert(oTokens != NULL);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oTokens); uIndex++)
+   {
+      oToken = DynArray_get(oTokens, uIndex);
+      if ((! Token_isPattern(oToken)) ||
+          glob_isRedirectTarget(oTokens, uIndex))
+         continue;
+
+      oMatches = DynArray_new(0);
+      if (oMatches == NULL)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+      pcPattern = Token_getValue(oToken);
+      if (*pcPattern == '/')
+      {
+         while (*pcPattern == '/')
+            pcPattern++;
+         glob_expand("/", pcPattern, oMatches);
+      }
+      else
+         glob_expand("", pcPattern, oMatches);
+
+      uCount = DynArray_getLength(oMatches);
+      if (uCount > 0)
+      {
+         DynArray_sort(oMatches, glob_comparePaths);
+         Token_free(DynArray_removeAt(oTokens, uIndex));
+         for (uMatch = 0; uMatch < uCount; uMatch++)
+         {
+            pcMatch = DynArray_get(oMatches, uMatch);
+            if (DynArray_addAt(oTokens, uIndex + uMatch,
+                               Token_new(TOKEN_ORDINARY, pcMatch)) == 0)
+            {perror(getPgmName()); exit(EXIT_FAILURE);}
+            Mem_free(pcMatch);
+         }
+         uIndex += uCount - 1;
+      }
+      DynArray_free(oMatches);
+   }
+}
@@ -0,0 +1,23 @@
+/*--------------------------------------------------------------------*/
+/* glob.h                                                             */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef GLOB_INCLUDED
+#define GLOB_INCLUDED
+
+#include "dynarray.h"
+
+/* replace each pattern token of oTokens, as lex_lexLine marks them, by
+   ordinary tokens for the paths it matches, in sorted order. the
+   wildcards are * ? and [...], and a name starting with '.' is only
+   matched by a pattern that starts with '.' too. a pattern that
+   matches nothing, or is the target of a redirection, stays as it is.
+   directory listings are cached and reused while a directory's mtime
+   stays the same */
+void Glob_expandTokens(DynArray_T oTokens);
+
+/* forget every cached directory listing */
+void Glob_freeCache(void);
+
+#endif
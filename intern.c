@@ -0,0 +1,246 @@
+/*--------------------------------------------------------------------
+  intern.c
+  Author: Nate Wilson
+  Description: the string pool. the same command names, options and
+  paths come up on line after line, so tokens share one counted copy
+  of each distinct string instead of a copy each, and a lookup keyed
+  by a pooled string compares pointers instead of chars. the pool is
+  kept under a lock, so that threads can lex too
+  --------------------------------------------------------------------*/
+
+#include "intern.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+/* one pooled string, allocated with room for all of its chars */
+struct InternEntry
+{
+   unsigned long ulHash;
+   /* how many references there are to it */
+   size_t uRefs;
+   struct InternEntry *psNext;
+   char acString[1];
+};
+
+/* the buckets start at this many and double whenever there are more
+   strings than buckets */
+enum {INTERN_INITIAL_BUCKETS = 256};
+
+/* the table, NULL until first used */
+static struct InternEntry **ppsInternBuckets;
+static size_t uInternBucketCount;
+static size_t uInternCount;
+
+/* guards the table and the reference counts. it is held across fork,
+   so that a child doesn't start with it held by a thread the child
+   doesn't have */
+static pthread_mutex_t sInternLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sInternOnce = PTHREAD_ONCE_INIT;
+
+/* fork handlers that hold the lock across fork */
+static void intern_lockForFork(void)
+{
+   (void)pthread_mutex_lock(&sInternLock);
+}
+
+static void intern_unlockAfterFork(void)
+{
+   (void)pthread_mutex_unlock(&sInternLock);
+}
+
+/* register the fork handlers */
+static void intern_init(void)
+{
+   (void)pthread_atfork(intern_lockForFork, intern_unlockAfterFork,
+                        intern_unlockAfterFork);
+}
+
+/* take the lock on the pool */
+static void intern_lock(void)
+{
+   (void)pthread_once(&sInternOnce, intern_init);
+   (void)pthread_mutex_lock(&sInternLock);
+}
+
+/* give up the lock on the pool */
+static void intern_unlock(void)
+{
+   (void)pthread_mutex_unlock(&sInternLock);
+}
+
+/* return the 32-bit FNV-1a hash of the uLength chars at pcChars */
+static unsigned long intern_hash(const char *pcChars, size_t uLength)
+{
+   const unsigned long ulFnvOffset = 2166136261UL;
+   const unsigned long ulFnvPrime = 16777619UL;
+
+   unsigned long ulHash = ulFnvOffset;
+
+   for (; uLength > 0; pcChars++, uLength--)
+   {
+      ulHash ^= (unsigned long)(unsigned char)*pcChars;
+      ulHash = (ulHash * ulFnvPrime) & 0xffffffffUL;
+   }
+   return ulHash;
+}
+
+/* return the entry whose string is pcInterned, a pooled copy */
+static struct InternEntry *intern_getEntry(const char *pcInterned)
+{
+   return (struct InternEntry*)(void*)
+      (pcInterned - offsetof(struct InternEntry, acString));
+}
+
+/* move every entry into a table of twice as many buckets, unless
+   there isn't the memory, in which case the chains just get longer */
+static void intern_grow(void)
+{
+   struct InternEntry **ppsBuckets;
+   struct InternEntry *psEntry;
+   struct InternEntry *psNext;
+   size_t uBucketCount;
+   size_t uIndex;
+
+   uBucketCount = uInternBucketCount * 2;
+   ppsBuckets = (struct InternEntry**)Mem_tryCalloc(MEM_INTERN,
+                                                    uBucketCount,
+                                                    sizeof(*ppsBuckets));
+   if (ppsBuckets == NULL)
+      return;
+   for (uIndex = 0; uIndex < uInternBucketCount; uIndex++)
+      for (psEntry = ppsInternBuckets[uIndex]; psEntry != NULL;
+           psEntry = psNext)
+      {
+         psNext = psEntry->psNext;
+         psEntry->psNext = ppsBuckets[psEntry->ulHash % uBucketCount];
+         ppsBuckets[psEntry->ulHash % uBucketCount] = psEntry;
+      }
+   Mem_free(ppsInternBuckets);
+   ppsInternBuckets = ppsBuckets;
+   uInternBucketCount = uBucketCount;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* return the pooled copy of pcString, with a new reference */
+const char *Intern_string(const char *pcString)
+{
+   assert(pcString != NULL);
+
+   return Intern_chars(pcString, strlen(pcString));
+}
+
+/* return the pooled copy of the uLength chars at pcChars, with a new
+   reference */
+const char *Intern_chars(const char *pcChars, size_t uLength)
+{
+   struct InternEntry *psEntry;
+   unsigned long ulHash;
+
+   assert(pcChars != NULL);
+
+   /* nothing is allocated with the lock held in a way that can fail
+      without it being given up first, so that a Mem_fail handler that
+      doesn't return can't leave it held */
+   intern_lock();
+   if (ppsInternBuckets == NULL)
+   {
+      ppsInternBuckets = (struct InternEntry**)Mem_tryCalloc(MEM_INTERN,
+         INTERN_INITIAL_BUCKETS, sizeof(*ppsInternBuckets));
+      if (ppsInternBuckets == NULL)
+      {
+         intern_unlock();
+         Mem_fail();
+      }
+      uInternBucketCount = INTERN_INITIAL_BUCKETS;
+   }
+
+   ulHash = intern_hash(pcChars, uLength);
+   for (psEntry = ppsInternBuckets[ulHash % uInternBucketCount];
+        psEntry != NULL; psEntry = psEntry->psNext)
+      if ((psEntry->ulHash == ulHash) &&
+          (strncmp(psEntry->acString, pcChars, uLength) == 0) &&
+          (psEntry->acString[uLength] == '\0'))
+      {
+         psEntry->uRefs++;
+         intern_unlock();
+         return psEntry->acString;
+      }
+
+   psEntry = (struct InternEntry*)Mem_tryAlloc(MEM_INTERN,
+      offsetof(struct InternEntry, acString) + uLength + 1);
+   if (psEntry == NULL)
+   {
+      intern_unlock();
+      Mem_fail();
+   }
+   psEntry->ulHash = ulHash;
+   psEntry->uRefs = 1;
+   memcpy(psEntry->acString, pcChars, uLength);
+   psEntry->acString[uLength] = '\0';
+   psEntry->psNext = ppsInternBuckets[ulHash % uInternBucketCount];
+   ppsInternBuckets[ulHash % uInternBucketCount] = psEntry;
+   uInternCount++;
+   if (uInternCount > uInternBucketCount)
+      intern_grow();
+   intern_unlock();
+   return psEntry->acString;
+}
+
+/* give up a reference to pcInterned */
+void Intern_release(const char *pcInterned)
+{
+   struct InternEntry **ppsLink;
+   struct InternEntry *psEntry;
+
+   assert(pcInterned != NULL);
+   assert(ppsInternBuckets != NULL);
+
+   intern_lock();
+   psEntry = intern_getEntry(pcInterned);
+   assert(psEntry->uRefs > 0);
+   if (--psEntry->uRefs > 0)
+   {
+      intern_unlock();
+      return;
+   }
+
+   ppsLink = &ppsInternBuckets[psEntry->ulHash % uInternBucketCount];
+   while (*ppsLink != psEntry)
+      ppsLink = &(*ppsLink)->psNext;
+   *ppsLink = psEntry->psNext;
+   uInternCount--;
+   intern_unlock();
+   Mem_free(psEntry);
+}
+
+/* return the hash of pcInterned */
+unsigned long Intern_getHash(const char *pcInterned)
+{
+   assert(pcInterned != NULL);
+
+   return intern_getEntry(pcInterned)->ulHash;
+}
+
+/* free the table if nothing is pooled */
+void Intern_free(void)
+{
+   struct InternEntry **ppsBuckets;
+
+   intern_lock();
+   if ((ppsInternBuckets == NULL) || (uInternCount > 0))
+   {
+      intern_unlock();
+      return;
+   }
+   ppsBuckets = ppsInternBuckets;
+   ppsInternBuckets = NULL;
+   uInternBucketCount = 0;
+   intern_unlock();
+   Mem_free(ppsBuckets);
+}
@@ -0,0 +1,35 @@
+/*--------------------------------------------------------------------*/
+/* intern.h                                                           */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef INTERN_INCLUDED
+#define INTERN_INCLUDED
+
+#include <stddef.h>
+
+/* the string pool. each distinct string is kept once, along with its
+   hash, so that two pooled strings are equal exactly when they are the
+   same pointer */
+
+/* return the pooled copy of pcString, pooling it if need be, and take
+   a reference to it. the copy must not be changed */
+const char *Intern_string(const char *pcString);
+
+/* return the pooled copy of the uLength chars at pcChars, which
+   needn't be followed by a '\0', as Intern_string does */
+const char *Intern_chars(const char *pcChars, size_t uLength);
+
+/* give up a reference to pcInterned, a pooled copy, which is freed
+   once no references are left */
+void Intern_release(const char *pcInterned);
+
+/* return the hash of pcInterned, a pooled copy, computed when it was
+   pooled */
+unsigned long Intern_getHash(const char *pcInterned);
+
+/* free the pool's table, if nothing is pooled. it is rebuilt if used
+   again */
+void Intern_free(void);
+
+#endif
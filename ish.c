@@ -3,16 +3,39 @@
 /* Author: Nate Wilson                                                */
 /*--------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
+
 #include "token.h"
 #include "ish.h"
 #include "command.h"
 #include "lex.h"
 #include "dynarray.h"
+#include "xargs.h"
+#include "prefix.h"
+#include "schedule.h"
+#include "cache.h"
+#include "test.h"
+#include "redirect.h"
+#include "event.h"
+#include "server.h"
+#include "script.h"
+#include "mem.h"
+#include "trace.h"
+#include "var.h"
+#include "glob.h"
+#include "intern.h"
+#include "path.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "lines.h"
+#include "state.h"
+#include "spawn.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -22,6 +45,47 @@
 /* program name, filled in by main */
 static const char *pcPgmName;
 
+/* the event loop that reaps children and copies fanned out output,
+   filled in by main */
+static Event_T oEvent;
+
+/* is this process a $(command) subshell? */
+static int iSubshell;
+
+/* does the shell read its commands from stdin? */
+static int iStdinIsInput;
+
+/* the shell's pid if it reports its memory use or saves its state as
+   it exits, so that children that exit don't too, and so that the
+   shell isn't replaced by its last command */
+static pid_t iShellPid;
+
+/* the image the shell saves its state as when it exits, or NULL */
+static char *pcStateFile;
+
+/* the most <(command) and >(command) words one line can have */
+enum {PROCESS_MAX = 64};
+
+/* the shell's ends of the pipes of the line's process substitutions,
+   open until the line's command has started */
+static int aiProcessFds[PROCESS_MAX];
+static size_t uProcessFdCount;
+
+/* the scheduler that runs a script's commands ahead of their turn,
+   with ISH_PARALLEL set, or NULL */
+static Parallel_T oParallel;
+
+/* the threads reading and lexing a script ahead, with ISH_PIPELINE
+   set, or NULL */
+static Pipeline_T oPipeline;
+
+/* the script's file mapped, when it is a regular file read without
+   ISH_PIPELINE, or NULL */
+static Lines_T oLines;
+
+/* the number of the line last read, which events are tagged with */
+static unsigned long ulLineNumber;
+
 const char *getPgmName(void)
 {
    return pcPgmName;
@@ -32,30 +96,26 @@ enum {FALSE, TRUE};
 
 /* takes pointer apcArgv array, and a command oCommand, and stores
    oCommand name and args properly into the array, adding a null 
-   terminator to the end, and allocating along the way
+   terminator to the end. the args are the tokens' pooled values, not
+   copies, as exec doesn't change them. the name is token uFirst
  Returns pointer to allocated apcArgv array or a NULL if command is empty*/
-static char **ish_allocateAndFillArgvArray(Command_T oCommand)
+static char **ish_allocateAndFillArgvArray(Command_T oCommand,
+                                           size_t uFirst)
 {
    size_t uLength;
    size_t uIndex;
    Token_T oToken;
    char **apcArgv;
    
-   uLength = DynArray_getLength(Command_getTokens(oCommand));
+   uLength = DynArray_getLength(Command_getTokens(oCommand)) - uFirst;
 
-   apcArgv = malloc(sizeof(char *) * (uLength+1));
-   if (apcArgv == NULL)
-   {perror(pcPgmName); exit(EXIT_FAILURE);}
+   apcArgv = Mem_alloc(MEM_SHELL, sizeof(char *) * (uLength+1));
    
    for (uIndex = 0; uIndex < uLength; uIndex++)
    {
-      oToken = DynArray_get(Command_getTokens(oCommand), uIndex);
-
-      apcArgv[uIndex] = malloc(strlen(Token_getValue(oToken)) + 1);
-      if (apcArgv[uIndex] == NULL)
-      {perror(pcPgmName); exit(EXIT_FAILURE);}
-      
-      strcpy(apcArgv[uIndex], Token_getValue(oToken));
+      oToken = DynArray_get(Command_getTokens(oCommand),
+                            uFirst + uIndex);
+      apcArgv[uIndex] = (char*)Token_getValue(oToken);
    }
 
    /* add null terminator according to execvp spec */
@@ -68,19 +128,51 @@ static char **ish_allocateAndFillArgvArray(Command_T oCommand)
 /* free memory allocated associated with the apcArgv string array */
 static void ish_freeArgvArray(char *apcArgv[])
 {
-   size_t uIndex = 0;
-   
    assert(apcArgv!=NULL);
    
-   while (apcArgv[uIndex] != NULL)
-   {
-      free(apcArgv[uIndex]);
-      uIndex++;
-   }
-   free(apcArgv);
+   Mem_free(apcArgv);
 }
 
-/* is oCommand one of the four implemented builtins?
+/* the builtins, and their names, which ish_internBuiltins pools so
+   that a command's name is matched by pointer */
+enum Builtin {BUILTIN_SETENV, BUILTIN_UNSETENV, BUILTIN_CD, BUILTIN_EXIT,
+              BUILTIN_XARGS, BUILTIN_TIMEOUT, BUILTIN_CACHE, BUILTIN_WAIT,
+              BUILTIN_MEMSTATS, BUILTIN_TEST, BUILTIN_BRACKET,
+              BUILTIN_EXEC, BUILTIN_SCHED, BUILTIN_LIMIT, BUILTIN_COUNT};
+static const char *apcBuiltins[BUILTIN_COUNT] =
+   {"setenv", "unsetenv", "cd", "exit", "xargs", "timeout", "cache",
+    "wait", "memstats", "test", "[", "exec", "sched", "limit"};
+
+/* replace the builtins' names by their pooled copies */
+static void ish_internBuiltins(void)
+{
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < BUILTIN_COUNT; uIndex++)
+      apcBuiltins[uIndex] = Intern_string(apcBuiltins[uIndex]);
+}
+
+/* give up the builtins' pooled names */
+static void ish_releaseBuiltins(void)
+{
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < BUILTIN_COUNT; uIndex++)
+      Intern_release(apcBuiltins[uIndex]);
+}
+
+/* is pcName, a pooled string, the name of a builtin? */
+static int ish_isBuiltInName(const char *pcName)
+{
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < BUILTIN_COUNT; uIndex++)
+      if (pcName == apcBuiltins[uIndex])
+         return TRUE;
+   return FALSE;
+}
+
+/* is oCommand one of the implemented builtins?
   return True is yes, False if no*/
 static int ish_isBuiltIn(Command_T oCommand)
 {
@@ -91,74 +183,106 @@ static int ish_isBuiltIn(Command_T oCommand)
 
    oToken = DynArray_get(oTokens, 0);
 
-   if ((strcmp(Token_getValue(oToken), "setenv")   == 0) ||
-       (strcmp(Token_getValue(oToken), "unsetenv") == 0) ||
-       (strcmp(Token_getValue(oToken), "cd")       == 0) ||
-       (strcmp(Token_getValue(oToken), "exit")     == 0))
-      return TRUE;
-   else
-      return FALSE;
+   return ish_isBuiltInName(Token_getValue(oToken));
 }
 
-/* redirect stdin and stdout according to the specss of oCommand */
-static void ish_handleRedirection(Command_T oCommand)
+/* exit with iStatus. a subshell skips exit's cleanup, which would
+   move the offset of the script's stream that it shares with the
+   parent, and the memory report, which is the parent's to make */
+static void ish_exit(int iStatus)
 {
-   char *pcStdin;
-   char *pcStdout;
+   if (iSubshell)
+   {
+      if (fflush(stdout) == EOF)
+         _exit(EXIT_FAILURE);
+      _exit(iStatus);
+   }
+   exit(iStatus);
+}
+
+/* run the event loop until the background commands have all exited
+   and their output has all been copied */
+static void ish_waitForJobs(void)
+{
+   while (Event_getWatchCount(oEvent) > 0)
+      if (Event_runOnce(oEvent, -1) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE);}
+}
+
+/* replace the shell with the command in oCommand's tokens from uFirst
+   on, with oPlan, oCommand's redirections, put in place first. never
+   returns: if the command can't be run, the shell exits as the child
+   it would have run in does */
+static void ish_execCommand(Command_T oCommand, size_t uFirst,
+                            RedirectPlan_T oPlan)
+{
+   char **apcArgv;
+   const char *pcFile;
+   int iErrno;
+
+   assert(oCommand != NULL);
+   assert(oPlan != NULL);
+   assert(! Redirect_hasCopies(oPlan));
+
+   /* what the shell wrote goes ahead of what the command writes */
+   if (fflush(stdout) == EOF)
+   {perror(pcPgmName); ish_exit(EXIT_FAILURE);}
+   if (Redirect_applyPlan(oPlan) == -1)
+   {perror(pcPgmName); ish_exit(EXIT_FAILURE);}
+   Redirect_freePlan(oPlan);
+   apcArgv = ish_allocateAndFillArgvArray(oCommand, uFirst);
+   pcFile = Path_find(apcArgv[0]);
+   Trace_mark(TRACE_EXEC, 0, 0);
+   /* the shell's exit handler won't get to write the trace */
+   if (! iSubshell)
+      Trace_dump();
+   if (pcFile != NULL)
+      execv(pcFile, apcArgv);
+   execvp(apcArgv[0], apcArgv);
+   iErrno = errno; /* perror may change errno */
+   Trace_mark(TRACE_EXEC_FAILED, 0, iErrno);
+   perror(pcPgmName);
+   ish_exit((iErrno == ENOENT) ? ISH_NOT_FOUND : ISH_CANNOT_RUN);
+}
+
+/* return the first fd that oCommand redirects and that the shell keeps
+   for itself, such as its event loop or script, or -1 if there's none.
+   the shell's own fds are all close-on-exec, and an fd left in place
+   for the commands that follow never is */
+static int ish_findShellFd(Command_T oCommand)
+{
+   DynArray_T oRedirects;
+   size_t uIndex;
    int iFd;
-   int iRet;
+   int iFlags;
+
+   assert(oCommand != NULL);
 
-   /* get input/output redirection strings */
-   pcStdin = Command_getStdin(oCommand);
-   pcStdout = Command_getStdout(oCommand);
-
-   /* handle stdout first */
-   if (pcStdout != NULL)
-   {
-      /* The permissions of the newly-created file. */
-      enum {PERMISSIONS = 0600};
-      /* create the file/overwrite if it exists */
-      iFd = creat(pcStdout, PERMISSIONS);
-      if (iFd == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-      /* close, dup, close pattern redirects output */
-      iRet = close(1);
-      if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-      iRet = dup(iFd);
-      if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-      iRet = close(iFd);
-      if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-   }
-
-   /* handle stdin next */
-   if (pcStdin != NULL)
-   {
-      /* open a file for reading */
-      iFd = open(pcStdin, O_RDONLY);
-      if (iFd == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-      /* close dup close pattern redirects input */
-      iRet = close(0);
-      if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-      iRet = dup(iFd);
-      if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-      iRet = close(iFd);
-      if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
-   }
-}
-
-/* handle one of the four builtin commands. should not be called 
-   unless oCommand is a built in command, take pcLine in case of
-   need to free it */
+   oRedirects = Command_getRedirects(oCommand);
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+   {
+      iFd = Redirect_getFd(DynArray_get(oRedirects, uIndex));
+      iFlags = fcntl(iFd, F_GETFD);
+      if ((iFlags != -1) && ((iFlags & FD_CLOEXEC) != 0))
+         return iFd;
+   }
+   return -1;
+}
+
+/* handle one of the builtin commands. should not be called 
+   unless oCommand is a built in command, take pcLine, which is NULL
+   for a compiled script, in case of need to free it */
 static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
 {
    DynArray_T oTokens;
+   RedirectPlan_T oPlan;
    size_t uLength;
    Token_T oCmdName;
    Token_T oCmdArg1;
    Token_T oCmdArg2;
-   char *pcHome;
+   const char *pcHome;
    int iRet;
 
-   assert(pcLine != NULL);
    assert(ish_isBuiltIn(oCommand)); 
    
    oTokens = Command_getTokens(oCommand);
@@ -166,7 +290,7 @@ static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
    uLength = DynArray_getLength(oTokens);
 
    /* handle exit */
-   if (strcmp(Token_getValue(oCmdName), "exit") == 0)
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_EXIT])
    {
       if (uLength > 1)
       {
@@ -177,12 +301,12 @@ static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
       Command_freeCommand(oCommand);
       lex_freeTokens(oTokens);
       DynArray_free(oTokens);
-      free(pcLine);
-      exit(0);
+      Mem_free(pcLine);
+      ish_exit(0);
    }
 
    /* handle setenv */
-   if (strcmp(Token_getValue(oCmdName), "setenv") == 0)
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_SETENV])
    {
       /* error for setenv to have 0 or more than 2 args. */
       if (uLength == 1) /* % setenv */
@@ -199,19 +323,21 @@ static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
       {
          oCmdArg1 = DynArray_get(oTokens, 1);
          oCmdArg2 = DynArray_get(oTokens, 2);
-         setenv(Token_getValue(oCmdArg1),
-                Token_getValue(oCmdArg2), TRUE);
+         if (Var_set(Token_getValue(oCmdArg1),
+                     Token_getValue(oCmdArg2)) == -1)
+            perror(pcPgmName);
          return;
       }
       if (uLength == 2) /* % setenv a -- default sets to empty string */
       {
          oCmdArg1 = DynArray_get(oTokens, 1);
-         setenv(Token_getValue(oCmdArg1), "", TRUE);
+         if (Var_set(Token_getValue(oCmdArg1), "") == -1)
+            perror(pcPgmName);
          return;
       }
    }
    /* handle unsetenv */
-   if (strcmp(Token_getValue(oCmdName), "unsetenv") == 0)
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_UNSETENV])
    {
       /* It is an error for an unsetenv command to have zero command-line arguments or more than one command-line argument.*/
       if (uLength == 1)
@@ -227,12 +353,13 @@ static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
       if (uLength == 2)
       {
          oCmdArg1 = DynArray_get(oTokens, 1);
-         unsetenv(Token_getValue(oCmdArg1));
+         if (Var_unset(Token_getValue(oCmdArg1)) == -1)
+            perror(pcPgmName);
          return;
       }
    }
    /* handle cd */
-   if (strcmp(Token_getValue(oCmdName), "cd") == 0)
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_CD])
    {
       /*  It is an error for a cd to have more than one argument. */
       if (uLength > 2)
@@ -242,7 +369,7 @@ static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
       }
       if (uLength == 1) /* cd [$HOME] unless home doesnt exist*/
       {
-         pcHome = getenv("HOME");
+         pcHome = Var_get("HOME", strlen("HOME"));
          if (pcHome == NULL)
          {
             fprintf(stderr, "%s: HOME not set\n", pcPgmName);
@@ -268,9 +395,775 @@ static void ish_handleBuiltIn(Command_T oCommand, char *pcLine)
          return;
       }
    }
+   /* handle exec: replace the shell with the command or, without
+      one, give the shell the redirections */
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_EXEC])
+   {
+      /* the shell would lose an fd it still needs */
+      iRet = (uLength > 1) ? -1 : ish_findShellFd(oCommand);
+      if (iRet != -1)
+      {
+         fprintf(stderr, "%s: exec: %d: fd is in use by the shell\n",
+                 pcPgmName, iRet);
+         Var_setStatus(EXIT_FAILURE);
+         return;
+      }
+      oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+      if (oPlan == NULL)
+      {
+         Var_setStatus(EXIT_FAILURE);
+         return;
+      }
+      /* the copying would take the shell that is being replaced */
+      if (Redirect_hasCopies(oPlan))
+      {
+         fprintf(stderr, "%s: exec: can't send an fd to several files\n",
+                 pcPgmName);
+         Redirect_freePlan(oPlan);
+         Var_setStatus(EXIT_FAILURE);
+         return;
+      }
+      if (uLength > 1)
+         ish_execCommand(oCommand, 1, oPlan);
+      if (fflush(stdout) == EOF)
+      {perror(pcPgmName); exit(EXIT_FAILURE);}
+      iRet = Redirect_applyPlan(oPlan);
+      Redirect_freePlan(oPlan);
+      if (iRet == -1)
+         perror(pcPgmName);
+      Var_setStatus((iRet == -1) ? EXIT_FAILURE : 0);
+      return;
+   }
+   /* handle xargs */
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_XARGS])
+   {
+      Var_setStatus(Xargs_run(oCommand, oEvent, iStdinIsInput));
+      return;
+   }
+   /* handle timeout, sched and limit, which may be chained */
+   if ((Token_getValue(oCmdName) == apcBuiltins[BUILTIN_TIMEOUT]) ||
+       (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_SCHED]) ||
+       (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_LIMIT]))
+   {
+      Var_setStatus(Prefix_run(oCommand, oEvent));
+      return;
+   }
+   /* handle cache */
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_CACHE])
+   {
+      Var_setStatus(Cache_run(oCommand, oEvent));
+      return;
+   }
+   /* handle test and [ */
+   if ((Token_getValue(oCmdName) == apcBuiltins[BUILTIN_TEST]) ||
+       (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_BRACKET]))
+   {
+      Var_setStatus(Test_run(oCommand));
+      return;
+   }
+   /* handle memstats */
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_MEMSTATS])
+   {
+      if (uLength > 1)
+      {
+         fprintf(stderr, "%s: too many arguments\n", pcPgmName);
+         return;
+      }
+      Mem_writeStats(stdout);
+      if (fflush(stdout) == EOF)
+      {perror(pcPgmName); exit(EXIT_FAILURE);}
+      return;
+   }
+   /* handle wait */
+   if (Token_getValue(oCmdName) == apcBuiltins[BUILTIN_WAIT])
+   {
+      if (uLength > 1)
+      {
+         fprintf(stderr, "%s: too many arguments\n", pcPgmName);
+         return;
+      }
+      ish_waitForJobs();
+      return;
+   }
+}
+
+/* the event loop's handler for the foreground command exiting: set
+   the int pvExtra points to, and record iStatus as $? */
+static void ish_reapForeground(pid_t iPid, int iStatus, void *pvExtra)
+{
+   (void)iPid;
+   assert(pvExtra != NULL);
+
+   *(int*)pvExtra = TRUE;
+   if (WIFSIGNALED(iStatus))
+      Var_setStatus(128 + WTERMSIG(iStatus));
+   else
+      Var_setStatus(WEXITSTATUS(iStatus));
+}
+
+/* while a command runs, look up the command of the script's next
+   line in PATH, if the line is lexed already, so that the search is
+   done by the time its turn comes */
+static void ish_findNextCommand(void)
+{
+   DynArray_T oTokens;
+   Token_T oToken;
+
+   oTokens = Pipeline_peekTokens(oPipeline);
+   if ((oTokens == NULL) || (DynArray_getLength(oTokens) == 0))
+      return;
+   oToken = DynArray_get(oTokens, 0);
+   if (Token_isOrdinary(oToken) && (! Token_isPattern(oToken)) &&
+       (! ish_isBuiltInName(Token_getValue(oToken))))
+      (void)Path_find(Token_getValue(oToken));
+}
+
+/* run oCommand, which is not a builtin, in a child process with its
+   redirections in place. unless it runs in the background, run the
+   event loop until it exits. if iLast, oCommand is the last thing the
+   shell has to do, so it replaces the shell instead when nothing else
+   needs the shell: no redirection copying, no '&', no other children
+   and no memory report */
+static void ish_runCommand(Command_T oCommand, int iLast)
+{
+   pid_t iPid;
+   RedirectPlan_T oPlan;
+   char **apcArgv;
+   const char *pcFile;
+   int iExited = FALSE;
+   int iBackground;
+
+   assert(oCommand != NULL);
+
+   /* open redirection files before forking. a file that can't be
+      opened fails the command, as in sh */
+   oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if (oPlan == NULL)
+   {
+      Var_setStatus(EXIT_FAILURE);
+      return;
+   }
+   if (iLast && (! Redirect_hasCopies(oPlan)) &&
+       (! Command_isBackground(oCommand)) &&
+       (Event_getWatchCount(oEvent) == 0) && (getpid() != iShellPid))
+      ish_execCommand(oCommand, 0, oPlan);
+   if (Redirect_watchPlan(oPlan, oEvent) == -1)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      Var_setStatus(EXIT_FAILURE);
+      return;
+   }
+   apcArgv = ish_allocateAndFillArgvArray(oCommand, 0);
+   /* searched in the shell, so that the search is remembered */
+   pcFile = Path_find(apcArgv[0]);
+   iPid = Spawn_command(apcArgv, pcFile, NULL, oPlan, NULL, NULL);
+   if (iPid == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   ish_freeArgvArray(apcArgv); /* free the argv array */
+   Redirect_closePlan(oPlan);
+
+   iBackground = Command_isBackground(oCommand);
+   if (Event_reapChild(oEvent, iPid,
+                       iBackground ? NULL : ish_reapForeground,
+                       &iExited) == -1)
+   {perror(pcPgmName); exit(EXIT_FAILURE); }
+   if (iBackground) /* the loop frees the plan once it's copied */
+   {
+      Redirect_releasePlan(oPlan);
+      Var_setStatus(0); /* starting it succeeded, as in sh */
+      return;
+   }
+   if (oPipeline != NULL)
+      ish_findNextCommand();
+   while (! iExited)
+      if (Event_runOnce(oEvent, -1) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE); }
+   Redirect_freePlan(oPlan);
+}
+
+/* how many of the latest events ISH_TRACE keeps */
+enum {TRACE_EVENTS = 65536};
+
+/* return a copy of pcValue, which the caller owns */
+static char *ish_copy(const char *pcValue)
+{
+   char *pcCopy;
+
+   assert(pcValue != NULL);
+
+   pcCopy = (char*)Mem_alloc(MEM_SHELL, strlen(pcValue) + 1);
+   return strcpy(pcCopy, pcValue);
+}
+
+/* write the allocation counts to stderr as the shell exits */
+static void ish_reportMemory(void)
+{
+   if (getpid() == iShellPid)
+   {
+      /* so that the tables don't count as leaks */
+      Var_free();
+      Glob_freeCache();
+      Path_free();
+      ish_releaseBuiltins();
+      Intern_free();
+      Mem_writeStats(stderr);
+   }
+}
+
+/* save the shell's state as it exits */
+static void ish_saveState(void)
+{
+   if (getpid() != iShellPid)
+      return;
+   (void)State_save(pcStateFile);
+   Mem_free(pcStateFile);
+   pcStateFile = NULL;
+}
+
+/* return a copy of pcPath, made absolute if it is relative, so that
+   it names the same file after the shell changes directory. the
+   caller owns the copy */
+static char *ish_makeAbsolute(const char *pcPath)
+{
+   char *pcCwd = NULL;
+   char *pcAbsolute;
+
+   assert(pcPath != NULL);
+
+   if (*pcPath != '/')
+      pcCwd = getcwd(NULL, 0);
+   if (pcCwd == NULL)
+   {  /* absolute, or relative to a directory with no name */
+      pcAbsolute = (char*)Mem_alloc(MEM_SHELL, strlen(pcPath) + 1);
+      strcpy(pcAbsolute, pcPath);
+      return pcAbsolute;
+   }
+   pcAbsolute = (char*)Mem_alloc(MEM_SHELL,
+                                 strlen(pcCwd) + strlen(pcPath) + 2);
+   sprintf(pcAbsolute, "%s/%s", pcCwd, pcPath);
+   free(pcCwd);
+   return pcAbsolute;
+}
+
+/* close the shell's ends of the process substitutions' pipes, so that
+   their commands see the end of the file or a broken pipe once the
+   line's command is done with them */
+static void ish_closeProcessFds(void)
+{
+   while (uProcessFdCount > 0)
+      (void)close(aiProcessFds[--uProcessFdCount]);
+}
+
+/* is there nothing left to run after the command just read from
+   oScript, or from psFile if oScript is NULL? with neither, the
+   command was all there was. return TRUE if so */
+static int ish_isAtEnd(FILE *psFile, Script_T oScript)
+{
+   int iChar;
+
+   if (oScript != NULL)
+      return Script_isDone(oScript);
+   if (oPipeline != NULL)
+      return Pipeline_isAtEnd(oPipeline);
+   if (oLines != NULL)
+      return Lines_isAtEnd(oLines);
+   if (psFile == NULL)
+      return TRUE;
+   iChar = getc(psFile);
+   if (iChar == EOF)
+      return TRUE;
+   (void)ungetc(iChar, psFile);
+   return FALSE;
+}
+
+/* is any of oTokens a pattern, to be matched against the files there
+   are when its command's turn comes? return TRUE if so */
+static int ish_hasPattern(DynArray_T oTokens)
+{
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oTokens); uIndex++)
+      if (Token_isPattern(DynArray_get(oTokens, uIndex)))
+         return TRUE;
+   return FALSE;
+}
+
+/* run the command in oTokens, taking its here-document bodies from
+   oScript, or from the pipeline, the mapped file or psFile if oScript
+   is NULL, echoing them if iEcho. with none of them, the bodies are
+   empty. pcLine is the line oTokens came from, or NULL. if iMayExec
+   and the command is the last, it may replace the shell instead of
+   running in a child */
+static void ish_runTokens(DynArray_T oTokens, char *pcLine,
+                          FILE *psFile, Script_T oScript, int iEcho,
+                          int iMayExec)
+{
+   Command_T oCommand;
+   int iRet;
+
+   assert(oTokens != NULL);
+
+   /* with commands run ahead, a pattern, a builtin and a command that
+      can't be run ahead each wait for those before to finish */
+   if ((oParallel != NULL) && ish_hasPattern(oTokens))
+      Parallel_drain(oParallel);
+   Glob_expandTokens(oTokens);
+   Trace_begin(TRACE_PARSE);
+   oCommand = Command_createCommand(oTokens);
+   Trace_end(TRACE_PARSE, 0, 0);
+   if (oCommand != NULL) /* do we have a valid command */
+   {  /* a here-document's body is on the lines that follow */
+      while (Command_getHereDelimiter(oCommand) != NULL)
+         Command_setHereBody(oCommand, (oScript != NULL)
+            ? Script_nextHereBody(oScript)
+            : (oPipeline != NULL)
+            ? lex_readHereBodyWith(Pipeline_readLine, oPipeline,
+                                   Command_getHereDelimiter(oCommand),
+                                   iEcho)
+            : (oLines != NULL)
+            ? lex_readHereBodyWith(Lines_readLine, oLines,
+                                   Command_getHereDelimiter(oCommand),
+                                   iEcho)
+            : (psFile != NULL)
+            ? lex_readHereBody(psFile,
+                               Command_getHereDelimiter(oCommand),
+                               iEcho)
+            : ish_copy(""));
+      if (ish_isBuiltIn(oCommand)) /* builtins ignore '&' */
+      {
+         if (oParallel != NULL)
+            Parallel_drain(oParallel);
+         ish_handleBuiltIn(oCommand, pcLine);
+      }
+      else if ((oParallel == NULL) ||
+               ! Parallel_start(oParallel, oCommand))
+      {  /* if the command is NOT a builtin */
+         if (oParallel != NULL)
+            Parallel_drain(oParallel);
+         ish_runCommand(oCommand,
+                        iMayExec && ish_isAtEnd(psFile, oScript));
+      }
+      Command_freeCommand(oCommand);/*free cmd struct & intrnls */
+   }
+   lex_freeTokens(oTokens); /* free each token in oTokens */
+   DynArray_free(oTokens); /* free dynarray struct */
+   ish_closeProcessFds();
+
+   /* reap background commands that are done, without waiting */
+   while ((iRet = Event_runOnce(oEvent, 0)) > 0)
+      ;
+   if (iRet == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+}
+
+/* read a line from psFile as a traced read span, with it and the
+   events that follow tagged with its line number. return the line, or
+   NULL at end of file */
+static char *ish_readLine(FILE *psFile)
+{
+   char *pcLine;
+
+   Trace_setLine(++ulLineNumber);
+   Trace_begin(TRACE_READ);
+   pcLine = (oPipeline != NULL) ? Pipeline_nextLine(oPipeline)
+      : lex_readLine(psFile);
+   Trace_end(TRACE_READ, 0, 0);
+   return pcLine;
+}
+
+/* lex pcLine as a traced lex span, returning what lex_lexLine does */
+static DynArray_T ish_lexLine(const char *pcLine)
+{
+   DynArray_T oTokens;
+
+   Trace_begin(TRACE_LEX);
+   oTokens = lex_lexLine(pcLine);
+   Trace_end(TRACE_LEX, 0, 0);
+   if (oTokens == NULL) /* the line won't run */
+      ish_closeProcessFds();
+   return oTokens;
+}
+
+/* read a script's next line as ish_readLine does, from the mapped
+   file if there is one, storing it in *ppcLine, which the caller owns,
+   and its tokens in *poTokens if it is lexed already, or NULL if it is
+   to be lexed now. a mapped line with nothing to expand is lexed where
+   it lies, as a traced lex span, with *ppcLine NULL, and has no tokens
+   if it doesn't lex. return FALSE at end of file */
+static int ish_nextLine(FILE *psFile, char **ppcLine,
+                        DynArray_T *poTokens)
+{
+   const char *pcChars;
+   size_t uLength;
+
+   assert(ppcLine != NULL);
+   assert(poTokens != NULL);
+
+   *ppcLine = NULL;
+   *poTokens = NULL;
+   if (oLines == NULL)
+   {
+      *ppcLine = ish_readLine(psFile);
+      if ((*ppcLine != NULL) && (oPipeline != NULL))
+         *poTokens = Pipeline_takeTokens(oPipeline);
+      return *ppcLine != NULL;
+   }
+
+   Trace_setLine(++ulLineNumber);
+   Trace_begin(TRACE_READ);
+   pcChars = Lines_next(oLines, &uLength);
+   Trace_end(TRACE_READ, 0, 0);
+   if (pcChars == NULL)
+      return FALSE;
+   if (lex_hasExpansionIn(pcChars, uLength))
+   {  /* lexed when its turn comes, which needs a string */
+      *ppcLine = (char*)Mem_alloc(MEM_LEX, uLength + 1);
+      memcpy(*ppcLine, pcChars, uLength);
+      (*ppcLine)[uLength] = '\0';
+      return TRUE;
+   }
+   Trace_begin(TRACE_LEX);
+   *poTokens = lex_lexChars(pcChars, uLength);
+   Trace_end(TRACE_LEX, 0, 0);
+   return TRUE;
+}
+
+/* the most bytes a command substitution keeps of its command's
+   output, unless ISH_CAPTURE_MAX says otherwise, and the least room
+   each read of the output gets */
+enum {CAPTURE_MAX = 16777216, CAPTURE_CHUNK = 65536};
+
+/* a command substitution's output as it is read */
+struct Capture
+{
+   char *pcOutput;
+   size_t uLength;
+   size_t uPhysLength;
+   size_t uMax;
+   /* is the pipe closed, was output dropped, has the command
+      exited? */
+   int iClosed;
+   int iTruncated;
+   int iExited;
+};
+
+/* return the capture limit ISH_CAPTURE_MAX sets, or the default if it
+   isn't set to a number */
+static size_t ish_getCaptureMax(void)
+{
+   const char *pcMax;
+   char *pcEnd;
+   unsigned long ulMax;
+
+   pcMax = Var_get("ISH_CAPTURE_MAX", strlen("ISH_CAPTURE_MAX"));
+   if ((pcMax == NULL) || (*pcMax == '\0'))
+      return CAPTURE_MAX;
+   errno = 0;
+   ulMax = strtoul(pcMax, &pcEnd, 10);
+   if ((*pcEnd != '\0') || (errno == ERANGE) || (*pcMax == '-'))
+      return CAPTURE_MAX;
+   return (size_t)ulMax;
+}
+
+/* the event loop's handler for a command substitution's pipe iFd
+   being readable: read what's there into the struct Capture pvExtra
+   points to, in one read of at least CAPTURE_CHUNK bytes unless the
+   limit is nearer. close the pipe at its end or at the limit */
+static void ish_captureOutput(int iFd, void *pvExtra)
+{
+   struct Capture *psCapture = (struct Capture*)pvExtra;
+   size_t uRoom;
+   ssize_t iRead;
+
+   assert(psCapture != NULL);
+
+   /* room for the output so far, a chunk and a '\0' */
+   if (psCapture->uPhysLength - psCapture->uLength < CAPTURE_CHUNK + 1)
+   {
+      while (psCapture->uPhysLength - psCapture->uLength <
+             CAPTURE_CHUNK + 1)
+         psCapture->uPhysLength *= 2;
+      psCapture->pcOutput = (char*)Mem_realloc(MEM_SHELL,
+         psCapture->pcOutput, psCapture->uPhysLength);
+   }
+   uRoom = psCapture->uPhysLength - psCapture->uLength - 1;
+   if (uRoom > psCapture->uMax - psCapture->uLength)
+      uRoom = psCapture->uMax - psCapture->uLength;
+
+   if (uRoom == 0)
+   {  /* at the limit: the command gets SIGPIPE if it writes more */
+      psCapture->iTruncated = TRUE;
+      iRead = 0;
+   }
+   else
+      iRead = read(iFd, psCapture->pcOutput + psCapture->uLength, uRoom);
+   if ((iRead == -1) && ((errno == EINTR) || (errno == EAGAIN)))
+      return;
+   if (iRead > 0)
+   {
+      psCapture->uLength += (size_t)iRead;
+      return;
+   }
+   Event_unwatchFd(oEvent, iFd);
+   (void)close(iFd);
+   psCapture->iClosed = TRUE;
+}
+
+/* the event loop's handler for a command substitution's command
+   exiting: record iStatus as $? and note the exit in the struct
+   Capture pvExtra points to */
+static void ish_reapSubstitution(pid_t iPid, int iStatus, void *pvExtra)
+{
+   (void)iPid;
+   assert(pvExtra != NULL);
+
+   ((struct Capture*)pvExtra)->iExited = TRUE;
+   if (WIFSIGNALED(iStatus))
+      Var_setStatus(128 + WTERMSIG(iStatus));
+   else
+      Var_setStatus(WEXITSTATUS(iStatus));
+}
+
+/* run pcCommand in a subshell, a child running it as ish runs a line,
+   with iFd as its fd iTarget. never returns */
+static void ish_runSubshell(const char *pcCommand, int iFd, int iTarget)
+{
+   DynArray_T oTokens;
+
+   iSubshell = TRUE;
+   /* the scheduler's commands are the parent's, and none are left,
+      and the pipeline's threads aren't in the child */
+   oParallel = NULL;
+   oPipeline = NULL;
+   oLines = NULL;
+   /* the pipes of the line's other process substitutions aren't its */
+   ish_closeProcessFds();
+   if (dup2(iFd, iTarget) == -1)
+   {perror(pcPgmName); _exit(EXIT_FAILURE);}
+   (void)close(iFd);
+   /* the parent's loop watches the parent's children, so the subshell
+      gets its own */
+   oEvent = Event_new();
+   if (oEvent == NULL)
+   {perror(pcPgmName); _exit(EXIT_FAILURE);}
+   oTokens = ish_lexLine(pcCommand);
+   if (oTokens != NULL)
+      ish_runTokens(oTokens, NULL, NULL, NULL, FALSE, TRUE);
+   ish_waitForJobs();
+   ish_exit(Var_getStatus());
+}
+
+/* the lexer's $(command) handler: run pcCommand in a subshell and
+   return its output, without NUL bytes or trailing newlines, which the
+   caller owns. the output is read through the event loop as it
+   comes, so a command with a lot of it never blocks on a full pipe */
+static char *ish_substitute(const char *pcCommand)
+{
+   struct Capture sCapture;
+   int aiPipe[2];
+   pid_t iPid;
+   size_t uIndex;
+   size_t uLength;
+
+   assert(pcCommand != NULL);
+
+   if (pipe2(aiPipe, O_CLOEXEC) == -1)
+   {perror(pcPgmName); return NULL;}
+   /* so that the child doesn't write the parent's pending output */
+   if (fflush(stdout) == EOF)
+   {perror(pcPgmName); exit(EXIT_FAILURE);}
+   Trace_begin(TRACE_FORK);
+   iPid = fork();
+   if (iPid == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   if (iPid == 0)
+   {
+      (void)close(aiPipe[0]);
+      ish_runSubshell(pcCommand, aiPipe[1], 1);
+   }
+   Trace_end(TRACE_FORK, (int)iPid, 0);
+   (void)close(aiPipe[1]);
+
+   sCapture.uMax = ish_getCaptureMax();
+   sCapture.uLength = 0;
+   sCapture.uPhysLength = CAPTURE_CHUNK + 1;
+   sCapture.pcOutput = (char*)Mem_alloc(MEM_SHELL,
+                                        sCapture.uPhysLength);
+   sCapture.iClosed = FALSE;
+   sCapture.iTruncated = FALSE;
+   sCapture.iExited = FALSE;
+   if ((Event_watchFd(oEvent, aiPipe[0], ish_captureOutput,
+                      &sCapture) == -1) ||
+       (Event_watchChild(oEvent, iPid, ish_reapSubstitution,
+                         &sCapture) == -1))
+   {perror(pcPgmName); exit(EXIT_FAILURE); }
+   while ((! sCapture.iClosed) || (! sCapture.iExited))
+      if (Event_runOnce(oEvent, -1) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE); }
+   if (sCapture.iTruncated)
+      fprintf(stderr, "%s: $(%s): output cut off at %lu bytes\n",
+              pcPgmName, pcCommand, (unsigned long)sCapture.uMax);
+
+   /* drop NUL bytes, which can't be in arguments, and the trailing
+      newlines */
+   uLength = 0;
+   for (uIndex = 0; uIndex < sCapture.uLength; uIndex++)
+      if (sCapture.pcOutput[uIndex] != '\0')
+         sCapture.pcOutput[uLength++] = sCapture.pcOutput[uIndex];
+   while ((uLength > 0) && (sCapture.pcOutput[uLength - 1] == '\n'))
+      uLength--;
+   sCapture.pcOutput[uLength] = '\0';
+   return sCapture.pcOutput;
+}
+
+/* return how many commands ISH_PARALLEL, pcJobs, lets run at once:
+   the number it is set to, or the number of processors online if it
+   isn't a number above 0 */
+static size_t ish_getJobCount(const char *pcJobs)
+{
+   char *pcEnd;
+   unsigned long ulJobs;
+   long lProcessors;
+
+   assert(pcJobs != NULL);
+
+   errno = 0;
+   ulJobs = strtoul(pcJobs, &pcEnd, 10);
+   if ((*pcJobs != '\0') && (*pcEnd == '\0') && (errno != ERANGE) &&
+       (*pcJobs != '-') && (ulJobs > 0))
+      return (size_t)ulJobs;
+   lProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+   return (lProcessors > 0) ? (size_t)lProcessors : 1;
+}
+
+/* run the script pcPath, from its compiled form if there's one that's
+   up to date, and without echoing. return the last command's exit
+   status, as if the last command replaced the shell, or EXIT_FAILURE
+   if the script can't be read */
+static int ish_runScript(const char *pcPath)
+{
+   Script_T oScript;
+   DynArray_T oTokens;
+   FILE *psFile;
+   char *pcSource;
+   char *pcLine;
+   unsigned long ulCommand = 0;
+
+   assert(pcPath != NULL);
+
+   oScript = Script_open(pcPath, &pcSource);
+   if (oScript != NULL)
+   {
+      /* a compiled script's events are tagged with command numbers,
+         its lines being gone */
+      for (;;)
+      {
+         Trace_setLine(++ulCommand);
+         /* expansions see what the commands before have done */
+         if ((oParallel != NULL) && Script_nextHasExpansion(oScript))
+            Parallel_drain(oParallel);
+         Trace_begin(TRACE_LEX);
+         oTokens = Script_nextTokens(oScript);
+         Trace_end(TRACE_LEX, 0, 0);
+         if (oTokens == NULL)
+            break;
+         ish_runTokens(oTokens, NULL, NULL, oScript, FALSE, TRUE);
+      }
+      Script_free(oScript);
+      if (oParallel != NULL)
+         Parallel_drain(oParallel);
+      return Var_getStatus();
+   }
+   if (pcSource == NULL)
+      return EXIT_FAILURE;
+   psFile = fopen(pcSource, "re");
+   if (psFile == NULL)
+   {
+      perror(pcSource);
+      Mem_free(pcSource);
+      return EXIT_FAILURE;
+   }
+   Mem_free(pcSource);
+   /* with ISH_PIPELINE set, lines are read and lexed ahead. without
+      it, a regular file is mapped and lexed where it lies, and
+      anything else is read through psFile */
+   if (getenv("ISH_PIPELINE") != NULL)
+   {
+      oPipeline = Pipeline_new(psFile);
+      if (oPipeline == NULL)
+         perror(pcPgmName);
+   }
+   else
+      oLines = Lines_new(fileno(psFile));
+   while (ish_nextLine(psFile, &pcLine, &oTokens))
+   {
+      if ((oParallel != NULL) && (pcLine != NULL) &&
+          lex_hasExpansion(pcLine))
+         Parallel_drain(oParallel);
+      if ((oTokens == NULL) && (pcLine != NULL))
+         oTokens = ish_lexLine(pcLine);
+      if (oTokens != NULL) /* do we have a valid token array? */
+         ish_runTokens(oTokens, pcLine, psFile, NULL, FALSE, TRUE);
+      Mem_free(pcLine);
+   }
+   if (oPipeline != NULL)
+   {
+      Pipeline_free(oPipeline);
+      oPipeline = NULL;
+   }
+   if (oLines != NULL)
+   {
+      Lines_free(oLines);
+      oLines = NULL;
+   }
+   (void)fclose(psFile);
+   if (oParallel != NULL)
+      Parallel_drain(oParallel);
+   return Var_getStatus();
+}
+
+/* the lexer's <(command) and >(command) handler: start pcCommand in a
+   subshell with its stdout, or its stdin if iWrite, on a pipe, and
+   return the shell's end of the pipe. the end stays open, and is
+   inherited across the exec of the line's command, until the command
+   has started. return -1 after writing a message to stderr */
+static int ish_substituteProcess(const char *pcCommand, int iWrite)
+{
+   int aiPipe[2];
+   int iKept;
+   int iGiven;
+   pid_t iPid;
+
+   assert(pcCommand != NULL);
+
+   if (uProcessFdCount == PROCESS_MAX)
+   {
+      fprintf(stderr, "%s: too many process substitutions\n",
+              pcPgmName);
+      return -1;
+   }
+   if (pipe(aiPipe) == -1)
+   {perror(pcPgmName); return -1;}
+   iKept = iWrite ? aiPipe[1] : aiPipe[0];
+   iGiven = iWrite ? aiPipe[0] : aiPipe[1];
+   if (fflush(stdout) == EOF)
+   {perror(pcPgmName); exit(EXIT_FAILURE);}
+   Trace_begin(TRACE_FORK);
+   iPid = fork();
+   if (iPid == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   if (iPid == 0)
+   {
+      (void)close(iKept);
+      ish_runSubshell(pcCommand, iGiven, iWrite ? 0 : 1);
+   }
+   Trace_end(TRACE_FORK, (int)iPid, 0);
+   (void)close(iGiven);
+   /* reaped in the background, like a command run with '&' */
+   if (Event_watchChild(oEvent, iPid, NULL, NULL) == -1)
+   {perror(pcPgmName); exit(EXIT_FAILURE); }
+   aiProcessFds[uProcessFdCount++] = iKept;
+   return iKept;
 }
 
-/* implements the shell command execution program with 4 builtins 
+/* implements the shell command execution program with builtins 
    and input/output redirection. argc is the number of command line
    arguments and argv are those arguments. return 0 if successful. */
 int main(int argc, char *argv[])
@@ -278,47 +1171,116 @@ int main(int argc, char *argv[])
    char *pcLine;
    DynArray_T oTokens;
    int iRet;
-   Command_T oCommand;
-   pid_t iPid;
-   char **apcArgv = NULL;
+   const char *pcTrace;
+   const char *pcJobs;
+   const char *pcSpread;
+   ScheduleSpread_T oSpread = NULL;
 
    pcPgmName = argv[0];
+   ish_internBuiltins();
+   /* with ISH_MEMSTATS set, report allocations on the way out */
+   if (getenv("ISH_MEMSTATS") != NULL)
+   {
+      iShellPid = getpid();
+      if (atexit(ish_reportMemory) != 0)
+      {perror(pcPgmName); exit(EXIT_FAILURE);}
+   }
+   /* with ISH_TRACE set to a file, trace events into it */
+   pcTrace = getenv("ISH_TRACE");
+   if ((pcTrace != NULL) && (Trace_start(pcTrace, TRACE_EVENTS) == -1))
+      perror(pcTrace);
+   /* "ish --load-state file" starts from the state a shell run with
+      "ish --save-state file" left, which is saved as it exits. either
+      comes before the arguments below. an image that can't be loaded
+      leaves the shell starting cold */
+   while ((argc >= 3) && ((strcmp(argv[1], "--load-state") == 0) ||
+                          (strcmp(argv[1], "--save-state") == 0)))
+   {
+      if (strcmp(argv[1], "--load-state") == 0)
+         (void)State_load(argv[2]);
+      else
+      {
+         if ((pcStateFile == NULL) && (atexit(ish_saveState) != 0))
+         {perror(pcPgmName); exit(EXIT_FAILURE);}
+         /* saved after any cd */
+         Mem_free(pcStateFile);
+         pcStateFile = ish_makeAbsolute(argv[2]);
+         iShellPid = getpid();
+      }
+      argc -= 2;
+      argv += 2;
+   }
+   /* "ish --compile script" writes script.ishb for later runs */
+   if ((argc == 3) && (strcmp(argv[1], "--compile") == 0))
+      return (Script_compile(argv[2]) == 0) ? 0 : EXIT_FAILURE;
+   oEvent = Event_new();
+   if (oEvent == NULL) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   /* "ish --serve socket" runs the commands clients send instead */
+   if ((argc == 3) && (strcmp(argv[1], "--serve") == 0))
+   {
+      Server_run(argv[2], oEvent, ish_isBuiltInName);
+      return EXIT_FAILURE;
+   }
+   /* after the server, which has no line to close the pipes after,
+      and whose event loop a $(command) would run with one client's
+      stderr in place while serving the others */
+   lex_setSubstitute(ish_substitute);
+   lex_setProcessSubstitute(ish_substituteProcess);
+   /* "ish -c command" runs command instead of reading stdin */
+   if ((argc == 3) && (strcmp(argv[1], "-c") == 0))
+   {
+      oTokens = ish_lexLine(argv[2]);
+      if (oTokens == NULL)
+         Var_setStatus(EXIT_FAILURE);
+      else
+         ish_runTokens(oTokens, NULL, NULL, NULL, FALSE, TRUE);
+      ish_waitForJobs();
+      Event_free(oEvent);
+      return Var_getStatus();
+   }
+   /* "ish script" runs the script instead of reading stdin, with
+      ISH_PARALLEL set running commands that can ahead of their turn,
+      and ISH_PARALLEL_SPREAD set to cpu or node spreading those that
+      run at once across the CPUs or the NUMA nodes */
+   if (argc == 2)
+   {
+      pcJobs = getenv("ISH_PARALLEL");
+      if (pcJobs != NULL)
+      {
+         pcSpread = getenv("ISH_PARALLEL_SPREAD");
+         if (pcSpread != NULL) /* NULL, not spread, if it's wrong */
+            oSpread = Schedule_newSpread(pcSpread);
+         oParallel = Parallel_new(ish_getJobCount(pcJobs), oEvent,
+                                  oSpread);
+         if (oParallel == NULL) {perror(pcPgmName); exit(EXIT_FAILURE);}
+      }
+      iRet = ish_runScript(argv[1]);
+      if (oParallel != NULL)
+      {
+         Parallel_free(oParallel);
+         oParallel = NULL;
+      }
+      if (oSpread != NULL)
+         Schedule_freeSpread(oSpread);
+      ish_waitForJobs();
+      Event_free(oEvent);
+      return iRet;
+   }
+   iStdinIsInput = TRUE;
    printf("%% ");
-   while ((pcLine = lex_readLine(stdin)) != NULL)
+   while ((pcLine = ish_readLine(stdin)) != NULL)
    {  printf("%s\n", pcLine);
       iRet = fflush(stdout);
       if (iRet == EOF)
       {perror(pcPgmName); exit(EXIT_FAILURE);}
-      oTokens = lex_lexLine(pcLine);
+      oTokens = ish_lexLine(pcLine);
       if (oTokens != NULL) /* do we have a valid token array? */
-      {  oCommand = Command_createCommand(oTokens);
-         if (oCommand != NULL) /* do we have a valid command */
-         {  
-            if (ish_isBuiltIn(oCommand)) /* is cmd a builtin?*/
-               ish_handleBuiltIn(oCommand, pcLine);
-            else /* if the command is NOT a builtin */
-            {
-               apcArgv = ish_allocateAndFillArgvArray(oCommand);
-               iPid = fork();
-               if (iPid == 0) /* child process */
-               {  /* handle redirection here */
-                  if ((Command_getStdin(oCommand) != NULL) ||
-                      (Command_getStdout(oCommand) != NULL))
-                     ish_handleRedirection(oCommand);
-                  execvp(apcArgv[0], apcArgv);
-                  perror(pcPgmName);
-                  exit(EXIT_FAILURE); }
-               iPid = wait(NULL);
-               if (iPid == -1) {perror(argv[0]); exit(EXIT_FAILURE); }
-               ish_freeArgvArray(apcArgv); /* free the argv array */
-            }
-            Command_freeCommand(oCommand);/*free cmd struct & intrnls */
-         }
-         lex_freeTokens(oTokens); /* free each token in oTokens */
-         DynArray_free(oTokens); /* free dynarray struct */
-      }
-      free(pcLine);
+         ish_runTokens(oTokens, pcLine, stdin, NULL, TRUE, FALSE);
+      Mem_free(pcLine);
       printf("%% ");
    }
    printf("\n");
+   /* let background commands finish before the shell does */
+   ish_waitForJobs();
+   Event_free(oEvent);
    return 0;}
@@ -6,6 +6,10 @@
 #ifndef ISH_INCLUDED
 #define ISH_INCLUDED
 
+/* the exit status of a child whose command can't be run, and of one
+   whose command isn't found, as in sh */
+enum {ISH_CANNOT_RUN = 126, ISH_NOT_FOUND = 127};
+
 /* returns the name of the program */
 const char *getPgmName(void);
 
@@ -0,0 +1,155 @@
+/*--------------------------------------------------------------------
+  ishc.c
+  Author: Nate Wilson
+  Description: client for an ish started with --serve. sends one
+  command line to the server along with this process's stdin, stdout
+  and stderr, waits for the command to finish and exits with its
+  status:
+     ishc socket command [args]
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* exit status when the server can't be reached or doesn't answer */
+enum {ISHC_FAILED = 255};
+
+/* program name, filled in by main */
+static const char *pcPgmName;
+
+/* join the iCount strings of ppcWords with spaces into pcLine, which
+   has room for SERVER_MAX_REQUEST_LENGTH chars. return the length of
+   the line, or 0 if it doesn't fit */
+static size_t ishc_joinWords(char *ppcWords[], int iCount, char *pcLine)
+{
+   size_t uLength = 0;
+   size_t uWordLength;
+   int iIndex;
+
+   assert(ppcWords != NULL);
+   assert(pcLine != NULL);
+
+   for (iIndex = 0; iIndex < iCount; iIndex++)
+   {
+      uWordLength = strlen(ppcWords[iIndex]);
+      if (uLength + uWordLength + 1 > SERVER_MAX_REQUEST_LENGTH)
+         return 0;
+      if (iIndex > 0)
+         pcLine[uLength++] = ' ';
+      memcpy(pcLine + uLength, ppcWords[iIndex], uWordLength);
+      uLength += uWordLength;
+   }
+   return uLength;
+}
+
+/* send the uLength chars of pcLine, with fds 0, 1 and 2 attached, over
+   the connected socket iFd. return 0 if successful, -1 otherwise */
+static int ishc_sendRequest(int iFd, char *pcLine, size_t uLength)
+{
+   union
+   {
+      struct cmsghdr sHeader; /* for alignment */
+      char acSpace[CMSG_SPACE(sizeof(int) * SERVER_FD_COUNT)];
+   } uControl;
+   struct msghdr sMessage;
+   struct iovec sIovec;
+   struct cmsghdr *psHeader;
+   int aiFds[SERVER_FD_COUNT];
+   int iIndex;
+
+   assert(pcLine != NULL);
+
+   for (iIndex = 0; iIndex < SERVER_FD_COUNT; iIndex++)
+      aiFds[iIndex] = iIndex;
+
+   memset(&sMessage, 0, sizeof(sMessage));
+   memset(&uControl, 0, sizeof(uControl));
+   sIovec.iov_base = pcLine;
+   sIovec.iov_len = uLength;
+   sMessage.msg_iov = &sIovec;
+   sMessage.msg_iovlen = 1;
+   sMessage.msg_control = uControl.acSpace;
+   sMessage.msg_controllen = sizeof(uControl.acSpace);
+   psHeader = CMSG_FIRSTHDR(&sMessage);
+   psHeader->cmsg_level = SOL_SOCKET;
+   psHeader->cmsg_type = SCM_RIGHTS;
+   psHeader->cmsg_len = CMSG_LEN(sizeof(aiFds));
+   memcpy(CMSG_DATA(psHeader), aiFds, sizeof(aiFds));
+
+   if (sendmsg(iFd, &sMessage, MSG_NOSIGNAL) == -1)
+      return -1;
+   return 0;
+}
+
+/* run a command line on the ish server listening on the socket
+   argv[1]. argc is the number of command line arguments and argv are
+   those arguments. return the command's exit status */
+int main(int argc, char *argv[])
+{
+   struct sockaddr_un sAddress;
+   char acLine[SERVER_MAX_REQUEST_LENGTH];
+   char acReply[SERVER_MAX_REPLY_LENGTH + 1];
+   size_t uLength;
+   ssize_t iLength;
+   int iFd;
+
+   pcPgmName = argv[0];
+   if (argc < 3)
+   {
+      fprintf(stderr, "usage: %s socket command [args]\n", pcPgmName);
+      return ISHC_FAILED;
+   }
+
+   memset(&sAddress, 0, sizeof(sAddress));
+   sAddress.sun_family = AF_UNIX;
+   if (strlen(argv[1]) >= sizeof(sAddress.sun_path))
+   {
+      fprintf(stderr, "%s: %s: socket path too long\n", pcPgmName,
+              argv[1]);
+      return ISHC_FAILED;
+   }
+   strcpy(sAddress.sun_path, argv[1]);
+
+   uLength = ishc_joinWords(argv + 2, argc - 2, acLine);
+   if (uLength == 0)
+   {
+      fprintf(stderr, "%s: command too long\n", pcPgmName);
+      return ISHC_FAILED;
+   }
+
+   iFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   if ((iFd == -1) ||
+       (connect(iFd, (struct sockaddr*)&sAddress,
+                sizeof(sAddress)) == -1))
+   {
+      perror(argv[1]);
+      return ISHC_FAILED;
+   }
+   if (ishc_sendRequest(iFd, acLine, uLength) == -1)
+   {
+      perror(pcPgmName);
+      return ISHC_FAILED;
+   }
+
+   do
+      iLength = recv(iFd, acReply, SERVER_MAX_REPLY_LENGTH, 0);
+   while ((iLength == -1) && (errno == EINTR));
+   if (iLength <= 0)
+   {
+      fprintf(stderr, "%s: server hung up\n", pcPgmName);
+      return ISHC_FAILED;
+   }
+   acReply[iLength] = '\0';
+   (void)close(iFd);
+   return atoi(acReply);
+}
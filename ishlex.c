@@ -7,6 +7,7 @@
 #include "ish.h"
 #include "lex.h"
 #include "dynarray.h"
+#include "mem.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,7 +48,7 @@ int main(int argc, char *argv[])
          lex_freeTokens(oTokens);
          DynArray_free(oTokens);
       }
-      free(pcLine);
+      Mem_free(pcLine);
       printf("%% ");
    }
    printf("\n");
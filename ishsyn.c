@@ -8,6 +8,7 @@
 #include "command.h"
 #include "lex.h"
 #include "dynarray.h"
+#include "mem.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -56,7 +57,7 @@ int main(int argc, char *argv[])
 
       }
       
-      free(pcLine);
+      Mem_free(pcLine);
       printf("%% ");
    }
    printf("\n");
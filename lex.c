@@ -7,12 +7,39 @@
 #include "lex.h"
 #include "ish.h"
 #include "dynarray.h"
+#include "mem.h"
+#include "arith.h"
+#include "var.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+/* most digits of an fd written before a redirection operator */
+enum {MAX_FD_DIGITS = 9};
+
+/* what runs the command of a $(command) expansion, NULL until the
+   shell sets it */
+static char *(*pfLexSubstitute)(const char *pcCommand);
+
+/* have $(command) expansions run their command with pfSubstitute */
+void lex_setSubstitute(char *(*pfSubstitute)(const char *pcCommand))
+{
+   pfLexSubstitute = pfSubstitute;
+}
+
+/* what starts the command of a <(command) or >(command) word, NULL
+   until the shell sets it */
+static int (*pfLexProcess)(const char *pcCommand, int iWrite);
+
+/* have <(command) and >(command) words start their command with
+   pfProcess */
+void lex_setProcessSubstitute(int (*pfProcess)(const char *pcCommand,
+                                               int iWrite))
+{
+   pfLexProcess = pfProcess;
+}
 
 /* read in a line from psFile, then return that line in string form */
 char *lex_readLine(FILE *psFile)
@@ -24,12 +51,9 @@ char *lex_readLine(FILE *psFile)
    size_t uPhysLineLength = INITIAL_LINE_LENGTH;
    char *pcLine;
    int iChar;
-   const char *pcPgmName;
    
    assert(psFile != NULL);
 
-   pcPgmName = getPgmName();
-   
    /* If no lines remain, return NULL. */
    if (feof(psFile))
       return NULL;
@@ -38,18 +62,14 @@ char *lex_readLine(FILE *psFile)
       return NULL;
 
    /* Allocate memory for the string. */
-   pcLine = (char*)malloc(uPhysLineLength);
-   if (pcLine == NULL)
-   {perror(pcPgmName); exit(EXIT_FAILURE);}
+   pcLine = (char*)Mem_alloc(MEM_LEX, uPhysLineLength);
    /* Read characters into the string. */
    while ((iChar != '\n') && (iChar != EOF))
    {
       if (uLineLength == uPhysLineLength)
       {
          uPhysLineLength *= GROWTH_FACTOR;
-         pcLine = (char*)realloc(pcLine, uPhysLineLength);
-         if (pcLine == NULL)
-         {perror(pcPgmName); exit(EXIT_FAILURE);}
+         pcLine = (char*)Mem_realloc(MEM_LEX, pcLine, uPhysLineLength);
       }
       pcLine[uLineLength] = (char)iChar;
       uLineLength++;
@@ -60,15 +80,90 @@ char *lex_readLine(FILE *psFile)
    if (uLineLength == uPhysLineLength)
    {
       uPhysLineLength++;
-      pcLine = (char*)realloc(pcLine, uPhysLineLength);
-      if (pcLine == NULL)
-      {perror(pcPgmName); exit(EXIT_FAILURE);}
+      pcLine = (char*)Mem_realloc(MEM_LEX, pcLine, uPhysLineLength);
    }
    pcLine[uLineLength] = '\0';
 
    return pcLine;
 }
 
+/* read lines with (*pfReadLine)(pvSource) up to the line pcDelimiter,
+   and return them, each ending with a newline, as one string that the
+   caller owns. if iEcho, prompt for and echo each line like ish does
+   its commands */
+char *lex_readHereBodyWith(char *(*pfReadLine)(void *pvSource),
+                           void *pvSource, const char *pcDelimiter,
+                           int iEcho)
+{
+   enum {INITIAL_BODY_LENGTH = 64};
+   enum {GROWTH_FACTOR = 2};
+
+   size_t uBodyLength = 0;
+   size_t uPhysBodyLength = INITIAL_BODY_LENGTH;
+   size_t uLineLength;
+   char *pcBody;
+   char *pcLine;
+   const char *pcPgmName;
+
+   assert(pfReadLine != NULL);
+   assert(pcDelimiter != NULL);
+
+   pcPgmName = getPgmName();
+
+   pcBody = (char*)Mem_alloc(MEM_LEX, uPhysBodyLength);
+
+   for (;;)
+   {
+      if (iEcho)
+         printf("> ");
+      pcLine = (*pfReadLine)(pvSource);
+      if (pcLine == NULL)
+      {
+         fprintf(stderr,
+                 "%s: here-document delimited by end-of-file\n",
+                 pcPgmName);
+         break;
+      }
+      if (iEcho)
+      {
+         printf("%s\n", pcLine);
+         if (fflush(stdout) == EOF)
+         {perror(pcPgmName); exit(EXIT_FAILURE);}
+      }
+      if (strcmp(pcLine, pcDelimiter) == 0)
+      {
+         Mem_free(pcLine);
+         break;
+      }
+      /* append the line and its newline, leaving room for '\0' */
+      uLineLength = strlen(pcLine);
+      while (uBodyLength + uLineLength + 2 > uPhysBodyLength)
+         uPhysBodyLength *= GROWTH_FACTOR;
+      pcBody = (char*)Mem_realloc(MEM_LEX, pcBody, uPhysBodyLength);
+      memcpy(pcBody + uBodyLength, pcLine, uLineLength);
+      uBodyLength += uLineLength;
+      pcBody[uBodyLength++] = '\n';
+      Mem_free(pcLine);
+   }
+   pcBody[uBodyLength] = '\0';
+   return pcBody;
+}
+
+/* read a line from the FILE pvSource, for lex_readHereBodyWith */
+static char *lex_readFileLine(void *pvSource)
+{
+   return lex_readLine((FILE*)pvSource);
+}
+
+/* read lines from psFile up to the line pcDelimiter */
+char *lex_readHereBody(FILE *psFile, const char *pcDelimiter, int iEcho)
+{
+   assert(psFile != NULL);
+
+   return lex_readHereBodyWith(lex_readFileLine, psFile, pcDelimiter,
+                               iEcho);
+}
+
 /* Write all tokens in oTokens to stdout in same sequence they 
    came in and according to spec.  */
 void lex_writeTokens(DynArray_T oTokens)
@@ -109,50 +204,524 @@ void lex_freeTokens(DynArray_T oTokens)
    }
 }
 
-/* add a special token using the char c to oTokens */
-static void lex_addSpecialToken(char c, DynArray_T oTokens)
+/* add a special token to oTokens for the operator that starts with
+   the char c, which was just read from pcLine, preceded by the fd pcFd
+   ("" if none). c may be extended into "<<", "<<<", "<&", ">>" or
+   ">&", in which case *puLineIndex is advanced past the extra chars.
+   '&' on its own runs the command in the background */
+static void lex_addSpecialToken(const char *pcFd, char c,
+                                const char *pcLine, size_t *puLineIndex,
+                                DynArray_T oTokens)
 {
-   char pcBuffer[2];
+   enum {MAX_OPERATOR_LENGTH = MAX_FD_DIGITS + 3};
+   char pcBuffer[MAX_OPERATOR_LENGTH + 1];
+   size_t uLength;
    Token_T oToken;
    int iSuccessful;
-   const char *pcPgmName;
-   pcPgmName = getPgmName();
-   
-   pcBuffer[0] = c;
-   pcBuffer[1] = '\0';
+
+   assert(pcFd != NULL);
+   assert(strlen(pcFd) <= MAX_FD_DIGITS);
+   assert(pcLine != NULL);
+   assert(puLineIndex != NULL);
+
+   strcpy(pcBuffer, pcFd);
+   uLength = strlen(pcBuffer);
+   pcBuffer[uLength++] = c;
+   if ((c == '<') && (pcLine[*puLineIndex] == '<'))
+   {
+      /* "<<" starts a here-document, "<<<" a here-string */
+      pcBuffer[uLength++] = pcLine[(*puLineIndex)++];
+      if (pcLine[*puLineIndex] == '<')
+         pcBuffer[uLength++] = pcLine[(*puLineIndex)++];
+   }
+   else if ((c == '>') && (pcLine[*puLineIndex] == '>'))
+      pcBuffer[uLength++] = pcLine[(*puLineIndex)++]; /* append */
+   else if ((c != '&') && (pcLine[*puLineIndex] == '&'))
+      pcBuffer[uLength++] = pcLine[(*puLineIndex)++]; /* dup fd */
+   pcBuffer[uLength] = '\0';
    oToken = Token_new(TOKEN_SPECIAL, pcBuffer);
    iSuccessful = DynArray_add(oTokens, oToken);
    if (! iSuccessful)
    {
-      fprintf(stderr, "%s: insufficient memory\n", pcPgmName);
-      exit(EXIT_FAILURE);
+      Token_free(oToken);
+      Mem_fail();
    }
 }
 
-/*  add an ordinary token to oTokens using pcBuffer. takes uBufferIndex
-    also which is needed to properly create the token  */
-static void lex_addOrdinaryToken(char *pcBuffer,
-                      size_t uBufferIndex,
+/* is the word in the uBufferIndex chars at pcBuffer, which had no
+   quotes in it, an fd that prefixes a redirection operator as in
+   "2>"? return 1 if true */
+static int lex_isFdPrefix(const char *pcBuffer, size_t uBufferIndex)
+{
+   size_t u;
+
+   assert(pcBuffer != NULL);
+
+   if ((uBufferIndex == 0) || (uBufferIndex > MAX_FD_DIGITS))
+      return 0;
+   for (u = 0; u < uBufferIndex; u++)
+      if (! isdigit((unsigned char)pcBuffer[u]))
+         return 0;
+   return 1;
+}
+
+/*  add an ordinary token to oTokens whose value is the uLength chars
+    at pcChars, in the buffer or the line itself. if iMayGlob and the
+    token has a wildcard, it is marked as a pattern  */
+static void lex_addOrdinaryToken(const char *pcChars,
+                      size_t uLength, int iMayGlob,
                       DynArray_T oTokens)
 {
    Token_T oToken;
    int iSuccessful;
-   const char *pcPgmName;
-   pcPgmName = getPgmName();
-   assert(pcBuffer != NULL);
-   pcBuffer[uBufferIndex] = '\0';
-   oToken = Token_new(TOKEN_ORDINARY, pcBuffer);
+   size_t u;
+   assert(pcChars != NULL);
+   oToken = Token_newChars(TOKEN_ORDINARY, pcChars, uLength);
+   if (iMayGlob)
+      for (u = 0; u < uLength; u++)
+         if ((pcChars[u] == '*') || (pcChars[u] == '?') ||
+             (pcChars[u] == '['))
+         {
+            Token_setPattern(oToken);
+            break;
+         }
    iSuccessful = DynArray_add(oTokens, oToken);
    if (! iSuccessful)
    {
-      fprintf(stderr, "%s: insufficient memory\n", pcPgmName);
-      exit(EXIT_FAILURE);
+      Token_free(oToken);
+      Mem_fail();
    }
 }
 
-/* take a string pcLine and return a token array of ordinary and 
-   special tokens.  return NULL if failure occurs*/
-DynArray_T lex_lexLine(const char *pcLine)
+/* append the uLength chars of pcValue to the token being built in
+   *ppcBuffer, whose first *puBufferIndex chars are used and which has
+   room for *puPhysLength. uRemaining chars of the line are still to be
+   read, so the buffer is grown to hold them too */
+static void lex_appendValue(const char *pcValue, size_t uLength,
+                            size_t uRemaining, char **ppcBuffer,
+                            size_t *puPhysLength, size_t *puBufferIndex)
+{
+   size_t uNeeded;
+
+   assert(pcValue != NULL);
+   assert(ppcBuffer != NULL);
+   assert(puPhysLength != NULL);
+   assert(puBufferIndex != NULL);
+
+   uNeeded = *puBufferIndex + uLength + uRemaining + 1;
+   if (uNeeded > *puPhysLength)
+   {
+      *ppcBuffer = (char*)Mem_realloc(MEM_LEX, *ppcBuffer, uNeeded);
+      *puPhysLength = uNeeded;
+   }
+   memcpy(*ppcBuffer + *puBufferIndex, pcValue, uLength);
+   *puBufferIndex += uLength;
+}
+
+/* return the index in pcLine of the "))" that closes the arithmetic
+   expansion whose expression starts at uStart, or 0 if there is none */
+static size_t lex_findArithmeticEnd(const char *pcLine, size_t uStart)
+{
+   size_t uIndex;
+   int iDepth = 0;
+
+   assert(pcLine != NULL);
+
+   for (uIndex = uStart; pcLine[uIndex] != '\0'; uIndex++)
+   {
+      if (pcLine[uIndex] == '(')
+         iDepth++;
+      else if (pcLine[uIndex] == ')')
+      {
+         if ((iDepth == 0) && (pcLine[uIndex + 1] == ')'))
+            return uIndex;
+         if (iDepth == 0)
+            return 0;
+         iDepth--;
+      }
+   }
+   return 0;
+}
+
+/* return the length of the variable name at the start of pcChars, or
+   0 if there isn't one. a name is a letter or _ then letters, digits
+   and _, or one of the special names ? and $ */
+static size_t lex_nameLength(const char *pcChars)
+{
+   size_t uLength = 0;
+
+   if ((*pcChars == '?') || (*pcChars == '$'))
+      return 1;
+   if ((! isalpha((unsigned char)*pcChars)) && (*pcChars != '_'))
+      return 0;
+   while (isalnum((unsigned char)pcChars[uLength]) ||
+          (pcChars[uLength] == '_'))
+      uLength++;
+   return uLength;
+}
+
+/* return the index in pcLine of the ')' that closes the command
+   substitution whose command starts at uStart, or 0 if there is none.
+   parentheses between quotes don't count */
+static size_t lex_findCommandEnd(const char *pcLine, size_t uStart)
+{
+   size_t uIndex;
+   int iDepth = 0;
+   int iInQuotes = 0;
+
+   assert(pcLine != NULL);
+
+   for (uIndex = uStart; pcLine[uIndex] != '\0'; uIndex++)
+   {
+      if (pcLine[uIndex] == '\"')
+         iInQuotes = ! iInQuotes;
+      else if (iInQuotes)
+         continue;
+      else if (pcLine[uIndex] == '(')
+         iDepth++;
+      else if (pcLine[uIndex] == ')')
+      {
+         if (iDepth == 0)
+            return uIndex;
+         iDepth--;
+      }
+   }
+   return 0;
+}
+
+/* return the value of the variable named by the uLength chars at
+   pcName, "" if it isn't set */
+static const char *lex_getVariable(const char *pcName, size_t uLength)
+{
+   const char *pcValue;
+
+   pcValue = Var_get(pcName, uLength);
+   if (pcValue == NULL) /* an unset variable expands to nothing */
+      return "";
+   return pcValue;
+}
+
+/* return the output of running the uLength chars at pcCommand as a
+   command, which the caller owns, or NULL after writing a message to
+   stderr */
+static char *lex_substitute(const char *pcCommand, size_t uLength)
+{
+   char *pcCopy;
+   char *pcOutput;
+
+   if (pfLexSubstitute == NULL)
+   {
+      fprintf(stderr, "%s: command substitution not available\n",
+              getPgmName());
+      return NULL;
+   }
+   pcCopy = (char*)Mem_alloc(MEM_LEX, uLength + 1);
+   memcpy(pcCopy, pcCommand, uLength);
+   pcCopy[uLength] = '\0';
+   pcOutput = (*pfLexSubstitute)(pcCopy);
+   Mem_free(pcCopy);
+   return pcOutput;
+}
+
+/* add a token to oTokens for the process substitution whose '<' or
+   '>', c, was just read from pcLine, which *puLineIndex is now past,
+   moving *puLineIndex past it. the token is the /dev/fd path of the
+   pipe to its command or, unless iExpand, its text as it is. return 0
+   if successful, or -1 after writing a message to stderr */
+static int lex_addProcessToken(const char *pcLine, size_t *puLineIndex,
+                               char c, int iExpand, DynArray_T oTokens)
+{
+   enum {MAX_PATH_LENGTH = 32};
+   char acPath[MAX_PATH_LENGTH];
+   char *pcCopy;
+   size_t uStart;
+   size_t uEnd;
+   int iFd;
+
+   assert(pcLine != NULL);
+   assert(puLineIndex != NULL);
+
+   uStart = *puLineIndex + 1;
+   uEnd = lex_findCommandEnd(pcLine, uStart);
+   if (uEnd == 0)
+   {
+      fprintf(stderr, "%s: missing ')'\n", getPgmName());
+      return -1;
+   }
+   *puLineIndex = uEnd + 1;
+
+   if (! iExpand)
+   {
+      uStart -= 2;
+      lex_addOrdinaryToken(pcLine + uStart, uEnd + 1 - uStart, 0,
+                           oTokens);
+      return 0;
+   }
+
+   if (pfLexProcess == NULL)
+   {
+      fprintf(stderr, "%s: process substitution not available\n",
+              getPgmName());
+      return -1;
+   }
+   pcCopy = (char*)Mem_alloc(MEM_LEX, uEnd - uStart + 1);
+   memcpy(pcCopy, pcLine + uStart, uEnd - uStart);
+   pcCopy[uEnd - uStart] = '\0';
+   iFd = (*pfLexProcess)(pcCopy, c == '>');
+   Mem_free(pcCopy);
+   if (iFd == -1)
+      return -1;
+   sprintf(acPath, "/dev/fd/%d", iFd);
+   lex_addOrdinaryToken(acPath, strlen(acPath), 0, oTokens);
+   return 0;
+}
+
+/* store the value of the uLength chars at pcExpr as an integer
+   expression in acValue, in decimal. return 0 if successful, or -1
+   after writing a message to stderr */
+static int lex_evaluate(const char *pcExpr, size_t uLength,
+                        char acValue[])
+{
+   char *pcCopy;
+   long lValue;
+   int iRet;
+
+   pcCopy = (char*)Mem_alloc(MEM_LEX, uLength + 1);
+   memcpy(pcCopy, pcExpr, uLength);
+   pcCopy[uLength] = '\0';
+   iRet = Arith_evaluate(pcCopy, &lValue);
+   Mem_free(pcCopy);
+   if (iRet == 0)
+      sprintf(acValue, "%ld", lValue);
+   return iRet;
+}
+
+/* expand the expansion whose '$' was just read from pcLine, which
+   *puLineIndex is now past, moving *puLineIndex past it. the
+   expansions are
+      $((expression))   the value of an integer expression
+      $name ${name}     the value of a variable, or nothing if unset
+      $(command)        the output of command
+   the value of the first two is appended to the token being built
+   (see lex_appendValue), as it is, without being split into words or
+   lexed again; return 1 for them. the output of a command is left in
+   *ppcFields, which the caller owns, to be split into words; return 2
+   for it. unless iExpand, nothing is evaluated and the expansion's
+   text is appended as it is, returning 1. return 0 if the '$' is an
+   ordinary char, or -1 after writing a message to stderr */
+static int lex_expand(const char *pcLine, size_t *puLineIndex,
+                      char **ppcBuffer, size_t *puPhysLength,
+                      size_t *puBufferIndex, char **ppcFields,
+                      int iExpand)
+{
+   enum {MAX_LONG_DIGITS = 24};
+   enum ExpandKind {EXPAND_ARITHMETIC, EXPAND_COMMAND, EXPAND_VARIABLE};
+
+   char acValue[MAX_LONG_DIGITS];
+   const char *pcValue;
+   enum ExpandKind eKind;
+   size_t uStart;
+   size_t uLength;
+   size_t uNext;
+   int iBraced;
+
+   assert(pcLine != NULL);
+   assert(puLineIndex != NULL);
+   assert(ppcFields != NULL);
+
+   /* find what the expansion holds, from uStart for uLength chars, and
+      where it ends */
+   uStart = *puLineIndex;
+   if ((pcLine[uStart] == '(') && (pcLine[uStart + 1] == '('))
+   {
+      eKind = EXPAND_ARITHMETIC;
+      uStart += 2;
+      uNext = lex_findArithmeticEnd(pcLine, uStart);
+      if (uNext == 0)
+      {
+         fprintf(stderr, "%s: missing '))'\n", getPgmName());
+         return -1;
+      }
+      uLength = uNext - uStart;
+      uNext += 2;
+   }
+   else if (pcLine[uStart] == '(')
+   {
+      eKind = EXPAND_COMMAND;
+      uStart++;
+      uNext = lex_findCommandEnd(pcLine, uStart);
+      if (uNext == 0)
+      {
+         fprintf(stderr, "%s: missing ')'\n", getPgmName());
+         return -1;
+      }
+      uLength = uNext - uStart;
+      uNext++;
+   }
+   else
+   {
+      eKind = EXPAND_VARIABLE;
+      iBraced = (pcLine[uStart] == '{');
+      if (iBraced)
+         uStart++;
+      uLength = lex_nameLength(pcLine + uStart);
+      if (iBraced && (pcLine[uStart + uLength] != '}'))
+      {
+         if (strchr(pcLine + uStart, '}') == NULL)
+            fprintf(stderr, "%s: missing '}'\n", getPgmName());
+         else
+            fprintf(stderr, "%s: bad substitution\n", getPgmName());
+         return -1;
+      }
+      if (uLength == 0)
+         return 0;
+      uNext = uStart + uLength + (iBraced ? 1 : 0);
+   }
+
+   if (! iExpand)
+      pcValue = pcLine + *puLineIndex - 1;
+   else if (eKind == EXPAND_COMMAND)
+   {
+      *ppcFields = lex_substitute(pcLine + uStart, uLength);
+      if (*ppcFields == NULL)
+         return -1;
+      *puLineIndex = uNext;
+      return 2;
+   }
+   else if (eKind == EXPAND_ARITHMETIC)
+   {
+      if (lex_evaluate(pcLine + uStart, uLength, acValue) == -1)
+         return -1;
+      pcValue = acValue;
+   }
+   else
+      pcValue = lex_getVariable(pcLine + uStart, uLength);
+
+   uLength = (! iExpand) ? uNext - (*puLineIndex - 1) : strlen(pcValue);
+   *puLineIndex = uNext;
+   lex_appendValue(pcValue, uLength, strlen(pcLine + uNext), ppcBuffer,
+                   puPhysLength, puBufferIndex);
+   return 1;
+}
+
+/* split pcFields, the output of a command substitution, into words at
+   white space, appending the first to the token being built and
+   adding a token to oTokens for each word that ends. *piQuoted is
+   whether the token being built has a quoted part, as in lex_lexLine,
+   and the rest is as for lex_appendValue. return 1 if a word ended,
+   or 0 if everything went into the token being built */
+static int lex_addFields(const char *pcFields, size_t uRemaining,
+                         char **ppcBuffer, size_t *puPhysLength,
+                         size_t *puBufferIndex, int *piQuoted,
+                         DynArray_T oTokens)
+{
+   size_t uLength;
+   int iSplit = 0;
+
+   assert(pcFields != NULL);
+   assert(piQuoted != NULL);
+
+   while (*pcFields != '\0')
+   {
+      if (isspace((unsigned char)*pcFields))
+      {
+         if ((*puBufferIndex > 0) || *piQuoted)
+         {
+            lex_addOrdinaryToken(*ppcBuffer, *puBufferIndex, ! *piQuoted,
+                                 oTokens);
+            *puBufferIndex = 0;
+            *piQuoted = 0;
+         }
+         iSplit = 1;
+         pcFields++;
+         continue;
+      }
+      uLength = strcspn(pcFields, " \t\n\r\f\v");
+      lex_appendValue(pcFields, uLength, uRemaining, ppcBuffer,
+                      puPhysLength, puBufferIndex);
+      pcFields += uLength;
+   }
+   return iSplit;
+}
+
+/* would lexing pcLine expand anything? */
+int lex_hasExpansion(const char *pcLine)
+{
+   assert(pcLine != NULL);
+
+   return lex_hasExpansionIn(pcLine, strlen(pcLine));
+}
+
+/* would lexing the uLength chars at pcLine expand anything? a '$'
+   outside quotes that is followed by a name, a brace or a parenthesis
+   starts an expansion, as does a word that starts with "<(" or ">(" */
+int lex_hasExpansionIn(const char *pcLine, size_t uLength)
+{
+   int iInQuotes = 0;
+   int iWordStart = 1;
+
+   assert(pcLine != NULL);
+
+   for (; uLength > 0; pcLine++, uLength--)
+   {
+      if (*pcLine == '\"')
+         iInQuotes = ! iInQuotes;
+      else if ((*pcLine == '$') && (! iInQuotes) &&
+               ((pcLine[1] == '(') || (pcLine[1] == '{') ||
+                (lex_nameLength(pcLine + 1) > 0)))
+         return 1;
+      else if (((*pcLine == '<') || (*pcLine == '>')) && (! iInQuotes) &&
+               iWordStart && (pcLine[1] == '('))
+         return 1;
+      iWordStart = (! iInQuotes) && isspace((unsigned char)*pcLine);
+   }
+   return 0;
+}
+
+/* move the word being built, whose uBufferIndex chars so far lie in
+   pcLine from uWordStart, into the buffer *ppcBuffer, first allocating
+   it with room for uPhysLength chars if it isn't yet */
+static void lex_bufferWord(const char *pcLine, size_t uWordStart,
+                           size_t uBufferIndex, char **ppcBuffer,
+                           size_t uPhysLength)
+{
+   assert(pcLine != NULL);
+   assert(ppcBuffer != NULL);
+
+   if (*ppcBuffer == NULL)
+      *ppcBuffer = (char*)Mem_alloc(MEM_LEX, uPhysLength);
+   memcpy(*ppcBuffer, pcLine + uWordStart, uBufferIndex);
+}
+
+/* what lex_lex has built so far: its token array, NULL until made,
+   and its buffer */
+struct LexBuilt
+{
+   DynArray_T *poTokens;
+   char **ppcBuffer;
+};
+
+/* free what the struct LexBuilt pvExtra points to, as memory ran out
+   part way */
+static void lex_undo(void *pvExtra)
+{
+   struct LexBuilt *psBuilt = (struct LexBuilt*)pvExtra;
+
+   assert(psBuilt != NULL);
+
+   if (*psBuilt->poTokens != NULL)
+   {
+      lex_freeTokens(*psBuilt->poTokens);
+      DynArray_free(*psBuilt->poTokens);
+   }
+   Mem_free(*psBuilt->ppcBuffer);
+}
+
+/* take the uLength chars at pcLine and return a token array of
+   ordinary and special tokens, expanding expansions if iExpand.
+   return NULL if failure occurs*/
+static DynArray_T lex_lex(const char *pcLine, size_t uLength,
+                          int iExpand)
 {
    /* lexLine() uses a DFA approach.  It "reads" its characters from
       pcLine. The DFA has these three states: */
@@ -165,56 +734,152 @@ DynArray_T lex_lexLine(const char *pcLine)
    size_t uLineIndex = 0;
 
    /* Pointer to a buffer in which the characters comprising each
-      token are accumulated. */
-   char *pcBuffer;
+      token are accumulated, once one has a quote or an expansion in
+      it. until then, NULL. */
+   char *pcBuffer = NULL;
 
-   /* An index into the buffer. */
+   /* An index into the buffer, and the buffer's size, which only
+      expansions make larger than pcLine. */
    size_t uBufferIndex = 0;
+   size_t uPhysLength;
+
+   /* Is the token being built still the uBufferIndex chars of pcLine
+      from uWordStart, as they lie, and so not in the buffer? */
+   int iInPlace = 1;
+   size_t uWordStart = 0;
+
+   /* Has the token in the buffer had a quoted part? An expanded
+      one? */
+   int iQuoted = 0;
+   int iHasExpansion = 0;
+
+   int iExpanded;
+
+   /* the output of a command substitution, and whether it ended a
+      word */
+   char *pcFields;
+   int iSplit;
+
+   /* the fd before a redirection operator, as in "2>" */
+   char acFd[MAX_FD_DIGITS + 1];
 
    char c;
    
    const char *pcPgmName = getPgmName();
    
-   DynArray_T oTokens;
+   DynArray_T oTokens = NULL;
+
+   /* what to free if memory runs out part way */
+   struct LexBuilt sBuilt;
+   struct MemUndo sUndo;
 
    assert(pcLine != NULL);
 
+   sBuilt.poTokens = &oTokens;
+   sBuilt.ppcBuffer = &pcBuffer;
+   Mem_pushUndo(&sUndo, lex_undo, &sBuilt);
+
    /* Create an empty token DynArray object. */
    oTokens = DynArray_new(0);
    if (oTokens == NULL)
-   {
-      fprintf(stderr, "%s: insufficient memory\n", pcPgmName);
-      exit(EXIT_FAILURE);
-   }
-   /* Allocate memory for a buffer that is large enough to store the
-      largest token that might appear within pcLine. */
-   pcBuffer = (char*)malloc(strlen(pcLine) + 1);
-   if (pcBuffer == NULL)
-   {
-      fprintf(stderr, "%s: insufficient memory\n", pcPgmName);
-      exit(EXIT_FAILURE);
-   }
+      Mem_fail();
+   /* the buffer, if needed, is large enough to store the largest
+      token that might appear within pcLine. */
+   uPhysLength = uLength + 1;
 
    for (;;)
    {
-      /* read next char */
-      c = pcLine[uLineIndex++];
+      /* read next char, '\0' past the end */
+      c = (uLineIndex < uLength) ? pcLine[uLineIndex] : '\0';
+      uLineIndex++;
+
+      /* a '$' starts an expansion, except between quotes */
+      if ((c == '$') && (eState != STATE_ESCAPE_IN))
+      {
+         if (iInPlace)
+         {
+            lex_bufferWord(pcLine, uWordStart, uBufferIndex, &pcBuffer,
+                           uPhysLength);
+            iInPlace = 0;
+         }
+         iExpanded = lex_expand(pcLine, &uLineIndex, &pcBuffer,
+                                &uPhysLength, &uBufferIndex, &pcFields,
+                                iExpand);
+         if (iExpanded == -1)
+         {
+            Mem_free(pcBuffer);
+            lex_freeTokens(oTokens);
+            DynArray_free(oTokens);
+            Mem_popUndo(&sUndo);
+            return NULL;
+         }
+         if (iExpanded == 0)
+            pcBuffer[uBufferIndex++] = c;
+         else
+            iHasExpansion = 1;
+         if (iExpanded == 2)
+         {
+            iSplit = lex_addFields(pcFields, uLength - uLineIndex,
+                                   &pcBuffer, &uPhysLength,
+                                   &uBufferIndex, &iQuoted, oTokens);
+            Mem_free(pcFields);
+            if (iSplit && (uBufferIndex == 0))
+            {  /* the output ended with a word */
+               iHasExpansion = 0;
+               iInPlace = 1;
+               eState = STATE_START;
+               continue;
+            }
+         }
+         /* a word that is so far just an empty expansion isn't a word
+            yet, as in other shells */
+         if ((uBufferIndex > 0) || (eState == STATE_ORDINARY) ||
+             (eState == STATE_ESCAPE_OUT))
+            eState = STATE_ORDINARY;
+         else
+            eState = STATE_START;
+         continue;
+      }
+      /* so does "<(" or ">(" starting a word */
+      if (((c == '<') || (c == '>')) && (pcLine[uLineIndex] == '(') &&
+          (eState == STATE_START))
+      {
+         if (lex_addProcessToken(pcLine, &uLineIndex, c, iExpand,
+                                 oTokens) == -1)
+         {
+            Mem_free(pcBuffer);
+            lex_freeTokens(oTokens);
+            DynArray_free(oTokens);
+            Mem_popUndo(&sUndo);
+            return NULL;
+         }
+         continue;
+      }
+
       switch (eState)
       {
          case STATE_START:
             if (c == '\0')
             {
-               free(pcBuffer);
+               Mem_free(pcBuffer);
+               Mem_popUndo(&sUndo);
                return oTokens;
             }
-            else if ((c == '>') || (c == '<'))
+            else if ((c == '>') || (c == '<') || (c == '&'))
             {
-               lex_addSpecialToken(c, oTokens);
+               lex_addSpecialToken("", c, pcLine, &uLineIndex, oTokens);
                eState = STATE_SPECIAL;
             }
             else if (c == '\"')
             {
+               if (iInPlace)
+               {
+                  lex_bufferWord(pcLine, uWordStart, uBufferIndex,
+                                 &pcBuffer, uPhysLength);
+                  iInPlace = 0;
+               }
                eState = STATE_ESCAPE_IN;
+               iQuoted = 1;
             }
             else if (isspace(c))
             {
@@ -222,7 +887,11 @@ DynArray_T lex_lexLine(const char *pcLine)
             }
             else
             {
-               pcBuffer[uBufferIndex++] = c;
+               if (! iInPlace)
+                  pcBuffer[uBufferIndex] = c;
+               else if (uBufferIndex == 0)
+                  uWordStart = uLineIndex - 1;
+               uBufferIndex++;
                eState = STATE_ORDINARY;
             }
             break;
@@ -230,10 +899,11 @@ DynArray_T lex_lexLine(const char *pcLine)
          case STATE_ESCAPE_IN:
             if (c == '\0')
             {
-               free(pcBuffer);
+               Mem_free(pcBuffer);
                fprintf(stderr, "%s: unmatched quote\n", pcPgmName );
                lex_freeTokens(oTokens);
                DynArray_free(oTokens);
+               Mem_popUndo(&sUndo);
                return NULL;
             }
             else if ((c == '>') || (c == '<'))
@@ -259,87 +929,160 @@ DynArray_T lex_lexLine(const char *pcLine)
          case STATE_ESCAPE_OUT:
             if (c == '\0')
             {
-               lex_addOrdinaryToken(pcBuffer, uBufferIndex, oTokens);
+               lex_addOrdinaryToken(pcBuffer, uBufferIndex, ! iQuoted,
+                                    oTokens);
                uBufferIndex = 0;
-               free(pcBuffer);
+               Mem_free(pcBuffer);
+               Mem_popUndo(&sUndo);
                return oTokens;
             }
-            else if ((c == '>') || (c == '<'))
+            else if ((c == '>') || (c == '<') || (c == '&'))
             {
-               lex_addSpecialToken(c, oTokens);
+               lex_addSpecialToken("", c, pcLine, &uLineIndex, oTokens);
                eState = STATE_SPECIAL;
             }
             else if (c == '\"')
             {
+               if (iInPlace)
+               {
+                  lex_bufferWord(pcLine, uWordStart, uBufferIndex,
+                                 &pcBuffer, uPhysLength);
+                  iInPlace = 0;
+               }
                eState = STATE_ESCAPE_IN;
+               iQuoted = 1;
             }
             else if (isspace(c))
             {
-               lex_addOrdinaryToken(pcBuffer, uBufferIndex, oTokens);
+               lex_addOrdinaryToken(pcBuffer, uBufferIndex, ! iQuoted,
+                                    oTokens);
                uBufferIndex = 0;
+               iQuoted = 0;
+               iHasExpansion = 0;
+               iInPlace = 1;
                eState = STATE_START;
             }
             else
             {
-               pcBuffer[uBufferIndex++] = c;
+               if (! iInPlace)
+                  pcBuffer[uBufferIndex] = c;
+               else if (uBufferIndex == 0)
+                  uWordStart = uLineIndex - 1;
+               uBufferIndex++;
                eState = STATE_ORDINARY;
             }
             break;
          case STATE_SPECIAL:
             if (c == '\0')
             {
-               free(pcBuffer);
+               Mem_free(pcBuffer);
+               Mem_popUndo(&sUndo);
                return oTokens;
             }
-            else if ((c == '>') || (c == '<'))
+            else if ((c == '>') || (c == '<') || (c == '&'))
             {
-               lex_addSpecialToken(c, oTokens);
+               lex_addSpecialToken("", c, pcLine, &uLineIndex, oTokens);
                uBufferIndex = 0;
+               iQuoted = 0;
+               iHasExpansion = 0;
+               iInPlace = 1;
                eState = STATE_SPECIAL;
             }
             else if (c == '\"')
             {
+               if (iInPlace)
+               {
+                  lex_bufferWord(pcLine, uWordStart, uBufferIndex,
+                                 &pcBuffer, uPhysLength);
+                  iInPlace = 0;
+               }
                eState = STATE_ESCAPE_IN;
+               iQuoted = 1;
             }
             else if (isspace(c))
             {
                uBufferIndex = 0;
+               iQuoted = 0;
+               iHasExpansion = 0;
+               iInPlace = 1;
                eState = STATE_START;
             }
             else
             {
-               pcBuffer[uBufferIndex++] = c;
+               if (! iInPlace)
+                  pcBuffer[uBufferIndex] = c;
+               else if (uBufferIndex == 0)
+                  uWordStart = uLineIndex - 1;
+               uBufferIndex++;
                eState = STATE_ORDINARY;
             }
             break;
          case STATE_ORDINARY:
             if (c == '\0')
             {
-               lex_addOrdinaryToken(pcBuffer, uBufferIndex, oTokens);
+               lex_addOrdinaryToken(iInPlace ? pcLine + uWordStart
+                                    : pcBuffer, uBufferIndex, ! iQuoted,
+                                    oTokens);
                uBufferIndex = 0;
-               free(pcBuffer);
+               Mem_free(pcBuffer);
+               Mem_popUndo(&sUndo);
                return oTokens;
             }
-            else if ((c == '>') || (c == '<'))
+            else if ((c == '>') || (c == '<') || (c == '&'))
             {
-               lex_addOrdinaryToken(pcBuffer, uBufferIndex, oTokens);
-               lex_addSpecialToken(c, oTokens);
-               uBufferIndex = 0;               
+               if ((c != '&') && (! iQuoted) && (! iHasExpansion) &&
+                   lex_isFdPrefix(iInPlace ? pcLine + uWordStart
+                                  : pcBuffer, uBufferIndex))
+               {  /* the word is the fd of the redirection */
+                  memcpy(acFd, iInPlace ? pcLine + uWordStart : pcBuffer,
+                         uBufferIndex);
+                  acFd[uBufferIndex] = '\0';
+                  lex_addSpecialToken(acFd, c, pcLine, &uLineIndex,
+                                      oTokens);
+               }
+               else
+               {
+                  lex_addOrdinaryToken(iInPlace ? pcLine + uWordStart
+                                       : pcBuffer, uBufferIndex,
+                                       ! iQuoted, oTokens);
+                  lex_addSpecialToken("", c, pcLine, &uLineIndex,
+                                      oTokens);
+               }
+               uBufferIndex = 0;
+               iQuoted = 0;
+               iHasExpansion = 0;
+               iInPlace = 1;
                eState = STATE_SPECIAL;
             }
             else if (c == '\"')
             {
+               if (iInPlace)
+               {
+                  lex_bufferWord(pcLine, uWordStart, uBufferIndex,
+                                 &pcBuffer, uPhysLength);
+                  iInPlace = 0;
+               }
                eState = STATE_ESCAPE_IN;
+               iQuoted = 1;
             }
             else if (isspace(c))
             {
-               lex_addOrdinaryToken(pcBuffer, uBufferIndex, oTokens);
+               lex_addOrdinaryToken(iInPlace ? pcLine + uWordStart
+                                    : pcBuffer, uBufferIndex, ! iQuoted,
+                                    oTokens);
                uBufferIndex = 0;
+               iQuoted = 0;
+               iHasExpansion = 0;
+               iInPlace = 1;
                eState = STATE_START;
             }
             else
             {
-               pcBuffer[uBufferIndex++] = c;
+               if (! iInPlace)
+                  pcBuffer[uBufferIndex] = c;
+               else if (uBufferIndex == 0)
+                  uWordStart = uLineIndex - 1;
+               uBufferIndex++;
                eState = STATE_ORDINARY;
             }
             break;
@@ -349,3 +1092,29 @@ DynArray_T lex_lexLine(const char *pcLine)
       }
    }
 }
+
+/* take a string pcLine and return a token array of ordinary and
+   special tokens.  return NULL if failure occurs*/
+DynArray_T lex_lexLine(const char *pcLine)
+{
+   assert(pcLine != NULL);
+
+   return lex_lex(pcLine, strlen(pcLine), 1);
+}
+
+/* lex pcLine as lex_lexLine does, but leaving expansions as they
+   are */
+DynArray_T lex_lexLineUnexpanded(const char *pcLine)
+{
+   assert(pcLine != NULL);
+
+   return lex_lex(pcLine, strlen(pcLine), 0);
+}
+
+/* lex the uLength chars at pcLine, where they lie */
+DynArray_T lex_lexChars(const char *pcLine, size_t uLength)
+{
+   assert(pcLine != NULL);
+
+   return lex_lex(pcLine, uLength, 0);
+}
@@ -15,10 +15,59 @@ void lex_writeTokens(DynArray_T oTokens);
 /* Free all of the tokens in oTokens. */
 void lex_freeTokens(DynArray_T oTokens);
 
-/* perform lexical analysis on a string pcLine, returns a token array*/
+/* perform lexical analysis on a string pcLine, returns a token array.
+   $ expansions outside quotes are replaced by their values*/
 DynArray_T lex_lexLine(const char *pcLine);
 
+/* perform lexical analysis on pcLine as lex_lexLine does, but leave
+   each $ expansion as its text, part of one word, without evaluating
+   it*/
+DynArray_T lex_lexLineUnexpanded(const char *pcLine);
+
+/* perform lexical analysis on the uLength chars at pcLine as
+   lex_lexLineUnexpanded does, where they lie, so that a word without
+   quotes is pooled straight from them. they needn't be followed by a
+   '\0', but the char after them must be readable and be a '\0' or a
+   newline, and they must have nothing to expand (see
+   lex_hasExpansionIn) */
+DynArray_T lex_lexChars(const char *pcLine, size_t uLength);
+
+/* have $(command) expansions call (*pfSubstitute)(pcCommand), which
+   returns the output of running pcCommand as a string the caller owns,
+   or NULL after writing a message to stderr. until this is called,
+   $(command) is an error */
+void lex_setSubstitute(char *(*pfSubstitute)(const char *pcCommand));
+
+/* have <(command) and >(command) words call
+   (*pfProcess)(pcCommand, iWrite), which starts pcCommand with its
+   stdout, or its stdin if iWrite, on a pipe and returns the fd of the
+   pipe's other end, or -1 after writing a message to stderr. the word
+   becomes /dev/fd/ and that fd. until this is called, they are an
+   error */
+void lex_setProcessSubstitute(int (*pfProcess)(const char *pcCommand,
+                                               int iWrite));
+
+/* would lexing pcLine expand anything? return 1 if so, so that its
+   tokens depend on when it is lexed, 0 if not */
+int lex_hasExpansion(const char *pcLine);
+
+/* would lexing the uLength chars at pcLine expand anything? as
+   lex_hasExpansion, for chars that needn't be followed by a '\0' */
+int lex_hasExpansionIn(const char *pcLine, size_t uLength);
+
 /* read in a line from psFile, then return that line in string form */
 char *lex_readLine(FILE *psFile);
 
+/* read lines from psFile up to the line pcDelimiter, and return them,
+   each ending with a newline, as one string that the caller owns. if
+   iEcho, prompt for and echo each line like ish does its commands */
+char *lex_readHereBody(FILE *psFile, const char *pcDelimiter, int iEcho);
+
+/* read a here-document's body as lex_readHereBody does, but from the
+   lines (*pfReadLine)(pvSource) returns, each a string the caller owns,
+   or NULL at the end */
+char *lex_readHereBodyWith(char *(*pfReadLine)(void *pvSource),
+                           void *pvSource, const char *pcDelimiter,
+                           int iEcho);
+
 #endif
@@ -0,0 +1,372 @@
+/*--------------------------------------------------------------------
+  libish.c
+  Author: Nate Wilson
+  Description: the library's entry points. each call records its
+  context as the calling thread's current one, which is what
+  getPgmName returns the name of, and where running out of memory
+  jumps back to, so that the call returns ISH_ERROR_MEMORY rather than
+  the process exiting. what the lexer, parser and planner have built
+  by then is freed by the undos they push onto the call's stack, and
+  from the fork on nothing jumps, as the event loop and the copiers
+  only try to allocate
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "libish.h"
+#include "ish.h"
+#include "lex.h"
+#include "command.h"
+#include "token.h"
+#include "dynarray.h"
+#include "redirect.h"
+#include "event.h"
+#include "spawn.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* a context */
+struct IshContext
+{
+   char *pcName;
+   Event_T oEvent;
+};
+
+/* a call in progress on a thread, with where running out of memory
+   returns to, what is to be undone first, and the call it was made
+   within, if any */
+struct IshFrame
+{
+   struct IshContext *psContext;
+   jmp_buf aJump;
+   struct MemUndo *psUndo;
+   struct IshFrame *psOuter;
+};
+
+/* a foreground command being waited for */
+struct IshWait
+{
+   int iExited;
+   int iStatus;
+};
+
+/* each thread's innermost call in progress */
+static pthread_key_t iFrameKey;
+static pthread_once_t sFrameOnce = PTHREAD_ONCE_INIT;
+
+/*--------------------------------------------------------------------*/
+
+/* the Mem_fail handler: return to the calling thread's innermost
+   call, if it has one, or return to write the message and exit */
+static void libish_fail(void)
+{
+   struct IshFrame *psFrame;
+
+   psFrame = (struct IshFrame*)pthread_getspecific(iFrameKey);
+   if (psFrame != NULL)
+      longjmp(psFrame->aJump, 1);
+}
+
+/* return the undo stack of the calling thread's innermost call, or
+   NULL if it has none */
+static struct MemUndo **libish_getUndoStack(void)
+{
+   struct IshFrame *psFrame;
+
+   psFrame = (struct IshFrame*)pthread_getspecific(iFrameKey);
+   if (psFrame == NULL)
+      return NULL;
+   return &psFrame->psUndo;
+}
+
+/* make the thread key and set the Mem_fail handler, once */
+static void libish_init(void)
+{
+   if (pthread_key_create(&iFrameKey, NULL) != 0)
+   {perror("libish"); exit(EXIT_FAILURE);}
+   Mem_setUndoStack(libish_getUndoStack);
+   Mem_setFailHandler(libish_fail);
+}
+
+/* make psFrame, a call on psContext, the thread's innermost */
+static void libish_enter(struct IshContext *psContext,
+                         struct IshFrame *psFrame)
+{
+   psFrame->psContext = psContext;
+   psFrame->psUndo = NULL;
+   psFrame->psOuter = (struct IshFrame*)pthread_getspecific(iFrameKey);
+   (void)pthread_setspecific(iFrameKey, psFrame);
+}
+
+/* end the call psFrame */
+static void libish_leave(struct IshFrame *psFrame)
+{
+   (void)pthread_setspecific(iFrameKey, psFrame->psOuter);
+}
+
+/* the event loop's handler for the foreground command exiting: record
+   iStatus in the struct IshWait pvExtra points to */
+static void libish_reap(pid_t iPid, int iStatus, void *pvExtra)
+{
+   struct IshWait *psWait = (struct IshWait*)pvExtra;
+
+   (void)iPid;
+   assert(psWait != NULL);
+
+   psWait->iExited = TRUE;
+   psWait->iStatus = iStatus;
+}
+
+/* run oCommand for psContext, storing its exit status in *piStatus.
+   return ISH_OK, or an error if it couldn't be started */
+static int libish_run(struct IshContext *psContext, Command_T oCommand,
+                      int *piStatus)
+{
+   RedirectPlan_T oPlan;
+   DynArray_T oTokens;
+   struct IshWait sWait;
+   char **apcArgv;
+   size_t uIndex;
+   pid_t iPid;
+
+   oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if (oPlan == NULL)
+      return ISH_ERROR_REDIRECT;
+   if (Redirect_watchPlan(oPlan, psContext->oEvent) == -1)
+   {
+      Redirect_freePlan(oPlan);
+      return ISH_ERROR_SYSTEM;
+   }
+   oTokens = Command_getTokens(oCommand);
+   apcArgv = (char**)Mem_tryCalloc(MEM_SHELL,
+                                   DynArray_getLength(oTokens) + 1,
+                                   sizeof(char*));
+   if (apcArgv == NULL)
+   {
+      Redirect_freePlan(oPlan);
+      return ISH_ERROR_MEMORY;
+   }
+   for (uIndex = 0; uIndex < DynArray_getLength(oTokens); uIndex++)
+      apcArgv[uIndex] = (char*)Token_getValue(DynArray_get(oTokens,
+                                                           uIndex));
+
+   /* execvp searches PATH itself, as the shell's cache of it isn't
+      shared between threads */
+   iPid = Spawn_command(apcArgv, NULL, NULL, oPlan, NULL, NULL);
+   Mem_free(apcArgv);
+   if (iPid == -1)
+   {
+      Redirect_freePlan(oPlan);
+      return ISH_ERROR_SYSTEM;
+   }
+   Redirect_closePlan(oPlan);
+
+   sWait.iExited = FALSE;
+   sWait.iStatus = 0;
+   if (Command_isBackground(oCommand))
+   {  /* reaped by a later call's loop, or Ish_freeContext's */
+      if (Event_reapChild(psContext->oEvent, iPid, NULL, NULL) == -1)
+      {
+         Redirect_freePlan(oPlan);
+         return ISH_ERROR_SYSTEM;
+      }
+      Redirect_releasePlan(oPlan);
+      *piStatus = 0;
+      return ISH_OK;
+   }
+   if (Event_reapChild(psContext->oEvent, iPid, libish_reap,
+                       &sWait) == -1)
+   {
+      Redirect_freePlan(oPlan);
+      return ISH_ERROR_SYSTEM;
+   }
+   /* the child is watched, so the loop must run until it is reaped,
+      whatever else fails */
+   while (! sWait.iExited)
+      (void)Event_runOnce(psContext->oEvent, -1);
+   Redirect_freePlan(oPlan);
+   if (WIFSIGNALED(sWait.iStatus))
+      *piStatus = 128 + WTERMSIG(sWait.iStatus);
+   else
+      *piStatus = WEXITSTATUS(sWait.iStatus);
+   return ISH_OK;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* the name of the calling thread's current context, for the
+   messages the lexer and parser write */
+const char *getPgmName(void)
+{
+   struct IshFrame *psFrame;
+
+   (void)pthread_once(&sFrameOnce, libish_init);
+   psFrame = (struct IshFrame*)pthread_getspecific(iFrameKey);
+   if (psFrame == NULL)
+      return "libish";
+   return psFrame->psContext->pcName;
+}
+
+/* return a new context named pcName */
+IshContext_T Ish_newContext(const char *pcName)
+{
+   struct IshContext *psContext;
+
+   assert(pcName != NULL);
+
+   (void)pthread_once(&sFrameOnce, libish_init);
+   psContext = (struct IshContext*)Mem_tryAlloc(MEM_SHELL,
+                                                sizeof(*psContext));
+   if (psContext == NULL)
+   {
+      errno = ENOMEM;
+      return NULL;
+   }
+   psContext->pcName = (char*)Mem_tryAlloc(MEM_SHELL,
+                                           strlen(pcName) + 1);
+   if (psContext->pcName == NULL)
+   {
+      Mem_free(psContext);
+      errno = ENOMEM;
+      return NULL;
+   }
+   strcpy(psContext->pcName, pcName);
+   psContext->oEvent = Event_new();
+   if (psContext->oEvent == NULL)
+   {
+      Mem_free(psContext->pcName);
+      Mem_free(psContext);
+      return NULL;
+   }
+   return psContext;
+}
+
+/* wait for oContext's background commands and free it */
+void Ish_freeContext(IshContext_T oContext)
+{
+   assert(oContext != NULL);
+
+   while (Event_getWatchCount(oContext->oEvent) > 0)
+      if (Event_runOnce(oContext->oEvent, -1) == -1)
+         break;
+   Event_free(oContext->oEvent);
+   Mem_free(oContext->pcName);
+   Mem_free(oContext);
+}
+
+/* lex pcLine into *poTokens */
+int Ish_lexLine(IshContext_T oContext, const char *pcLine,
+                DynArray_T *poTokens)
+{
+   struct IshFrame sFrame;
+   DynArray_T oTokens;
+
+   assert(oContext != NULL);
+   assert(pcLine != NULL);
+   assert(poTokens != NULL);
+
+   *poTokens = NULL;
+   libish_enter(oContext, &sFrame);
+   if (setjmp(sFrame.aJump) != 0)
+   {
+      libish_leave(&sFrame);
+      return ISH_ERROR_MEMORY;
+   }
+   oTokens = lex_lexLineUnexpanded(pcLine);
+   libish_leave(&sFrame);
+   if (oTokens == NULL)
+      return ISH_ERROR_SYNTAX;
+   *poTokens = oTokens;
+   return ISH_OK;
+}
+
+/* parse pcLine into *poCommand */
+int Ish_parseLine(IshContext_T oContext, const char *pcLine,
+                  Command_T *poCommand)
+{
+   struct IshFrame sFrame;
+   DynArray_T oTokens;
+   Command_T oCommand;
+   int iResult;
+
+   assert(poCommand != NULL);
+
+   *poCommand = NULL;
+   iResult = Ish_lexLine(oContext, pcLine, &oTokens);
+   if (iResult != ISH_OK)
+      return iResult;
+   if (DynArray_getLength(oTokens) == 0)
+   {
+      DynArray_free(oTokens);
+      return ISH_ERROR_EMPTY;
+   }
+   libish_enter(oContext, &sFrame);
+   if (setjmp(sFrame.aJump) != 0)
+   {  /* the command, if any, was undone, but the tokens are ours */
+      libish_leave(&sFrame);
+      lex_freeTokens(oTokens);
+      DynArray_free(oTokens);
+      return ISH_ERROR_MEMORY;
+   }
+   oCommand = Command_createCommand(oTokens);
+   libish_leave(&sFrame);
+   if (oCommand == NULL)
+   {  /* the command has the tokens only once it's made */
+      lex_freeTokens(oTokens);
+      DynArray_free(oTokens);
+      return ISH_ERROR_SYNTAX;
+   }
+   *poCommand = oCommand;
+   return ISH_OK;
+}
+
+/* free oCommand and its tokens */
+void Ish_freeCommand(Command_T oCommand)
+{
+   DynArray_T oTokens;
+
+   assert(oCommand != NULL);
+
+   oTokens = Command_getTokens(oCommand);
+   Command_freeCommand(oCommand);
+   lex_freeTokens(oTokens);
+   DynArray_free(oTokens);
+}
+
+/* run pcLine's command */
+int Ish_runLine(IshContext_T oContext, const char *pcLine,
+                int *piStatus)
+{
+   struct IshFrame sFrame;
+   Command_T oCommand;
+   int iResult;
+
+   assert(piStatus != NULL);
+
+   *piStatus = 0;
+   iResult = Ish_parseLine(oContext, pcLine, &oCommand);
+   if (iResult != ISH_OK)
+      return iResult;
+   libish_enter(oContext, &sFrame);
+   if (setjmp(sFrame.aJump) != 0)
+   {  /* the plan was undone, and no command started */
+      libish_leave(&sFrame);
+      Ish_freeCommand(oCommand);
+      return ISH_ERROR_MEMORY;
+   }
+   iResult = libish_run(oContext, oCommand, piStatus);
+   libish_leave(&sFrame);
+   Ish_freeCommand(oCommand);
+   return iResult;
+}
@@ -0,0 +1,72 @@
+/*--------------------------------------------------------------------*/
+/* libish.h                                                           */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef LIBISH_INCLUDED
+#define LIBISH_INCLUDED
+
+#include "dynarray.h"
+#include "command.h"
+
+/* the ish lexer, parser and executor as a library, libish.a or
+   libish.so, for programs that run command lines themselves rather
+   than starting an ish for each. every call takes a context, and
+   contexts used from different threads at once don't interfere. a
+   line is taken as ish takes it, except:
+      - $ expansions and <(command) words are left as their text, as
+        the shell's variables and subshells aren't the library's
+      - patterns aren't matched against files
+      - here-documents have empty bodies, there being no lines after
+      - there are no builtins: every command is run from PATH
+   messages about a line are written to stderr under the context's
+   name. a call that runs out of memory frees what it had built, and
+   starts no command, before it returns ISH_ERROR_MEMORY. the library
+   defines getPgmName, so it can't be linked into a program that
+   does */
+
+/* IshContext_T is a pointer to a context: the name messages are
+   written under, and the event loop the context's commands are
+   watched with */
+typedef struct IshContext *IshContext_T;
+
+/* what the calls below return */
+enum IshResult {ISH_OK = 0,
+                ISH_ERROR_MEMORY = -1, /* memory ran out             */
+                ISH_ERROR_SYNTAX = -2, /* the line isn't well formed */
+                ISH_ERROR_EMPTY = -3,  /* the line has no command    */
+                ISH_ERROR_REDIRECT = -4, /* a file can't be opened   */
+                ISH_ERROR_SYSTEM = -5  /* a system call failed       */};
+
+/* return a new context whose messages are written under pcName, or
+   NULL with errno set if it can't be made */
+IshContext_T Ish_newContext(const char *pcName);
+
+/* wait for the commands oContext runs in the background, then free
+   it */
+void Ish_freeContext(IshContext_T oContext);
+
+/* lex pcLine into tokens, stored in *poTokens, which the caller owns
+   and frees with lex_freeTokens and DynArray_free. return ISH_OK, or
+   an error with *poTokens NULL */
+int Ish_lexLine(IshContext_T oContext, const char *pcLine,
+                DynArray_T *poTokens);
+
+/* parse pcLine into a command, stored in *poCommand, which the caller
+   owns and frees with Ish_freeCommand. return ISH_OK, or an error with
+   *poCommand NULL */
+int Ish_parseLine(IshContext_T oContext, const char *pcLine,
+                  Command_T *poCommand);
+
+/* free oCommand, from Ish_parseLine, and its tokens */
+void Ish_freeCommand(Command_T oCommand);
+
+/* run pcLine's command in a child with its redirections in place, and
+   wait for it unless it ends with '&'. store its exit status in
+   *piStatus, 128 plus the signal if one ended it, 127 if the command
+   isn't found, 126 if it can't be run, or 0 for '&'. return ISH_OK,
+   or an error if the command couldn't be started */
+int Ish_runLine(IshContext_T oContext, const char *pcLine,
+                int *piStatus);
+
+#endif
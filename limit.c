@@ -0,0 +1,289 @@
+/*--------------------------------------------------------------------
+  limit.c
+  Author: Nate Wilson
+  Description: the limit prefix. a command is run with resource
+  limits set in the child between the fork and the exec, so that one
+  runaway command is stopped by the kernel rather than taking the
+  machine with it, and which limit stopped it is said when that limit
+  is what it died of
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "limit.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "mem.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* the limits there are options for */
+enum {LIMIT_COUNT = 8};
+
+/* an option, the resource it limits, what that is called, and whether
+   its value is a size */
+struct LimitOption
+{
+   char cOption;
+   int iResource;
+   const char *pcName;
+   int iIsSize;
+};
+
+static const struct LimitOption asOptions[LIMIT_COUNT] =
+{
+   {'t', RLIMIT_CPU, "CPU time", FALSE},
+   {'v', RLIMIT_AS, "address space", TRUE},
+   {'d', RLIMIT_DATA, "data size", TRUE},
+   {'s', RLIMIT_STACK, "stack size", TRUE},
+   {'f', RLIMIT_FSIZE, "file size", TRUE},
+   {'c', RLIMIT_CORE, "core file size", TRUE},
+   {'n', RLIMIT_NOFILE, "open files", FALSE},
+   {'u', RLIMIT_NPROC, "processes", FALSE}
+};
+
+/* the limits a command is run with, as given on the limit command
+   line */
+struct LimitSettings
+{
+   /* is each of asOptions' limits given, and what it is */
+   int aiHas[LIMIT_COUNT];
+   struct rlimit asLimits[LIMIT_COUNT];
+};
+
+/*--------------------------------------------------------------------*/
+
+/* parse pcValue as a limit, "unlimited" or a number, with a k, m or g
+   suffix if iIsSize, storing it in *puValue. return TRUE if
+   successful, FALSE if pcValue isn't one */
+static int limit_parseValue(const char *pcValue, int iIsSize,
+                            rlim_t *puValue)
+{
+   char *pcEnd;
+   unsigned long ulValue;
+   unsigned long ulScale = 1;
+
+   assert(pcValue != NULL);
+   assert(puValue != NULL);
+
+   if (strcmp(pcValue, "unlimited") == 0)
+   {
+      *puValue = RLIM_INFINITY;
+      return TRUE;
+   }
+   if (! isdigit((unsigned char)pcValue[0]))
+      return FALSE;
+   errno = 0;
+   ulValue = strtoul(pcValue, &pcEnd, 10);
+   if (errno != 0)
+      return FALSE;
+   if (iIsSize)
+      switch (tolower((unsigned char)*pcEnd))
+      {
+         case 'k': ulScale = 1024UL; pcEnd++; break;
+         case 'm': ulScale = 1024UL * 1024; pcEnd++; break;
+         case 'g': ulScale = 1024UL * 1024 * 1024; pcEnd++; break;
+         default: break;
+      }
+   if ((*pcEnd != '\0') || (ulValue > ULONG_MAX / ulScale))
+      return FALSE;
+   *puValue = (rlim_t)(ulValue * ulScale);
+   return TRUE;
+}
+
+/* set psLimit to the limit uValue of iResource: the soft limit, and
+   the hard one unless that would be above the shell's. CPU time gets a
+   second more before the hard limit, so that SIGXCPU comes before
+   SIGKILL */
+static void limit_setLimit(int iResource, rlim_t uValue,
+                           struct rlimit *psLimit)
+{
+   struct rlimit sCurrent;
+
+   assert(psLimit != NULL);
+
+   psLimit->rlim_cur = uValue;
+   psLimit->rlim_max = uValue;
+   if ((iResource == RLIMIT_CPU) && (uValue != RLIM_INFINITY))
+      psLimit->rlim_max = uValue + 1;
+   /* RLIM_INFINITY is above every other limit. a soft limit above
+      the shell's hard one is left for setrlimit to refuse */
+   if ((getrlimit(iResource, &sCurrent) == 0) &&
+       (uValue <= sCurrent.rlim_max) &&
+       (psLimit->rlim_max > sCurrent.rlim_max))
+      psLimit->rlim_max = sCurrent.rlim_max;
+}
+
+/* fill psSettings from the limit prefix at token *puIndex of oTokens
+   and its options, and move *puIndex past them. return TRUE if
+   successful, FALSE (after writing a message to stderr) if they are
+   malformed */
+static int limit_parseOptions(DynArray_T oTokens, size_t *puIndex,
+                              struct LimitSettings *psSettings)
+{
+   size_t uIndex;
+   size_t uLength;
+   size_t uOption;
+   const char *pcOption;
+   const char *pcValue;
+   rlim_t uValue;
+   const char *pcPgmName = getPgmName();
+
+   assert(oTokens != NULL);
+   assert(puIndex != NULL);
+   assert(psSettings != NULL);
+
+   memset(psSettings, 0, sizeof(*psSettings));
+
+   uLength = DynArray_getLength(oTokens);
+   /* token *puIndex is "limit" itself */
+   for (uIndex = *puIndex + 1; uIndex < uLength; uIndex++)
+   {
+      pcOption = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (pcOption[0] != '-')
+         break;
+      for (uOption = 0; uOption < LIMIT_COUNT; uOption++)
+         if (pcOption[1] == asOptions[uOption].cOption)
+            break;
+      if ((uOption == LIMIT_COUNT) || (pcOption[2] != '\0'))
+      {
+         fprintf(stderr, "%s: limit: invalid option %s\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      /* every option takes a value */
+      if (uIndex + 1 == uLength)
+      {
+         fprintf(stderr, "%s: limit: option %s requires a value\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      uIndex++;
+      pcValue = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (! limit_parseValue(pcValue, asOptions[uOption].iIsSize,
+                             &uValue))
+      {
+         fprintf(stderr, "%s: limit: invalid value for %s: %s\n",
+                 pcPgmName, pcOption, pcValue);
+         return FALSE;
+      }
+      psSettings->aiHas[uOption] = TRUE;
+      limit_setLimit(asOptions[uOption].iResource, uValue,
+                     &psSettings->asLimits[uOption]);
+   }
+   *puIndex = uIndex;
+   return TRUE;
+}
+
+/* return the CPU time psUsage says was used, in whole seconds */
+static rlim_t limit_getCpuSeconds(const struct rusage *psUsage)
+{
+   assert(psUsage != NULL);
+
+   return (rlim_t)(psUsage->ru_utime.tv_sec + psUsage->ru_stime.tv_sec +
+                   (psUsage->ru_utime.tv_usec + psUsage->ru_stime.tv_usec) /
+                   1000000);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* parse the limit prefix at token *puIndex of oTokens */
+LimitSettings_T Limit_parse(DynArray_T oTokens, size_t *puIndex)
+{
+   struct LimitSettings *psSettings;
+
+   psSettings = (struct LimitSettings*)Mem_alloc(MEM_BUILTIN,
+                                                 sizeof(*psSettings));
+   if (! limit_parseOptions(oTokens, puIndex, psSettings))
+   {
+      Mem_free(psSettings);
+      return NULL;
+   }
+   return psSettings;
+}
+
+/* set the calling process's limits as oSettings says */
+int Limit_apply(LimitSettings_T oSettings)
+{
+   size_t uOption;
+
+   assert(oSettings != NULL);
+
+   for (uOption = 0; uOption < LIMIT_COUNT; uOption++)
+      if (oSettings->aiHas[uOption] &&
+          (setrlimit(asOptions[uOption].iResource,
+                     &oSettings->asLimits[uOption]) == -1))
+         return -1;
+   return 0;
+}
+
+/* if pcCommand, run with oSettings, died of one of its limits, as its
+   wait status iStatus and its usage psUsage show, say so on stderr */
+void Limit_report(LimitSettings_T oSettings, const char *pcCommand,
+                  int iStatus, const struct rusage *psUsage)
+{
+   const struct rlimit *psLimit;
+   size_t uOption;
+   int iSignal;
+   int iHit;
+
+   assert(oSettings != NULL);
+   assert(pcCommand != NULL);
+   assert(psUsage != NULL);
+
+   if (! WIFSIGNALED(iStatus))
+      return;
+   iSignal = WTERMSIG(iStatus);
+   for (uOption = 0; uOption < LIMIT_COUNT; uOption++)
+   {
+      if (! oSettings->aiHas[uOption])
+         continue;
+      psLimit = &oSettings->asLimits[uOption];
+      switch (asOptions[uOption].iResource)
+      {
+         case RLIMIT_CPU:
+            /* past the hard limit, the signal is SIGKILL, which
+               anything else may have sent as well. the kernel's count
+               of CPU time runs a little ahead of what rusage reports,
+               so a command that used up its soft limit is taken to
+               have run on to the hard one */
+            iHit = (iSignal == SIGXCPU) ||
+                   ((iSignal == SIGKILL) &&
+                    (psLimit->rlim_cur != RLIM_INFINITY) &&
+                    (limit_getCpuSeconds(psUsage) >= psLimit->rlim_cur));
+            break;
+         case RLIMIT_FSIZE:
+            iHit = iSignal == SIGXFSZ;
+            break;
+         default:
+            iHit = FALSE;
+            break;
+      }
+      if (iHit)
+      {
+         fprintf(stderr, "%s: limit: %s: %s limit exceeded\n",
+                 getPgmName(), pcCommand, asOptions[uOption].pcName);
+         return;
+      }
+   }
+}
+
+/* free oSettings */
+void Limit_freeSettings(LimitSettings_T oSettings)
+{
+   Mem_free(oSettings);
+}
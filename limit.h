@@ -0,0 +1,46 @@
+/*--------------------------------------------------------------------*/
+/* limit.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef LIMIT_INCLUDED
+#define LIMIT_INCLUDED
+
+#include "dynarray.h"
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* LimitSettings_T is a pointer to what a limit prefix (see prefix.h)
+   gives:
+      limit [-t seconds] [-v size] [-d size] [-s size] [-f size]
+            [-c size] [-n files] [-u processes] [cmd [args]]
+   cmd runs with its CPU time, address space, data, stack, file size,
+   core file size, open files and processes limited, each set with
+   setrlimit. a size is bytes, optionally suffixed with k, m or g, and
+   any value may be "unlimited". a limit can't be raised above the
+   shell's own hard limit */
+typedef struct LimitSettings *LimitSettings_T;
+
+/* parse the limit prefix whose name is token *puIndex of oTokens, and
+   move *puIndex to the token after its options. return its settings,
+   or NULL after writing a message to stderr if they are malformed.
+   the caller owns the settings */
+LimitSettings_T Limit_parse(DynArray_T oTokens, size_t *puIndex);
+
+/* set the limits of the calling process, the shell or a child about to
+   exec, as oSettings says. return 0 if successful, or -1 with errno
+   set otherwise */
+int Limit_apply(LimitSettings_T oSettings);
+
+/* if pcCommand, run with oSettings, was killed by one of its limits,
+   as its wait status iStatus and its resource usage psUsage show, say
+   which on stderr. a SIGKILL is only put down to the CPU time limit if
+   pcCommand had used that much CPU time */
+void Limit_report(LimitSettings_T oSettings, const char *pcCommand,
+                  int iStatus, const struct rusage *psUsage);
+
+/* free oSettings */
+void Limit_freeSettings(LimitSettings_T oSettings);
+
+#endif
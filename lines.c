@@ -0,0 +1,143 @@
+/*--------------------------------------------------------------------
+  lines.c
+  Author: Nate Wilson
+  Description: a script file mapped into memory and taken a line at a
+  time. reading a script through stdio copies each char into a
+  buffer, then into a line grown as it goes, before the lexer copies
+  it again. mapped, a line is a span of the file that the lexer reads
+  where it lies. the mapping is one byte longer than the file, that
+  byte being left as zeroed memory, so that every line is followed by a
+  newline or a '\0' that can be read
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "lines.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* the mapped file */
+struct Lines
+{
+   /* the mapping, NULL for an empty file, and how long it is */
+   char *pcMap;
+   size_t uMapLength;
+   /* the file's length, and where the next line starts */
+   size_t uLength;
+   size_t uNext;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* map the file open on iFd */
+Lines_T Lines_new(int iFd)
+{
+   struct Lines *psLines;
+   struct stat sStat;
+   void *pvMap;
+
+   if (fstat(iFd, &sStat) == -1)
+      return NULL;
+   if (! S_ISREG(sStat.st_mode))
+   {
+      errno = EINVAL;
+      return NULL;
+   }
+   psLines = (struct Lines*)Mem_tryCalloc(MEM_SHELL, 1,
+                                          sizeof(*psLines));
+   if (psLines == NULL)
+   {
+      errno = ENOMEM;
+      return NULL;
+   }
+   psLines->uLength = (size_t)sStat.st_size;
+   if (psLines->uLength == 0)
+      return psLines;
+
+   /* zeroed memory a byte longer than the file, with the file mapped
+      over the start of it */
+   psLines->uMapLength = psLines->uLength + 1;
+   pvMap = mmap(NULL, psLines->uMapLength, PROT_READ,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (pvMap == MAP_FAILED)
+   {
+      Mem_free(psLines);
+      return NULL;
+   }
+   if (mmap(pvMap, psLines->uLength, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+            iFd, 0) == MAP_FAILED)
+   {
+      (void)munmap(pvMap, psLines->uMapLength);
+      Mem_free(psLines);
+      return NULL;
+   }
+   /* read front to back, so the kernel can read ahead and drop
+      behind */
+   (void)madvise(pvMap, psLines->uLength, MADV_SEQUENTIAL);
+   psLines->pcMap = (char*)pvMap;
+   return psLines;
+}
+
+/* return the next line and its length */
+const char *Lines_next(Lines_T oLines, size_t *puLength)
+{
+   const char *pcLine;
+   const char *pcEnd;
+
+   assert(oLines != NULL);
+   assert(puLength != NULL);
+
+   if (oLines->uNext >= oLines->uLength)
+      return NULL;
+   pcLine = oLines->pcMap + oLines->uNext;
+   pcEnd = (const char*)memchr(pcLine, '\n',
+                               oLines->uLength - oLines->uNext);
+   if (pcEnd == NULL) /* the last line has no newline */
+      pcEnd = oLines->pcMap + oLines->uLength;
+   *puLength = (size_t)(pcEnd - pcLine);
+   oLines->uNext += *puLength + 1;
+   return pcLine;
+}
+
+/* return a copy of the next line */
+char *Lines_readLine(void *pvLines)
+{
+   const char *pcLine;
+   char *pcCopy;
+   size_t uLength;
+
+   assert(pvLines != NULL);
+
+   pcLine = Lines_next((Lines_T)pvLines, &uLength);
+   if (pcLine == NULL)
+      return NULL;
+   pcCopy = (char*)Mem_alloc(MEM_LEX, uLength + 1);
+   memcpy(pcCopy, pcLine, uLength);
+   pcCopy[uLength] = '\0';
+   return pcCopy;
+}
+
+/* is the end of the file next? */
+int Lines_isAtEnd(Lines_T oLines)
+{
+   assert(oLines != NULL);
+
+   return oLines->uNext >= oLines->uLength;
+}
+
+/* unmap and free oLines */
+void Lines_free(Lines_T oLines)
+{
+   assert(oLines != NULL);
+
+   if (oLines->pcMap != NULL)
+      (void)munmap(oLines->pcMap, oLines->uMapLength);
+   Mem_free(oLines);
+}
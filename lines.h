@@ -0,0 +1,37 @@
+/*--------------------------------------------------------------------*/
+/* lines.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef LINES_INCLUDED
+#define LINES_INCLUDED
+
+#include <stddef.h>
+
+/* Lines_T is a pointer to a script file mapped into memory, whose
+   lines are taken one at a time where they lie, rather than copied out
+   of it a char at a time */
+typedef struct Lines *Lines_T;
+
+/* map the file open on iFd, from its start, and return it, or NULL
+   with errno set if it isn't a regular file or can't be mapped */
+Lines_T Lines_new(int iFd);
+
+/* return the next line, without its newline, and store its length in
+   *puLength, or return NULL at the end of the file. the line stays
+   the mapping's, isn't followed by a '\0', but is followed by a
+   readable '\0' or newline */
+const char *Lines_next(Lines_T oLines, size_t *puLength);
+
+/* return a copy of the next line, which the caller owns, or NULL at
+   the end of the file. pvLines is the lines, so that this can be given
+   to lex_readHereBodyWith */
+char *Lines_readLine(void *pvLines);
+
+/* is the end of the file next? return 1 if true */
+int Lines_isAtEnd(Lines_T oLines);
+
+/* unmap and free oLines */
+void Lines_free(Lines_T oLines);
+
+#endif
@@ -0,0 +1,327 @@
+/*--------------------------------------------------------------------
+  mem.c
+  Author: Nate Wilson
+  Description: the allocation layer every module goes through. each
+  block carries a small header holding its size and the subsystem that
+  allocated it, so the counts below stay right whoever frees it. the
+  counts are updated atomically, so that threads can allocate too,
+  with no lock for a fork to find held
+  --------------------------------------------------------------------*/
+
+#include "mem.h"
+#include "ish.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* what comes before each block. the union keeps the block after it
+   aligned for anything */
+union MemHeader
+{
+   struct
+   {
+      size_t uSize;
+      enum MemTag eTag;
+   } sInfo;
+   long lAlign;
+   double dAlign;
+   void *pvAlign;
+};
+
+/* one subsystem's counts */
+struct MemStats
+{
+   unsigned long ulAllocs;
+   unsigned long ulFrees;
+   unsigned long ulReallocs;
+   /* bytes copied by reallocs that had to move their block */
+   unsigned long ulMovedBytes;
+   /* bytes allocated in all, in use now, and in use at most */
+   unsigned long ulTotalBytes;
+   size_t uBytes;
+   size_t uPeakBytes;
+};
+
+/* the names the stats are written under, in enum MemTag order */
+static const char *apcMemNames[MEM_TAG_COUNT] =
+   {"token", "lex", "command", "dynarray", "redirect", "tee", "event",
+    "builtin", "server", "script", "var", "glob", "cache", "intern",
+    "path", "parallel", "shell"};
+
+static struct MemStats asMemStats[MEM_TAG_COUNT];
+
+/* bytes in use by every subsystem together, now and at most */
+static size_t uMemBytes;
+static size_t uMemPeakBytes;
+
+/* add ulCount to the count *pulCount */
+static void mem_count(unsigned long *pulCount, unsigned long ulCount)
+{
+   (void)__atomic_add_fetch(pulCount, ulCount, __ATOMIC_RELAXED);
+}
+
+/* raise the peak *puPeak to uBytes, unless it is higher already */
+static void mem_raisePeak(size_t *puPeak, size_t uBytes)
+{
+   size_t uPeak;
+
+   uPeak = __atomic_load_n(puPeak, __ATOMIC_RELAXED);
+   while ((uBytes > uPeak) &&
+          ! __atomic_compare_exchange_n(puPeak, &uPeak, uBytes, 1,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+      ;
+}
+
+/* count uSize more bytes in use by eTag */
+static void mem_addBytes(enum MemTag eTag, size_t uSize)
+{
+   struct MemStats *psStats = &asMemStats[eTag];
+
+   mem_raisePeak(&psStats->uPeakBytes,
+                 __atomic_add_fetch(&psStats->uBytes, uSize,
+                                    __ATOMIC_RELAXED));
+   mem_raisePeak(&uMemPeakBytes,
+                 __atomic_add_fetch(&uMemBytes, uSize,
+                                    __ATOMIC_RELAXED));
+}
+
+/* count uSize fewer bytes in use by eTag */
+static void mem_removeBytes(enum MemTag eTag, size_t uSize)
+{
+   (void)__atomic_sub_fetch(&asMemStats[eTag].uBytes, uSize,
+                            __ATOMIC_RELAXED);
+   (void)__atomic_sub_fetch(&uMemBytes, uSize, __ATOMIC_RELAXED);
+}
+
+/* what is called first when memory runs out, if not NULL */
+static void (*pfMemFail)(void);
+
+/* what returns the calling thread's undo stack, if not NULL */
+static struct MemUndo **(*pfMemGetUndoStack)(void);
+
+/* return the calling thread's undo stack, or NULL if undos aren't
+   kept */
+static struct MemUndo **mem_getUndoStack(void)
+{
+   if (pfMemGetUndoStack == NULL)
+      return NULL;
+   return (*pfMemGetUndoStack)();
+}
+
+/*--------------------------------------------------------------------*/
+
+/* have memory running out call pfFail first */
+void Mem_setFailHandler(void (*pfFail)(void))
+{
+   pfMemFail = pfFail;
+}
+
+/* keep undos on the stacks pfGetStack returns */
+void Mem_setUndoStack(struct MemUndo **(*pfGetStack)(void))
+{
+   pfMemGetUndoStack = pfGetStack;
+}
+
+/* push psUndo onto the calling thread's stack */
+void Mem_pushUndo(struct MemUndo *psUndo, void (*pfUndo)(void *pvExtra),
+                  void *pvExtra)
+{
+   struct MemUndo **ppsStack;
+
+   assert(psUndo != NULL);
+   assert(pfUndo != NULL);
+
+   psUndo->pfUndo = pfUndo;
+   psUndo->pvExtra = pvExtra;
+   psUndo->psOuter = NULL;
+   ppsStack = mem_getUndoStack();
+   if (ppsStack == NULL)
+      return;
+   psUndo->psOuter = *ppsStack;
+   *ppsStack = psUndo;
+}
+
+/* pop psUndo off the calling thread's stack */
+void Mem_popUndo(struct MemUndo *psUndo)
+{
+   struct MemUndo **ppsStack;
+
+   assert(psUndo != NULL);
+
+   ppsStack = mem_getUndoStack();
+   /* not there if it was pushed while undos weren't kept */
+   if ((ppsStack != NULL) && (*ppsStack == psUndo))
+      *ppsStack = psUndo->psOuter;
+}
+
+/* undo what the calling thread was building, call the handler, then
+   write a message and exit */
+void Mem_fail(void)
+{
+   struct MemUndo **ppsStack;
+   struct MemUndo *psUndo;
+
+   ppsStack = mem_getUndoStack();
+   if (ppsStack != NULL)
+      /* innermost first, each popped before it runs */
+      while (*ppsStack != NULL)
+      {
+         psUndo = *ppsStack;
+         *ppsStack = psUndo->psOuter;
+         (*psUndo->pfUndo)(psUndo->pvExtra);
+      }
+   if (pfMemFail != NULL)
+      (*pfMemFail)();
+   perror(getPgmName());
+   exit(EXIT_FAILURE);
+}
+
+/* allocate uSize bytes for eTag, or return NULL */
+void *Mem_tryAlloc(enum MemTag eTag, size_t uSize)
+{
+   union MemHeader *puHeader;
+
+   assert((int)eTag >= 0 && eTag < MEM_TAG_COUNT);
+
+   if (uSize > (size_t)-1 - sizeof(union MemHeader))
+      return NULL;
+   puHeader = (union MemHeader*)malloc(sizeof(union MemHeader) + uSize);
+   if (puHeader == NULL)
+      return NULL;
+   puHeader->sInfo.uSize = uSize;
+   puHeader->sInfo.eTag = eTag;
+   mem_count(&asMemStats[eTag].ulAllocs, 1);
+   mem_count(&asMemStats[eTag].ulTotalBytes, (unsigned long)uSize);
+   mem_addBytes(eTag, uSize);
+   return puHeader + 1;
+}
+
+/* allocate uCount zeroed elements of uSize bytes for eTag, or return
+   NULL */
+void *Mem_tryCalloc(enum MemTag eTag, size_t uCount, size_t uSize)
+{
+   void *pvBlock;
+
+   if ((uSize != 0) && (uCount > (size_t)-1 / uSize))
+      return NULL;
+   pvBlock = Mem_tryAlloc(eTag, uCount * uSize);
+   if (pvBlock != NULL)
+      memset(pvBlock, 0, uCount * uSize);
+   return pvBlock;
+}
+
+/* resize pvBlock to uSize bytes, or return NULL */
+void *Mem_tryRealloc(enum MemTag eTag, void *pvBlock, size_t uSize)
+{
+   union MemHeader *puHeader;
+   union MemHeader *puNewHeader;
+   size_t uOldSize;
+
+   if (pvBlock == NULL)
+      return Mem_tryAlloc(eTag, uSize);
+   if (uSize > (size_t)-1 - sizeof(union MemHeader))
+      return NULL;
+
+   puHeader = (union MemHeader*)pvBlock - 1;
+   uOldSize = puHeader->sInfo.uSize;
+   eTag = puHeader->sInfo.eTag;
+   puNewHeader = (union MemHeader*)realloc(puHeader,
+                                           sizeof(union MemHeader) +
+                                           uSize);
+   if (puNewHeader == NULL)
+      return NULL;
+   puNewHeader->sInfo.uSize = uSize;
+   mem_count(&asMemStats[eTag].ulReallocs, 1);
+   if (puNewHeader != puHeader)
+      mem_count(&asMemStats[eTag].ulMovedBytes,
+                (unsigned long)(uOldSize < uSize ? uOldSize : uSize));
+   /* only growth counts as newly allocated */
+   if (uSize > uOldSize)
+      mem_count(&asMemStats[eTag].ulTotalBytes,
+                (unsigned long)(uSize - uOldSize));
+   mem_removeBytes(eTag, uOldSize);
+   mem_addBytes(eTag, uSize);
+   return puNewHeader + 1;
+}
+
+/* allocate uSize bytes for eTag, exiting if there isn't enough */
+void *Mem_alloc(enum MemTag eTag, size_t uSize)
+{
+   void *pvBlock;
+
+   pvBlock = Mem_tryAlloc(eTag, uSize);
+   if (pvBlock == NULL)
+      Mem_fail();
+   return pvBlock;
+}
+
+/* allocate uCount zeroed elements of uSize bytes for eTag, exiting if
+   there isn't enough memory */
+void *Mem_calloc(enum MemTag eTag, size_t uCount, size_t uSize)
+{
+   void *pvBlock;
+
+   pvBlock = Mem_tryCalloc(eTag, uCount, uSize);
+   if (pvBlock == NULL)
+      Mem_fail();
+   return pvBlock;
+}
+
+/* resize pvBlock to uSize bytes, exiting if there isn't enough
+   memory */
+void *Mem_realloc(enum MemTag eTag, void *pvBlock, size_t uSize)
+{
+   pvBlock = Mem_tryRealloc(eTag, pvBlock, uSize);
+   if (pvBlock == NULL)
+      Mem_fail();
+   return pvBlock;
+}
+
+/* free pvBlock */
+void Mem_free(void *pvBlock)
+{
+   union MemHeader *puHeader;
+
+   if (pvBlock == NULL)
+      return;
+   puHeader = (union MemHeader*)pvBlock - 1;
+   mem_count(&asMemStats[puHeader->sInfo.eTag].ulFrees, 1);
+   mem_removeBytes(puHeader->sInfo.eTag, puHeader->sInfo.uSize);
+   free(puHeader);
+}
+
+/* write each subsystem's counts to psFile */
+void Mem_writeStats(FILE *psFile)
+{
+   struct MemStats sTotal;
+   struct MemStats *psStats;
+   int iTag;
+
+   assert(psFile != NULL);
+
+   memset(&sTotal, 0, sizeof(sTotal));
+   fprintf(psFile, "%-10s %9s %9s %9s %11s %11s %11s %11s\n",
+           "subsystem", "allocs", "frees", "reallocs", "moved", "total",
+           "bytes", "peak");
+   for (iTag = 0; iTag < MEM_TAG_COUNT; iTag++)
+   {
+      psStats = &asMemStats[iTag];
+      fprintf(psFile, "%-10s %9lu %9lu %9lu %11lu %11lu %11lu %11lu\n",
+              apcMemNames[iTag], psStats->ulAllocs, psStats->ulFrees,
+              psStats->ulReallocs, psStats->ulMovedBytes,
+              psStats->ulTotalBytes, (unsigned long)psStats->uBytes,
+              (unsigned long)psStats->uPeakBytes);
+      sTotal.ulAllocs += psStats->ulAllocs;
+      sTotal.ulFrees += psStats->ulFrees;
+      sTotal.ulReallocs += psStats->ulReallocs;
+      sTotal.ulMovedBytes += psStats->ulMovedBytes;
+      sTotal.ulTotalBytes += psStats->ulTotalBytes;
+   }
+   /* the peak of the sum isn't the sum of the peaks */
+   fprintf(psFile, "%-10s %9lu %9lu %9lu %11lu %11lu %11lu %11lu\n",
+           "all", sTotal.ulAllocs, sTotal.ulFrees, sTotal.ulReallocs,
+           sTotal.ulMovedBytes, sTotal.ulTotalBytes,
+           (unsigned long)uMemBytes, (unsigned long)uMemPeakBytes);
+}
@@ -0,0 +1,86 @@
+/*--------------------------------------------------------------------*/
+/* mem.h                                                              */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef MEM_INCLUDED
+#define MEM_INCLUDED
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* the subsystems that allocate, each of which gets its own counts. a
+   block is counted against the subsystem that allocated it, whichever
+   one frees it */
+enum MemTag {MEM_TOKEN, MEM_LEX, MEM_COMMAND, MEM_DYNARRAY,
+             MEM_REDIRECT, MEM_TEE, MEM_EVENT, MEM_BUILTIN, MEM_SERVER,
+             MEM_SCRIPT, MEM_VAR, MEM_GLOB, MEM_CACHE, MEM_INTERN,
+             MEM_PATH, MEM_PARALLEL, MEM_SHELL,
+             MEM_TAG_COUNT};
+
+/* allocate and return uSize bytes for subsystem eTag. write a message
+   and exit if there isn't enough memory */
+void *Mem_alloc(enum MemTag eTag, size_t uSize);
+
+/* allocate and return uCount zeroed elements of uSize bytes each for
+   subsystem eTag. write a message and exit if there isn't enough
+   memory */
+void *Mem_calloc(enum MemTag eTag, size_t uCount, size_t uSize);
+
+/* resize pvBlock, which came from this module or is NULL, to uSize
+   bytes and return it. a NULL pvBlock is allocated for eTag, anything
+   else stays with the subsystem that allocated it. write a message and
+   exit if there isn't enough memory */
+void *Mem_realloc(enum MemTag eTag, void *pvBlock, size_t uSize);
+
+/* like Mem_alloc, Mem_calloc and Mem_realloc, but return NULL if there
+   isn't enough memory, leaving pvBlock as it was */
+void *Mem_tryAlloc(enum MemTag eTag, size_t uSize);
+void *Mem_tryCalloc(enum MemTag eTag, size_t uCount, size_t uSize);
+void *Mem_tryRealloc(enum MemTag eTag, void *pvBlock, size_t uSize);
+
+/* report that memory ran out: run the calling thread's undos (see
+   Mem_pushUndo), call the handler Mem_setFailHandler set, if any,
+   which needn't return, then write a message and exit.
+   the allocators above call this, as does code whose own allocation
+   through them fails */
+void Mem_fail(void);
+
+/* have Mem_fail call (*pfFail)() first, or nothing if pfFail is
+   NULL. a handler that doesn't return (by longjmp) lets a caller
+   recover from running out of memory, losing what it had allocated
+   but not pushed an undo for */
+void Mem_setFailHandler(void (*pfFail)(void));
+
+/* something a caller has built part of, which Mem_fail undoes before
+   calling the handler, so that a handler that doesn't return loses
+   nothing. the caller owns the struct, which lasts until popped */
+struct MemUndo
+{
+   void (*pfUndo)(void *pvExtra);
+   void *pvExtra;
+   struct MemUndo *psOuter;
+};
+
+/* have the undos pushed below be kept on the stack (*pfGetStack)()
+   returns, the calling thread's, or not kept at all if it returns NULL
+   or pfGetStack is NULL, as when running out of memory just exits */
+void Mem_setUndoStack(struct MemUndo **(*pfGetStack)(void));
+
+/* push psUndo, so that Mem_fail calls (*pfUndo)(pvExtra) if memory
+   runs out before it is popped */
+void Mem_pushUndo(struct MemUndo *psUndo, void (*pfUndo)(void *pvExtra),
+                  void *pvExtra);
+
+/* pop psUndo, the last pushed, once what it undoes is complete or
+   handed over */
+void Mem_popUndo(struct MemUndo *psUndo);
+
+/* free pvBlock, which came from this module or is NULL */
+void Mem_free(void *pvBlock);
+
+/* write a table of each subsystem's allocation counts, live bytes,
+   peak bytes and realloc churn to psFile */
+void Mem_writeStats(FILE *psFile);
+
+#endif
@@ -0,0 +1,701 @@
+/*--------------------------------------------------------------------
+  parallel.c
+  Author: Nate Wilson
+  Description: runs a script's commands ahead of their turn when they
+  are known to touch only the files their redirections and arguments
+  name, and those files show they can't affect one another. the
+  commands started form a queue in script order, so that held output
+  is written, and exit statuses recorded, as if they had run one at a
+  time
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include "token.h"
+#include "command.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "redirect.h"
+#include "event.h"
+#include "mem.h"
+#include "var.h"
+#include "path.h"
+#include "spawn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* the names that stand for the shell's stdin, stdout and stderr among
+   the files a command touches. no file name made absolute starts
+   without a '/', so they can't clash with one */
+static const char *apcShellFds[3] = {"stdin", "stdout", "stderr"};
+
+/* the length getcwd is first given */
+enum {PARALLEL_DIR_LENGTH = 256};
+
+/* the commands that may run ahead of their turn, in strcmp order for
+   bsearch. each touches no file but those its arguments name, and the
+   shell's stdin, stdout and stderr. a command that may read or write
+   anything else, a script say, or ls, which reads "." unless told
+   otherwise, can't be shown not to affect the commands around it */
+static const char *apcParallelKnown[] =
+   {"basename", "cat", "cksum", "cmp", "comm", "cp", "cut", "date",
+    "diff", "dirname", "echo", "expand", "expr", "false", "fold",
+    "head", "join", "ln", "md5sum", "mkdir", "mv", "nl", "od", "paste",
+    "printf", "rm", "rmdir", "seq", "sha1sum", "sha256sum", "sleep",
+    "sort", "tac", "tail", "tee", "touch", "tr", "true", "uniq", "wc"};
+
+/* one command started, in script order */
+struct ParallelJob
+{
+   /* the scheduler it belongs to */
+   struct Parallel *psParallel;
+   pid_t iPid;
+   RedirectPlan_T oPlan;
+   /* the files it may read, and may write, as absolute paths without
+      "." or ".." */
+   DynArray_T oReads;
+   DynArray_T oWrites;
+   /* is its stdout (stderr) to be held, and the memfd it is held in,
+      or -1 */
+   int aiHold[2];
+   int aiHeld[2];
+   /* has it exited, and its exit status, as $? has it, if so */
+   int iExited;
+   int iStatus;
+   /* which of the spread's groups of CPUs it runs on */
+   size_t uSlot;
+   struct ParallelJob *psNext;
+};
+
+/* the scheduler */
+struct Parallel
+{
+   Event_T oEvent;
+   /* the groups of CPUs commands are spread across, or NULL */
+   ScheduleSpread_T oSpread;
+   /* how many commands may run at once, and how many are running */
+   size_t uJobs;
+   size_t uRunning;
+   /* the commands started whose output isn't written yet, oldest
+      first */
+   struct ParallelJob *psFirst;
+   struct ParallelJob *psLast;
+   /* is the shell's stdout (stderr) held, not being a terminal? */
+   int aiHold[2];
+   /* is the shell's stdin data that commands would take in turn,
+      rather than a terminal or a device like /dev/null? */
+   int iSharedStdin;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* return a copy of pcValue, which the caller owns */
+static char *parallel_copy(const char *pcValue)
+{
+   char *pcCopy;
+
+   pcCopy = (char*)Mem_alloc(MEM_PARALLEL, strlen(pcValue) + 1);
+   return strcpy(pcCopy, pcValue);
+}
+
+/* return the working directory, which the caller owns, or NULL with
+   errno set */
+static char *parallel_getDir(void)
+{
+   char *pcDir;
+   size_t uLength;
+
+   uLength = PARALLEL_DIR_LENGTH;
+   pcDir = (char*)Mem_alloc(MEM_PARALLEL, uLength);
+   while (getcwd(pcDir, uLength) == NULL)
+   {
+      if (errno != ERANGE)
+      {
+         Mem_free(pcDir);
+         return NULL;
+      }
+      uLength *= 2;
+      pcDir = (char*)Mem_realloc(MEM_PARALLEL, pcDir, uLength);
+   }
+   return pcDir;
+}
+
+/* return pcName made absolute against the directory pcDir, with its
+   "." and ".." components and repeated '/'s taken out, which the
+   caller owns. symbolic links are left as they are */
+static char *parallel_resolve(const char *pcDir, const char *pcName)
+{
+   char *pcPath;
+   char *pcOut;
+   const char *pcIn;
+   size_t uLength;
+
+   pcPath = (char*)Mem_alloc(MEM_PARALLEL,
+                             strlen(pcDir) + strlen(pcName) + 2);
+   if (*pcName == '/')
+      strcpy(pcPath, pcName);
+   else
+      sprintf(pcPath, "%s/%s", pcDir, pcName);
+
+   /* each component written takes no more room than it was read
+      from, so the path is rewritten in place */
+   pcOut = pcPath;
+   pcIn = pcPath;
+   for (;;)
+   {
+      while (*pcIn == '/')
+         pcIn++;
+      uLength = strcspn(pcIn, "/");
+      if (uLength == 0)
+         break;
+      if ((uLength == 2) && (strncmp(pcIn, "..", 2) == 0))
+         while ((pcOut > pcPath) && (*--pcOut != '/'))
+            ;
+      else if ((uLength != 1) || (*pcIn != '.'))
+      {
+         *pcOut++ = '/';
+         memmove(pcOut, pcIn, uLength);
+         pcOut += uLength;
+      }
+      pcIn += uLength;
+   }
+   if (pcOut == pcPath)
+      *pcOut++ = '/';
+   *pcOut = '\0';
+   return pcPath;
+}
+
+/* compare the name pvKey with the name pvName points to, for
+   bsearch */
+static int parallel_compareName(const void *pvKey, const void *pvName)
+{
+   return strcmp((const char*)pvKey, *(const char * const *)pvName);
+}
+
+/* is pcName a command that may run ahead of its turn? */
+static int parallel_isKnown(const char *pcName)
+{
+   return bsearch(pcName, apcParallelKnown,
+                  sizeof(apcParallelKnown) / sizeof(apcParallelKnown[0]),
+                  sizeof(apcParallelKnown[0]), parallel_compareName)
+      != NULL;
+}
+
+/* add pcName, which oArray takes, to oArray. exit if there isn't
+   enough memory */
+static void parallel_add(DynArray_T oArray, char *pcName)
+{
+   if (! DynArray_add(oArray, pcName))
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+}
+
+/* is pcPath the file pcDir, or inside the directory pcDir? */
+static int parallel_isWithin(const char *pcPath, const char *pcDir)
+{
+   size_t uLength;
+
+   uLength = strlen(pcDir);
+   if (strncmp(pcPath, pcDir, uLength) != 0)
+      return FALSE;
+   return (pcPath[uLength] == '\0') || (pcPath[uLength] == '/') ||
+      (pcDir[uLength - 1] == '/');
+}
+
+/* does a file in oWrites overlap one in oFiles? */
+static int parallel_overlap(DynArray_T oWrites, DynArray_T oFiles)
+{
+   const char *pcWrite;
+   const char *pcFile;
+   size_t uWrite;
+   size_t uFile;
+
+   for (uWrite = 0; uWrite < DynArray_getLength(oWrites); uWrite++)
+   {
+      pcWrite = (const char*)DynArray_get(oWrites, uWrite);
+      for (uFile = 0; uFile < DynArray_getLength(oFiles); uFile++)
+      {
+         pcFile = (const char*)DynArray_get(oFiles, uFile);
+         if (parallel_isWithin(pcWrite, pcFile) ||
+             parallel_isWithin(pcFile, pcWrite))
+            return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+/* must psJob wait for a command still running? */
+static int parallel_isBlocked(struct Parallel *psParallel,
+                              struct ParallelJob *psJob)
+{
+   struct ParallelJob *psOther;
+
+   for (psOther = psParallel->psFirst; psOther != NULL;
+        psOther = psOther->psNext)
+      if ((! psOther->iExited) &&
+          (parallel_overlap(psJob->oWrites, psOther->oReads) ||
+           parallel_overlap(psJob->oWrites, psOther->oWrites) ||
+           parallel_overlap(psOther->oWrites, psJob->oReads)))
+         return TRUE;
+   return FALSE;
+}
+
+/* does a command with redirections oRedirects use the shell's own
+   fd iFd, either by leaving it alone or by copying it? */
+static int parallel_usesShellFd(DynArray_T oRedirects, int iFd)
+{
+   Redirect_T oRedirect;
+   int iUsed = TRUE;
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      if (Redirect_getFd(oRedirect) == iFd)
+         iUsed = FALSE;
+   }
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      if ((Redirect_getType(oRedirect) == REDIRECT_DUP) &&
+          (Redirect_getSourceFd(oRedirect) == iFd))
+         iUsed = TRUE;
+   }
+   return iUsed;
+}
+
+/* free psJob, which has no plan or held output left */
+static void parallel_freeJob(struct ParallelJob *psJob)
+{
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < DynArray_getLength(psJob->oReads); uIndex++)
+      Mem_free(DynArray_get(psJob->oReads, uIndex));
+   for (uIndex = 0; uIndex < DynArray_getLength(psJob->oWrites);
+        uIndex++)
+      Mem_free(DynArray_get(psJob->oWrites, uIndex));
+   DynArray_free(psJob->oReads);
+   DynArray_free(psJob->oWrites);
+   Mem_free(psJob);
+}
+
+/* return a job for oCommand, not started, with the files it touches
+   resolved against the directory pcDir */
+static struct ParallelJob *parallel_newJob(struct Parallel *psParallel,
+                                           Command_T oCommand,
+                                           const char *pcDir)
+{
+   struct ParallelJob *psJob;
+   DynArray_T oTokens;
+   DynArray_T oRedirects;
+   Redirect_T oRedirect;
+   const char *pcValue;
+   const char *pcFile;
+   size_t uIndex;
+   int iFd;
+
+   psJob = (struct ParallelJob*)Mem_calloc(MEM_PARALLEL, 1,
+                                           sizeof(*psJob));
+   psJob->psParallel = psParallel;
+   psJob->aiHeld[0] = -1;
+   psJob->aiHeld[1] = -1;
+   psJob->oReads = DynArray_new(0);
+   psJob->oWrites = DynArray_new(0);
+   if ((psJob->oReads == NULL) || (psJob->oWrites == NULL))
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+
+   oRedirects = Command_getRedirects(oCommand);
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      switch (Redirect_getType(oRedirect))
+      {
+         case REDIRECT_INPUT:
+            parallel_add(psJob->oReads, parallel_resolve(pcDir,
+               Redirect_getWord(oRedirect)));
+            break;
+         case REDIRECT_OUTPUT:
+         case REDIRECT_APPEND:
+            parallel_add(psJob->oWrites, parallel_resolve(pcDir,
+               Redirect_getWord(oRedirect)));
+            break;
+         default:
+            break;
+      }
+   }
+
+   /* any argument may be a file the command writes. so may what
+      follows an option's letter or its '=', as in -ofile or
+      --output=file */
+   oTokens = Command_getTokens(oCommand);
+   for (uIndex = 1; uIndex < DynArray_getLength(oTokens); uIndex++)
+   {
+      pcValue = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (*pcValue != '-')
+         pcFile = pcValue;
+      else if (pcValue[1] == '-')
+      {
+         pcFile = strchr(pcValue, '=');
+         if (pcFile != NULL)
+            pcFile++;
+      }
+      else if (pcValue[1] != '\0')
+         pcFile = pcValue + 2;
+      else /* "-", stdin */
+         pcFile = NULL;
+      if ((pcFile != NULL) && (*pcFile != '\0'))
+         parallel_add(psJob->oWrites, parallel_resolve(pcDir, pcFile));
+   }
+
+   /* held output needs no turn, but a terminal or stdin does */
+   for (iFd = 0; iFd < 3; iFd++)
+   {
+      if (! parallel_usesShellFd(oRedirects, iFd))
+         continue;
+      if ((iFd > 0) && psParallel->aiHold[iFd - 1])
+         psJob->aiHold[iFd - 1] = TRUE;
+      else if ((iFd > 0) || psParallel->iSharedStdin)
+         parallel_add(psJob->oWrites, parallel_copy(apcShellFds[iFd]));
+   }
+   return psJob;
+}
+
+/* write the output held in iHeld, if not -1, to the shell's fd iFd and
+   close it */
+static void parallel_writeHeld(int iHeld, int iFd)
+{
+   enum {COPY_CHUNK = 65536};
+   char acChunk[COPY_CHUNK];
+   struct stat sStat;
+   off_t iOffset = 0;
+   ssize_t iRead;
+   ssize_t iDone;
+   ssize_t iWritten;
+
+   if (iHeld == -1)
+      return;
+   /* a failed write is dropped, as the command's own would have
+      been */
+   if (fstat(iHeld, &sStat) == 0)
+      while (iOffset < sStat.st_size)
+      {
+         iWritten = sendfile(iFd, iHeld, &iOffset,
+                             (size_t)(sStat.st_size - iOffset));
+         if (iWritten > 0)
+            continue;
+         if ((iWritten == 0) || (errno != EINVAL))
+            break;
+         /* sendfile can't write to every file, one opened to append
+            among them, so the rest is copied through a buffer */
+         while ((iRead = pread(iHeld, acChunk, sizeof(acChunk),
+                               iOffset)) > 0)
+         {  /* a write may take only part of the chunk */
+            for (iDone = 0; iDone < iRead; iDone += iWritten)
+            {
+               iWritten = write(iFd, acChunk + iDone,
+                                (size_t)(iRead - iDone));
+               if (iWritten == -1)
+                  break;
+            }
+            if (iDone < iRead)
+               break;
+            iOffset += iRead;
+         }
+         break;
+      }
+   (void)close(iHeld);
+}
+
+/* finish the oldest commands for as long as they have exited: write
+   their held output and record their exit status as $? */
+static void parallel_finish(struct Parallel *psParallel)
+{
+   struct ParallelJob *psJob;
+
+   while ((psParallel->psFirst != NULL) &&
+          psParallel->psFirst->iExited)
+   {
+      psJob = psParallel->psFirst;
+      psParallel->psFirst = psJob->psNext;
+      if (psParallel->psFirst == NULL)
+         psParallel->psLast = NULL;
+      if (psJob->oPlan != NULL)
+         Redirect_freePlan(psJob->oPlan);
+      if (fflush(stdout) == EOF)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+      parallel_writeHeld(psJob->aiHeld[0], 1);
+      parallel_writeHeld(psJob->aiHeld[1], 2);
+      Var_setStatus(psJob->iStatus);
+      parallel_freeJob(psJob);
+   }
+}
+
+/* move the shell's stderr to iFd, unless iFd is -1, and return a
+   copy of the stderr it had for parallel_restoreStderr, or -1 if it
+   is left alone */
+static int parallel_moveStderr(int iFd)
+{
+   int iSaved;
+
+   if (iFd == -1)
+      return -1;
+   if (fflush(stderr) == EOF)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   iSaved = fcntl(2, F_DUPFD_CLOEXEC, 0);
+   if ((iSaved == -1) || (dup2(iFd, 2) == -1))
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   return iSaved;
+}
+
+/* put back the stderr iSaved, which parallel_moveStderr returned */
+static void parallel_restoreStderr(int iSaved)
+{
+   if (iSaved == -1)
+      return;
+   if ((fflush(stderr) == EOF) || (dup2(iSaved, 2) == -1))
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   (void)close(iSaved);
+}
+
+/* add psJob to the end of psParallel's queue */
+static void parallel_enqueue(struct Parallel *psParallel,
+                             struct ParallelJob *psJob)
+{
+   assert(psParallel != NULL);
+   assert(psJob != NULL);
+
+   if (psParallel->psLast == NULL)
+      psParallel->psFirst = psJob;
+   else
+      psParallel->psLast->psNext = psJob;
+   psParallel->psLast = psJob;
+}
+
+/* the event loop's handler for a command exiting: record its exit
+   status, from wait status iStatus, in the job pvExtra points to */
+static void parallel_reap(pid_t iPid, int iStatus, void *pvExtra)
+{
+   struct ParallelJob *psJob = (struct ParallelJob*)pvExtra;
+
+   (void)iPid;
+   assert(psJob != NULL);
+
+   psJob->iExited = TRUE;
+   if (WIFSIGNALED(iStatus))
+      psJob->iStatus = 128 + WTERMSIG(iStatus);
+   else
+      psJob->iStatus = WEXITSTATUS(iStatus);
+   psJob->psParallel->uRunning--;
+}
+
+/* wait for the next event, then finish what can be */
+static void parallel_runOnce(struct Parallel *psParallel)
+{
+   if (Event_runOnce(psParallel->oEvent, -1) == -1)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   parallel_finish(psParallel);
+}
+
+/* return the lowest slot that no command of psParallel's still
+   running has */
+static size_t parallel_freeSlot(struct Parallel *psParallel)
+{
+   struct ParallelJob *psJob;
+   size_t uSlot = 0;
+
+   for (;;)
+   {
+      for (psJob = psParallel->psFirst; psJob != NULL;
+           psJob = psJob->psNext)
+         if ((! psJob->iExited) && (psJob->uSlot == uSlot))
+            break;
+      if (psJob == NULL)
+         return uSlot;
+      uSlot++;
+   }
+}
+
+/* the Spawn_command setup for the struct ParallelJob pvExtra: limit
+   the child to its slot's CPUs if the jobs are spread */
+static void parallel_setupChild(void *pvExtra)
+{
+   struct ParallelJob *psJob = (struct ParallelJob*)pvExtra;
+
+   assert(psJob != NULL);
+
+   /* a command that can't be limited runs where it would have */
+   if (psJob->psParallel->oSpread != NULL)
+      (void)Schedule_applySpread(psJob->psParallel->oSpread,
+                                 psJob->uSlot);
+}
+
+/* fork and exec psJob's command, the tokens oTokens, with its held
+   fds and then its plan in place, on its slot's CPUs if spread.
+   return the child's pid */
+static pid_t parallel_fork(struct ParallelJob *psJob, DynArray_T oTokens)
+{
+   char **apcArgv;
+   size_t uIndex;
+   pid_t iPid;
+   int aiFds[3];
+
+   apcArgv = (char**)Mem_calloc(MEM_PARALLEL,
+                                DynArray_getLength(oTokens) + 1,
+                                sizeof(char*));
+   for (uIndex = 0; uIndex < DynArray_getLength(oTokens); uIndex++)
+      apcArgv[uIndex] = (char*)Token_getValue(DynArray_get(oTokens,
+                                                           uIndex));
+   /* the held fds first, so that the plan can copy them */
+   aiFds[0] = -1;
+   aiFds[1] = psJob->aiHeld[0];
+   aiFds[2] = psJob->aiHeld[1];
+   iPid = Spawn_command(apcArgv, Path_find(apcArgv[0]), aiFds,
+                        psJob->oPlan, parallel_setupChild, psJob);
+   if (iPid == -1) {perror(getPgmName()); exit(EXIT_FAILURE);}
+   Mem_free(apcArgv);
+   return iPid;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* return a scheduler for up to uJobs commands at once */
+Parallel_T Parallel_new(size_t uJobs, Event_T oEvent,
+                        ScheduleSpread_T oSpread)
+{
+   struct Parallel *psParallel;
+   struct stat sStat;
+   int iFd;
+
+   assert(uJobs > 0);
+   assert(oEvent != NULL);
+
+   psParallel = (struct Parallel*)Mem_tryCalloc(MEM_PARALLEL, 1,
+                                                sizeof(*psParallel));
+   if (psParallel == NULL)
+   {
+      errno = ENOMEM;
+      return NULL;
+   }
+   psParallel->oEvent = oEvent;
+   psParallel->oSpread = oSpread;
+   psParallel->uJobs = uJobs;
+   for (iFd = 1; iFd < 3; iFd++)
+      psParallel->aiHold[iFd - 1] = ! isatty(iFd);
+   psParallel->iSharedStdin = (! isatty(0)) &&
+      (fstat(0, &sStat) == 0) && (! S_ISCHR(sStat.st_mode));
+   return psParallel;
+}
+
+/* start oCommand once it may run */
+int Parallel_start(Parallel_T oParallel, Command_T oCommand)
+{
+   struct ParallelJob *psJob;
+   DynArray_T oTokens;
+   const char *pcName;
+   char *pcDir;
+   pid_t iPid;
+   int iIndex;
+   int iSavedStderr;
+
+   assert(oParallel != NULL);
+   assert(oCommand != NULL);
+
+   parallel_finish(oParallel);
+   oTokens = Command_getTokens(oCommand);
+   pcName = Token_getValue(DynArray_get(oTokens, 0));
+   if (Command_isBackground(oCommand))
+      return FALSE;
+   /* anything else may touch files no word names, so it runs alone,
+      as does a known command not found */
+   if ((! parallel_isKnown(pcName)) || (Path_find(pcName) == NULL))
+      return FALSE;
+   pcDir = parallel_getDir();
+   if (pcDir == NULL)
+      return FALSE;
+   psJob = parallel_newJob(oParallel, oCommand, pcDir);
+   Mem_free(pcDir);
+
+   while ((oParallel->uRunning >= oParallel->uJobs) ||
+          parallel_isBlocked(oParallel, psJob))
+      parallel_runOnce(oParallel);
+
+   for (iIndex = 0; iIndex < 2; iIndex++)
+      if (psJob->aiHold[iIndex])
+      {
+         psJob->aiHeld[iIndex] = memfd_create("ish-held", MFD_CLOEXEC);
+         if (psJob->aiHeld[iIndex] == -1)
+         {  /* it can still run in order */
+            if (iIndex > 0)
+               (void)close(psJob->aiHeld[0]);
+            parallel_freeJob(psJob);
+            return FALSE;
+         }
+      }
+
+   /* the files are opened now the commands before that use them are
+      done. one that can't be is reported in the command's held
+      stderr, if it has one, so that the message comes in its turn */
+   iSavedStderr = parallel_moveStderr(psJob->aiHeld[1]);
+   psJob->oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if ((psJob->oPlan != NULL) &&
+       (Redirect_watchPlan(psJob->oPlan, oParallel->oEvent) == -1))
+   {
+      perror(getPgmName());
+      Redirect_freePlan(psJob->oPlan);
+      psJob->oPlan = NULL;
+   }
+   parallel_restoreStderr(iSavedStderr);
+   if (psJob->oPlan == NULL)
+   {  /* it fails in its turn, with its message, as it would have
+         run */
+      psJob->iExited = TRUE;
+      psJob->iStatus = EXIT_FAILURE;
+      parallel_enqueue(oParallel, psJob);
+      parallel_finish(oParallel);
+      return TRUE;
+   }
+
+   psJob->uSlot = parallel_freeSlot(oParallel);
+   iPid = parallel_fork(psJob, oTokens);
+   Redirect_closePlan(psJob->oPlan);
+   parallel_enqueue(oParallel, psJob);
+   oParallel->uRunning++;
+   if (Event_reapChild(oParallel->oEvent, iPid, parallel_reap,
+                       psJob) == -1)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   /* reaped already if it couldn't be watched */
+   parallel_finish(oParallel);
+   return TRUE;
+}
+
+/* wait for every command started */
+void Parallel_drain(Parallel_T oParallel)
+{
+   assert(oParallel != NULL);
+
+   parallel_finish(oParallel);
+   while (oParallel->psFirst != NULL)
+      parallel_runOnce(oParallel);
+}
+
+/* drain oParallel and free it */
+void Parallel_free(Parallel_T oParallel)
+{
+   assert(oParallel != NULL);
+
+   Parallel_drain(oParallel);
+   Mem_free(oParallel);
+}
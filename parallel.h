@@ -0,0 +1,54 @@
+/*--------------------------------------------------------------------*/
+/* parallel.h                                                         */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef PARALLEL_INCLUDED
+#define PARALLEL_INCLUDED
+
+#include "command.h"
+#include "event.h"
+#include "schedule.h"
+#include <stddef.h>
+
+/* Parallel_T is a pointer to a scheduler that runs a script's
+   commands ahead of their turn when they can't affect one another,
+   with the observable results of running them one at a time. only
+   commands known to touch nothing but the files they name, like cat,
+   sort or cp, found in PATH by their bare name, run ahead. the files
+   such a command touches are taken to be those its redirections and
+   its arguments name (any argument counts as a file it may write, as
+   does what follows an option's letter or '=', as in -ofile or
+   --output=file), along with the shell's stdin, stdout and stderr
+   where it inherits them. two commands that touch the same file, or a
+   file and a directory above it, and where one may write it, run in
+   script order. what a command run ahead writes to the shell's
+   stdout and stderr, unless they are terminals, is held until the
+   commands before it are done, and then written in order */
+typedef struct Parallel *Parallel_T;
+
+/* return a scheduler that runs up to uJobs commands at once in
+   children watched by oEvent, or NULL with errno set if there isn't
+   enough memory. unless oSpread is NULL, each command is limited to
+   one of its groups of CPUs, the first that no other command running
+   has, or round again if they all do. oSpread stays the caller's, and
+   must outlive the scheduler */
+Parallel_T Parallel_new(size_t uJobs, Event_T oEvent,
+                        ScheduleSpread_T oSpread);
+
+/* start oCommand, which is not a builtin, once the commands it
+   depends on are done and a job is free. return 1 if it was started,
+   or couldn't be started for a reason its message was written for,
+   or 0 if it must run in order once Parallel_drain returns: it runs
+   in the background, or its command isn't one known to run ahead, or
+   isn't found in PATH */
+int Parallel_start(Parallel_T oParallel, Command_T oCommand);
+
+/* wait for every command started to exit, writing what was held of
+   their output and recording the last one's exit status as $? */
+void Parallel_drain(Parallel_T oParallel);
+
+/* drain oParallel and free it */
+void Parallel_free(Parallel_T oParallel);
+
+#endif
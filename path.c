@@ -0,0 +1,200 @@
+/*--------------------------------------------------------------------
+  path.c
+  Author: Nate Wilson
+  Description: the commands found in PATH, remembered by their pooled
+  names, so that a lookup is a pointer comparison in one bucket
+  instead of an access call per PATH directory on every run
+  --------------------------------------------------------------------*/
+
+#include "path.h"
+#include "intern.h"
+#include "var.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* a command found */
+struct PathEntry
+{
+   /* its pooled name, which the entry holds a reference to */
+   const char *pcName;
+   /* the file it runs */
+   char *pcFile;
+   struct PathEntry *psNext;
+};
+
+/* the number of buckets */
+enum {PATH_BUCKETS = 256};
+
+/* the commands found, and the PATH they were found in, NULL if
+   none */
+static struct PathEntry *apsPathBuckets[PATH_BUCKETS];
+static char *pcPathSearched;
+
+/* return the file named pcName in PATH pcPath, which the caller owns,
+   or NULL if there is none or a relative directory comes first */
+static char *path_search(const char *pcPath, const char *pcName)
+{
+   struct stat sStat;
+   const char *pcEnd;
+   size_t uDirLength;
+   char *pcFile;
+
+   for (;;)
+   {
+      pcEnd = strchr(pcPath, ':');
+      uDirLength = (pcEnd == NULL) ? strlen(pcPath)
+                                   : (size_t)(pcEnd - pcPath);
+      /* what a relative directory finds depends on where the shell
+         is, so it is execvp's to search */
+      if ((uDirLength == 0) || (*pcPath != '/'))
+         return NULL;
+      pcFile = (char*)Mem_alloc(MEM_PATH, uDirLength + strlen(pcName) + 2);
+      memcpy(pcFile, pcPath, uDirLength);
+      pcFile[uDirLength] = '/';
+      strcpy(pcFile + uDirLength + 1, pcName);
+      if ((stat(pcFile, &sStat) == 0) && S_ISREG(sStat.st_mode) &&
+          (access(pcFile, X_OK) == 0))
+         return pcFile;
+      Mem_free(pcFile);
+      if (pcEnd == NULL)
+         return NULL;
+      pcPath = pcEnd + 1;
+   }
+}
+
+/* remember pcFile, which the entry owns from now on, as what the
+   command pcName, in bucket uBucket, runs in PATH pcPath */
+static void path_add(const char *pcPath, const char *pcName,
+                     size_t uBucket, char *pcFile)
+{
+   struct PathEntry *psEntry;
+
+   if (pcPathSearched == NULL)
+   {
+      pcPathSearched = (char*)Mem_alloc(MEM_PATH, strlen(pcPath) + 1);
+      strcpy(pcPathSearched, pcPath);
+   }
+   psEntry = (struct PathEntry*)Mem_alloc(MEM_PATH, sizeof(*psEntry));
+   psEntry->pcName = Intern_string(pcName);
+   psEntry->pcFile = pcFile;
+   psEntry->psNext = apsPathBuckets[uBucket];
+   apsPathBuckets[uBucket] = psEntry;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* return the file that the command pcName runs */
+const char *Path_find(const char *pcName)
+{
+   struct PathEntry *psEntry;
+   const char *pcPath;
+   char *pcFile;
+   size_t uBucket;
+
+   assert(pcName != NULL);
+
+   if (strchr(pcName, '/') != NULL)
+      return NULL;
+   pcPath = Var_get("PATH", strlen("PATH"));
+   if (pcPath == NULL) /* execvp has a default */
+      return NULL;
+   if ((pcPathSearched != NULL) && (strcmp(pcPathSearched, pcPath) != 0))
+      Path_free();
+
+   uBucket = Intern_getHash(pcName) % PATH_BUCKETS;
+   for (psEntry = apsPathBuckets[uBucket]; psEntry != NULL;
+        psEntry = psEntry->psNext)
+      if (psEntry->pcName == pcName)
+         return psEntry->pcFile;
+
+   /* not found isn't remembered, so a command installed later is */
+   pcFile = path_search(pcPath, pcName);
+   if (pcFile == NULL)
+      return NULL;
+   path_add(pcPath, pcName, uBucket, pcFile);
+   return pcFile;
+}
+
+/* remember pcFile as what the command pcName runs */
+void Path_remember(const char *pcName, const char *pcFile)
+{
+   struct PathEntry *psEntry;
+   const char *pcPath;
+   char *pcCopy;
+   size_t uBucket;
+
+   assert(pcName != NULL);
+   assert(pcFile != NULL);
+
+   if (strchr(pcName, '/') != NULL)
+      return;
+   pcPath = Var_get("PATH", strlen("PATH"));
+   if (pcPath == NULL)
+      return;
+   if ((pcPathSearched != NULL) && (strcmp(pcPathSearched, pcPath) != 0))
+      Path_free();
+
+   pcName = Intern_string(pcName);
+   uBucket = Intern_getHash(pcName) % PATH_BUCKETS;
+   for (psEntry = apsPathBuckets[uBucket]; psEntry != NULL;
+        psEntry = psEntry->psNext)
+      if (psEntry->pcName == pcName)
+         break;
+   if (psEntry == NULL)
+   {
+      pcCopy = (char*)Mem_alloc(MEM_PATH, strlen(pcFile) + 1);
+      path_add(pcPath, pcName, uBucket, strcpy(pcCopy, pcFile));
+   }
+   Intern_release(pcName);
+}
+
+/* return the PATH the commands found were found in */
+const char *Path_getSearched(void)
+{
+   return pcPathSearched;
+}
+
+/* call (*pfApply) for every command found */
+void Path_map(void (*pfApply)(const char *pcName, const char *pcFile,
+                              void *pvExtra),
+              void *pvExtra)
+{
+   struct PathEntry *psEntry;
+   size_t uBucket;
+
+   assert(pfApply != NULL);
+
+   for (uBucket = 0; uBucket < PATH_BUCKETS; uBucket++)
+      for (psEntry = apsPathBuckets[uBucket]; psEntry != NULL;
+           psEntry = psEntry->psNext)
+         (*pfApply)(psEntry->pcName, psEntry->pcFile, pvExtra);
+}
+
+/* forget every command found */
+void Path_free(void)
+{
+   struct PathEntry *psEntry;
+   struct PathEntry *psNext;
+   size_t uBucket;
+
+   for (uBucket = 0; uBucket < PATH_BUCKETS; uBucket++)
+   {
+      for (psEntry = apsPathBuckets[uBucket]; psEntry != NULL;
+           psEntry = psNext)
+      {
+         psNext = psEntry->psNext;
+         Intern_release(psEntry->pcName);
+         Mem_free(psEntry->pcFile);
+         Mem_free(psEntry);
+      }
+      apsPathBuckets[uBucket] = NULL;
+   }
+   Mem_free(pcPathSearched);
+   pcPathSearched = NULL;
+}
@@ -0,0 +1,37 @@
+/*--------------------------------------------------------------------*/
+/* path.h                                                             */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef PATH_INCLUDED
+#define PATH_INCLUDED
+
+/* return the file that running the command pcName finds in PATH, or
+   NULL if the search is better left to execvp: pcName has a '/', the
+   file isn't there, or the search reaches a relative directory.
+   pcName must be pooled (see intern.h). what is found is remembered
+   until PATH changes, so that running a command again costs no
+   search. the file may have gone since, so the caller falls back to
+   execvp if it can't be run */
+const char *Path_find(const char *pcName);
+
+/* remember pcFile as what the command pcName runs, as if Path_find
+   had found it in the current PATH, unless a file is remembered for
+   pcName already. nothing is remembered if pcName has a '/' or PATH
+   isn't set. pcName needn't be pooled, and neither string is kept */
+void Path_remember(const char *pcName, const char *pcFile);
+
+/* return the PATH the commands remembered were found in, or NULL if
+   none are. the string stays the path module's */
+const char *Path_getSearched(void);
+
+/* call (*pfApply)(pcName, pcFile, pvExtra) for every command
+   remembered, with its pooled name and its file */
+void Path_map(void (*pfApply)(const char *pcName, const char *pcFile,
+                              void *pvExtra),
+              void *pvExtra);
+
+/* forget every command found */
+void Path_free(void);
+
+#endif
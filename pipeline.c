@@ -0,0 +1,332 @@
+/*--------------------------------------------------------------------
+  pipeline.c
+  Author: Nate Wilson
+  Description: reads and lexes a script ahead of the shell, so that a
+  script of many short commands reads and lexes its next lines while
+  the shell waits for the command before. a reader thread and a lexer
+  thread are joined to each other and to the shell by bounded rings,
+  each with one thread putting in and one taking out
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "pipeline.h"
+#include "lex.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* how many lines each ring holds */
+enum {PIPELINE_DEPTH = 64};
+
+/* a line and its tokens, NULL if it isn't lexed. a NULL line marks
+   the end of the file */
+struct PipelineItem
+{
+   char *pcLine;
+   DynArray_T oTokens;
+};
+
+/* a bounded ring with one thread putting in and one taking out. each
+   index belongs to one side, and the semaphores, which only enter the
+   kernel when a side has to wait, hand the slots across */
+struct PipelineRing
+{
+   struct PipelineItem asItems[PIPELINE_DEPTH];
+   /* where the taker takes next, and where the putter puts */
+   size_t uHead;
+   size_t uTail;
+   /* how many slots are filled, and how many free */
+   sem_t sFilled;
+   sem_t sFree;
+};
+
+/* the pipeline */
+struct Pipeline
+{
+   FILE *psFile;
+   /* lines from the reader to the lexer, and from the lexer to the
+      shell */
+   struct PipelineRing sLines;
+   struct PipelineRing sLexed;
+   pthread_t iReader;
+   pthread_t iLexer;
+   /* the item the shell looked at ahead, if any */
+   struct PipelineItem sAhead;
+   int iHasAhead;
+   /* the tokens of the line last returned, until taken */
+   DynArray_T oTokens;
+   /* has the end of the file been returned? */
+   int iDone;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* set up psRing, empty. return 0 if successful, or -1 with errno set
+   otherwise */
+static int pipeline_initRing(struct PipelineRing *psRing)
+{
+   psRing->uHead = 0;
+   psRing->uTail = 0;
+   if (sem_init(&psRing->sFilled, 0, 0) == -1)
+      return -1;
+   if (sem_init(&psRing->sFree, 0, PIPELINE_DEPTH) == -1)
+   {
+      (void)sem_destroy(&psRing->sFilled);
+      return -1;
+   }
+   return 0;
+}
+
+/* free psRing's semaphores */
+static void pipeline_freeRing(struct PipelineRing *psRing)
+{
+   (void)sem_destroy(&psRing->sFilled);
+   (void)sem_destroy(&psRing->sFree);
+}
+
+/* wait on psSem, through any signals */
+static void pipeline_wait(sem_t *psSem)
+{
+   while (sem_wait(psSem) == -1)
+      if (errno != EINTR)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+}
+
+/* put pcLine and oTokens into psRing, waiting for a free slot */
+static void pipeline_put(struct PipelineRing *psRing, char *pcLine,
+                         DynArray_T oTokens)
+{
+   pipeline_wait(&psRing->sFree);
+   psRing->asItems[psRing->uTail].pcLine = pcLine;
+   psRing->asItems[psRing->uTail].oTokens = oTokens;
+   psRing->uTail = (psRing->uTail + 1) % PIPELINE_DEPTH;
+   (void)sem_post(&psRing->sFilled);
+}
+
+/* take the next item from psRing into *psItem, waiting for one if
+   iWait, or returning FALSE if there isn't one otherwise. return
+   TRUE if an item was taken */
+static int pipeline_take(struct PipelineRing *psRing,
+                         struct PipelineItem *psItem, int iWait)
+{
+   if (iWait)
+      pipeline_wait(&psRing->sFilled);
+   else if (sem_trywait(&psRing->sFilled) == -1)
+      return FALSE;
+   *psItem = psRing->asItems[psRing->uHead];
+   psRing->uHead = (psRing->uHead + 1) % PIPELINE_DEPTH;
+   (void)sem_post(&psRing->sFree);
+   return TRUE;
+}
+
+/* the reader thread: read lines from the pipeline pvPipeline's file
+   into its first ring, then the end */
+static void *pipeline_read(void *pvPipeline)
+{
+   struct Pipeline *psPipeline = (struct Pipeline*)pvPipeline;
+   char *pcLine;
+
+   do
+   {
+      pcLine = lex_readLine(psPipeline->psFile);
+      pipeline_put(&psPipeline->sLines, pcLine, NULL);
+   } while (pcLine != NULL);
+   return NULL;
+}
+
+/* does pcLine have a quote left open, which lexing reports? */
+static int pipeline_hasOpenQuote(const char *pcLine)
+{
+   int iOpen = FALSE;
+
+   for (; *pcLine != '\0'; pcLine++)
+      if (*pcLine == '\"')
+         iOpen = ! iOpen;
+   return iOpen;
+}
+
+/* the lexer thread: lex the lines in the pipeline pvPipeline's first
+   ring that can be lexed ahead, and pass them all on in order */
+static void *pipeline_lex(void *pvPipeline)
+{
+   struct Pipeline *psPipeline = (struct Pipeline*)pvPipeline;
+   struct PipelineItem sItem;
+   DynArray_T oTokens;
+
+   do
+   {
+      (void)pipeline_take(&psPipeline->sLines, &sItem, TRUE);
+      oTokens = NULL;
+      /* with nothing to expand, lexing now or later is the same, and
+         never starts anything */
+      if ((sItem.pcLine != NULL) && (! lex_hasExpansion(sItem.pcLine)) &&
+          (! pipeline_hasOpenQuote(sItem.pcLine)))
+         oTokens = lex_lexLineUnexpanded(sItem.pcLine);
+      pipeline_put(&psPipeline->sLexed, sItem.pcLine, oTokens);
+   } while (sItem.pcLine != NULL);
+   return NULL;
+}
+
+/* free oTokens, if not NULL, and their tokens */
+static void pipeline_freeTokens(DynArray_T oTokens)
+{
+   if (oTokens == NULL)
+      return;
+   lex_freeTokens(oTokens);
+   DynArray_free(oTokens);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* start reading and lexing psFile ahead */
+Pipeline_T Pipeline_new(FILE *psFile)
+{
+   struct Pipeline *psPipeline;
+   int iError;
+
+   assert(psFile != NULL);
+
+   psPipeline = (struct Pipeline*)Mem_tryCalloc(MEM_SHELL, 1,
+                                                sizeof(*psPipeline));
+   if (psPipeline == NULL)
+   {
+      errno = ENOMEM;
+      return NULL;
+   }
+   psPipeline->psFile = psFile;
+   if (pipeline_initRing(&psPipeline->sLines) == -1)
+   {
+      Mem_free(psPipeline);
+      return NULL;
+   }
+   if (pipeline_initRing(&psPipeline->sLexed) == -1)
+   {
+      pipeline_freeRing(&psPipeline->sLines);
+      Mem_free(psPipeline);
+      return NULL;
+   }
+   iError = pthread_create(&psPipeline->iReader, NULL, pipeline_read,
+                           psPipeline);
+   if (iError == 0)
+   {
+      iError = pthread_create(&psPipeline->iLexer, NULL, pipeline_lex,
+                              psPipeline);
+      /* the reader hasn't read anything that can't be left, but can
+         only be stopped by cancelling it */
+      if (iError != 0)
+      {
+         (void)pthread_cancel(psPipeline->iReader);
+         (void)pthread_join(psPipeline->iReader, NULL);
+      }
+   }
+   if (iError != 0)
+   {
+      pipeline_freeRing(&psPipeline->sLines);
+      pipeline_freeRing(&psPipeline->sLexed);
+      Mem_free(psPipeline);
+      errno = iError;
+      return NULL;
+   }
+   return psPipeline;
+}
+
+/* return the next line, waiting for it */
+char *Pipeline_nextLine(Pipeline_T oPipeline)
+{
+   struct PipelineItem sItem;
+
+   assert(oPipeline != NULL);
+
+   pipeline_freeTokens(oPipeline->oTokens);
+   oPipeline->oTokens = NULL;
+   if (oPipeline->iDone)
+      return NULL;
+   if (oPipeline->iHasAhead)
+   {
+      sItem = oPipeline->sAhead;
+      oPipeline->iHasAhead = FALSE;
+   }
+   else
+      (void)pipeline_take(&oPipeline->sLexed, &sItem, TRUE);
+   oPipeline->oTokens = sItem.oTokens;
+   oPipeline->iDone = (sItem.pcLine == NULL);
+   return sItem.pcLine;
+}
+
+/* return the last line's tokens, for the caller to own */
+DynArray_T Pipeline_takeTokens(Pipeline_T oPipeline)
+{
+   DynArray_T oTokens;
+
+   assert(oPipeline != NULL);
+
+   oTokens = oPipeline->oTokens;
+   oPipeline->oTokens = NULL;
+   return oTokens;
+}
+
+/* return the next line's tokens, if lexed already */
+DynArray_T Pipeline_peekTokens(Pipeline_T oPipeline)
+{
+   assert(oPipeline != NULL);
+
+   if (oPipeline->iDone)
+      return NULL;
+   if (! oPipeline->iHasAhead)
+      oPipeline->iHasAhead = pipeline_take(&oPipeline->sLexed,
+                                           &oPipeline->sAhead, FALSE);
+   if (! oPipeline->iHasAhead)
+      return NULL;
+   return oPipeline->sAhead.oTokens;
+}
+
+/* is the end of the file next? */
+int Pipeline_isAtEnd(Pipeline_T oPipeline)
+{
+   assert(oPipeline != NULL);
+
+   if (oPipeline->iDone)
+      return TRUE;
+   if (! oPipeline->iHasAhead)
+   {
+      (void)pipeline_take(&oPipeline->sLexed, &oPipeline->sAhead, TRUE);
+      oPipeline->iHasAhead = TRUE;
+   }
+   return oPipeline->sAhead.pcLine == NULL;
+}
+
+/* return the next line, without its tokens */
+char *Pipeline_readLine(void *pvPipeline)
+{
+   char *pcLine;
+
+   assert(pvPipeline != NULL);
+
+   pcLine = Pipeline_nextLine((Pipeline_T)pvPipeline);
+   pipeline_freeTokens(Pipeline_takeTokens((Pipeline_T)pvPipeline));
+   return pcLine;
+}
+
+/* wait for the threads and free oPipeline */
+void Pipeline_free(Pipeline_T oPipeline)
+{
+   assert(oPipeline != NULL);
+
+   (void)pthread_join(oPipeline->iReader, NULL);
+   (void)pthread_join(oPipeline->iLexer, NULL);
+   pipeline_freeTokens(oPipeline->oTokens);
+   pipeline_freeRing(&oPipeline->sLines);
+   pipeline_freeRing(&oPipeline->sLexed);
+   Mem_free(oPipeline);
+}
@@ -0,0 +1,51 @@
+/*--------------------------------------------------------------------*/
+/* pipeline.h                                                         */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef PIPELINE_INCLUDED
+#define PIPELINE_INCLUDED
+
+#include "dynarray.h"
+#include <stdio.h>
+
+/* Pipeline_T is a pointer to a script's lines being read and lexed
+   ahead of the shell by two threads: one reads lines, the other lexes
+   those that have nothing to expand and would lex without error, so
+   that their tokens don't depend on when they are lexed and no message
+   comes early. the shell takes the lines in order, each with its
+   tokens if it was lexed ahead */
+typedef struct Pipeline *Pipeline_T;
+
+/* start reading psFile, which the pipeline's reader has to itself
+   from now on, and return the pipeline, or NULL with errno set if the
+   threads can't be started */
+Pipeline_T Pipeline_new(FILE *psFile);
+
+/* return the next line, which the caller owns, waiting for it if need
+   be, or NULL at the end of the file */
+char *Pipeline_nextLine(Pipeline_T oPipeline);
+
+/* return the tokens the line Pipeline_nextLine last returned was
+   lexed into, which the caller owns, or NULL if it is to be lexed now
+   (or they were taken already) */
+DynArray_T Pipeline_takeTokens(Pipeline_T oPipeline);
+
+/* return the tokens of the line after, without waiting, or NULL if it
+   isn't lexed (yet). they stay the pipeline's */
+DynArray_T Pipeline_peekTokens(Pipeline_T oPipeline);
+
+/* is the end of the file next, after the line last returned? waits
+   until that is known. return 1 if true */
+int Pipeline_isAtEnd(Pipeline_T oPipeline);
+
+/* return the next line as Pipeline_nextLine does, dropping its
+   tokens. pvPipeline is the pipeline, so that this can be given to
+   lex_readHereBodyWith */
+char *Pipeline_readLine(void *pvPipeline);
+
+/* wait for the threads, which are done once the end of the file has
+   been returned, and free oPipeline */
+void Pipeline_free(Pipeline_T oPipeline);
+
+#endif
@@ -0,0 +1,291 @@
+/*--------------------------------------------------------------------
+  prefix.c
+  Author: Nate Wilson
+  Description: the prefix builtins timeout, sched and limit, run
+  together. each prefix's options are parsed by its own module, in the
+  shell, and the command is then forked once with every prefix's
+  settings made in the child, so that they combine rather than each
+  prefix taking the next one for the command
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "prefix.h"
+#include "command.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "redirect.h"
+#include "event.h"
+#include "timeout.h"
+#include "schedule.h"
+#include "limit.h"
+#include "mem.h"
+#include "path.h"
+#include "spawn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* exit statuses, same as GNU timeout and nice */
+enum {PREFIX_TIMED_OUT = 124, PREFIX_FAILED = 125, PREFIX_SIGNALED = 128};
+
+/* the prefixes at the start of a command, each NULL if not given */
+struct PrefixSettings
+{
+   TimeoutSettings_T oTimeout;
+   ScheduleSettings_T oSchedule;
+   LimitSettings_T oLimit;
+   /* index into the command's tokens of the command to run, or the
+      count of tokens if there is none */
+   size_t uCmdIndex;
+};
+
+/* the command being run */
+struct PrefixChild
+{
+   /* the loop that reaps it */
+   Event_T oEvent;
+   /* has it been reaped? */
+   int iExited;
+   /* its wait status and resource usage, once reaped */
+   int iStatus;
+   struct rusage sUsage;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* free the settings psSettings holds */
+static void prefix_free(struct PrefixSettings *psSettings)
+{
+   assert(psSettings != NULL);
+
+   if (psSettings->oTimeout != NULL)
+      Timeout_freeSettings(psSettings->oTimeout);
+   if (psSettings->oSchedule != NULL)
+      Schedule_freeSettings(psSettings->oSchedule);
+   if (psSettings->oLimit != NULL)
+      Limit_freeSettings(psSettings->oLimit);
+}
+
+/* fill psSettings from the leading tokens of oTokens, one prefix
+   after another until a token isn't one. return TRUE if successful,
+   FALSE (after writing a message to stderr) if they are malformed,
+   with what was parsed left in psSettings to be freed */
+static int prefix_parse(DynArray_T oTokens,
+                        struct PrefixSettings *psSettings)
+{
+   size_t uIndex = 0;
+   const char *pcName;
+   void *pvGiven;
+   void *pvParsed;
+   const char *pcPgmName = getPgmName();
+
+   assert(oTokens != NULL);
+   assert(psSettings != NULL);
+
+   memset(psSettings, 0, sizeof(*psSettings));
+
+   while (uIndex < DynArray_getLength(oTokens))
+   {
+      pcName = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (strcmp(pcName, "timeout") == 0)
+         pvGiven = psSettings->oTimeout;
+      else if (strcmp(pcName, "sched") == 0)
+         pvGiven = psSettings->oSchedule;
+      else if (strcmp(pcName, "limit") == 0)
+         pvGiven = psSettings->oLimit;
+      else
+         break;
+      if (pvGiven != NULL)
+      {
+         fprintf(stderr, "%s: %s: given twice\n", pcPgmName, pcName);
+         return FALSE;
+      }
+      if (strcmp(pcName, "timeout") == 0)
+         pvParsed = psSettings->oTimeout = Timeout_parse(oTokens, &uIndex);
+      else if (strcmp(pcName, "sched") == 0)
+         pvParsed = psSettings->oSchedule = Schedule_parse(oTokens,
+                                                           &uIndex);
+      else
+         pvParsed = psSettings->oLimit = Limit_parse(oTokens, &uIndex);
+      if (pvParsed == NULL)
+         return FALSE;
+   }
+   psSettings->uCmdIndex = uIndex;
+   return TRUE;
+}
+
+/* make the calling process run as psSettings says: sched's settings,
+   then limit's, last so that nothing before is held to them. return
+   NULL if successful, or the name of the prefix whose settings
+   couldn't be made, with errno set */
+static const char *prefix_apply(const struct PrefixSettings *psSettings)
+{
+   assert(psSettings != NULL);
+
+   if ((psSettings->oSchedule != NULL) &&
+       (Schedule_apply(psSettings->oSchedule) == -1))
+      return "sched";
+   if ((psSettings->oLimit != NULL) &&
+       (Limit_apply(psSettings->oLimit) == -1))
+      return "limit";
+   return NULL;
+}
+
+/* the event loop's handler for the command exiting with wait status
+   iStatus: record it, and its resource usage, in the struct
+   PrefixChild pvExtra */
+static void prefix_reap(pid_t iPid, int iStatus, void *pvExtra)
+{
+   struct PrefixChild *psChild = (struct PrefixChild*)pvExtra;
+
+   (void)iPid;
+   assert(psChild != NULL);
+
+   psChild->iExited = TRUE;
+   psChild->iStatus = iStatus;
+   Event_getUsage(psChild->oEvent, &psChild->sUsage);
+}
+
+/* the child's setup: make the struct PrefixSettings pvExtra, or
+   write a message and exit if it can't be made */
+static void prefix_setupChild(void *pvExtra)
+{
+   const struct PrefixSettings *psSettings =
+      (const struct PrefixSettings*)pvExtra;
+   const char *pcFailed;
+
+   assert(psSettings != NULL);
+
+   pcFailed = prefix_apply(psSettings);
+   if (pcFailed != NULL)
+   {
+      fprintf(stderr, "%s: %s: %s\n", getPgmName(), pcFailed,
+              strerror(errno));
+      /* _exit, as exit would rewind the stdin the shell reads from */
+      _exit(PREFIX_FAILED);
+   }
+}
+
+/* run the command oTokens names from psSettings' uCmdIndex on, with
+   oCommand's redirections and psSettings in place and oEvent watching
+   it, and return its exit status */
+static int prefix_runCommand(Command_T oCommand, DynArray_T oTokens,
+                             const struct PrefixSettings *psSettings,
+                             Event_T oEvent)
+{
+   struct PrefixChild sChild;
+   RedirectPlan_T oPlan;
+   char **apcArgv;
+   size_t uLength;
+   size_t uIndex;
+   pid_t iPid;
+   int iStatus;
+   int iTimedOut = FALSE;
+   const char *pcPgmName = getPgmName();
+
+   oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if (oPlan == NULL)
+      return PREFIX_FAILED;
+   /* "> a > b" is copied while the command runs */
+   if (Redirect_watchPlan(oPlan, oEvent) == -1)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      return PREFIX_FAILED;
+   }
+
+   uLength = DynArray_getLength(oTokens) - psSettings->uCmdIndex;
+   apcArgv = (char**)Mem_alloc(MEM_BUILTIN,
+                               sizeof(char *) * (uLength + 1));
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+      apcArgv[uIndex] = (char*)Token_getValue(
+         DynArray_get(oTokens, psSettings->uCmdIndex + uIndex));
+   apcArgv[uLength] = NULL;
+
+   iPid = Spawn_command(apcArgv, Path_find(apcArgv[0]), NULL, oPlan,
+                        prefix_setupChild, (void*)psSettings);
+   if (iPid == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   Redirect_closePlan(oPlan);
+
+   sChild.oEvent = oEvent;
+   sChild.iExited = FALSE;
+   /* one that can't be watched is waited for here, and has exited */
+   if (Event_reapChild(oEvent, iPid, prefix_reap, &sChild) == -1)
+   {perror(pcPgmName); exit(EXIT_FAILURE); }
+   if (psSettings->oTimeout != NULL)
+      iTimedOut = Timeout_wait(psSettings->oTimeout, oEvent, iPid,
+                               &sChild.iExited);
+   else
+      while (! sChild.iExited)
+         if (Event_runOnce(oEvent, -1) == -1)
+         {perror(pcPgmName); exit(EXIT_FAILURE); }
+   Redirect_freePlan(oPlan);
+   iStatus = sChild.iStatus;
+   if (psSettings->oLimit != NULL)
+      Limit_report(psSettings->oLimit, apcArgv[0], iStatus,
+                   &sChild.sUsage);
+   Mem_free(apcArgv);
+
+   if (WIFSIGNALED(iStatus))
+   {  /* a grace period that ran out is reported as the KILL */
+      if (iTimedOut && (WTERMSIG(iStatus) != SIGKILL))
+         return PREFIX_TIMED_OUT;
+      return PREFIX_SIGNALED + WTERMSIG(iStatus);
+   }
+   if (iTimedOut)
+      return PREFIX_TIMED_OUT;
+   return WEXITSTATUS(iStatus);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* run the prefixes at the start of oCommand, with oEvent watching the
+   command */
+int Prefix_run(Command_T oCommand, Event_T oEvent)
+{
+   struct PrefixSettings sSettings;
+   DynArray_T oTokens;
+   const char *pcFailed;
+   int iRet;
+
+   assert(oCommand != NULL);
+   assert(oEvent != NULL);
+
+   oTokens = Command_getTokens(oCommand);
+   if (! prefix_parse(oTokens, &sSettings))
+   {
+      prefix_free(&sSettings);
+      return PREFIX_FAILED;
+   }
+
+   /* without a command, it's the shell that changes. timeout always
+      has one */
+   if (sSettings.uCmdIndex == DynArray_getLength(oTokens))
+   {
+      iRet = 0;
+      pcFailed = prefix_apply(&sSettings);
+      if (pcFailed != NULL)
+      {
+         fprintf(stderr, "%s: %s: %s\n", getPgmName(), pcFailed,
+                 strerror(errno));
+         iRet = PREFIX_FAILED;
+      }
+   }
+   else
+      iRet = prefix_runCommand(oCommand, oTokens, &sSettings, oEvent);
+   prefix_free(&sSettings);
+   return iRet;
+}
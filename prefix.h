@@ -0,0 +1,28 @@
+/*--------------------------------------------------------------------*/
+/* prefix.h                                                           */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef PREFIX_INCLUDED
+#define PREFIX_INCLUDED
+
+#include "command.h"
+#include "event.h"
+
+/* the prefix builtins timeout, sched and limit (see timeout.h,
+   schedule.h and limit.h), each of which runs the command after its
+   options changed. prefixes may be chained, as in
+      limit -t 10 sched -c 0 timeout 5 cmd [args]
+   and cmd is then run in one child with all of them in place: the
+   redirections, then sched's settings, then limit's, each set between
+   the fork and the exec, while timeout watches it from the shell. a
+   prefix may be given only once. without cmd, sched and limit change
+   the shell itself, and so every command it runs after */
+
+/* run the prefixes at the start of oCommand, with oEvent watching the
+   command. return its exit status, 124 if it timed out, 125 if the
+   prefixes are malformed or can't be set, 126 if it can't be run, 127
+   if it isn't found, or 128 plus the signal if one killed it */
+int Prefix_run(Command_T oCommand, Event_T oEvent);
+
+#endif
@@ -0,0 +1,881 @@
+/*--------------------------------------------------------------------
+  redirect.c
+  Author: Nate Wilson
+  Description: ADT representing one redirection of a shell command,
+  and the plan that turns a command's redirections into fds. the shell
+  opens everything up front, so the child only has to move each fd
+  into place with a single dup2. an fd sent to several files gets a
+  pipe, which the shell fans out into the files with a Tee_T, pumped
+  by the event loop as data arrives
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "redirect.h"
+#include "tee.h"
+#include "event.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "mem.h"
+#include "trace.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* The permissions of newly-created files. */
+enum {PERMISSIONS = 0600};
+
+/* a redirection operator, the fd it targets and the word after it */
+struct Redirect
+{
+   /* what kind of redirection this is */
+   enum RedirectType eType;
+   /* the fd the redirection targets */
+   int iFd;
+   /* the fd a REDIRECT_DUP copies */
+   int iSourceFd;
+   /* '<' or '>', the direction a REDIRECT_DUP or REDIRECT_CLOSE was
+      written with */
+   char cDirection;
+   /* file name, or here-document delimiter */
+   char *pcWord;
+   /* text fed to iFd by a here-document or here-string */
+   char *pcBody;
+};
+
+/* one entry per target fd, in the order the targets first appear */
+struct RedirectPlan
+{
+   /* number of target fds */
+   size_t uLength;
+   /* the target fds */
+   int *piTargets;
+   /* fd to move onto each target, -1 to close the target */
+   int *piSources;
+   /* number of fds the shell opened for the plan */
+   size_t uOpenedLength;
+   /* fds the shell opened for the plan, all close-on-exec */
+   int *piOpened;
+   /* number of fds fanned out into several files */
+   size_t uTeeLength;
+   /* the fds fanned out */
+   int *piTeeTargets;
+   /* the copier for each fd fanned out, NULL once it is done */
+   Tee_T *aoTees;
+   /* the loop pumping the copiers, NULL if they aren't watched */
+   Event_T oEvent;
+   /* number of watched copiers that haven't reached end of file */
+   size_t uBusyLength;
+   /* should the last copier to finish free the plan? */
+   int iReleased;
+   /* called once a released plan is freed, if not NULL */
+   void (*pfDone)(void *pvExtra);
+   /* passed to pfDone */
+   void *pvDone;
+};
+
+/* return a newly allocated copy of pcString followed by pcSuffix, or
+   NULL if there isn't enough memory. the caller owns the copy */
+static char *redirect_copyString(const char *pcString,
+                                 const char *pcSuffix)
+{
+   char *pcCopy;
+
+   assert(pcString != NULL);
+   assert(pcSuffix != NULL);
+
+   pcCopy = (char*)Mem_tryAlloc(MEM_REDIRECT,
+                                strlen(pcString) + strlen(pcSuffix) + 1);
+   if (pcCopy == NULL)
+      return NULL;
+   strcpy(pcCopy, pcString);
+   strcat(pcCopy, pcSuffix);
+   return pcCopy;
+}
+
+/* parse the decimal fd at the start of pcDigits, storing the number of
+   digits in *puLength. return -1 if it's too large to be an fd */
+static int redirect_parseFd(const char *pcDigits, size_t *puLength)
+{
+   long lFd = 0;
+   size_t uLength = 0;
+
+   assert(pcDigits != NULL);
+   assert(puLength != NULL);
+
+   while (isdigit((unsigned char)pcDigits[uLength]))
+   {
+      lFd = lFd * 10 + (pcDigits[uLength] - '0');
+      if (lFd > INT_MAX)
+         lFd = INT_MAX;
+      uLength++;
+   }
+   *puLength = uLength;
+   if (lFd == INT_MAX)
+      return -1;
+   return (int)lFd;
+}
+
+/* return the fd targeted by the redirection operator pcOperator, its
+   leading digits if it has any, else 0 for '<' and 1 for '>' */
+int Redirect_getOperatorFd(const char *pcOperator)
+{
+   size_t uLength;
+   int iFd;
+
+   assert(pcOperator != NULL);
+
+   iFd = redirect_parseFd(pcOperator, &uLength);
+   if (uLength > 0)
+      return iFd;
+   return (pcOperator[0] == '<') ? 0 : 1;
+}
+
+/* create and return the redirection for operator pcOperator followed
+   by word pcWord. return NULL if pcWord doesn't suit pcOperator */
+Redirect_T Redirect_new(const char *pcOperator, const char *pcWord)
+{
+   Redirect_T oRedirect;
+   const char *pcKind;
+   size_t uLength;
+   const char *pcPgmName = getPgmName();
+
+   assert(pcOperator != NULL);
+   assert(pcWord != NULL);
+
+   oRedirect = (struct Redirect*)Mem_alloc(MEM_REDIRECT,
+                                           sizeof(struct Redirect));
+
+   oRedirect->iFd = Redirect_getOperatorFd(pcOperator);
+   oRedirect->iSourceFd = -1;
+   oRedirect->pcWord = NULL;
+   oRedirect->pcBody = NULL;
+   if (oRedirect->iFd == -1)
+   {
+      fprintf(stderr, "%s: file descriptor out of range\n", pcPgmName);
+      Mem_free(oRedirect);
+      return NULL;
+   }
+
+   /* skip the fd to find the kind of operator */
+   pcKind = pcOperator;
+   while (isdigit((unsigned char)*pcKind))
+      pcKind++;
+   oRedirect->cDirection = *pcKind;
+
+   if ((strcmp(pcKind, ">&") == 0) || (strcmp(pcKind, "<&") == 0))
+   {
+      if (strcmp(pcWord, "-") == 0)
+      {
+         oRedirect->eType = REDIRECT_CLOSE;
+         return oRedirect;
+      }
+      oRedirect->eType = REDIRECT_DUP;
+      oRedirect->iSourceFd = redirect_parseFd(pcWord, &uLength);
+      if ((uLength == 0) || (pcWord[uLength] != '\0') ||
+          (oRedirect->iSourceFd == -1))
+      {
+         fprintf(stderr, "%s: %s: bad file descriptor\n",
+                 pcPgmName, pcWord);
+         Mem_free(oRedirect);
+         return NULL;
+      }
+      return oRedirect;
+   }
+
+   if (strcmp(pcKind, "<<<") == 0) /* a here-string ends in newline */
+   {
+      oRedirect->eType = REDIRECT_HERESTRING;
+      oRedirect->pcBody = redirect_copyString(pcWord, "\n");
+      if (oRedirect->pcBody == NULL)
+      {
+         Mem_free(oRedirect);
+         Mem_fail();
+      }
+      return oRedirect;
+   }
+
+   if (strcmp(pcKind, "<") == 0)
+      oRedirect->eType = REDIRECT_INPUT;
+   else if (strcmp(pcKind, "<<") == 0)
+      oRedirect->eType = REDIRECT_HEREDOC;
+   else if (strcmp(pcKind, ">>") == 0)
+      oRedirect->eType = REDIRECT_APPEND;
+   else
+   {
+      assert(strcmp(pcKind, ">") == 0);
+      oRedirect->eType = REDIRECT_OUTPUT;
+   }
+   oRedirect->pcWord = redirect_copyString(pcWord, "");
+   if (oRedirect->pcWord == NULL)
+   {
+      Mem_free(oRedirect);
+      Mem_fail();
+   }
+   return oRedirect;
+}
+
+/* free oRedirect and the strings it owns */
+void Redirect_free(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   Mem_free(oRedirect->pcWord);
+   Mem_free(oRedirect->pcBody);
+   Mem_free(oRedirect);
+}
+
+/* return eType of oRedirect */
+enum RedirectType Redirect_getType(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   return oRedirect->eType;
+}
+
+/* return iFd of oRedirect */
+int Redirect_getFd(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   return oRedirect->iFd;
+}
+
+/* return iSourceFd of oRedirect */
+int Redirect_getSourceFd(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   return oRedirect->iSourceFd;
+}
+
+/* return pcWord of oRedirect */
+char *Redirect_getWord(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   return oRedirect->pcWord;
+}
+
+/* return pcBody of oRedirect */
+char *Redirect_getBody(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   return oRedirect->pcBody;
+}
+
+/* give here-document oRedirect its body pcBody */
+void Redirect_setBody(Redirect_T oRedirect, char *pcBody)
+{
+   assert(oRedirect != NULL);
+   assert(oRedirect->eType == REDIRECT_HEREDOC);
+   assert(pcBody != NULL);
+
+   Mem_free(oRedirect->pcBody);
+   oRedirect->pcBody = pcBody;
+}
+
+/* write oRedirect to stdout. plain stdin and stdout files are written
+   the way they always have been */
+void Redirect_write(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   switch (oRedirect->eType)
+   {
+      case REDIRECT_INPUT:
+         if (oRedirect->iFd == 0)
+            printf("Command stdin: %s\n", oRedirect->pcWord);
+         else
+            printf("Command redirection: %d< %s\n",
+                   oRedirect->iFd, oRedirect->pcWord);
+         break;
+      case REDIRECT_OUTPUT:
+         if (oRedirect->iFd == 1)
+            printf("Command stdout: %s\n", oRedirect->pcWord);
+         else
+            printf("Command redirection: %d> %s\n",
+                   oRedirect->iFd, oRedirect->pcWord);
+         break;
+      case REDIRECT_APPEND:
+         printf("Command redirection: %d>> %s\n",
+                oRedirect->iFd, oRedirect->pcWord);
+         break;
+      case REDIRECT_DUP:
+         printf("Command redirection: %d%c&%d\n", oRedirect->iFd,
+                oRedirect->cDirection, oRedirect->iSourceFd);
+         break;
+      case REDIRECT_CLOSE:
+         printf("Command redirection: %d%c&-\n", oRedirect->iFd,
+                oRedirect->cDirection);
+         break;
+      case REDIRECT_HEREDOC:
+         printf("Command here-document: %s\n", oRedirect->pcWord);
+         break;
+      case REDIRECT_HERESTRING:
+         printf("Command here-string: %s", oRedirect->pcBody);
+         break;
+      default:
+         assert(0);
+   }
+}
+
+/* write the uLength bytes of pcData to iFd, retrying short writes.
+   return 0 if successful, -1 otherwise */
+static int redirect_writeAll(int iFd, const char *pcData,
+                             size_t uLength)
+{
+   ssize_t iWritten;
+
+   assert(pcData != NULL);
+
+   while (uLength > 0)
+   {
+      iWritten = write(iFd, pcData, uLength);
+      if (iWritten == -1)
+         return -1;
+      pcData += iWritten;
+      uLength -= (size_t)iWritten;
+   }
+   return 0;
+}
+
+/* return a close-on-exec fd from which pcBody, the text of a
+   here-document or here-string, can be read, or -1 if it can't be
+   made. bodies that fit in a pipe's atomic write size go through a
+   pipe, and larger ones into an anonymous memfd file, so no temp file
+   ever touches the disk */
+static int redirect_createHereFd(const char *pcBody)
+{
+   size_t uLength;
+   int aiPipe[2];
+   int iFd;
+
+   assert(pcBody != NULL);
+
+   uLength = strlen(pcBody);
+   if (uLength <= PIPE_BUF)
+   {
+      /* an empty pipe always holds PIPE_BUF bytes, so this write
+         can't block waiting for a reader */
+      if (pipe2(aiPipe, O_CLOEXEC) == -1)
+         return -1;
+      if (redirect_writeAll(aiPipe[1], pcBody, uLength) == -1)
+      {
+         (void)close(aiPipe[0]);
+         (void)close(aiPipe[1]);
+         return -1;
+      }
+      (void)close(aiPipe[1]);
+      return aiPipe[0];
+   }
+
+   iFd = memfd_create("ish-heredoc", MFD_CLOEXEC);
+   if (iFd == -1)
+      return -1;
+   if ((redirect_writeAll(iFd, pcBody, uLength) == -1) ||
+       (lseek(iFd, 0, SEEK_SET) == -1))
+   {
+      (void)close(iFd);
+      return -1;
+   }
+   return iFd;
+}
+
+/* move iFd, if it's one of the fds 0..iMaxTarget a plan might target,
+   to a close-on-exec fd above them so that no dup2 of the plan can
+   clobber it. return the fd, or -1 if it can't be moved */
+static int redirect_raiseFd(int iFd, int iMaxTarget)
+{
+   int iNewFd;
+
+   if ((iFd == -1) || (iFd > iMaxTarget))
+      return iFd;
+   iNewFd = fcntl(iFd, F_DUPFD_CLOEXEC, iMaxTarget + 1);
+   (void)close(iFd);
+   return iNewFd;
+}
+
+/* set the source of iTarget in oPlan to iSource, adding iTarget to
+   the end of oPlan if it's not a target yet */
+static void redirect_setPlanFd(RedirectPlan_T oPlan, int iTarget,
+                               int iSource)
+{
+   size_t uIndex;
+
+   assert(oPlan != NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uLength; uIndex++)
+      if (oPlan->piTargets[uIndex] == iTarget)
+      {
+         oPlan->piSources[uIndex] = iSource;
+         return;
+      }
+   oPlan->piTargets[oPlan->uLength] = iTarget;
+   oPlan->piSources[oPlan->uLength] = iSource;
+   oPlan->uLength++;
+}
+
+/* return the fd that oPlan moves onto iTarget, or -1 if oPlan leaves
+   iTarget alone or closes it */
+int Redirect_getPlanFd(RedirectPlan_T oPlan, int iTarget)
+{
+   size_t uIndex;
+
+   assert(oPlan != NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uLength; uIndex++)
+      if (oPlan->piTargets[uIndex] == iTarget)
+         return oPlan->piSources[uIndex];
+   return -1;
+}
+
+/* does oPlan send an fd into several files? */
+int Redirect_hasCopies(RedirectPlan_T oPlan)
+{
+   assert(oPlan != NULL);
+
+   return oPlan->uTeeLength > 0;
+}
+
+/* return the fd that iSourceFd refers to after the redirections
+   already in oPlan: what the plan moved onto it, or the shell's own
+   iSourceFd if the plan hasn't touched it */
+static int redirect_resolveFd(RedirectPlan_T oPlan, int iSourceFd)
+{
+   size_t uIndex;
+
+   assert(oPlan != NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uLength; uIndex++)
+      if (oPlan->piTargets[uIndex] == iSourceFd)
+         return oPlan->piSources[uIndex];
+   return iSourceFd;
+}
+
+/* does any redirection in oRedirects target iFd? */
+static int redirect_isTarget(DynArray_T oRedirects, int iFd)
+{
+   size_t uIndex;
+   Redirect_T oRedirect;
+
+   assert(oRedirects != NULL);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      if (oRedirect->iFd == iFd)
+         return TRUE;
+   }
+   return FALSE;
+}
+
+/* is oRedirect a redirection of its fd into a file? */
+static int redirect_isFileOutput(Redirect_T oRedirect)
+{
+   assert(oRedirect != NULL);
+
+   return (oRedirect->eType == REDIRECT_OUTPUT) ||
+          (oRedirect->eType == REDIRECT_APPEND);
+}
+
+/* return the number of redirections in oRedirects that send iFd into
+   a file. more than one means iFd is fanned out */
+static size_t redirect_countFileOutputs(DynArray_T oRedirects, int iFd)
+{
+   size_t uIndex;
+   size_t uCount = 0;
+   Redirect_T oRedirect;
+
+   assert(oRedirects != NULL);
+
+   for (uIndex = 0; uIndex < DynArray_getLength(oRedirects); uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      if ((oRedirect->iFd == iFd) && redirect_isFileOutput(oRedirect))
+         uCount++;
+   }
+   return uCount;
+}
+
+/* return the copier oPlan fans iTarget out with, creating it and the
+   pipe iTarget is moved onto if this is iTarget's first file. return
+   NULL if the pipe can't be made */
+static Tee_T redirect_getTee(RedirectPlan_T oPlan, int iTarget,
+                             int iMaxTarget)
+{
+   size_t uIndex;
+   int aiPipe[2];
+
+   assert(oPlan != NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uTeeLength; uIndex++)
+      if (oPlan->piTeeTargets[uIndex] == iTarget)
+         return oPlan->aoTees[uIndex];
+
+   if (pipe2(aiPipe, O_CLOEXEC) == -1)
+      return NULL;
+   aiPipe[0] = redirect_raiseFd(aiPipe[0], iMaxTarget);
+   aiPipe[1] = redirect_raiseFd(aiPipe[1], iMaxTarget);
+   if ((aiPipe[0] == -1) || (aiPipe[1] == -1))
+   {
+      if (aiPipe[0] != -1)
+         (void)close(aiPipe[0]);
+      if (aiPipe[1] != -1)
+         (void)close(aiPipe[1]);
+      return NULL;
+   }
+   /* the command writes into the pipe, the copier reads from it */
+   oPlan->piOpened[oPlan->uOpenedLength++] = aiPipe[1];
+   redirect_setPlanFd(oPlan, iTarget, aiPipe[1]);
+   oPlan->piTeeTargets[oPlan->uTeeLength] = iTarget;
+   oPlan->aoTees[oPlan->uTeeLength] = Tee_new(aiPipe[0]);
+   return oPlan->aoTees[oPlan->uTeeLength++];
+}
+
+/* free oPlan's memory, its fds and copiers being closed already */
+static void redirect_destroyPlan(RedirectPlan_T oPlan)
+{
+   assert(oPlan != NULL);
+
+   Mem_free(oPlan->piTargets);
+   Mem_free(oPlan->piSources);
+   Mem_free(oPlan->piOpened);
+   Mem_free(oPlan->piTeeTargets);
+   Mem_free(oPlan->aoTees);
+   Mem_free(oPlan);
+}
+
+/* close and free the plan pvExtra, built part way when memory ran
+   out, copying nothing */
+static void redirect_undoPlan(void *pvExtra)
+{
+   RedirectPlan_T oPlan = (RedirectPlan_T)pvExtra;
+   size_t uIndex;
+
+   assert(oPlan != NULL);
+
+   Redirect_closePlan(oPlan);
+   for (uIndex = 0; uIndex < oPlan->uTeeLength; uIndex++)
+      Tee_free(oPlan->aoTees[uIndex]);
+   redirect_destroyPlan(oPlan);
+}
+
+/* open the files and create the here-document fds that oRedirects
+   needs, and return the resulting plan. return NULL if a file can't
+   be opened */
+static RedirectPlan_T redirect_buildPlan(DynArray_T oRedirects)
+{
+   RedirectPlan_T oPlan;
+   Redirect_T oRedirect;
+   Tee_T oTee;
+   size_t uLength;
+   size_t uIndex;
+   int iMaxTarget = 2;
+   int iSource;
+   struct MemUndo sUndo;
+   const char *pcPgmName = getPgmName();
+
+   assert(oRedirects != NULL);
+
+   uLength = DynArray_getLength(oRedirects);
+   oPlan = (struct RedirectPlan*)Mem_alloc(MEM_REDIRECT,
+                                           sizeof(struct RedirectPlan));
+   oPlan->uLength = 0;
+   oPlan->piTargets = NULL;
+   oPlan->piSources = NULL;
+   oPlan->uOpenedLength = 0;
+   oPlan->piOpened = NULL;
+   oPlan->uTeeLength = 0;
+   oPlan->piTeeTargets = NULL;
+   oPlan->aoTees = NULL;
+   oPlan->oEvent = NULL;
+   oPlan->uBusyLength = 0;
+   oPlan->iReleased = FALSE;
+   oPlan->pfDone = NULL;
+   oPlan->pvDone = NULL;
+   /* what is opened from here on is closed if memory runs out */
+   Mem_pushUndo(&sUndo, redirect_undoPlan, oPlan);
+   /* never more targets or opened fds than redirections */
+   oPlan->piTargets = (int*)Mem_alloc(MEM_REDIRECT,
+                                      sizeof(int) * (uLength + 1));
+   oPlan->piSources = (int*)Mem_alloc(MEM_REDIRECT,
+                                      sizeof(int) * (uLength + 1));
+   oPlan->piOpened = (int*)Mem_alloc(MEM_REDIRECT,
+                                     sizeof(int) * (uLength + 1));
+   oPlan->piTeeTargets = (int*)Mem_alloc(MEM_REDIRECT,
+                                         sizeof(int) * (uLength + 1));
+   oPlan->aoTees = (Tee_T*)Mem_alloc(MEM_REDIRECT,
+                                     sizeof(Tee_T) * (uLength + 1));
+
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      if (oRedirect->iFd > iMaxTarget)
+         iMaxTarget = oRedirect->iFd;
+   }
+
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+   {
+      oRedirect = DynArray_get(oRedirects, uIndex);
+      /* one of several files: the copier, made first, takes the
+         file */
+      oTee = NULL;
+      if (redirect_isFileOutput(oRedirect) &&
+          (redirect_countFileOutputs(oRedirects, oRedirect->iFd) > 1))
+      {
+         oTee = redirect_getTee(oPlan, oRedirect->iFd, iMaxTarget);
+         if (oTee == NULL)
+         {
+            perror(pcPgmName);
+            Mem_popUndo(&sUndo);
+            Redirect_freePlan(oPlan);
+            return NULL;
+         }
+      }
+      switch (oRedirect->eType)
+      {
+         case REDIRECT_INPUT:
+            iSource = open(oRedirect->pcWord, O_RDONLY | O_CLOEXEC);
+            break;
+         case REDIRECT_OUTPUT: /* create the file/overwrite it */
+            iSource = open(oRedirect->pcWord,
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                           PERMISSIONS);
+            break;
+         case REDIRECT_APPEND:
+            iSource = open(oRedirect->pcWord,
+                           O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                           PERMISSIONS);
+            break;
+         case REDIRECT_HEREDOC:
+         case REDIRECT_HERESTRING:
+            assert(oRedirect->pcBody != NULL);
+            iSource = redirect_createHereFd(oRedirect->pcBody);
+            break;
+         case REDIRECT_DUP:
+            iSource = redirect_resolveFd(oPlan, oRedirect->iSourceFd);
+            /* the shell's own fd is copied before the child's dup2s
+               can move another fd onto it, as "3>&1 1>&2 2>&3" does */
+            if ((iSource != oRedirect->iSourceFd) ||
+                (! redirect_isTarget(oRedirects, iSource)))
+            {
+               redirect_setPlanFd(oPlan, oRedirect->iFd, iSource);
+               continue;
+            }
+            iSource = fcntl(iSource, F_DUPFD_CLOEXEC, iMaxTarget + 1);
+            break;
+         case REDIRECT_CLOSE:
+            redirect_setPlanFd(oPlan, oRedirect->iFd, -1);
+            continue;
+         default:
+            assert(0);
+            iSource = -1;
+      }
+      iSource = redirect_raiseFd(iSource, iMaxTarget);
+      if (iSource == -1)
+      {
+         perror(pcPgmName);
+         Mem_popUndo(&sUndo);
+         Redirect_freePlan(oPlan);
+         return NULL;
+      }
+      if (oTee != NULL)
+      {
+         Tee_addTarget(oTee, iSource);
+         continue;
+      }
+      oPlan->piOpened[oPlan->uOpenedLength++] = iSource;
+      redirect_setPlanFd(oPlan, oRedirect->iFd, iSource);
+   }
+   Mem_popUndo(&sUndo);
+   return oPlan;
+}
+
+/* create the plan oRedirects needs, as a traced redirect span */
+RedirectPlan_T Redirect_createPlan(DynArray_T oRedirects)
+{
+   RedirectPlan_T oPlan;
+
+   Trace_begin(TRACE_REDIRECT);
+   oPlan = redirect_buildPlan(oRedirects);
+   Trace_end(TRACE_REDIRECT, 0, 0);
+   return oPlan;
+}
+
+/* put oPlan's fds in place, with one dup2 (or close) per target fd.
+   the fds the shell opened are close-on-exec, so they need no closing
+   here. return 0 if successful, or -1 with errno set otherwise */
+int Redirect_applyPlan(RedirectPlan_T oPlan)
+{
+   size_t uIndex;
+   int iTarget;
+   int iSource;
+
+   assert(oPlan != NULL);
+
+   Trace_begin(TRACE_REDIRECT);
+   for (uIndex = 0; uIndex < oPlan->uLength; uIndex++)
+   {
+      iTarget = oPlan->piTargets[uIndex];
+      iSource = oPlan->piSources[uIndex];
+      if (iSource == -1)
+         (void)close(iTarget);
+      else if ((iSource != iTarget) && (dup2(iSource, iTarget) == -1))
+      {
+         Trace_end(TRACE_REDIRECT, 0, 0);
+         return -1;
+      }
+   }
+   Trace_end(TRACE_REDIRECT, 0, 0);
+   return 0;
+}
+
+/* free the released plan oPlan, whose copiers are done, and then call
+   its pfDone */
+static void redirect_endPlan(RedirectPlan_T oPlan)
+{
+   void (*pfDone)(void *pvExtra);
+   void *pvDone;
+
+   assert(oPlan != NULL);
+
+   pfDone = oPlan->pfDone;
+   pvDone = oPlan->pvDone;
+   redirect_destroyPlan(oPlan);
+   if (pfDone != NULL)
+      (*pfDone)(pvDone);
+}
+
+/* the event loop's handler for the pipe iFd of one of the copiers of
+   plan pvExtra: pump one round, and finish the copier at end of file */
+static void redirect_pumpTee(int iFd, void *pvExtra)
+{
+   RedirectPlan_T oPlan = (RedirectPlan_T)pvExtra;
+   size_t uIndex;
+   int iRet;
+
+   assert(oPlan != NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uTeeLength; uIndex++)
+      if ((oPlan->aoTees[uIndex] != NULL) &&
+          (Tee_getFd(oPlan->aoTees[uIndex]) == iFd))
+         break;
+   assert(uIndex < oPlan->uTeeLength);
+
+   iRet = Tee_pump(oPlan->aoTees[uIndex]);
+   if (iRet > 0)
+      return;
+   if (iRet == -1)
+      perror(getPgmName());
+   Event_unwatchFd(oPlan->oEvent, iFd);
+   Tee_free(oPlan->aoTees[uIndex]);
+   oPlan->aoTees[uIndex] = NULL;
+   oPlan->uBusyLength--;
+   if (oPlan->iReleased && (oPlan->uBusyLength == 0))
+      redirect_endPlan(oPlan);
+}
+
+/* have oEvent pump oPlan's copiers as data arrives */
+int Redirect_watchPlan(RedirectPlan_T oPlan, Event_T oEvent)
+{
+   size_t uIndex;
+   int iSavedErrno;
+
+   assert(oPlan != NULL);
+   assert(oEvent != NULL);
+   assert(oPlan->oEvent == NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uTeeLength; uIndex++)
+      if (Event_watchFd(oEvent, Tee_getFd(oPlan->aoTees[uIndex]),
+                        redirect_pumpTee, oPlan) == -1)
+      {  /* all or nothing */
+         iSavedErrno = errno;
+         while (uIndex-- > 0)
+            Event_unwatchFd(oEvent, Tee_getFd(oPlan->aoTees[uIndex]));
+         errno = iSavedErrno;
+         return -1;
+      }
+   oPlan->oEvent = oEvent;
+   oPlan->uBusyLength = oPlan->uTeeLength;
+   return 0;
+}
+
+/* close the fds the shell opened for oPlan */
+void Redirect_closePlan(RedirectPlan_T oPlan)
+{
+   size_t uIndex;
+
+   assert(oPlan != NULL);
+
+   for (uIndex = 0; uIndex < oPlan->uOpenedLength; uIndex++)
+      (void)close(oPlan->piOpened[uIndex]);
+   oPlan->uOpenedLength = 0;
+}
+
+/* close oPlan's fds, and free it now if no watched copier is busy,
+   else when the last one finishes */
+void Redirect_releasePlan(RedirectPlan_T oPlan)
+{
+   assert(oPlan != NULL);
+
+   Redirect_finishPlan(oPlan, NULL, NULL);
+}
+
+/* give oPlan up, and call (*pfDone)(pvExtra) once it is freed */
+void Redirect_finishPlan(RedirectPlan_T oPlan,
+                         void (*pfDone)(void *pvExtra), void *pvExtra)
+{
+   assert(oPlan != NULL);
+
+   Redirect_closePlan(oPlan);
+   oPlan->pfDone = pfDone;
+   oPlan->pvDone = pvExtra;
+   if (oPlan->uBusyLength == 0)
+   {  /* nothing left to copy */
+      Redirect_freePlan(oPlan);
+      if (pfDone != NULL)
+         (*pfDone)(pvExtra);
+   }
+   else
+      oPlan->iReleased = TRUE;
+}
+
+/* close the fds the shell opened for oPlan, then copy whatever is
+   still to be written into fds that oPlan fans out into their files
+   until every writer closes them, and free oPlan */
+void Redirect_freePlan(RedirectPlan_T oPlan)
+{
+   size_t uIndex;
+   int iRet;
+
+   assert(oPlan != NULL);
+
+   Redirect_closePlan(oPlan);
+   for (uIndex = 0; uIndex < oPlan->uTeeLength; uIndex++)
+   {
+      if (oPlan->aoTees[uIndex] == NULL)
+         continue;
+      if (oPlan->oEvent != NULL)
+         Event_unwatchFd(oPlan->oEvent,
+                         Tee_getFd(oPlan->aoTees[uIndex]));
+      do
+         iRet = Tee_pump(oPlan->aoTees[uIndex]);
+      while (iRet > 0);
+      if (iRet == -1)
+         perror(getPgmName());
+      Tee_free(oPlan->aoTees[uIndex]);
+   }
+   redirect_destroyPlan(oPlan);
+}
@@ -0,0 +1,114 @@
+/*--------------------------------------------------------------------*/
+/* redirect.h                                                         */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef REDIRECT_INCLUDED
+#define REDIRECT_INCLUDED
+
+#include "dynarray.h"
+#include "event.h"
+
+/* Redirect_T will be an object to the user but is in reality a
+   pointer to a redirect structure, one redirection operator of a
+   command along with the word that follows it */
+typedef struct Redirect *Redirect_T;
+
+/* RedirectPlan_T is a pointer to a plan structure, the fds a list of
+   redirections resolves to, opened by the shell and ready to be moved
+   into place in a child with one dup2 per target fd. an fd redirected
+   into several files ("> a > b") is sent into a pipe that the shell
+   copies into each of the files */
+typedef struct RedirectPlan *RedirectPlan_T;
+
+/* the kinds of redirection */
+enum RedirectType {REDIRECT_INPUT,     /* N< file    */
+                   REDIRECT_OUTPUT,    /* N> file    */
+                   REDIRECT_APPEND,    /* N>> file   */
+                   REDIRECT_DUP,       /* N>&M, N<&M */
+                   REDIRECT_CLOSE,     /* N>&-, N<&- */
+                   REDIRECT_HEREDOC,   /* N<< delim  */
+                   REDIRECT_HERESTRING /* N<<< word  */};
+
+/* return the fd targeted by the redirection operator pcOperator, one
+   of the special tokens made by the lexical analyzer */
+int Redirect_getOperatorFd(const char *pcOperator);
+
+/* create and return the redirection for operator pcOperator followed
+   by word pcWord. write a message to stderr and return NULL if pcWord
+   doesn't suit pcOperator. the caller owns the redirection */
+Redirect_T Redirect_new(const char *pcOperator, const char *pcWord);
+
+/* free oRedirect */
+void Redirect_free(Redirect_T oRedirect);
+
+/* return the kind of oRedirect */
+enum RedirectType Redirect_getType(Redirect_T oRedirect);
+
+/* return the fd that oRedirect targets */
+int Redirect_getFd(Redirect_T oRedirect);
+
+/* return the fd that a dup oRedirect copies onto its fd */
+int Redirect_getSourceFd(Redirect_T oRedirect);
+
+/* return the file name of an input, output or append oRedirect, or the
+   delimiter of a here-document, or NULL otherwise */
+char *Redirect_getWord(Redirect_T oRedirect);
+
+/* return the text of a here-document or here-string oRedirect, or NULL
+   if it has none (yet) */
+char *Redirect_getBody(Redirect_T oRedirect);
+
+/* give here-document oRedirect its body pcBody. oRedirect takes
+   ownership of pcBody */
+void Redirect_setBody(Redirect_T oRedirect, char *pcBody);
+
+/* write oRedirect to stdout */
+void Redirect_write(Redirect_T oRedirect);
+
+/* open the files and create the here-document fds that oRedirects, an
+   array of Redirect_T in command line order, needs, and return the
+   resulting plan. write a message to stderr and return NULL if a file
+   can't be opened. the caller owns the plan */
+RedirectPlan_T Redirect_createPlan(DynArray_T oRedirects);
+
+/* return the fd that oPlan moves onto iTarget, or -1 if oPlan leaves
+   iTarget alone or closes it */
+int Redirect_getPlanFd(RedirectPlan_T oPlan, int iTarget);
+
+/* does oPlan send an fd into several files, which takes the shell to
+   copy? return 1 if true */
+int Redirect_hasCopies(RedirectPlan_T oPlan);
+
+/* put oPlan's fds in place, with one dup2 (or close) per target fd.
+   meant to be called in a child between fork and exec. return 0 if
+   successful, or -1 with errno set otherwise */
+int Redirect_applyPlan(RedirectPlan_T oPlan);
+
+/* have oEvent copy what is written into each fd oPlan sends into
+   several files into those files, as the data arrives. return 0 if
+   successful, or -1 with errno set otherwise */
+int Redirect_watchPlan(RedirectPlan_T oPlan, Event_T oEvent);
+
+/* close the fds the shell opened for oPlan. call once every child
+   that needs them has been forked, so the copiers can see end of
+   file */
+void Redirect_closePlan(RedirectPlan_T oPlan);
+
+/* close oPlan's fds and give it up: it is freed now if it isn't busy,
+   or by its event loop once it is done otherwise */
+void Redirect_releasePlan(RedirectPlan_T oPlan);
+
+/* give oPlan up as Redirect_releasePlan does, and call
+   (*pfDone)(pvExtra), unless pfDone is NULL, once it is freed: before
+   returning if it isn't busy, or from its event loop once the copying
+   is done otherwise */
+void Redirect_finishPlan(RedirectPlan_T oPlan,
+                         void (*pfDone)(void *pvExtra), void *pvExtra);
+
+/* close the fds the shell opened for oPlan and free it. copiers not
+   done yet are pumped to end of file first, blocking until every
+   writer closes them */
+void Redirect_freePlan(RedirectPlan_T oPlan);
+
+#endif
@@ -0,0 +1,479 @@
+/*--------------------------------------------------------------------
+  schedule.c
+  Author: Nate Wilson
+  Description: the sched prefix, and the spreading of commands run at
+  once across CPUs. a command otherwise inherits the shell's CPU
+  affinity, nice value, I/O priority and scheduling policy, so sched
+  has them set in the child between the fork and the exec, after its
+  options have been checked in the shell, where a mistake can be
+  reported before anything is started
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "schedule.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "mem.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* I/O priorities as the kernel takes them: the class in the top bits,
+   the level below */
+enum {IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_SHIFT = 13,
+      IOPRIO_MAX_LEVEL = 7};
+
+/* where the NUMA nodes are listed */
+static const char *pcNodeDir = "/sys/devices/system/node";
+
+/* a name -i or -p takes, with its value */
+struct ScheduleName
+{
+   const char *pcName;
+   int iValue;
+};
+
+/* the I/O scheduling classes, and the scheduling policies */
+enum {IO_CLASS_COUNT = 3, POLICY_COUNT = 5};
+
+static const struct ScheduleName asIoClasses[IO_CLASS_COUNT] =
+{
+   {"realtime", 1}, {"best-effort", 2}, {"idle", 3}
+};
+
+static const struct ScheduleName asPolicies[POLICY_COUNT] =
+{
+   {"other", SCHED_OTHER}, {"batch", SCHED_BATCH}, {"idle", SCHED_IDLE},
+   {"fifo", SCHED_FIFO}, {"rr", SCHED_RR}
+};
+
+/* what a command is run with, as given on the sched command line */
+struct ScheduleSettings
+{
+   /* the CPUs it may run on, if given */
+   int iHasCpus;
+   cpu_set_t sCpus;
+   /* how much its nice value is adjusted, if given */
+   int iHasNice;
+   int iNice;
+   /* its I/O priority, as the kernel takes it, if given */
+   int iHasIoPriority;
+   int iIoPriority;
+   /* its scheduling policy and priority, if given */
+   int iHasPolicy;
+   int iPolicy;
+   int iPriority;
+};
+
+/* the groups commands are spread across */
+struct ScheduleSpread
+{
+   cpu_set_t *psGroups;
+   size_t uCount;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* parse pcValue as a decimal number from lMin to lMax, storing it in
+   *piValue. return TRUE if successful, FALSE if it isn't one */
+static int schedule_parseNumber(const char *pcValue, long lMin, long lMax,
+                                int *piValue)
+{
+   char *pcEnd;
+   long lValue;
+
+   assert(pcValue != NULL);
+   assert(piValue != NULL);
+
+   if (! (isdigit((unsigned char)pcValue[0]) || (pcValue[0] == '-')))
+      return FALSE;
+   errno = 0;
+   lValue = strtol(pcValue, &pcEnd, 10);
+   if ((errno != 0) || (*pcEnd != '\0') || (lValue < lMin) ||
+       (lValue > lMax))
+      return FALSE;
+   *piValue = (int)lValue;
+   return TRUE;
+}
+
+/* parse pcValue as a list of CPUs, numbers and ranges like "0-3,8"
+   separated by commas, storing them in *psCpus. return TRUE if
+   successful, FALSE if pcValue isn't one */
+static int schedule_parseCpus(const char *pcValue, cpu_set_t *psCpus)
+{
+   char *pcEnd;
+   unsigned long ulFirst;
+   unsigned long ulLast;
+
+   assert(pcValue != NULL);
+   assert(psCpus != NULL);
+
+   CPU_ZERO(psCpus);
+   for (;;)
+   {
+      if (! isdigit((unsigned char)*pcValue))
+         return FALSE;
+      ulFirst = strtoul(pcValue, &pcEnd, 10);
+      ulLast = ulFirst;
+      if (*pcEnd == '-')
+      {
+         pcValue = pcEnd + 1;
+         if (! isdigit((unsigned char)*pcValue))
+            return FALSE;
+         ulLast = strtoul(pcValue, &pcEnd, 10);
+      }
+      if ((ulFirst > ulLast) || (ulLast >= CPU_SETSIZE))
+         return FALSE;
+      for (; ulFirst <= ulLast; ulFirst++)
+         CPU_SET((int)ulFirst, psCpus);
+      if (*pcEnd != ',')
+         break;
+      pcValue = pcEnd + 1;
+   }
+   return *pcEnd == '\0';
+}
+
+/* return TRUE if any of psCpus is one the shell may run on, FALSE
+   otherwise, as the kernel refuses such a list only in the child */
+static int schedule_checkCpus(const cpu_set_t *psCpus)
+{
+   cpu_set_t sAllowed;
+
+   assert(psCpus != NULL);
+
+   /* if the shell's own CPUs can't be had, leave it to the kernel */
+   if (sched_getaffinity(0, sizeof(sAllowed), &sAllowed) == -1)
+      return TRUE;
+   CPU_AND(&sAllowed, &sAllowed, psCpus);
+   return CPU_COUNT(&sAllowed) > 0;
+}
+
+/* parse pcValue as one of the uCount names in asNames, then
+   optionally ':' and a number from lMin to lMax, storing the name's
+   value in *piValue and the number, or 0, in *piNumber. return TRUE if
+   successful, FALSE otherwise */
+static int schedule_parseNamed(const char *pcValue,
+                               const struct ScheduleName asNames[],
+                               size_t uCount, long lMin, long lMax,
+                               int *piValue, int *piNumber)
+{
+   const char *pcColon;
+   size_t uLength;
+   size_t uIndex;
+
+   assert(pcValue != NULL);
+   assert(piValue != NULL);
+   assert(piNumber != NULL);
+
+   pcColon = strchr(pcValue, ':');
+   uLength = (pcColon == NULL) ? strlen(pcValue)
+      : (size_t)(pcColon - pcValue);
+   for (uIndex = 0; uIndex < uCount; uIndex++)
+      if ((strncmp(pcValue, asNames[uIndex].pcName, uLength) == 0) &&
+          (asNames[uIndex].pcName[uLength] == '\0'))
+         break;
+   if (uIndex == uCount)
+      return FALSE;
+   *piValue = asNames[uIndex].iValue;
+   *piNumber = 0;
+   if (pcColon == NULL)
+      return TRUE;
+   return schedule_parseNumber(pcColon + 1, lMin, lMax, piNumber);
+}
+
+/* parse pcValue as -i's class[:level] into psSettings. return TRUE
+   if successful, FALSE otherwise */
+static int schedule_parseIoPriority(const char *pcValue,
+                                    struct ScheduleSettings *psSettings)
+{
+   int iClass;
+   int iLevel;
+
+   if (! schedule_parseNamed(pcValue, asIoClasses, IO_CLASS_COUNT, 0,
+                             IOPRIO_MAX_LEVEL, &iClass, &iLevel))
+      return FALSE;
+   psSettings->iIoPriority = (iClass << IOPRIO_CLASS_SHIFT) | iLevel;
+   return TRUE;
+}
+
+/* parse pcValue as -p's policy[:priority] into psSettings. return
+   TRUE if successful, FALSE otherwise */
+static int schedule_parsePolicy(const char *pcValue,
+                                struct ScheduleSettings *psSettings)
+{
+   int iRealTime;
+
+   if (! schedule_parseNamed(pcValue, asPolicies, POLICY_COUNT,
+                             sched_get_priority_min(SCHED_FIFO),
+                             sched_get_priority_max(SCHED_FIFO),
+                             &psSettings->iPolicy,
+                             &psSettings->iPriority))
+      return FALSE;
+   /* only the real time policies have priorities, which they need */
+   iRealTime = (psSettings->iPolicy == SCHED_FIFO) ||
+               (psSettings->iPolicy == SCHED_RR);
+   if (iRealTime && (psSettings->iPriority == 0))
+      psSettings->iPriority = sched_get_priority_min(psSettings->iPolicy);
+   return iRealTime || (psSettings->iPriority == 0);
+}
+
+/* fill psSettings from the sched prefix at token *puIndex of oTokens
+   and its options, and move *puIndex past them. return TRUE if
+   successful, FALSE (after writing a message to stderr) if they are
+   malformed */
+static int schedule_parseOptions(DynArray_T oTokens, size_t *puIndex,
+                                 struct ScheduleSettings *psSettings)
+{
+   size_t uIndex;
+   size_t uLength;
+   const char *pcOption;
+   const char *pcValue;
+   int iValid;
+   const char *pcPgmName = getPgmName();
+
+   assert(oTokens != NULL);
+   assert(puIndex != NULL);
+   assert(psSettings != NULL);
+
+   memset(psSettings, 0, sizeof(*psSettings));
+
+   uLength = DynArray_getLength(oTokens);
+   /* token *puIndex is "sched" itself */
+   for (uIndex = *puIndex + 1; uIndex < uLength; uIndex++)
+   {
+      pcOption = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (pcOption[0] != '-')
+         break;
+      if ((strlen(pcOption) != 2) ||
+          (strchr("cnip", pcOption[1]) == NULL))
+      {
+         fprintf(stderr, "%s: sched: invalid option %s\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      /* every option takes a value */
+      if (uIndex + 1 == uLength)
+      {
+         fprintf(stderr, "%s: sched: option %s requires a value\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      uIndex++;
+      pcValue = Token_getValue(DynArray_get(oTokens, uIndex));
+      switch (pcOption[1])
+      {
+         case 'c':
+            iValid = schedule_parseCpus(pcValue, &psSettings->sCpus);
+            psSettings->iHasCpus = TRUE;
+            break;
+         case 'n':
+            iValid = schedule_parseNumber(pcValue, -40, 40,
+                                          &psSettings->iNice);
+            psSettings->iHasNice = TRUE;
+            break;
+         case 'i':
+            iValid = schedule_parseIoPriority(pcValue, psSettings);
+            psSettings->iHasIoPriority = TRUE;
+            break;
+         default:
+            iValid = schedule_parsePolicy(pcValue, psSettings);
+            psSettings->iHasPolicy = TRUE;
+            break;
+      }
+      if (! iValid)
+      {
+         fprintf(stderr, "%s: sched: invalid value for %s: %s\n",
+                 pcPgmName, pcOption, pcValue);
+         return FALSE;
+      }
+      if ((pcOption[1] == 'c') &&
+          (! schedule_checkCpus(&psSettings->sCpus)))
+      {
+         fprintf(stderr, "%s: sched: no CPU in %s %s is available\n",
+                 pcPgmName, pcOption, pcValue);
+         return FALSE;
+      }
+   }
+   *puIndex = uIndex;
+   return TRUE;
+}
+
+
+/* add psCpus, the CPUs of a group, to psSpread, unless it is empty */
+static void schedule_addGroup(struct ScheduleSpread *psSpread,
+                              const cpu_set_t *psCpus)
+{
+   if (CPU_COUNT(psCpus) == 0)
+      return;
+   psSpread->psGroups = (cpu_set_t*)Mem_realloc(MEM_BUILTIN,
+      psSpread->psGroups, (psSpread->uCount + 1) * sizeof(cpu_set_t));
+   psSpread->psGroups[psSpread->uCount++] = *psCpus;
+}
+
+/* add a group to psSpread for each NUMA node with CPUs in psAllowed.
+   return TRUE if the nodes could be listed, FALSE otherwise */
+static int schedule_addNodes(struct ScheduleSpread *psSpread,
+                             const cpu_set_t *psAllowed)
+{
+   enum {MAX_PATH_LENGTH = 64, MAX_LIST_LENGTH = 4096};
+   char acPath[MAX_PATH_LENGTH];
+   char acList[MAX_LIST_LENGTH];
+   struct dirent *psEntry;
+   cpu_set_t sCpus;
+   unsigned uNode;
+   char cAfter;
+   FILE *psFile;
+   DIR *psDir;
+
+   psDir = opendir(pcNodeDir);
+   if (psDir == NULL)
+      return FALSE;
+   while ((psEntry = readdir(psDir)) != NULL)
+   {
+      if (sscanf(psEntry->d_name, "node%u%c", &uNode, &cAfter) != 1)
+         continue;
+      sprintf(acPath, "%s/node%u/cpulist", pcNodeDir, uNode);
+      psFile = fopen(acPath, "re");
+      if (psFile == NULL)
+         continue;
+      if ((fgets(acList, (int)sizeof(acList), psFile) != NULL) &&
+          (acList[0] != '\n'))
+      {
+         acList[strcspn(acList, "\n")] = '\0';
+         if (schedule_parseCpus(acList, &sCpus))
+         {
+            CPU_AND(&sCpus, &sCpus, psAllowed);
+            schedule_addGroup(psSpread, &sCpus);
+         }
+      }
+      (void)fclose(psFile);
+   }
+   (void)closedir(psDir);
+   return TRUE;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* parse the sched prefix at token *puIndex of oTokens */
+ScheduleSettings_T Schedule_parse(DynArray_T oTokens, size_t *puIndex)
+{
+   struct ScheduleSettings *psSettings;
+
+   psSettings = (struct ScheduleSettings*)Mem_alloc(MEM_BUILTIN,
+                                                    sizeof(*psSettings));
+   if (! schedule_parseOptions(oTokens, puIndex, psSettings))
+   {
+      Mem_free(psSettings);
+      return NULL;
+   }
+   return psSettings;
+}
+
+/* make the calling process run as oSettings says */
+int Schedule_apply(ScheduleSettings_T oSettings)
+{
+   struct sched_param sParam;
+
+   assert(oSettings != NULL);
+
+   if (oSettings->iHasCpus &&
+       (sched_setaffinity(0, sizeof(oSettings->sCpus),
+                          &oSettings->sCpus) == -1))
+      return -1;
+   if (oSettings->iHasPolicy)
+   {
+      sParam.sched_priority = oSettings->iPriority;
+      if (sched_setscheduler(0, oSettings->iPolicy, &sParam) == -1)
+         return -1;
+   }
+   if (oSettings->iHasNice)
+   {  /* -1 is a nice value as well as the error */
+      errno = 0;
+      if ((nice(oSettings->iNice) == -1) && (errno != 0))
+         return -1;
+   }
+   if (oSettings->iHasIoPriority &&
+       (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                oSettings->iIoPriority) == -1))
+      return -1;
+   return 0;
+}
+
+/* free oSettings */
+void Schedule_freeSettings(ScheduleSettings_T oSettings)
+{
+   Mem_free(oSettings);
+}
+
+/* return the groups pcMode names */
+ScheduleSpread_T Schedule_newSpread(const char *pcMode)
+{
+   struct ScheduleSpread *psSpread;
+   cpu_set_t sAllowed;
+   cpu_set_t sCpu;
+   int iCpu;
+   const char *pcPgmName = getPgmName();
+
+   assert(pcMode != NULL);
+
+   if ((strcmp(pcMode, "cpu") != 0) && (strcmp(pcMode, "node") != 0))
+   {
+      fprintf(stderr, "%s: invalid spread %s\n", pcPgmName, pcMode);
+      return NULL;
+   }
+   if (sched_getaffinity(0, sizeof(sAllowed), &sAllowed) == -1)
+   {
+      perror(pcPgmName);
+      return NULL;
+   }
+   psSpread = (struct ScheduleSpread*)Mem_calloc(MEM_BUILTIN, 1,
+                                              sizeof(*psSpread));
+   /* without NUMA, a node is every CPU */
+   if ((strcmp(pcMode, "node") == 0) &&
+       ((! schedule_addNodes(psSpread, &sAllowed)) ||
+        (psSpread->uCount == 0)))
+      schedule_addGroup(psSpread, &sAllowed);
+   if (strcmp(pcMode, "cpu") == 0)
+      for (iCpu = 0; iCpu < CPU_SETSIZE; iCpu++)
+         if (CPU_ISSET(iCpu, &sAllowed))
+         {
+            CPU_ZERO(&sCpu);
+            CPU_SET(iCpu, &sCpu);
+            schedule_addGroup(psSpread, &sCpu);
+         }
+   return psSpread;
+}
+
+/* limit the calling process to group uSlot of oSpread */
+int Schedule_applySpread(ScheduleSpread_T oSpread, size_t uSlot)
+{
+   assert(oSpread != NULL);
+   assert(oSpread->uCount > 0);
+
+   return sched_setaffinity(0, sizeof(cpu_set_t),
+                            &oSpread->psGroups[uSlot % oSpread->uCount]);
+}
+
+/* free oSpread */
+void Schedule_freeSpread(ScheduleSpread_T oSpread)
+{
+   assert(oSpread != NULL);
+
+   Mem_free(oSpread->psGroups);
+   Mem_free(oSpread);
+}
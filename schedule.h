@@ -0,0 +1,56 @@
+/*--------------------------------------------------------------------*/
+/* schedule.h                                                         */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef SCHEDULE_INCLUDED
+#define SCHEDULE_INCLUDED
+
+#include "dynarray.h"
+#include <stddef.h>
+
+/* ScheduleSettings_T is a pointer to what a sched prefix (see
+   prefix.h) gives:
+      sched [-c cpus] [-n adjustment] [-i class[:level]]
+            [-p policy[:priority]] [cmd [args]]
+   cmd runs with the CPUs it may run on limited to cpus, a list like
+   "0-3,8", its nice value adjusted by adjustment, its I/O scheduling
+   class (realtime, best-effort or idle) and level (0 to 7), and its
+   scheduling policy (other, batch, idle, fifo or rr) and priority (1
+   to 99 for fifo and rr). what isn't given is inherited from the
+   shell */
+typedef struct ScheduleSettings *ScheduleSettings_T;
+
+/* parse the sched prefix whose name is token *puIndex of oTokens, and
+   move *puIndex to the token after its options. return its settings,
+   or NULL after writing a message to stderr if they are malformed or
+   name no CPU the shell may run on. the caller owns the settings */
+ScheduleSettings_T Schedule_parse(DynArray_T oTokens, size_t *puIndex);
+
+/* make the calling process, the shell or a child about to exec, run
+   as oSettings says. return 0 if successful, or -1 with errno set
+   otherwise */
+int Schedule_apply(ScheduleSettings_T oSettings);
+
+/* free oSettings */
+void Schedule_freeSettings(ScheduleSettings_T oSettings);
+
+/* ScheduleSpread_T is a pointer to the groups of CPUs that commands run
+   at once are spread across, one CPU or one NUMA node each, among
+   those the shell may run on */
+typedef struct ScheduleSpread *ScheduleSpread_T;
+
+/* return the groups pcMode names, "cpu" for one per CPU or "node" for
+   one per NUMA node, or NULL after writing a message to stderr if
+   pcMode is neither or they can't be found */
+ScheduleSpread_T Schedule_newSpread(const char *pcMode);
+
+/* limit the calling process, a child about to exec, to the CPUs of
+   group uSlot of oSpread, counting round from the first again past the
+   last. return 0 if successful, or -1 with errno set otherwise */
+int Schedule_applySpread(ScheduleSpread_T oSpread, size_t uSlot);
+
+/* free oSpread */
+void Schedule_freeSpread(ScheduleSpread_T oSpread);
+
+#endif
@@ -0,0 +1,691 @@
+/*--------------------------------------------------------------------*/
+/* script.c                                                           */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "script.h"
+#include "command.h"
+#include "lex.h"
+#include "token.h"
+#include "dynarray.h"
+#include "ish.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* the first bytes of every compiled script, and the version of the
+   layout that follows them. a compiled script is only ever read on
+   the machine that wrote it, so sizes are stored in native form */
+static const char acScriptMagic[4] = {'I', 'S', 'H', 'B'};
+enum {SCRIPT_VERSION = 2};
+
+/* what's added to a source's name to name its compiled script */
+static const char pcScriptSuffix[] = ".ishb";
+
+/* how a token's type is stored. a line whose tokens depend on when it
+   is lexed, because it has expansions, is stored as one SCRIPT_LINE
+   token holding the line, to be lexed when it runs */
+enum {SCRIPT_ORDINARY = 'o', SCRIPT_SPECIAL = 's', SCRIPT_PATTERN = 'p',
+      SCRIPT_LINE = 'l'};
+
+/* a compiled script starts with a header and then the source's path.
+   each command follows as its token count, its tokens (a type byte
+   and a string each), its here-document count and its here-document
+   bodies. a string is its length, its chars and a '\0' */
+struct ScriptHeader
+{
+   char acMagic[4];
+   unsigned int uVersion;
+   /* the source when it was compiled */
+   unsigned long ulSize;
+   long lMtime;
+   long lMtimeNsec;
+   unsigned long ulHash;
+   /* how many commands follow */
+   size_t uCommandCount;
+   /* the length of the source's path */
+   size_t uSourceLength;
+};
+
+struct Script
+{
+   /* the mapped file and its length */
+   char *pcMap;
+   size_t uMapLength;
+   /* the header, copied out of the map */
+   struct ScriptHeader sHeader;
+   /* the offset of the first command, and of what's read next */
+   size_t uStart;
+   size_t uOffset;
+   /* how many commands are left to read, and how many here-document
+      bodies are left in the last command read */
+   size_t uCommandsLeft;
+   size_t uBodiesLeft;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* return the 32-bit FNV-1a hash of what's left of psFile */
+static unsigned long script_hashFile(FILE *psFile)
+{
+   const unsigned long ulFnvOffset = 2166136261UL;
+   const unsigned long ulFnvPrime = 16777619UL;
+
+   unsigned long ulHash = ulFnvOffset;
+   int iChar;
+
+   assert(psFile != NULL);
+
+   while ((iChar = getc(psFile)) != EOF)
+   {
+      ulHash ^= (unsigned long)(unsigned char)iChar;
+      ulHash = (ulHash * ulFnvPrime) & 0xffffffffUL;
+   }
+   return ulHash;
+}
+
+/* return a copy of pcValue, which the caller owns */
+static char *script_copy(const char *pcValue)
+{
+   char *pcCopy;
+
+   assert(pcValue != NULL);
+
+   pcCopy = (char*)Mem_alloc(MEM_SCRIPT, strlen(pcValue) + 1);
+   return strcpy(pcCopy, pcValue);
+}
+
+/* return pcSource with the compiled script suffix added, which the
+   caller owns */
+static char *script_getCompiledPath(const char *pcSource)
+{
+   char *pcCompiled;
+
+   assert(pcSource != NULL);
+
+   pcCompiled = (char*)Mem_alloc(MEM_SCRIPT, strlen(pcSource) +
+                                             sizeof(pcScriptSuffix));
+   strcpy(pcCompiled, pcSource);
+   strcat(pcCompiled, pcScriptSuffix);
+   return pcCompiled;
+}
+
+/* is psHeader's record of its source up to date with pcSource? a
+   source whose size and mtime match is; one whose mtime alone moved
+   is if its contents still hash the same. return TRUE or FALSE. errno
+   is left 0 unless pcSource can't be read */
+static int script_isFresh(const struct ScriptHeader *psHeader,
+                          const char *pcSource)
+{
+   struct stat sStat;
+   FILE *psSource;
+   unsigned long ulHash;
+
+   assert(psHeader != NULL);
+   assert(pcSource != NULL);
+
+   errno = 0;
+   if (stat(pcSource, &sStat) == -1)
+      return FALSE;
+   if ((unsigned long)sStat.st_size != psHeader->ulSize)
+      return FALSE;
+   if (((long)sStat.st_mtim.tv_sec == psHeader->lMtime) &&
+       ((long)sStat.st_mtim.tv_nsec == psHeader->lMtimeNsec))
+      return TRUE;
+   psSource = fopen(pcSource, "re");
+   if (psSource == NULL)
+      return FALSE;
+   ulHash = script_hashFile(psSource);
+   (void)fclose(psSource);
+   return ulHash == psHeader->ulHash;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* write uValue to psFile */
+static void script_putSize(FILE *psFile, size_t uValue)
+{
+   (void)fwrite(&uValue, sizeof(uValue), 1, psFile);
+}
+
+/* write the string pcValue to psFile */
+static void script_putString(FILE *psFile, const char *pcValue)
+{
+   size_t uLength;
+
+   assert(pcValue != NULL);
+
+   uLength = strlen(pcValue);
+   script_putSize(psFile, uLength);
+   (void)fwrite(pcValue, 1, uLength + 1, psFile);
+}
+
+/* write the tokens of oTokens to psFile */
+static void script_putTokens(FILE *psFile, DynArray_T oTokens)
+{
+   size_t uIndex;
+   size_t uLength;
+   Token_T oToken;
+
+   assert(oTokens != NULL);
+
+   uLength = DynArray_getLength(oTokens);
+   script_putSize(psFile, uLength);
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+   {
+      oToken = DynArray_get(oTokens, uIndex);
+      if (Token_isSpecial(oToken))
+         (void)putc(SCRIPT_SPECIAL, psFile);
+      else if (Token_isPattern(oToken))
+         (void)putc(SCRIPT_PATTERN, psFile);
+      else
+         (void)putc(SCRIPT_ORDINARY, psFile);
+      script_putString(psFile, Token_getValue(oToken));
+   }
+}
+
+/* read the here-document bodies oCommand needs from psSource and write
+   them, with their count, to psCompiled */
+static void script_putHereBodies(FILE *psCompiled, FILE *psSource,
+                                 Command_T oCommand)
+{
+   DynArray_T oBodies;
+   char *pcBody;
+   size_t uIndex;
+
+   assert(oCommand != NULL);
+
+   oBodies = DynArray_new(0);
+   if (oBodies == NULL)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   while (Command_getHereDelimiter(oCommand) != NULL)
+   {
+      pcBody = lex_readHereBody(psSource,
+                                Command_getHereDelimiter(oCommand),
+                                FALSE);
+      if (DynArray_add(oBodies, pcBody) == 0)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+      Command_setHereBody(oCommand, script_copy(pcBody));
+   }
+   script_putSize(psCompiled, DynArray_getLength(oBodies));
+   for (uIndex = 0; uIndex < DynArray_getLength(oBodies); uIndex++)
+   {
+      pcBody = DynArray_get(oBodies, uIndex);
+      script_putString(psCompiled, pcBody);
+      Mem_free(pcBody);
+   }
+   DynArray_free(oBodies);
+}
+
+/* write the commands of psSource, whose path is pcSource, to
+   psCompiled and store how many there were in *puCount. return 0 if
+   successful, or -1 after writing a message to stderr if a line has an
+   error */
+static int script_putCommands(FILE *psCompiled, FILE *psSource,
+                              const char *pcSource, size_t *puCount)
+{
+   char *pcLine;
+   DynArray_T oTokens;
+   Command_T oCommand;
+   unsigned long ulLine = 0;
+   int iRet = 0;
+
+   assert(puCount != NULL);
+
+   *puCount = 0;
+   while ((pcLine = lex_readLine(psSource)) != NULL)
+   {
+      ulLine++;
+      /* expansions wait for the line to run */
+      oTokens = lex_lexLineUnexpanded(pcLine);
+      if (oTokens == NULL)
+      {Mem_free(pcLine); iRet = -1; break;}
+      if (DynArray_getLength(oTokens) == 0)
+      {
+         Mem_free(pcLine);
+         DynArray_free(oTokens);
+         continue;
+      }
+      /* store the tokens before the command takes them apart */
+      if (lex_hasExpansion(pcLine))
+      {
+         script_putSize(psCompiled, 1);
+         (void)putc(SCRIPT_LINE, psCompiled);
+         script_putString(psCompiled, pcLine);
+      }
+      else
+         script_putTokens(psCompiled, oTokens);
+      Mem_free(pcLine);
+      oCommand = Command_createCommand(oTokens);
+      if (oCommand == NULL)
+      {
+         lex_freeTokens(oTokens);
+         DynArray_free(oTokens);
+         iRet = -1;
+         break;
+      }
+      script_putHereBodies(psCompiled, psSource, oCommand);
+      Command_freeCommand(oCommand);
+      lex_freeTokens(oTokens);
+      DynArray_free(oTokens);
+      (*puCount)++;
+   }
+   if (iRet == 0)
+      return 0;
+   fprintf(stderr, "%s: %s: line %lu: not compiled\n", getPgmName(),
+           pcSource, ulLine);
+   return -1;
+}
+
+/* compile the ish script pcSource into pcSource.ishb. return 0 if
+   successful, or -1 after writing a message to stderr. nothing is
+   written if any line of pcSource has an error */
+int Script_compile(const char *pcSource)
+{
+   struct ScriptHeader sHeader;
+   struct stat sStat;
+   FILE *psSource;
+   FILE *psCompiled;
+   char *pcRealSource;
+   char *pcCompiled;
+   char *pcTemp;
+   int iRet;
+
+   assert(pcSource != NULL);
+
+   psSource = fopen(pcSource, "re");
+   if (psSource == NULL)
+   {perror(pcSource); return -1;}
+   pcRealSource = realpath(pcSource, NULL);
+   if ((pcRealSource == NULL) ||
+       (fstat(fileno(psSource), &sStat) == -1))
+   {
+      perror(pcSource);
+      free(pcRealSource);
+      (void)fclose(psSource);
+      return -1;
+   }
+
+   memset(&sHeader, 0, sizeof(sHeader));
+   memcpy(sHeader.acMagic, acScriptMagic, sizeof(acScriptMagic));
+   sHeader.uVersion = SCRIPT_VERSION;
+   sHeader.ulSize = (unsigned long)sStat.st_size;
+   sHeader.lMtime = (long)sStat.st_mtim.tv_sec;
+   sHeader.lMtimeNsec = (long)sStat.st_mtim.tv_nsec;
+   sHeader.ulHash = script_hashFile(psSource);
+   sHeader.uSourceLength = strlen(pcRealSource);
+   rewind(psSource);
+
+   /* write a temporary file and rename it into place, so that a
+      compiled script is never seen half written */
+   pcCompiled = script_getCompiledPath(pcSource);
+   pcTemp = script_getCompiledPath(pcCompiled);
+   psCompiled = fopen(pcTemp, "we");
+   if (psCompiled == NULL)
+   {
+      perror(pcTemp);
+      Mem_free(pcTemp);
+      Mem_free(pcCompiled);
+      free(pcRealSource);
+      (void)fclose(psSource);
+      return -1;
+   }
+   (void)fwrite(&sHeader, sizeof(sHeader), 1, psCompiled);
+   (void)fwrite(pcRealSource, 1, sHeader.uSourceLength + 1, psCompiled);
+   iRet = script_putCommands(psCompiled, psSource, pcSource,
+                             &sHeader.uCommandCount);
+   if (iRet == 0)
+   {  /* now the command count is known */
+      rewind(psCompiled);
+      (void)fwrite(&sHeader, sizeof(sHeader), 1, psCompiled);
+      if (ferror(psCompiled))
+      {perror(pcTemp); iRet = -1;}
+   }
+   if ((fclose(psCompiled) == EOF) && (iRet == 0))
+   {perror(pcTemp); iRet = -1;}
+   if ((iRet == 0) && (rename(pcTemp, pcCompiled) == -1))
+   {perror(pcCompiled); iRet = -1;}
+   if (iRet == -1)
+      (void)unlink(pcTemp);
+
+   Mem_free(pcTemp);
+   Mem_free(pcCompiled);
+   free(pcRealSource);
+   (void)fclose(psSource);
+   return iRet;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* read a size from oScript into *puValue. return 0 if successful, or
+   -1 if the map ends first */
+static int script_getSize(Script_T oScript, size_t *puValue)
+{
+   assert(oScript != NULL);
+   assert(puValue != NULL);
+
+   if (oScript->uMapLength - oScript->uOffset < sizeof(*puValue))
+      return -1;
+   memcpy(puValue, oScript->pcMap + oScript->uOffset, sizeof(*puValue));
+   oScript->uOffset += sizeof(*puValue);
+   return 0;
+}
+
+/* read a string from oScript. return the string, which is in the map,
+   or NULL if it isn't well formed */
+static char *script_getString(Script_T oScript)
+{
+   size_t uLength;
+   char *pcValue;
+
+   assert(oScript != NULL);
+
+   if (script_getSize(oScript, &uLength) == -1)
+      return NULL;
+   if (oScript->uMapLength - oScript->uOffset <= uLength)
+      return NULL;
+   pcValue = oScript->pcMap + oScript->uOffset;
+   if (pcValue[uLength] != '\0')
+      return NULL;
+   oScript->uOffset += uLength + 1;
+   return pcValue;
+}
+
+/* walk every command of oScript to make sure that reading it later
+   can't run off the map. return 0 if it's well formed, -1 if not */
+static int script_check(Script_T oScript)
+{
+   size_t uCommand;
+   size_t uCount;
+   size_t uIndex;
+   char cType;
+
+   assert(oScript != NULL);
+
+   for (uCommand = 0; uCommand < oScript->sHeader.uCommandCount;
+        uCommand++)
+   {
+      if (script_getSize(oScript, &uCount) == -1)
+         return -1;
+      for (uIndex = 0; uIndex < uCount; uIndex++)
+      {
+         if (oScript->uOffset == oScript->uMapLength)
+            return -1;
+         cType = oScript->pcMap[oScript->uOffset++];
+         if ((cType != SCRIPT_ORDINARY) && (cType != SCRIPT_SPECIAL) &&
+             (cType != SCRIPT_PATTERN) &&
+             ((cType != SCRIPT_LINE) || (uCount != 1)))
+            return -1;
+         if (script_getString(oScript) == NULL)
+            return -1;
+      }
+      if (script_getSize(oScript, &uCount) == -1)
+         return -1;
+      for (uIndex = 0; uIndex < uCount; uIndex++)
+         if (script_getString(oScript) == NULL)
+            return -1;
+   }
+   if (oScript->uOffset != oScript->uMapLength)
+      return -1;
+   oScript->uOffset = oScript->uStart;
+   return 0;
+}
+
+/* map the file pcPath. return it as a script if it's a well formed
+   compiled script. otherwise return NULL, setting *piCompiled to TRUE
+   if it claimed to be one anyway */
+static Script_T script_map(const char *pcPath, int *piCompiled)
+{
+   struct Script *psScript;
+   struct stat sStat;
+   char *pcSource;
+   void *pvMap;
+   int iFd;
+
+   assert(pcPath != NULL);
+   assert(piCompiled != NULL);
+
+   *piCompiled = FALSE;
+   iFd = open(pcPath, O_RDONLY | O_CLOEXEC);
+   if (iFd == -1)
+      return NULL;
+   if ((fstat(iFd, &sStat) == -1) || (! S_ISREG(sStat.st_mode)) ||
+       ((size_t)sStat.st_size < sizeof(acScriptMagic)))
+   {
+      (void)close(iFd);
+      return NULL;
+   }
+   pvMap = mmap(NULL, (size_t)sStat.st_size, PROT_READ, MAP_PRIVATE,
+                iFd, 0);
+   (void)close(iFd);
+   if (pvMap == MAP_FAILED)
+      return NULL;
+   if (memcmp(pvMap, acScriptMagic, sizeof(acScriptMagic)) != 0)
+   {
+      (void)munmap(pvMap, (size_t)sStat.st_size);
+      return NULL;
+   }
+   *piCompiled = TRUE;
+   if ((size_t)sStat.st_size < sizeof(struct ScriptHeader))
+   {
+      (void)munmap(pvMap, (size_t)sStat.st_size);
+      return NULL;
+   }
+   (void)madvise(pvMap, (size_t)sStat.st_size, MADV_SEQUENTIAL);
+
+   psScript = (struct Script*)Mem_alloc(MEM_SCRIPT,
+                                        sizeof(struct Script));
+   psScript->pcMap = (char*)pvMap;
+   psScript->uMapLength = (size_t)sStat.st_size;
+   memcpy(&psScript->sHeader, pvMap, sizeof(struct ScriptHeader));
+   psScript->uOffset = sizeof(struct ScriptHeader);
+   psScript->uCommandsLeft = psScript->sHeader.uCommandCount;
+   psScript->uBodiesLeft = 0;
+
+   /* the source's path, stored like any other string but with the
+      length kept in the header */
+   pcSource = psScript->pcMap + psScript->uOffset;
+   if ((psScript->sHeader.uVersion != SCRIPT_VERSION) ||
+       (psScript->uMapLength - psScript->uOffset <=
+        psScript->sHeader.uSourceLength) ||
+       (pcSource[psScript->sHeader.uSourceLength] != '\0'))
+   {
+      Script_free(psScript);
+      return NULL;
+   }
+   psScript->uOffset += psScript->sHeader.uSourceLength + 1;
+   psScript->uStart = psScript->uOffset;
+   if (script_check(psScript) == -1)
+   {
+      Script_free(psScript);
+      return NULL;
+   }
+   return psScript;
+}
+
+/* open pcPath, a compiled script or a script's source, for running.
+   return the compiled script if pcPath is one that is up to date with
+   its source, or a source whose compiled script is up to date.
+   otherwise return NULL and set *ppcSource to the source to read
+   instead, which the caller owns, or to NULL after writing a message
+   to stderr if there's nothing to run */
+Script_T Script_open(const char *pcPath, char **ppcSource)
+{
+   Script_T oScript;
+   const char *pcSource;
+   char *pcCompiled;
+   int iCompiled;
+
+   assert(pcPath != NULL);
+   assert(ppcSource != NULL);
+
+   *ppcSource = NULL;
+
+   /* run a compiled script unless its source has since changed. one
+      whose source is gone runs as it is */
+   oScript = script_map(pcPath, &iCompiled);
+   if (oScript != NULL)
+   {
+      pcSource = oScript->pcMap + sizeof(struct ScriptHeader);
+      if (script_isFresh(&oScript->sHeader, pcSource) ||
+          (errno == ENOENT))
+         return oScript;
+      *ppcSource = script_copy(pcSource);
+      Script_free(oScript);
+      return NULL;
+   }
+   if (iCompiled)
+   {
+      fprintf(stderr, "%s: %s: bad compiled script\n", getPgmName(),
+              pcPath);
+      return NULL;
+   }
+
+   /* pcPath is a source, which runs from its compiled script if that
+      is up to date */
+   pcCompiled = script_getCompiledPath(pcPath);
+   oScript = script_map(pcCompiled, &iCompiled);
+   Mem_free(pcCompiled);
+   if (oScript != NULL)
+   {
+      if (script_isFresh(&oScript->sHeader, pcPath))
+         return oScript;
+      Script_free(oScript);
+   }
+   *ppcSource = script_copy(pcPath);
+   return NULL;
+}
+
+/* write a message that oScript is corrupt, and end it there */
+static void script_endCorrupt(Script_T oScript)
+{
+   assert(oScript != NULL);
+
+   fprintf(stderr, "%s: compiled script is corrupt\n", getPgmName());
+   oScript->uCommandsLeft = 0;
+   oScript->uBodiesLeft = 0;
+}
+
+/* return the tokens of oScript's next command, as lex_lexLine would,
+   or NULL if no commands remain. the caller owns the array and its
+   tokens */
+DynArray_T Script_nextTokens(Script_T oScript)
+{
+   DynArray_T oTokens;
+   Token_T oToken;
+   size_t uCount;
+   size_t uIndex;
+   char cType;
+
+   assert(oScript != NULL);
+
+   /* skip the bodies of the last command that weren't asked for */
+   while (oScript->uBodiesLeft > 0)
+      Mem_free(Script_nextHereBody(oScript));
+   if (oScript->uCommandsLeft == 0)
+      return NULL;
+   oScript->uCommandsLeft--;
+
+   /* script_check made sure none of these reads can fail, unless the
+      file changed under the map since */
+   if (script_getSize(oScript, &uCount) == -1)
+   {
+      script_endCorrupt(oScript);
+      return NULL;
+   }
+   if ((uCount == 1) &&
+       (oScript->pcMap[oScript->uOffset] == SCRIPT_LINE))
+   {  /* a line with expansions is lexed now. one that fails runs as
+         an empty line, its message written */
+      oScript->uOffset++;
+      oTokens = lex_lexLine(script_getString(oScript));
+      if (oTokens == NULL)
+         oTokens = DynArray_new(0);
+      if (oTokens == NULL)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+      (void)script_getSize(oScript, &oScript->uBodiesLeft);
+      return oTokens;
+   }
+   oTokens = DynArray_new(uCount);
+   if (oTokens == NULL)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   for (uIndex = 0; uIndex < uCount; uIndex++)
+   {
+      cType = oScript->pcMap[oScript->uOffset++];
+      oToken = Token_new(cType == SCRIPT_SPECIAL ? TOKEN_SPECIAL
+                         : TOKEN_ORDINARY, script_getString(oScript));
+      if (cType == SCRIPT_PATTERN)
+         Token_setPattern(oToken);
+      DynArray_set(oTokens, uIndex, oToken);
+   }
+   (void)script_getSize(oScript, &oScript->uBodiesLeft);
+   return oTokens;
+}
+
+/* return the body of oScript's next here-document, which the caller
+   owns */
+char *Script_nextHereBody(Script_T oScript)
+{
+   assert(oScript != NULL);
+
+   if (oScript->uBodiesLeft == 0)
+      return script_copy("");
+   oScript->uBodiesLeft--;
+   return script_copy(script_getString(oScript));
+}
+
+/* has every command of oScript been read? */
+int Script_isDone(Script_T oScript)
+{
+   assert(oScript != NULL);
+
+   return oScript->uCommandsLeft == 0;
+}
+
+/* is oScript's next command a line with expansions? */
+int Script_nextHasExpansion(Script_T oScript)
+{
+   size_t uOffset;
+   size_t uCount;
+   int iLine;
+
+   assert(oScript != NULL);
+
+   while (oScript->uBodiesLeft > 0)
+      Mem_free(Script_nextHereBody(oScript));
+   if (oScript->uCommandsLeft == 0)
+      return FALSE;
+   uOffset = oScript->uOffset;
+   if (script_getSize(oScript, &uCount) == -1)
+   {
+      script_endCorrupt(oScript);
+      return FALSE;
+   }
+   iLine = (uCount == 1) &&
+      (oScript->pcMap[oScript->uOffset] == SCRIPT_LINE);
+   oScript->uOffset = uOffset;
+   return iLine;
+}
+
+/* unmap and free oScript */
+void Script_free(Script_T oScript)
+{
+   assert(oScript != NULL);
+
+   (void)munmap(oScript->pcMap, oScript->uMapLength);
+   Mem_free(oScript);
+}
@@ -0,0 +1,53 @@
+/*--------------------------------------------------------------------*/
+/* script.h                                                           */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef SCRIPT_INCLUDED
+#define SCRIPT_INCLUDED
+
+#include "dynarray.h"
+
+/* Script_T will be an object to the user but is in reality a pointer
+   to a script structure, a compiled ish script mapped into memory. a
+   compiled script holds each command's tokens and here-document bodies
+   so that running it takes no reading of lines or lexing, except of
+   lines with expansions, which are lexed as they run. it lives next to
+   its source, named like it with ".ishb" added, and records the
+   source's size, mtime and hash so that a stale one is never run */
+typedef struct Script *Script_T;
+
+/* compile the ish script pcSource into pcSource.ishb. return 0 if
+   successful, or -1 after writing a message to stderr. nothing is
+   written if any line of pcSource has an error */
+int Script_compile(const char *pcSource);
+
+/* open pcPath, a compiled script or a script's source, for running.
+   return the compiled script if pcPath is one that is up to date with
+   its source, or a source whose compiled script is up to date.
+   otherwise return NULL and set *ppcSource to the source to read
+   instead, which the caller owns, or to NULL after writing a message
+   to stderr if there's nothing to run */
+Script_T Script_open(const char *pcPath, char **ppcSource);
+
+/* return the tokens of oScript's next command, as lex_lexLine would,
+   or NULL if no commands remain. the caller owns the array and its
+   tokens */
+DynArray_T Script_nextTokens(Script_T oScript);
+
+/* return the body of oScript's next here-document, which the caller
+   owns */
+char *Script_nextHereBody(Script_T oScript);
+
+/* has every command of oScript been read? return 1 if true */
+int Script_isDone(Script_T oScript);
+
+/* is oScript's next command a line with expansions, which
+   Script_nextTokens will lex (and so expand) as it reads it? skips
+   the unread bodies of the last command read. return 1 if true */
+int Script_nextHasExpansion(Script_T oScript);
+
+/* unmap and free oScript */
+void Script_free(Script_T oScript);
+
+#endif
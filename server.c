@@ -0,0 +1,416 @@
+/*--------------------------------------------------------------------
+  server.c
+  Author: Nate Wilson
+  Description: server mode. one long-lived shell listens on a Unix
+  socket and runs the command lines its clients send, each with the
+  client's own stdin, stdout and stderr, which come over the socket as
+  SCM_RIGHTS. every connection and child is multiplexed through the
+  shell's event loop, so clients don't wait on one another
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "server.h"
+#include "event.h"
+#include "command.h"
+#include "redirect.h"
+#include "lex.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "mem.h"
+#include "glob.h"
+#include "path.h"
+#include "spawn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* a command killed by a signal exits this plus the signal, as in sh */
+enum {SERVER_SIGNALED = 128};
+
+/* one client connection */
+struct Connection
+{
+   /* the connected socket */
+   int iFd;
+   /* the loop watching it */
+   Event_T oEvent;
+   /* number of its commands still running */
+   size_t uPending;
+   /* has the client hung up? */
+   int iClosed;
+};
+
+/* one command being run for a client */
+struct Request
+{
+   /* the connection to reply on */
+   struct Connection *psConnection;
+   /* the command's redirections */
+   RedirectPlan_T oPlan;
+   /* the status to reply with, once the command has exited */
+   int iStatus;
+};
+
+/* says whether a command name is one of the shell's builtins */
+static int (*pfServerIsBuiltin)(const char *pcName);
+
+/* free psConnection once the client has hung up and none of its
+   commands are left to reply for */
+static void server_releaseConnection(struct Connection *psConnection)
+{
+   assert(psConnection != NULL);
+
+   if (psConnection->iClosed && (psConnection->uPending == 0))
+      Mem_free(psConnection);
+}
+
+/* send exit status iStatus to the client of psConnection, if it is
+   still there. a client that doesn't read its replies loses them
+   rather than stalling the server */
+static void server_reply(struct Connection *psConnection, int iStatus)
+{
+   char acReply[SERVER_MAX_REPLY_LENGTH];
+
+   assert(psConnection != NULL);
+
+   if (psConnection->iClosed)
+      return;
+   sprintf(acReply, "%d", iStatus);
+   (void)send(psConnection->iFd, acReply, strlen(acReply),
+              MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/* the handler for the struct Request pvExtra's plan being done with,
+   once what its command wrote has all been copied: reply, and free
+   the request */
+static void server_finishRequest(void *pvExtra)
+{
+   struct Request *psRequest = (struct Request*)pvExtra;
+   struct Connection *psConnection;
+
+   assert(psRequest != NULL);
+
+   psConnection = psRequest->psConnection;
+   server_reply(psConnection, psRequest->iStatus);
+   Mem_free(psRequest);
+   psConnection->uPending--;
+   server_releaseConnection(psConnection);
+}
+
+/* the event loop's handler for a client's command exiting with wait
+   status iStatus: reply for the struct Request pvExtra once the loop
+   has finished copying its output, so that "> a > b" doesn't hold up
+   the other clients */
+static void server_reap(pid_t iPid, int iStatus, void *pvExtra)
+{
+   struct Request *psRequest = (struct Request*)pvExtra;
+
+   (void)iPid;
+   assert(psRequest != NULL);
+
+   if (WIFSIGNALED(iStatus))
+      psRequest->iStatus = SERVER_SIGNALED + WTERMSIG(iStatus);
+   else
+      psRequest->iStatus = WEXITSTATUS(iStatus);
+   Redirect_finishPlan(psRequest->oPlan, server_finishRequest,
+                       psRequest);
+}
+
+/* start oCommand for the client of psConnection, whose fds are aiFds.
+   return -1 if the command was started and its status will be sent
+   when it exits, or the status to send now otherwise */
+static int server_startCommand(struct Connection *psConnection,
+                               Command_T oCommand, const int aiFds[])
+{
+   struct Request *psRequest;
+   RedirectPlan_T oPlan;
+   DynArray_T oTokens;
+   char **apcArgv;
+   size_t uLength;
+   size_t uIndex;
+   pid_t iPid;
+   const char *pcPgmName = getPgmName();
+
+   assert(psConnection != NULL);
+   assert(oCommand != NULL);
+   assert(aiFds != NULL);
+
+   /* a request is a single line */
+   if (Command_getHereDelimiter(oCommand) != NULL)
+   {
+      fprintf(stderr, "%s: here-documents are not supported by the "
+              "server\n", pcPgmName);
+      return SERVER_BAD_REQUEST;
+   }
+   /* a builtin would change the server, which every client shares */
+   oTokens = Command_getTokens(oCommand);
+   if ((*pfServerIsBuiltin)(Token_getValue(DynArray_get(oTokens, 0))))
+   {
+      fprintf(stderr, "%s: %s: builtins are not supported by the "
+              "server\n", pcPgmName,
+              Token_getValue(DynArray_get(oTokens, 0)));
+      return SERVER_BAD_REQUEST;
+   }
+
+   oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if (oPlan == NULL)
+      return SERVER_BAD_REQUEST;
+   if (Redirect_watchPlan(oPlan, psConnection->oEvent) == -1)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      return SERVER_BAD_REQUEST;
+   }
+
+   uLength = DynArray_getLength(oTokens);
+   apcArgv = (char**)Mem_alloc(MEM_SERVER,
+                               sizeof(char *) * (uLength + 1));
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+      apcArgv[uIndex] = (char*)Token_getValue(DynArray_get(oTokens,
+                                                           uIndex));
+   apcArgv[uLength] = NULL;
+
+   /* the client's fds, then the redirections on top of them */
+   iPid = Spawn_command(apcArgv, Path_find(apcArgv[0]), aiFds, oPlan,
+                        NULL, NULL);
+   Mem_free(apcArgv);
+   Redirect_closePlan(oPlan);
+   if (iPid == -1)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      return ISH_CANNOT_RUN;
+   }
+
+   /* the client of a background command hears back right away */
+   if (Command_isBackground(oCommand))
+   {
+      if (Event_reapChild(psConnection->oEvent, iPid, NULL, NULL) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE); }
+      Redirect_releasePlan(oPlan);
+      return 0;
+   }
+
+   psRequest = (struct Request*)Mem_alloc(MEM_SERVER,
+                                          sizeof(struct Request));
+   psRequest->psConnection = psConnection;
+   psRequest->oPlan = oPlan;
+   psConnection->uPending++;
+   /* a child that can't be watched is reaped, and replied for, now */
+   if (Event_reapChild(psConnection->oEvent, iPid, server_reap,
+                       psRequest) == -1)
+   {perror(pcPgmName); exit(EXIT_FAILURE); }
+   return -1;
+}
+
+/* run the command line pcLine for the client of psConnection, whose
+   fds are aiFds. messages about the line go to the client's stderr.
+   return -1 if a command was started, or the status to send now */
+static int server_runLine(struct Connection *psConnection,
+                          const char *pcLine, const int aiFds[])
+{
+   DynArray_T oTokens;
+   Command_T oCommand;
+   int iSavedStderr;
+   int iStatus = SERVER_BAD_REQUEST;
+
+   assert(psConnection != NULL);
+   assert(pcLine != NULL);
+   assert(aiFds != NULL);
+
+   iSavedStderr = fcntl(2, F_DUPFD_CLOEXEC, 0);
+   if ((iSavedStderr == -1) || (dup2(aiFds[2], 2) == -1))
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+
+   oTokens = lex_lexLine(pcLine);
+   if (oTokens != NULL)
+   {
+      Glob_expandTokens(oTokens);
+      oCommand = Command_createCommand(oTokens);
+      if (oCommand != NULL)
+      {
+         iStatus = server_startCommand(psConnection, oCommand, aiFds);
+         Command_freeCommand(oCommand);
+      }
+      else if (DynArray_getLength(oTokens) == 0) /* empty line */
+         iStatus = 0;
+      lex_freeTokens(oTokens);
+      DynArray_free(oTokens);
+   }
+
+   if (dup2(iSavedStderr, 2) == -1)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   (void)close(iSavedStderr);
+   return iStatus;
+}
+
+/* stop watching the connection psConnection and close it */
+static void server_closeConnection(struct Connection *psConnection)
+{
+   assert(psConnection != NULL);
+
+   Event_unwatchFd(psConnection->oEvent, psConnection->iFd);
+   (void)close(psConnection->iFd);
+   psConnection->iClosed = TRUE;
+   server_releaseConnection(psConnection);
+}
+
+/* the event loop's handler for the connection iFd, whose struct
+   Connection is pvExtra: receive one request and run it */
+static void server_readRequest(int iFd, void *pvExtra)
+{
+   struct Connection *psConnection = (struct Connection*)pvExtra;
+   char acRequest[SERVER_MAX_REQUEST_LENGTH + 1];
+   union
+   {
+      struct cmsghdr sHeader; /* for alignment */
+      char acSpace[CMSG_SPACE(sizeof(int) * SERVER_FD_COUNT)];
+   } uControl;
+   struct msghdr sMessage;
+   struct iovec sIovec;
+   struct cmsghdr *psHeader;
+   int aiFds[SERVER_FD_COUNT];
+   size_t uFdCount = 0;
+   size_t uIndex;
+   ssize_t iLength;
+   int iStatus;
+
+   assert(psConnection != NULL);
+
+   memset(&sMessage, 0, sizeof(sMessage));
+   sIovec.iov_base = acRequest;
+   sIovec.iov_len = SERVER_MAX_REQUEST_LENGTH;
+   sMessage.msg_iov = &sIovec;
+   sMessage.msg_iovlen = 1;
+   sMessage.msg_control = uControl.acSpace;
+   sMessage.msg_controllen = sizeof(uControl.acSpace);
+
+   iLength = recvmsg(iFd, &sMessage, MSG_CMSG_CLOEXEC);
+   if ((iLength == -1) && ((errno == EINTR) || (errno == EAGAIN)))
+      return;
+   if (iLength <= 0) /* hung up */
+   {
+      server_closeConnection(psConnection);
+      return;
+   }
+
+   for (psHeader = CMSG_FIRSTHDR(&sMessage); psHeader != NULL;
+        psHeader = CMSG_NXTHDR(&sMessage, psHeader))
+      if ((psHeader->cmsg_level == SOL_SOCKET) &&
+          (psHeader->cmsg_type == SCM_RIGHTS))
+         for (uIndex = 0; uIndex < (psHeader->cmsg_len -
+                                    CMSG_LEN(0)) / sizeof(int); uIndex++)
+         {
+            if (uFdCount < SERVER_FD_COUNT)
+               memcpy(&aiFds[uFdCount], CMSG_DATA(psHeader) +
+                      uIndex * sizeof(int), sizeof(int));
+            uFdCount++;
+         }
+
+   if ((uFdCount != SERVER_FD_COUNT) ||
+       (sMessage.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+      iStatus = SERVER_BAD_REQUEST;
+   else
+   {
+      acRequest[iLength] = '\0';
+      if ((iLength > 0) && (acRequest[iLength - 1] == '\n'))
+         acRequest[iLength - 1] = '\0';
+      iStatus = server_runLine(psConnection, acRequest, aiFds);
+   }
+   for (uIndex = 0; (uIndex < uFdCount) && (uIndex < SERVER_FD_COUNT);
+        uIndex++)
+      (void)close(aiFds[uIndex]);
+   if (iStatus != -1)
+      server_reply(psConnection, iStatus);
+}
+
+/* the event loop's handler for the listening socket iFd: accept a
+   client and watch its connection through the loop pvExtra */
+static void server_accept(int iFd, void *pvExtra)
+{
+   Event_T oEvent = (Event_T)pvExtra;
+   struct Connection *psConnection;
+   int iClientFd;
+
+   assert(oEvent != NULL);
+
+   iClientFd = accept4(iFd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+   if (iClientFd == -1) /* e.g. the client already gave up */
+      return;
+   psConnection = (struct Connection*)Mem_alloc(
+      MEM_SERVER, sizeof(struct Connection));
+   psConnection->iFd = iClientFd;
+   psConnection->oEvent = oEvent;
+   psConnection->uPending = 0;
+   psConnection->iClosed = FALSE;
+   if (Event_watchFd(oEvent, iClientFd, server_readRequest,
+                     psConnection) == -1)
+   {
+      perror(getPgmName());
+      (void)close(iClientFd);
+      Mem_free(psConnection);
+   }
+}
+
+/* listen on the Unix socket pcPath and serve clients through oEvent */
+void Server_run(const char *pcPath, Event_T oEvent,
+                int (*pfIsBuiltin)(const char *pcName))
+{
+   struct sockaddr_un sAddress;
+   struct stat sStat;
+   int iFd;
+   const char *pcPgmName = getPgmName();
+
+   assert(pcPath != NULL);
+   assert(oEvent != NULL);
+   assert(pfIsBuiltin != NULL);
+
+   pfServerIsBuiltin = pfIsBuiltin;
+   memset(&sAddress, 0, sizeof(sAddress));
+   sAddress.sun_family = AF_UNIX;
+   if (strlen(pcPath) >= sizeof(sAddress.sun_path))
+   {
+      fprintf(stderr, "%s: %s: socket path too long\n", pcPgmName,
+              pcPath);
+      return;
+   }
+   strcpy(sAddress.sun_path, pcPath);
+
+   /* a socket left behind by an earlier server is reused */
+   if ((lstat(pcPath, &sStat) == 0) && S_ISSOCK(sStat.st_mode))
+      (void)unlink(pcPath);
+
+   iFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                0);
+   if (iFd == -1)
+   {
+      perror(pcPgmName);
+      return;
+   }
+   if ((bind(iFd, (struct sockaddr*)&sAddress, sizeof(sAddress)) == -1)
+       || (listen(iFd, SOMAXCONN) == -1) ||
+       (Event_watchFd(oEvent, iFd, server_accept, oEvent) == -1))
+   {
+      perror(pcPath);
+      (void)close(iFd);
+      return;
+   }
+
+   for (;;)
+      if (Event_runOnce(oEvent, -1) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE);}
+}
@@ -0,0 +1,34 @@
+/*--------------------------------------------------------------------*/
+/* server.h                                                           */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef SERVER_INCLUDED
+#define SERVER_INCLUDED
+
+#include "event.h"
+
+/* the protocol spoken over the server's SOCK_SEQPACKET socket. a
+   request is one message holding a command line, with the client's
+   stdin, stdout and stderr attached as SCM_RIGHTS. the reply is one
+   message holding the command's exit status in decimal. replies to
+   several requests on one connection come in the order the commands
+   finish. a command line's $(command) and <(command) words aren't
+   run: lexing them fails, and the request with it */
+enum {SERVER_MAX_REQUEST_LENGTH = 65536};
+enum {SERVER_FD_COUNT = 3};
+enum {SERVER_MAX_REPLY_LENGTH = 16};
+
+/* the exit status of a request that could not be run */
+enum {SERVER_BAD_REQUEST = 2};
+
+/* listen on the Unix socket pcPath and run the commands that clients
+   send, multiplexing every connection and child through oEvent. a
+   command whose pooled name (*pfIsBuiltin)(name) says is one of the
+   shell's builtins is refused, as it would change the server for
+   every client. only returns, with a message written to stderr, if
+   the socket can't be set up */
+void Server_run(const char *pcPath, Event_T oEvent,
+                int (*pfIsBuiltin)(const char *pcName));
+
+#endif
@@ -0,0 +1,81 @@
+/*--------------------------------------------------------------------
+  spawn.c
+  Author: Nate Wilson
+  Description: forking a child that runs a command. every command the
+  shell, its builtins and the library run is started here, so that
+  they all set up the child and fail in the same way
+  --------------------------------------------------------------------*/
+
+#include "spawn.h"
+#include "ish.h"
+#include "redirect.h"
+#include "trace.h"
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/* the fds aiFds of Spawn_command may stand in for */
+enum {SPAWN_FD_COUNT = 3};
+
+/* write the program's name and the message for errno to stderr, as
+   perror does, but with write, whose lock a thread of the parent
+   can't have been holding at the fork */
+static void spawn_writeError(void)
+{
+   const char *pcName = getPgmName();
+   const char *pcMessage = strerror(errno);
+
+   (void)write(2, pcName, strlen(pcName));
+   (void)write(2, ": ", 2);
+   (void)write(2, pcMessage, strlen(pcMessage));
+   (void)write(2, "\n", 1);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* fork a child that runs the command apcArgv */
+pid_t Spawn_command(char *apcArgv[], const char *pcFile,
+                    const int aiFds[], RedirectPlan_T oPlan,
+                    void (*pfSetup)(void *pvExtra), void *pvExtra)
+{
+   pid_t iPid;
+   int iFd;
+   int iErrno;
+
+   assert(apcArgv != NULL);
+   assert(apcArgv[0] != NULL);
+   assert(oPlan != NULL);
+
+   Trace_begin(TRACE_FORK);
+   iPid = fork();
+   if (iPid != 0) /* parent process */
+   {
+      if (iPid != -1)
+         Trace_end(TRACE_FORK, (int)iPid, 0);
+      return iPid;
+   }
+
+   /* _exit throughout, as exit would flush the parent's stdio buffers
+      again and rewind the script the shell reads from */
+   if (aiFds != NULL)
+      for (iFd = 0; iFd < SPAWN_FD_COUNT; iFd++)
+         if ((aiFds[iFd] != -1) && (dup2(aiFds[iFd], iFd) == -1))
+         {spawn_writeError(); _exit(ISH_CANNOT_RUN); }
+   /* one dup2 per redirected fd */
+   if (Redirect_applyPlan(oPlan) == -1)
+   {spawn_writeError(); _exit(ISH_CANNOT_RUN); }
+   if (pfSetup != NULL)
+      (*pfSetup)(pvExtra);
+   Trace_mark(TRACE_EXEC, 0, 0);
+   if (pcFile != NULL)
+      execv(pcFile, apcArgv);
+   /* not found, or gone since, so execvp reports it */
+   execvp(apcArgv[0], apcArgv);
+   iErrno = errno; /* writing the message may change errno */
+   Trace_mark(TRACE_EXEC_FAILED, 0, iErrno);
+   errno = iErrno;
+   spawn_writeError();
+   _exit((iErrno == ENOENT) ? ISH_NOT_FOUND : ISH_CANNOT_RUN);
+}
@@ -0,0 +1,29 @@
+/*--------------------------------------------------------------------*/
+/* spawn.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef SPAWN_INCLUDED
+#define SPAWN_INCLUDED
+
+#include "redirect.h"
+#include <sys/types.h>
+
+/* fork a child that runs the command apcArgv, and return its pid, or
+   -1 with errno set if there can be no child. in the child, in turn:
+      - aiFds[0], aiFds[1] and aiFds[2] become stdin, stdout and
+        stderr, unless aiFds is NULL or one is -1
+      - oPlan's redirections are made
+      - (*pfSetup)(pvExtra) is called, unless pfSetup is NULL. it may
+        write a message and _exit the child with a status of its own
+      - the file pcFile, as Path_find found it, is exec'd or, if
+        pcFile is NULL or can't be run, apcArgv[0] is found by execvp
+   a command that can't be run makes the child write a message to
+   stderr and exit ISH_NOT_FOUND if it isn't found, or ISH_CANNOT_RUN
+   otherwise. the child only writes to stderr with write, so a process
+   with other threads may spawn */
+pid_t Spawn_command(char *apcArgv[], const char *pcFile,
+                    const int aiFds[], RedirectPlan_T oPlan,
+                    void (*pfSetup)(void *pvExtra), void *pvExtra);
+
+#endif
@@ -0,0 +1,349 @@
+/*--------------------------------------------------------------------
+  state.c
+  Author: Nate Wilson
+  Description: saves the shell's variables, working directory and
+  commands found in PATH as an image, and loads them back from it. an
+  image is mapped and its strings read where they lie, so loading one
+  is a walk over the map rather than parsing. the variables the loader
+  had are replaced by the image's, which are copied into the table
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "state.h"
+#include "path.h"
+#include "var.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* the first bytes of every image, and the version of the layout that
+   follows them */
+static const char acStateMagic[4] = {'I', 'S', 'H', 'S'};
+enum {STATE_VERSION = 1};
+
+/* what's added to an image's name to name the file it's written to
+   before being renamed into place */
+static const char pcStateTempSuffix[] = ".tmp";
+
+/* an image starts with a header. the working directory follows, then
+   the PATH the commands were found in, empty if none were, then each
+   variable's name and value, then each command's name and file. a
+   string is its length, its chars and a '\0' */
+struct StateHeader
+{
+   char acMagic[4];
+   unsigned int uVersion;
+   /* how many variables and commands follow */
+   size_t uVarCount;
+   size_t uPathCount;
+};
+
+/* an image being read */
+struct StateReader
+{
+   const char *pcMap;
+   size_t uMapLength;
+   size_t uOffset;
+};
+
+/*--------------------------------------------------------------------*/
+
+/* write uValue to psFile */
+static void state_putSize(FILE *psFile, size_t uValue)
+{
+   (void)fwrite(&uValue, sizeof(uValue), 1, psFile);
+}
+
+/* write the uLength chars at pcChars to psFile as a string */
+static void state_putChars(FILE *psFile, const char *pcChars,
+                           size_t uLength)
+{
+   assert(pcChars != NULL);
+
+   state_putSize(psFile, uLength);
+   (void)fwrite(pcChars, 1, uLength, psFile);
+   (void)putc('\0', psFile);
+}
+
+/* write the string pcValue to psFile */
+static void state_putString(FILE *psFile, const char *pcValue)
+{
+   assert(pcValue != NULL);
+
+   state_putChars(psFile, pcValue, strlen(pcValue));
+}
+
+/* write the variables, which the environment holds, to psFile. return
+   how many were written */
+static size_t state_putVars(FILE *psFile)
+{
+   char **ppcEnv;
+   char *pcEquals;
+   size_t uCount = 0;
+
+   for (ppcEnv = environ; *ppcEnv != NULL; ppcEnv++)
+   {
+      pcEquals = strchr(*ppcEnv, '=');
+      if ((pcEquals == NULL) || (pcEquals == *ppcEnv))
+         continue;
+      state_putChars(psFile, *ppcEnv, (size_t)(pcEquals - *ppcEnv));
+      state_putString(psFile, pcEquals + 1);
+      uCount++;
+   }
+   return uCount;
+}
+
+/* the Path_map function: write the command pcName and its file pcFile
+   to the image being written, counting it in its header. pvExtra is
+   an array of the image's file and header */
+static void state_putPath(const char *pcName, const char *pcFile,
+                          void *pvExtra)
+{
+   void **ppvExtra = (void**)pvExtra;
+
+   state_putString((FILE*)ppvExtra[0], pcName);
+   state_putString((FILE*)ppvExtra[0], pcFile);
+   ((struct StateHeader*)ppvExtra[1])->uPathCount++;
+}
+
+/* save the shell's state as the image pcPath */
+int State_save(const char *pcPath)
+{
+   struct StateHeader sHeader;
+   const char *pcSearched;
+   FILE *psFile;
+   char *pcCwd;
+   char *pcTemp;
+   void *apvExtra[2];
+   int iRet = 0;
+
+   assert(pcPath != NULL);
+
+   memset(&sHeader, 0, sizeof(sHeader));
+   memcpy(sHeader.acMagic, acStateMagic, sizeof(acStateMagic));
+   sHeader.uVersion = STATE_VERSION;
+
+   /* write a temporary file and rename it into place, so that an
+      image is never seen half written */
+   pcTemp = (char*)Mem_alloc(MEM_SHELL, strlen(pcPath) +
+                                        sizeof(pcStateTempSuffix));
+   strcpy(pcTemp, pcPath);
+   strcat(pcTemp, pcStateTempSuffix);
+   psFile = fopen(pcTemp, "we");
+   if (psFile == NULL)
+   {
+      perror(pcTemp);
+      Mem_free(pcTemp);
+      return -1;
+   }
+   (void)fwrite(&sHeader, sizeof(sHeader), 1, psFile);
+
+   /* a directory that has gone has no name to go back to */
+   pcCwd = getcwd(NULL, 0);
+   state_putString(psFile, (pcCwd == NULL) ? "" : pcCwd);
+   free(pcCwd);
+   pcSearched = Path_getSearched();
+   state_putString(psFile, (pcSearched == NULL) ? "" : pcSearched);
+   sHeader.uVarCount = state_putVars(psFile);
+   apvExtra[0] = psFile;
+   apvExtra[1] = &sHeader;
+   Path_map(state_putPath, apvExtra);
+
+   /* now the counts are known */
+   rewind(psFile);
+   (void)fwrite(&sHeader, sizeof(sHeader), 1, psFile);
+   if (ferror(psFile))
+   {perror(pcTemp); iRet = -1;}
+   if ((fclose(psFile) == EOF) && (iRet == 0))
+   {perror(pcTemp); iRet = -1;}
+   if ((iRet == 0) && (rename(pcTemp, pcPath) == -1))
+   {perror(pcPath); iRet = -1;}
+   if (iRet == -1)
+      (void)unlink(pcTemp);
+   Mem_free(pcTemp);
+   return iRet;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* read a string from psReader. return the string, which is in the
+   map, or NULL if it isn't well formed */
+static const char *state_getString(struct StateReader *psReader)
+{
+   const char *pcValue;
+   size_t uLength;
+
+   assert(psReader != NULL);
+
+   if (psReader->uMapLength - psReader->uOffset < sizeof(uLength))
+      return NULL;
+   memcpy(&uLength, psReader->pcMap + psReader->uOffset,
+          sizeof(uLength));
+   psReader->uOffset += sizeof(uLength);
+   if (psReader->uMapLength - psReader->uOffset <= uLength)
+      return NULL;
+   pcValue = psReader->pcMap + psReader->uOffset;
+   if ((pcValue[uLength] != '\0') ||
+       (memchr(pcValue, '\0', uLength) != NULL))
+      return NULL;
+   psReader->uOffset += uLength + 1;
+   return pcValue;
+}
+
+/* walk every string of psReader's image, whose header is psHeader, to
+   make sure that loading it can't run off the map. return 0 if it's
+   well formed, leaving psReader at the first string, or -1 if not */
+static int state_check(struct StateReader *psReader,
+                       const struct StateHeader *psHeader)
+{
+   size_t uStart;
+   size_t uIndex;
+
+   assert(psReader != NULL);
+   assert(psHeader != NULL);
+
+   uStart = psReader->uOffset;
+   if ((state_getString(psReader) == NULL) ||
+       (state_getString(psReader) == NULL))
+      return -1;
+   for (uIndex = 0; uIndex < psHeader->uVarCount; uIndex++)
+      if ((state_getString(psReader) == NULL) ||
+          (state_getString(psReader) == NULL))
+         return -1;
+   for (uIndex = 0; uIndex < psHeader->uPathCount; uIndex++)
+      if ((state_getString(psReader) == NULL) ||
+          (state_getString(psReader) == NULL))
+         return -1;
+   if (psReader->uOffset != psReader->uMapLength)
+      return -1;
+   psReader->uOffset = uStart;
+   return 0;
+}
+
+/* unset every variable the environment holds, so that after loading
+   an image only its variables are set */
+static void state_clearVars(void)
+{
+   char *pcEquals;
+   char *pcName;
+   size_t uIndex = 0;
+   size_t uLength;
+
+   /* each variable unset moves the ones after it up */
+   while (environ[uIndex] != NULL)
+   {
+      pcEquals = strchr(environ[uIndex], '=');
+      if ((pcEquals == NULL) || (pcEquals == environ[uIndex]))
+      {  /* not a variable, so never saved */
+         uIndex++;
+         continue;
+      }
+      uLength = (size_t)(pcEquals - environ[uIndex]);
+      pcName = (char*)Mem_alloc(MEM_SHELL, uLength + 1);
+      memcpy(pcName, environ[uIndex], uLength);
+      pcName[uLength] = '\0';
+      if (Var_unset(pcName) == -1)
+         uIndex++;
+      Mem_free(pcName);
+   }
+}
+
+/* load the state psReader's image, whose header is psHeader, holds.
+   return 0 if successful, or -1 after writing a message to stderr */
+static int state_apply(struct StateReader *psReader,
+                       const struct StateHeader *psHeader)
+{
+   const char *pcCwd;
+   const char *pcSearched;
+   const char *pcName;
+   const char *pcValue;
+   const char *pcPath;
+   size_t uIndex;
+   int iRet = 0;
+
+   pcCwd = state_getString(psReader);
+   pcSearched = state_getString(psReader);
+   state_clearVars();
+   for (uIndex = 0; uIndex < psHeader->uVarCount; uIndex++)
+   {
+      pcName = state_getString(psReader);
+      pcValue = state_getString(psReader);
+      if (Var_set(pcName, pcValue) == -1)
+      {perror(pcName); iRet = -1;}
+   }
+   if ((*pcCwd != '\0') && (chdir(pcCwd) == -1))
+   {perror(pcCwd); iRet = -1;}
+
+   /* the commands were found in the PATH they were searched, so they
+      are only what a search now would find if PATH is still that */
+   pcPath = Var_get("PATH", strlen("PATH"));
+   if ((pcPath == NULL) || (strcmp(pcPath, pcSearched) != 0))
+      return iRet;
+   for (uIndex = 0; uIndex < psHeader->uPathCount; uIndex++)
+   {
+      pcName = state_getString(psReader);
+      pcValue = state_getString(psReader);
+      Path_remember(pcName, pcValue);
+   }
+   return iRet;
+}
+
+/* load the image pcPath */
+int State_load(const char *pcPath)
+{
+   struct StateHeader sHeader;
+   struct StateReader sReader;
+   struct stat sStat;
+   void *pvMap;
+   int iFd;
+   int iRet;
+
+   assert(pcPath != NULL);
+
+   iFd = open(pcPath, O_RDONLY | O_CLOEXEC);
+   if (iFd == -1)
+   {perror(pcPath); return -1;}
+   if (fstat(iFd, &sStat) == -1)
+   {
+      perror(pcPath);
+      (void)close(iFd);
+      return -1;
+   }
+   if ((! S_ISREG(sStat.st_mode)) ||
+       ((size_t)sStat.st_size < sizeof(sHeader)))
+   {
+      fprintf(stderr, "%s: not a saved state\n", pcPath);
+      (void)close(iFd);
+      return -1;
+   }
+   pvMap = mmap(NULL, (size_t)sStat.st_size, PROT_READ, MAP_PRIVATE,
+                iFd, 0);
+   (void)close(iFd);
+   if (pvMap == MAP_FAILED)
+   {perror(pcPath); return -1;}
+
+   memcpy(&sHeader, pvMap, sizeof(sHeader));
+   sReader.pcMap = (const char*)pvMap;
+   sReader.uMapLength = (size_t)sStat.st_size;
+   sReader.uOffset = sizeof(sHeader);
+   if ((memcmp(sHeader.acMagic, acStateMagic, sizeof(acStateMagic))
+        != 0) || (sHeader.uVersion != STATE_VERSION) ||
+       (state_check(&sReader, &sHeader) == -1))
+   {
+      fprintf(stderr, "%s: not a saved state\n", pcPath);
+      (void)munmap(pvMap, (size_t)sStat.st_size);
+      return -1;
+   }
+   iRet = state_apply(&sReader, &sHeader);
+   (void)munmap(pvMap, (size_t)sStat.st_size);
+   return iRet;
+}
@@ -0,0 +1,29 @@
+/*--------------------------------------------------------------------*/
+/* state.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef STATE_INCLUDED
+#define STATE_INCLUDED
+
+/* the shell's state saved as an image, so that a shell started by
+   tooling can take up where a warmed one left off rather than
+   starting cold. an image holds the variables, the working directory
+   and the commands found in PATH (see path.h). it is a header and
+   '\0' terminated strings, mapped and read in place when loaded. like
+   a compiled script, it is only ever read on the machine that wrote
+   it, so sizes are stored in native form */
+
+/* save the shell's state as the image pcPath, replacing it whole, so
+   that a shell loading it never sees it half written. return 0 if
+   successful, or -1 after writing a message to stderr */
+int State_save(const char *pcPath);
+
+/* load the image pcPath: set its variables in place of those
+   inherited, go to its directory, and remember the commands it found
+   if PATH is still what they were found in. return 0 if successful,
+   or -1 after writing a message to stderr, with nothing loaded if the
+   image isn't well formed */
+int State_load(const char *pcPath);
+
+#endif
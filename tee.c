@@ -0,0 +1,301 @@
+/*--------------------------------------------------------------------
+  tee.c
+  Author: Nate Wilson
+  Description: a copier that fans the output of a command out into
+  several files. tee(2) duplicates the data waiting in the command's
+  pipe into one private pipe per extra file, and splice(2) moves each
+  pipe's data into its file, so the bytes never pass through the
+  shell's memory
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "tee.h"
+#include "ish.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* most bytes moved per round, the default capacity of a pipe */
+enum {ROUND_LENGTH = 65536};
+
+/* buffer used for files that can't be spliced into */
+enum {COPY_BUFFER_LENGTH = 16384};
+
+/* a pipe to copy from, the files to copy into, and private pipes
+   holding each file's copy of the current round */
+struct Tee
+{
+   /* read end of the pipe the command writes into */
+   int iSource;
+   /* number of files copied into */
+   size_t uLength;
+   /* physical length of the arrays below */
+   size_t uPhysLength;
+   /* the files, in command line order */
+   int *piTargets;
+   /* is splice still usable on each file? it is not on every kind of
+      file, e.g. files opened for appending on older kernels */
+   int *piCanSplice;
+   /* read and write ends of the private pipes: pair i holds the copy
+      for file i. the last file is fed from iSource itself */
+   int *piPipes;
+   /* have the private pipes been made? */
+   int iStarted;
+};
+
+/* create and return a copier for the pipe whose read end is iSource */
+Tee_T Tee_new(int iSource)
+{
+   enum {INITIAL_PHYS_LENGTH = 2};
+
+   Tee_T oTee;
+   int *piTargets;
+   int *piCanSplice;
+
+   oTee = (struct Tee*)Mem_tryAlloc(MEM_TEE, sizeof(struct Tee));
+   piTargets = (int*)Mem_tryAlloc(MEM_TEE,
+                                  sizeof(int) * INITIAL_PHYS_LENGTH);
+   piCanSplice = (int*)Mem_tryAlloc(MEM_TEE,
+                                    sizeof(int) * INITIAL_PHYS_LENGTH);
+   if ((oTee == NULL) || (piTargets == NULL) || (piCanSplice == NULL))
+   {  /* iSource is the copier's to close, even so */
+      Mem_free(oTee);
+      Mem_free(piTargets);
+      Mem_free(piCanSplice);
+      (void)close(iSource);
+      Mem_fail();
+   }
+   oTee->iSource = iSource;
+   oTee->uLength = 0;
+   oTee->uPhysLength = INITIAL_PHYS_LENGTH;
+   oTee->piTargets = piTargets;
+   oTee->piCanSplice = piCanSplice;
+   oTee->piPipes = NULL;
+   oTee->iStarted = FALSE;
+   return oTee;
+}
+
+/* add iTarget to the files oTee copies into */
+void Tee_addTarget(Tee_T oTee, int iTarget)
+{
+   enum {GROWTH_FACTOR = 2};
+
+   int *piTargets;
+   int *piCanSplice;
+
+   assert(oTee != NULL);
+   assert(! oTee->iStarted);
+
+   if (oTee->uLength == oTee->uPhysLength)
+   {
+      piTargets = (int*)Mem_tryRealloc(MEM_TEE, oTee->piTargets,
+                                       sizeof(int) * GROWTH_FACTOR *
+                                       oTee->uPhysLength);
+      if (piTargets != NULL)
+         oTee->piTargets = piTargets;
+      piCanSplice = (int*)Mem_tryRealloc(MEM_TEE, oTee->piCanSplice,
+                                         sizeof(int) * GROWTH_FACTOR *
+                                         oTee->uPhysLength);
+      if (piCanSplice != NULL)
+         oTee->piCanSplice = piCanSplice;
+      if ((piTargets == NULL) || (piCanSplice == NULL))
+      {  /* iTarget is the copier's to close, even so */
+         (void)close(iTarget);
+         Mem_fail();
+      }
+      oTee->uPhysLength *= GROWTH_FACTOR;
+   }
+   oTee->piTargets[oTee->uLength] = iTarget;
+   oTee->piCanSplice[oTee->uLength] = TRUE;
+   oTee->uLength++;
+}
+
+/* return iSource of oTee */
+int Tee_getFd(Tee_T oTee)
+{
+   assert(oTee != NULL);
+
+   return oTee->iSource;
+}
+
+/* make oTee's private pipes, one per file but the last. return 0 if
+   successful, -1 otherwise */
+static int tee_start(Tee_T oTee)
+{
+   size_t uIndex;
+
+   assert(oTee != NULL);
+   assert(oTee->uLength > 0);
+
+   oTee->piPipes = (int*)Mem_tryAlloc(MEM_TEE,
+                                      sizeof(int) * 2 * oTee->uLength);
+   if (oTee->piPipes == NULL)
+   {
+      errno = ENOMEM;
+      return -1;
+   }
+   for (uIndex = 0; uIndex + 1 < oTee->uLength; uIndex++)
+      if (pipe2(oTee->piPipes + 2 * uIndex, O_CLOEXEC) == -1)
+      {
+         while (uIndex-- > 0)
+         {
+            (void)close(oTee->piPipes[2 * uIndex]);
+            (void)close(oTee->piPipes[2 * uIndex + 1]);
+         }
+         Mem_free(oTee->piPipes);
+         oTee->piPipes = NULL;
+         return -1;
+      }
+   oTee->iStarted = TRUE;
+   return 0;
+}
+
+/* write the uLength bytes of pcData to iFd, retrying short writes.
+   return 0 if successful, -1 otherwise */
+static int tee_writeAll(int iFd, const char *pcData, size_t uLength)
+{
+   ssize_t iWritten;
+
+   assert(pcData != NULL);
+
+   while (uLength > 0)
+   {
+      iWritten = write(iFd, pcData, uLength);
+      if (iWritten == -1)
+         return -1;
+      pcData += iWritten;
+      uLength -= (size_t)iWritten;
+   }
+   return 0;
+}
+
+/* move up to uLength bytes from the pipe iFrom into target uIndex of
+   oTee, splicing if the target allows it and reading and writing
+   otherwise. return the number of bytes moved, 0 at end of file, or
+   -1 on error */
+static ssize_t tee_moveSome(Tee_T oTee, int iFrom, size_t uIndex,
+                            size_t uLength)
+{
+   char acBuffer[COPY_BUFFER_LENGTH];
+   ssize_t iMoved;
+
+   assert(oTee != NULL);
+   assert(uIndex < oTee->uLength);
+
+   if (oTee->piCanSplice[uIndex])
+   {
+      iMoved = splice(iFrom, NULL, oTee->piTargets[uIndex], NULL,
+                      uLength, SPLICE_F_MOVE);
+      if ((iMoved != -1) || (errno != EINVAL))
+         return iMoved;
+      /* this file can't be spliced into, from now on copy */
+      oTee->piCanSplice[uIndex] = FALSE;
+   }
+   if (uLength > sizeof(acBuffer))
+      uLength = sizeof(acBuffer);
+   iMoved = read(iFrom, acBuffer, uLength);
+   if (iMoved <= 0)
+      return iMoved;
+   if (tee_writeAll(oTee->piTargets[uIndex], acBuffer,
+                    (size_t)iMoved) == -1)
+      return -1;
+   return iMoved;
+}
+
+/* move exactly uLength bytes from the pipe iFrom into target uIndex
+   of oTee. return 0 if successful, -1 otherwise */
+static int tee_moveAll(Tee_T oTee, int iFrom, size_t uIndex,
+                       size_t uLength)
+{
+   ssize_t iMoved;
+
+   assert(oTee != NULL);
+
+   while (uLength > 0)
+   {
+      iMoved = tee_moveSome(oTee, iFrom, uIndex, uLength);
+      if (iMoved <= 0)
+         return -1;
+      uLength -= (size_t)iMoved;
+   }
+   return 0;
+}
+
+/* copy the data waiting in oTee's pipe into every target. return 1 if
+   data was copied, 0 at end of file, -1 on error */
+int Tee_pump(Tee_T oTee)
+{
+   ssize_t iLength;
+   ssize_t iCopied;
+   size_t uIndex;
+   size_t uLast;
+
+   assert(oTee != NULL);
+
+   if (oTee->uLength == 0)
+      return 0;
+   if ((! oTee->iStarted) && (tee_start(oTee) == -1))
+      return -1;
+   uLast = oTee->uLength - 1;
+
+   /* a single file needs no copies, just move the data */
+   if (uLast == 0)
+   {
+      iLength = tee_moveSome(oTee, oTee->iSource, 0, ROUND_LENGTH);
+      return (iLength <= 0) ? (int)iLength : 1;
+   }
+
+   /* the first tee waits for data and decides the round's length.
+      the private pipes are empty between rounds, so the other tees
+      always take the whole round */
+   iLength = tee(oTee->iSource, oTee->piPipes[1], ROUND_LENGTH, 0);
+   if (iLength <= 0)
+      return (int)iLength;
+   for (uIndex = 1; uIndex < uLast; uIndex++)
+   {
+      iCopied = tee(oTee->iSource, oTee->piPipes[2 * uIndex + 1],
+                    (size_t)iLength, 0);
+      if (iCopied != iLength)
+         return -1;
+   }
+   for (uIndex = 0; uIndex < uLast; uIndex++)
+      if (tee_moveAll(oTee, oTee->piPipes[2 * uIndex], uIndex,
+                      (size_t)iLength) == -1)
+         return -1;
+
+   /* the last file takes the round out of the source pipe */
+   if (tee_moveAll(oTee, oTee->iSource, uLast, (size_t)iLength) == -1)
+      return -1;
+   return 1;
+}
+
+/* close the fds oTee owns and free it */
+void Tee_free(Tee_T oTee)
+{
+   size_t uIndex;
+
+   assert(oTee != NULL);
+
+   (void)close(oTee->iSource);
+   for (uIndex = 0; uIndex < oTee->uLength; uIndex++)
+      (void)close(oTee->piTargets[uIndex]);
+   if (oTee->iStarted)
+      for (uIndex = 0; uIndex + 1 < oTee->uLength; uIndex++)
+      {
+         (void)close(oTee->piPipes[2 * uIndex]);
+         (void)close(oTee->piPipes[2 * uIndex + 1]);
+      }
+   Mem_free(oTee->piPipes);
+   Mem_free(oTee->piTargets);
+   Mem_free(oTee->piCanSplice);
+   Mem_free(oTee);
+}
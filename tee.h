@@ -0,0 +1,36 @@
+/*--------------------------------------------------------------------*/
+/* tee.h                                                              */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef TEE_INCLUDED
+#define TEE_INCLUDED
+
+#include <stddef.h>
+
+/* Tee_T will be an object to the user but is in reality a pointer to
+   a tee structure, a copier that duplicates everything written into a
+   pipe into several files, without copying it through user space */
+typedef struct Tee *Tee_T;
+
+/* create and return a copier for the pipe whose read end is iSource.
+   the copier owns iSource, and closes it if memory runs out. the
+   caller owns the copier */
+Tee_T Tee_new(int iSource);
+
+/* add iTarget to the files oTee copies into. oTee owns iTarget, and
+   closes it if memory runs out */
+void Tee_addTarget(Tee_T oTee, int iTarget);
+
+/* return the read end of the pipe oTee copies from */
+int Tee_getFd(Tee_T oTee);
+
+/* copy the data that is waiting in oTee's pipe (blocking until there
+   is some) into every target. return 1 if data was copied, 0 when
+   every writer has closed the pipe, or -1 with errno set on error */
+int Tee_pump(Tee_T oTee);
+
+/* close the fds oTee owns and free it */
+void Tee_free(Tee_T oTee);
+
+#endif
@@ -0,0 +1,343 @@
+/*--------------------------------------------------------------------
+  test.c
+  Author: Nate Wilson
+  Description: the test and [ builtins. the expression is parsed by
+  recursive descent over the command's tokens and evaluated as it is
+  parsed, so that a predicate costs one system call instead of a fork
+  and exec of /usr/bin/test
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "test.h"
+#include "command.h"
+#include "ish.h"
+#include "dynarray.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* exit statuses, same as other tests */
+enum {TEST_TRUE = 0, TEST_FALSE = 1, TEST_FAILED = 2};
+
+/* where a parse is up to */
+struct Test
+{
+   /* the command's tokens, the name at 0 */
+   DynArray_T oTokens;
+   /* the index of the next argument and one past the last */
+   size_t uNext;
+   size_t uEnd;
+   /* has an error been reported? */
+   int iFailed;
+};
+
+static int test_parseOr(struct Test *psTest);
+
+/* report pcMessage about pcArg, unless an error has been reported
+   already. return FALSE, a value for the failed part */
+static int test_fail(struct Test *psTest, const char *pcArg,
+                     const char *pcMessage)
+{
+   assert(psTest != NULL);
+   assert(pcMessage != NULL);
+
+   if (! psTest->iFailed)
+   {
+      if (pcArg == NULL)
+         fprintf(stderr, "%s: test: %s\n", getPgmName(), pcMessage);
+      else
+         fprintf(stderr, "%s: test: %s: %s\n", getPgmName(), pcArg,
+                 pcMessage);
+   }
+   psTest->iFailed = TRUE;
+   return FALSE;
+}
+
+/* return the argument uOffset after the next one, or NULL if there
+   aren't that many */
+static const char *test_peek(struct Test *psTest, size_t uOffset)
+{
+   if (psTest->uNext + uOffset >= psTest->uEnd)
+      return NULL;
+   return Token_getValue(DynArray_get(psTest->oTokens,
+                                      psTest->uNext + uOffset));
+}
+
+/* is the next argument pcArg? */
+static int test_nextIs(struct Test *psTest, const char *pcArg)
+{
+   const char *pcNext;
+
+   pcNext = test_peek(psTest, 0);
+   return (pcNext != NULL) && (strcmp(pcNext, pcArg) == 0);
+}
+
+/* is pcOperator a binary operator? */
+static int test_isBinary(const char *pcOperator)
+{
+   static const char *apcBinaries[] =
+      {"=", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL};
+   size_t uIndex;
+
+   if (pcOperator == NULL)
+      return FALSE;
+   for (uIndex = 0; apcBinaries[uIndex] != NULL; uIndex++)
+      if (strcmp(pcOperator, apcBinaries[uIndex]) == 0)
+         return TRUE;
+   return FALSE;
+}
+
+/* store the integer pcValue in *plValue. return 0 if successful, or -1
+   after reporting an error */
+static int test_parseInteger(struct Test *psTest, const char *pcValue,
+                             long *plValue)
+{
+   char *pcEnd;
+
+   errno = 0;
+   *plValue = strtol(pcValue, &pcEnd, 10);
+   while ((*pcEnd == ' ') || (*pcEnd == '\t'))
+      pcEnd++;
+   if ((pcEnd == pcValue) || (*pcEnd != '\0') || (errno == ERANGE))
+   {
+      (void)test_fail(psTest, pcValue, "integer expression expected");
+      return -1;
+   }
+   return 0;
+}
+
+/* return the value of the binary predicate pcLeft pcOperator
+   pcRight */
+static int test_binary(struct Test *psTest, const char *pcLeft,
+                       const char *pcOperator, const char *pcRight)
+{
+   long lLeft;
+   long lRight;
+
+   if (strcmp(pcOperator, "=") == 0)
+      return strcmp(pcLeft, pcRight) == 0;
+   if (strcmp(pcOperator, "!=") == 0)
+      return strcmp(pcLeft, pcRight) != 0;
+
+   if ((test_parseInteger(psTest, pcLeft, &lLeft) == -1) ||
+       (test_parseInteger(psTest, pcRight, &lRight) == -1))
+      return FALSE;
+   if (strcmp(pcOperator, "-eq") == 0)
+      return lLeft == lRight;
+   if (strcmp(pcOperator, "-ne") == 0)
+      return lLeft != lRight;
+   if (strcmp(pcOperator, "-lt") == 0)
+      return lLeft < lRight;
+   if (strcmp(pcOperator, "-le") == 0)
+      return lLeft <= lRight;
+   if (strcmp(pcOperator, "-gt") == 0)
+      return lLeft > lRight;
+   assert(strcmp(pcOperator, "-ge") == 0);
+   return lLeft >= lRight;
+}
+
+/* return the value of the unary predicate cOperator pcArg, or -1 if
+   cOperator isn't a unary operator */
+static int test_unary(char cOperator, const char *pcArg)
+{
+   struct stat sStat;
+
+   switch (cOperator)
+   {
+      case 'z':
+         return *pcArg == '\0';
+      case 'n':
+         return *pcArg != '\0';
+      case 'r':
+         return access(pcArg, R_OK) == 0;
+      case 'w':
+         return access(pcArg, W_OK) == 0;
+      case 'x':
+         return access(pcArg, X_OK) == 0;
+      case 'L':
+      case 'h':
+         return (lstat(pcArg, &sStat) == 0) && S_ISLNK(sStat.st_mode);
+      case 'e':
+      case 'f':
+      case 'd':
+      case 's':
+      case 'p':
+      case 'S':
+      case 'b':
+      case 'c':
+         break;
+      default:
+         return -1;
+   }
+
+   if (stat(pcArg, &sStat) == -1)
+      return FALSE;
+   switch (cOperator)
+   {
+      case 'e':
+         return TRUE;
+      case 'f':
+         return S_ISREG(sStat.st_mode);
+      case 'd':
+         return S_ISDIR(sStat.st_mode);
+      case 's':
+         return sStat.st_size > 0;
+      case 'p':
+         return S_ISFIFO(sStat.st_mode);
+      case 'S':
+         return S_ISSOCK(sStat.st_mode);
+      case 'b':
+         return S_ISBLK(sStat.st_mode);
+      default:
+         assert(cOperator == 'c');
+         return S_ISCHR(sStat.st_mode);
+   }
+}
+
+/* primary: ( expr ), a unary or binary predicate, or a string, true
+   if it isn't empty */
+static int test_parsePrimary(struct Test *psTest)
+{
+   const char *pcArg;
+   const char *pcOperator;
+   const char *pcOperand;
+   int iValue;
+
+   pcArg = test_peek(psTest, 0);
+   if (pcArg == NULL)
+      return test_fail(psTest, NULL, "argument expected");
+
+   /* a binary operator takes precedence, so that = = = compares */
+   pcOperator = test_peek(psTest, 1);
+   if (test_isBinary(pcOperator))
+   {
+      pcOperand = test_peek(psTest, 2);
+      if (pcOperand == NULL)
+         return test_fail(psTest, pcOperator, "argument expected");
+      psTest->uNext += 3;
+      return test_binary(psTest, pcArg, pcOperator, pcOperand);
+   }
+
+   if (strcmp(pcArg, "(") == 0)
+   {
+      psTest->uNext++;
+      iValue = test_parseOr(psTest);
+      if (! test_nextIs(psTest, ")"))
+         return test_fail(psTest, NULL, "missing ')'");
+      psTest->uNext++;
+      return iValue;
+   }
+
+   pcOperand = test_peek(psTest, 1);
+   if ((pcArg[0] == '-') && (pcArg[1] != '\0') && (pcArg[2] == '\0') &&
+       (pcOperand != NULL))
+   {
+      iValue = test_unary(pcArg[1], pcOperand);
+      if (iValue != -1)
+      {
+         psTest->uNext += 2;
+         return iValue;
+      }
+   }
+
+   psTest->uNext++;
+   return *pcArg != '\0';
+}
+
+/* not: ! applied to a not, or a primary */
+static int test_parseNot(struct Test *psTest)
+{
+   /* a lone ! is a string, as in other tests */
+   if (test_nextIs(psTest, "!") && (test_peek(psTest, 1) != NULL))
+   {
+      psTest->uNext++;
+      return ! test_parseNot(psTest);
+   }
+   return test_parsePrimary(psTest);
+}
+
+/* and: nots joined by -a. both sides are always evaluated, there
+   being no side effects to skip */
+static int test_parseAnd(struct Test *psTest)
+{
+   int iValue;
+   int iRight;
+
+   iValue = test_parseNot(psTest);
+   while (test_nextIs(psTest, "-a"))
+   {
+      psTest->uNext++;
+      iRight = test_parseNot(psTest);
+      iValue = iValue && iRight;
+   }
+   return iValue;
+}
+
+/* or: ands joined by -o */
+static int test_parseOr(struct Test *psTest)
+{
+   int iValue;
+   int iRight;
+
+   iValue = test_parseAnd(psTest);
+   while (test_nextIs(psTest, "-o"))
+   {
+      psTest->uNext++;
+      iRight = test_parseAnd(psTest);
+      iValue = iValue || iRight;
+   }
+   return iValue;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* run the test builtin described by oCommand */
+int Test_run(Command_T oCommand)
+{
+   struct Test sTest;
+   const char *pcName;
+   int iValue;
+
+   assert(oCommand != NULL);
+
+   sTest.oTokens = Command_getTokens(oCommand);
+   sTest.uNext = 1;
+   sTest.uEnd = DynArray_getLength(sTest.oTokens);
+   sTest.iFailed = FALSE;
+
+   pcName = Token_getValue(DynArray_get(sTest.oTokens, 0));
+   if (strcmp(pcName, "[") == 0)
+   {
+      if ((sTest.uEnd < 2) ||
+          (strcmp(Token_getValue(DynArray_get(sTest.oTokens,
+                                              sTest.uEnd - 1)),
+                  "]") != 0))
+      {
+         fprintf(stderr, "%s: [: missing ']'\n", getPgmName());
+         return TEST_FAILED;
+      }
+      sTest.uEnd--;
+   }
+
+   /* no expression is false */
+   if (sTest.uNext == sTest.uEnd)
+      return TEST_FALSE;
+
+   iValue = test_parseOr(&sTest);
+   if ((! sTest.iFailed) && (sTest.uNext < sTest.uEnd))
+      (void)test_fail(&sTest, test_peek(&sTest, 0),
+                      "unexpected argument");
+   if (sTest.iFailed)
+      return TEST_FAILED;
+   return iValue ? TEST_TRUE : TEST_FALSE;
+}
@@ -0,0 +1,22 @@
+/*--------------------------------------------------------------------*/
+/* test.h                                                             */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef TEST_INCLUDED
+#define TEST_INCLUDED
+
+#include "command.h"
+
+/* run the test builtin described by oCommand, named test or [ (which
+   takes a closing ]):
+      -e -f -d -r -w -x -s -L -h -p -S -b -c file
+      -z -n string    string    s1 = s2    s1 != s2
+      n1 -eq -ne -lt -le -gt -ge n2
+      ! expr    expr -a expr    expr -o expr    ( expr )
+   file predicates are answered with stat, lstat and access calls from
+   the shell itself. return 0 if the expression is true, 1 if it is
+   false, or 2 after writing a message to stderr */
+int Test_run(Command_T oCommand);
+
+#endif
@@ -0,0 +1,287 @@
+/*--------------------------------------------------------------------
+  timeout.c
+  Author: Nate Wilson
+  Description: the timeout prefix. the command it runs is watched
+  through a pidfd in the shell's event loop, so that the shell sleeps
+  in the kernel until either the command exits or its deadline
+  passes, with no timer process and no polling while the command runs
+  normally
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "timeout.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "event.h"
+#include "mem.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* signals that may be given to -s by name */
+static const struct {const char *pcName; int iSignal;} asSignals[] =
+{
+   {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT},
+   {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+   {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+   {"STOP", SIGSTOP}
+};
+
+/* options given on the timeout command line */
+struct TimeoutSettings
+{
+   /* signal sent when the duration runs out */
+   int iSignal;
+   /* seconds the command may run, 0 for no limit */
+   double dDuration;
+   /* seconds between the signal and KILL, 0 to never send KILL */
+   double dGrace;
+};
+
+/* parse pcValue as a duration, seconds with an optional s, m, h or d
+   suffix, storing the seconds in *pdSeconds. return TRUE if
+   successful, FALSE if pcValue is not a duration */
+static int timeout_parseDuration(const char *pcValue,
+                                 double *pdSeconds)
+{
+   char *pcEnd;
+   double dSeconds;
+
+   assert(pcValue != NULL);
+   assert(pdSeconds != NULL);
+
+   if (! (isdigit((unsigned char)pcValue[0]) || (pcValue[0] == '.')))
+      return FALSE;
+   errno = 0;
+   dSeconds = strtod(pcValue, &pcEnd);
+   if ((errno != 0) || (pcEnd == pcValue))
+      return FALSE;
+   switch (*pcEnd)
+   {
+      case '\0': case 's': break;
+      case 'm': dSeconds *= 60; break;
+      case 'h': dSeconds *= 60 * 60; break;
+      case 'd': dSeconds *= 24 * 60 * 60; break;
+      default: return FALSE;
+   }
+   if ((*pcEnd != '\0') && (pcEnd[1] != '\0'))
+      return FALSE;
+   /* beyond what a timespec surely holds is as good as forever */
+   if (dSeconds > INT_MAX)
+      dSeconds = INT_MAX;
+   *pdSeconds = dSeconds;
+   return TRUE;
+}
+
+/* parse pcValue as a signal number or name, with or without "SIG",
+   storing the signal in *piSignal. return TRUE if successful, FALSE
+   if pcValue is not a signal */
+static int timeout_parseSignal(const char *pcValue, int *piSignal)
+{
+   char *pcEnd;
+   long lSignal;
+   size_t uIndex;
+
+   assert(pcValue != NULL);
+   assert(piSignal != NULL);
+
+   if (isdigit((unsigned char)pcValue[0]))
+   {
+      errno = 0;
+      lSignal = strtol(pcValue, &pcEnd, 10);
+      if ((errno != 0) || (*pcEnd != '\0') || (lSignal <= 0) ||
+          (lSignal >= NSIG))
+         return FALSE;
+      *piSignal = (int)lSignal;
+      return TRUE;
+   }
+   if (strncmp(pcValue, "SIG", 3) == 0)
+      pcValue += 3;
+   for (uIndex = 0; uIndex < sizeof(asSignals) / sizeof(asSignals[0]);
+        uIndex++)
+      if (strcmp(pcValue, asSignals[uIndex].pcName) == 0)
+      {
+         *piSignal = asSignals[uIndex].iSignal;
+         return TRUE;
+      }
+   return FALSE;
+}
+
+/* fill psSettings from the timeout prefix at token *puIndex of
+   oTokens, its options and its duration, and move *puIndex past them.
+   return TRUE if successful, FALSE (after writing a message to
+   stderr) if they are malformed */
+static int timeout_parseOptions(DynArray_T oTokens, size_t *puIndex,
+                                struct TimeoutSettings *psSettings)
+{
+   size_t uIndex;
+   size_t uLength;
+   const char *pcOption;
+   const char *pcValue;
+   int iValid;
+   const char *pcPgmName = getPgmName();
+
+   assert(oTokens != NULL);
+   assert(puIndex != NULL);
+   assert(psSettings != NULL);
+
+   psSettings->iSignal = SIGTERM;
+   psSettings->dGrace = 0;
+
+   uLength = DynArray_getLength(oTokens);
+   /* token *puIndex is "timeout" itself */
+   for (uIndex = *puIndex + 1; uIndex < uLength; uIndex++)
+   {
+      pcOption = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (pcOption[0] != '-')
+         break;
+      if ((strcmp(pcOption, "-s") != 0) && (strcmp(pcOption, "-k") != 0))
+      {
+         fprintf(stderr, "%s: timeout: invalid option %s\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      /* both options take a value */
+      if (uIndex + 1 == uLength)
+      {
+         fprintf(stderr, "%s: timeout: option %s requires a value\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      uIndex++;
+      pcValue = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (pcOption[1] == 's')
+         iValid = timeout_parseSignal(pcValue, &psSettings->iSignal);
+      else
+         iValid = timeout_parseDuration(pcValue, &psSettings->dGrace);
+      if (! iValid)
+      {
+         fprintf(stderr, "%s: timeout: invalid value for %s: %s\n",
+                 pcPgmName, pcOption, pcValue);
+         return FALSE;
+      }
+   }
+
+   if (uIndex == uLength)
+   {
+      fprintf(stderr, "%s: timeout: missing duration\n", pcPgmName);
+      return FALSE;
+   }
+   pcValue = Token_getValue(DynArray_get(oTokens, uIndex));
+   if (! timeout_parseDuration(pcValue, &psSettings->dDuration))
+   {
+      fprintf(stderr, "%s: timeout: invalid duration %s\n",
+              pcPgmName, pcValue);
+      return FALSE;
+   }
+   uIndex++;
+   if (uIndex == uLength)
+   {
+      fprintf(stderr, "%s: timeout: missing command\n", pcPgmName);
+      return FALSE;
+   }
+   *puIndex = uIndex;
+   return TRUE;
+}
+
+/* run oEvent until *piExited or dSeconds pass. dSeconds of 0 means no
+   limit. return TRUE if the child exited, FALSE if the time ran out */
+static int timeout_waitFor(Event_T oEvent, const int *piExited,
+                           double dSeconds)
+{
+   struct timespec sDeadline;
+   struct timespec sNow;
+   double dRemaining;
+   int iMillis;
+
+   assert(oEvent != NULL);
+   assert(piExited != NULL);
+
+   if (clock_gettime(CLOCK_MONOTONIC, &sDeadline) == -1)
+   {perror(getPgmName()); exit(EXIT_FAILURE);}
+   sDeadline.tv_sec += (time_t)dSeconds;
+   sDeadline.tv_nsec += (long)((dSeconds - (time_t)dSeconds) * 1e9);
+   if (sDeadline.tv_nsec >= 1000000000L)
+   {
+      sDeadline.tv_sec++;
+      sDeadline.tv_nsec -= 1000000000L;
+   }
+
+   while (! *piExited)
+   {
+      if (dSeconds == 0)
+         iMillis = -1;
+      else
+      {  /* recompute after every wakeup, e.g. by another job */
+         if (clock_gettime(CLOCK_MONOTONIC, &sNow) == -1)
+         {perror(getPgmName()); exit(EXIT_FAILURE);}
+         dRemaining = (double)(sDeadline.tv_sec - sNow.tv_sec) +
+                      (double)(sDeadline.tv_nsec - sNow.tv_nsec) / 1e9;
+         if (dRemaining <= 0)
+            return FALSE;
+         /* round up, so we never wake just short of the deadline */
+         if (dRemaining * 1000 >= INT_MAX)
+            iMillis = INT_MAX;
+         else
+            iMillis = (int)(dRemaining * 1000) + 1;
+      }
+      if (Event_runOnce(oEvent, iMillis) == -1)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+   }
+   return TRUE;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* parse the timeout prefix at token *puIndex of oTokens */
+TimeoutSettings_T Timeout_parse(DynArray_T oTokens, size_t *puIndex)
+{
+   struct TimeoutSettings *psSettings;
+
+   psSettings = (struct TimeoutSettings*)Mem_alloc(MEM_BUILTIN,
+                                                   sizeof(*psSettings));
+   if (! timeout_parseOptions(oTokens, puIndex, psSettings))
+   {
+      Mem_free(psSettings);
+      return NULL;
+   }
+   return psSettings;
+}
+
+/* run oEvent until child iPid has exited, as *piExited says, sending
+   it oSettings' signal once its time runs out */
+int Timeout_wait(TimeoutSettings_T oSettings, Event_T oEvent, pid_t iPid,
+                 const int *piExited)
+{
+   assert(oSettings != NULL);
+   assert(oEvent != NULL);
+   assert(piExited != NULL);
+
+   /* the child's pidfd lets the loop's wait carry the deadline */
+   if (timeout_waitFor(oEvent, piExited, oSettings->dDuration))
+      return FALSE;
+   (void)kill(iPid, oSettings->iSignal);
+   if ((oSettings->dGrace != 0) &&
+       ! timeout_waitFor(oEvent, piExited, oSettings->dGrace))
+      (void)kill(iPid, SIGKILL);
+   (void)timeout_waitFor(oEvent, piExited, 0);
+   return TRUE;
+}
+
+/* free oSettings */
+void Timeout_freeSettings(TimeoutSettings_T oSettings)
+{
+   Mem_free(oSettings);
+}
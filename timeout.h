@@ -0,0 +1,38 @@
+/*--------------------------------------------------------------------*/
+/* timeout.h                                                          */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef TIMEOUT_INCLUDED
+#define TIMEOUT_INCLUDED
+
+#include "dynarray.h"
+#include "event.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/* TimeoutSettings_T is a pointer to what a timeout prefix (see
+   prefix.h) gives:
+      timeout [-s signal] [-k grace] duration cmd [args]
+   if cmd is still running after duration it is sent signal (TERM by
+   default), then KILL if it outlives grace as well. durations are
+   seconds, optionally suffixed with s, m, h or d, and 0 disables the
+   limit */
+typedef struct TimeoutSettings *TimeoutSettings_T;
+
+/* parse the timeout prefix whose name is token *puIndex of oTokens,
+   and move *puIndex to the token after its duration. return its
+   settings, or NULL after writing a message to stderr if they are
+   malformed or no command follows. the caller owns the settings */
+TimeoutSettings_T Timeout_parse(DynArray_T oTokens, size_t *puIndex);
+
+/* run oEvent, which watches child iPid, until *piExited is set,
+   sending iPid oSettings' signals as its time runs out. return 1 if
+   it timed out, 0 otherwise */
+int Timeout_wait(TimeoutSettings_T oSettings, Event_T oEvent, pid_t iPid,
+                 const int *piExited);
+
+/* free oSettings */
+void Timeout_freeSettings(TimeoutSettings_T oSettings);
+
+#endif
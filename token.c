@@ -6,6 +6,8 @@
 
 #include "ish.h"
 #include "token.h"
+#include "mem.h"
+#include "intern.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,41 +20,54 @@ struct Token
    /* The type of the token. */
    enum TokenType eType;
 
-   /* The string which is the token's value. */
-   char *pcValue;
+   /* The string which is the token's value, pooled. */
+   const char *pcValue;
+
+   /* Is the value a pattern for pathname expansion? */
+   int iPattern;
 };
 
 
 /* Create and return a token whose type is eTokenType and whose
    value consists of string pcValue.  The caller owns the token. */
 Token_T Token_new(enum TokenType eTokenType,
-                                  char *pcValue)
+                                  const char *pcValue)
 {
-   struct Token *psToken;
-   const char *pcPgmName;
-
    assert(pcValue != NULL);
 
-   pcPgmName = getPgmName();
+   return Token_newChars(eTokenType, pcValue, strlen(pcValue));
+}
 
-   psToken = (struct Token*)malloc(sizeof(struct Token));
-   if (psToken == NULL)
-   {perror(pcPgmName); exit(EXIT_FAILURE);}
+/* Create and return a token whose type is eTokenType and whose value
+   is the uLength chars at pcChars, as they lie, in a line or
+   wherever.  The caller owns the token. */
+Token_T Token_newChars(enum TokenType eTokenType, const char *pcChars,
+                       size_t uLength)
+{
+   struct Token *psToken;
+   const char *pcValue;
 
-   psToken->eType = eTokenType;
-   psToken->pcValue = (char*)malloc(strlen(pcValue) + 1);
-   if (psToken->pcValue == NULL)
-   { perror(pcPgmName); exit(EXIT_FAILURE);}
+   assert(pcChars != NULL);
 
-   strcpy(psToken->pcValue, pcValue);
+   /* shared with every token of the same value */
+   pcValue = Intern_chars(pcChars, uLength);
+   psToken = (struct Token*)Mem_tryAlloc(MEM_TOKEN, sizeof(struct Token));
+   if (psToken == NULL)
+   {  /* so that nothing is lost if Mem_fail doesn't return */
+      Intern_release(pcValue);
+      Mem_fail();
+   }
+   psToken->eType = eTokenType;
+   psToken->iPattern = 0;
+   psToken->pcValue = pcValue;
 
    return psToken;
 }
 
 void Token_free(Token_T oToken)
 {
-   free(oToken->pcValue);
-   free(oToken);
+   Intern_release(oToken->pcValue);
+   Mem_free(oToken);
 }
 
 int Token_isOrdinary(Token_T oToken)
@@ -67,8 +82,21 @@ int Token_isSpecial(Token_T oToken)
    return (oToken->eType == TOKEN_SPECIAL);
 }
 
-char *Token_getValue(Token_T oToken)
+const char *Token_getValue(Token_T oToken)
 {
    assert(oToken != NULL);
    return oToken->pcValue;
 }
+
+void Token_setPattern(Token_T oToken)
+{
+   assert(oToken != NULL);
+   assert(oToken->eType == TOKEN_ORDINARY);
+   oToken->iPattern = 1;
+}
+
+int Token_isPattern(Token_T oToken)
+{
+   assert(oToken != NULL);
+   return oToken->iPattern;
+}
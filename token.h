@@ -6,6 +6,9 @@
 
 #ifndef TOKEN_INCLUDED
 #define TOKEN_INCLUDED
+
+#include <stddef.h>
+
 /* command_t will be an object to the user but is in reality a
    pointer to a command structure */
 typedef struct Token *Token_T;
@@ -15,7 +18,12 @@ enum TokenType {TOKEN_ORDINARY, TOKEN_SPECIAL};
 
 /* Create and return a token whose type is eTokenType and whose
    value consists of string pcValue.  The caller owns the token. */
-Token_T Token_new(enum TokenType eTokenType, char *pcValue);
+Token_T Token_new(enum TokenType eTokenType, const char *pcValue);
+
+/* Create and return a token as Token_new does, whose value is the
+   uLength chars at pcChars, which needn't be followed by a '\0'. */
+Token_T Token_newChars(enum TokenType eTokenType, const char *pcChars,
+                       size_t uLength);
 
 /* free memory allocated for oToken */
 void Token_free(Token_T oToken);
@@ -26,7 +34,15 @@ int Token_isOrdinary(Token_T oToken);
 /* is oToken special? return 1 if true  */
 int Token_isSpecial(Token_T oToken);
 
-/* return value associated with oToken */
-char *Token_getValue(Token_T oToken);
+/* return value associated with oToken. it is pooled (see intern.h),
+   the same pointer for equal values, and must not be changed */
+const char *Token_getValue(Token_T oToken);
+
+/* mark the ordinary token oToken as a pattern, a word with unquoted
+   wildcards that is replaced by the paths it matches */
+void Token_setPattern(Token_T oToken);
+
+/* is oToken a pattern? return 1 if true */
+int Token_isPattern(Token_T oToken);
 
 #endif
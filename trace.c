@@ -0,0 +1,342 @@
+/*--------------------------------------------------------------------
+  trace.c
+  Author: Nate Wilson
+  Description: event tracing into a preallocated ring buffer. the ring
+  is a shared anonymous mapping, so children record into it between
+  fork and exec, and a slot is claimed with one atomic add. recording
+  is a clock read and a few stores; everything else waits for a dump
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+/* one recorded event */
+struct TraceEvent
+{
+   /* CLOCK_MONOTONIC time of the event */
+   long lSeconds;
+   long lNanoseconds;
+   enum TraceKind eKind;
+   /* 'B' for a span's begin, 'E' for its end, 'i' for an instant */
+   char cPhase;
+   /* the process that recorded it */
+   int iPid;
+   unsigned long ulLine;
+   int iChild;
+   int iValue;
+};
+
+/* the ring: the number of events ever recorded, then the slots */
+struct TraceRing
+{
+   unsigned long ulNext;
+   struct TraceEvent asEvents[1];
+};
+
+/* the event names, and what iValue means for each, in enum TraceKind
+   order */
+static const char *apcTraceNames[TRACE_KIND_COUNT] =
+   {"read", "lex", "parse", "redirect", "fork", "exec", "exec failed",
+    "exit"};
+static const char *apcTraceValueNames[TRACE_KIND_COUNT] =
+   {NULL, NULL, NULL, NULL, NULL, NULL, "errno", "status"};
+
+/* the ring and its size in slots. psTraceRing is NULL if not
+   tracing */
+static struct TraceRing *psTraceRing;
+static unsigned long ulTraceCapacity;
+
+/* the trace file, kept open so that a dump doesn't depend on the
+   shell's cwd */
+static int iTraceFd = -1;
+
+/* the line events are tagged with */
+static unsigned long ulTraceLine;
+
+/* the pid of the shell, the only process that dumps on exit */
+static pid_t iTracePid;
+
+/*--------------------------------------------------------------------*/
+
+/* record an event of eKind in phase cPhase */
+static void trace_record(enum TraceKind eKind, char cPhase, int iChild,
+                         int iValue)
+{
+   struct TraceEvent *psEvent;
+   struct timespec sNow;
+   unsigned long ulSlot;
+
+   if (psTraceRing == NULL)
+      return;
+   (void)clock_gettime(CLOCK_MONOTONIC, &sNow);
+   ulSlot = __sync_fetch_and_add(&psTraceRing->ulNext, 1UL) %
+      ulTraceCapacity;
+   psEvent = &psTraceRing->asEvents[ulSlot];
+   psEvent->lSeconds = (long)sNow.tv_sec;
+   psEvent->lNanoseconds = sNow.tv_nsec;
+   psEvent->eKind = eKind;
+   psEvent->cPhase = cPhase;
+   psEvent->iPid = (int)getpid();
+   psEvent->ulLine = ulTraceLine;
+   psEvent->iChild = iChild;
+   psEvent->iValue = iValue;
+}
+
+/* record the start of an eKind span */
+void Trace_begin(enum TraceKind eKind)
+{
+   trace_record(eKind, 'B', 0, 0);
+}
+
+/* record the end of an eKind span */
+void Trace_end(enum TraceKind eKind, int iChild, int iValue)
+{
+   trace_record(eKind, 'E', iChild, iValue);
+}
+
+/* record an eKind instant */
+void Trace_mark(enum TraceKind eKind, int iChild, int iValue)
+{
+   trace_record(eKind, 'i', iChild, iValue);
+}
+
+/* tag the events from now on with line ulLine */
+void Trace_setLine(unsigned long ulLine)
+{
+   ulTraceLine = ulLine;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* the dump is built in a buffer that is written out whenever it
+   fills, since stdio can't be used in a signal handler */
+enum {TRACE_BUFFER_LENGTH = 4096};
+
+struct TraceBuffer
+{
+   char acChars[TRACE_BUFFER_LENGTH];
+   size_t uLength;
+};
+
+/* write what psBuffer holds to the trace file and empty it */
+static void trace_flush(struct TraceBuffer *psBuffer)
+{
+   size_t uDone = 0;
+   ssize_t iWritten;
+
+   while (uDone < psBuffer->uLength)
+   {
+      iWritten = write(iTraceFd, psBuffer->acChars + uDone,
+                       psBuffer->uLength - uDone);
+      if ((iWritten == -1) && (errno == EINTR))
+         continue;
+      if (iWritten <= 0)
+         break;
+      uDone += (size_t)iWritten;
+   }
+   psBuffer->uLength = 0;
+}
+
+/* add the string pcChars to psBuffer */
+static void trace_putString(struct TraceBuffer *psBuffer,
+                            const char *pcChars)
+{
+   for (; *pcChars != '\0'; pcChars++)
+   {
+      if (psBuffer->uLength == TRACE_BUFFER_LENGTH)
+         trace_flush(psBuffer);
+      psBuffer->acChars[psBuffer->uLength++] = *pcChars;
+   }
+}
+
+/* add ulValue in decimal to psBuffer, with at least iMinDigits
+   digits */
+static void trace_putNumber(struct TraceBuffer *psBuffer,
+                            unsigned long ulValue, int iMinDigits)
+{
+   enum {MAX_DIGITS = 24};
+
+   char acDigits[MAX_DIGITS + 1];
+   int iIndex = MAX_DIGITS;
+
+   acDigits[iIndex] = '\0';
+   do
+   {
+      acDigits[--iIndex] = (char)('0' + ulValue % 10);
+      ulValue /= 10;
+      iMinDigits--;
+   } while ((ulValue > 0) || (iMinDigits > 0));
+   trace_putString(psBuffer, acDigits + iIndex);
+}
+
+/* add iValue in decimal to psBuffer */
+static void trace_putInt(struct TraceBuffer *psBuffer, int iValue)
+{
+   if (iValue < 0)
+   {
+      trace_putString(psBuffer, "-");
+      trace_putNumber(psBuffer, (unsigned long)-(long)iValue, 1);
+   }
+   else
+      trace_putNumber(psBuffer, (unsigned long)iValue, 1);
+}
+
+/* add psEvent to psBuffer as a Chrome trace event. timestamps are in
+   microseconds */
+static void trace_putEvent(struct TraceBuffer *psBuffer,
+                           const struct TraceEvent *psEvent)
+{
+   char acPhase[2];
+
+   acPhase[0] = psEvent->cPhase;
+   acPhase[1] = '\0';
+   trace_putString(psBuffer, "{\"name\":\"");
+   trace_putString(psBuffer, apcTraceNames[psEvent->eKind]);
+   trace_putString(psBuffer, "\",\"cat\":\"ish\",\"ph\":\"");
+   trace_putString(psBuffer, acPhase);
+   trace_putString(psBuffer, "\",\"ts\":");
+   trace_putNumber(psBuffer,
+                   (unsigned long)psEvent->lSeconds * 1000000UL +
+                   (unsigned long)psEvent->lNanoseconds / 1000UL, 1);
+   trace_putString(psBuffer, ".");
+   trace_putNumber(psBuffer,
+                   (unsigned long)psEvent->lNanoseconds % 1000UL, 3);
+   if (psEvent->cPhase == 'i')
+      trace_putString(psBuffer, ",\"s\":\"t\"");
+   trace_putString(psBuffer, ",\"pid\":");
+   trace_putInt(psBuffer, psEvent->iPid);
+   trace_putString(psBuffer, ",\"tid\":");
+   trace_putInt(psBuffer, psEvent->iPid);
+   trace_putString(psBuffer, ",\"args\":{\"line\":");
+   trace_putNumber(psBuffer, psEvent->ulLine, 1);
+   if (psEvent->iChild != 0)
+   {
+      trace_putString(psBuffer, ",\"child\":");
+      trace_putInt(psBuffer, psEvent->iChild);
+   }
+   if (apcTraceValueNames[psEvent->eKind] != NULL)
+   {
+      trace_putString(psBuffer, ",\"");
+      trace_putString(psBuffer, apcTraceValueNames[psEvent->eKind]);
+      trace_putString(psBuffer, "\":");
+      trace_putInt(psBuffer, psEvent->iValue);
+   }
+   trace_putString(psBuffer, "}}");
+}
+
+/* write the buffer to the trace file, oldest event first */
+void Trace_dump(void)
+{
+   struct TraceBuffer sBuffer;
+   unsigned long ulNext;
+   unsigned long ulIndex;
+   int iErrno;
+
+   if (psTraceRing == NULL)
+      return;
+   iErrno = errno; /* a signal handler mustn't change errno */
+
+   sBuffer.uLength = 0;
+   if ((ftruncate(iTraceFd, 0) == -1) ||
+       (lseek(iTraceFd, 0, SEEK_SET) == -1))
+   {
+      errno = iErrno;
+      return;
+   }
+   trace_putString(&sBuffer, "{\"displayTimeUnit\":\"ms\",");
+   trace_putString(&sBuffer, "\"traceEvents\":[\n");
+   ulNext = psTraceRing->ulNext;
+   ulIndex = (ulNext > ulTraceCapacity) ? ulNext - ulTraceCapacity : 0;
+   for (; ulIndex < ulNext; ulIndex++)
+   {
+      trace_putEvent(&sBuffer,
+                     &psTraceRing->asEvents[ulIndex % ulTraceCapacity]);
+      if (ulIndex + 1 < ulNext)
+         trace_putString(&sBuffer, ",");
+      trace_putString(&sBuffer, "\n");
+   }
+   trace_putString(&sBuffer, "]}\n");
+   trace_flush(&sBuffer);
+   errno = iErrno;
+}
+
+/* the SIGUSR1 handler */
+static void trace_handleSignal(int iSignal)
+{
+   (void)iSignal;
+   Trace_dump();
+}
+
+/* the exit handler. children that exit instead of exec'ing leave the
+   dump to the shell */
+static void trace_dumpAtExit(void)
+{
+   if (getpid() == iTracePid)
+      Trace_dump();
+}
+
+/* start recording into a ring of ulCapacity events, dumped to
+   pcPath */
+int Trace_start(const char *pcPath, unsigned long ulCapacity)
+{
+   struct sigaction sAction;
+   void *pvMap;
+   size_t uLength;
+   int iFd;
+   int iErrno;
+
+   assert(pcPath != NULL);
+   assert(ulCapacity > 0);
+   assert(psTraceRing == NULL);
+
+   iFd = open(pcPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+   if (iFd == -1)
+      return -1;
+   uLength = offsetof(struct TraceRing, asEvents) +
+      sizeof(struct TraceEvent) * (size_t)ulCapacity;
+   pvMap = mmap(NULL, uLength, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (pvMap == MAP_FAILED)
+   {
+      iErrno = errno;
+      (void)close(iFd);
+      errno = iErrno;
+      return -1;
+   }
+
+   iTraceFd = iFd;
+   iTracePid = getpid();
+   ulTraceCapacity = ulCapacity;
+   psTraceRing = (struct TraceRing*)pvMap;
+   psTraceRing->ulNext = 0;
+
+   /* SA_RESTART, so that a dump doesn't cut short the shell's reads */
+   memset(&sAction, 0, sizeof(sAction));
+   sAction.sa_handler = trace_handleSignal;
+   sAction.sa_flags = SA_RESTART;
+   (void)sigemptyset(&sAction.sa_mask);
+   if ((sigaction(SIGUSR1, &sAction, NULL) == -1) ||
+       (atexit(trace_dumpAtExit) != 0))
+   {
+      iErrno = errno;
+      (void)munmap(pvMap, uLength);
+      (void)close(iFd);
+      psTraceRing = NULL;
+      iTraceFd = -1;
+      errno = iErrno;
+      return -1;
+   }
+   return 0;
+}
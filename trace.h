@@ -0,0 +1,41 @@
+/*--------------------------------------------------------------------*/
+/* trace.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+
+/* what a trace event records. a span has a begin and an end event, the
+   rest are single instants. a successful exec shows as an exec that no
+   exec failure follows */
+enum TraceKind {TRACE_READ, TRACE_LEX, TRACE_PARSE, TRACE_REDIRECT,
+                TRACE_FORK, TRACE_EXEC, TRACE_EXEC_FAILED, TRACE_EXIT,
+                TRACE_KIND_COUNT};
+
+/* start recording events into a ring buffer of the latest uCapacity
+   of them, shared with the children forked from now on so that their
+   events land there too. the buffer is written to pcPath as Chrome
+   trace JSON when the shell exits or gets SIGUSR1. return 0 if
+   successful, or -1 with errno set otherwise */
+int Trace_start(const char *pcPath, unsigned long ulCapacity);
+
+/* tag the events from now on with script or input line ulLine */
+void Trace_setLine(unsigned long ulLine);
+
+/* record the start of an eKind span */
+void Trace_begin(enum TraceKind eKind);
+
+/* record the end of an eKind span. iChild is the pid of the child it
+   concerns and iValue an exit status or errno, or 0 for none */
+void Trace_end(enum TraceKind eKind, int iChild, int iValue);
+
+/* record an eKind instant, with iChild and iValue as for Trace_end */
+void Trace_mark(enum TraceKind eKind, int iChild, int iValue);
+
+/* write the buffer to the trace file. only uses async-signal-safe
+   calls, so a signal handler may call it. does nothing unless tracing
+   was started */
+void Trace_dump(void);
+
+#endif
@@ -0,0 +1,275 @@
+/*--------------------------------------------------------------------
+  var.c
+  Author: Nate Wilson
+  Description: the shell's variables, kept in a chained hash table so
+  that an expansion is one hash and a short chain walk rather than
+  getenv's scan of the whole environment
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "var.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/* one variable */
+struct VarEntry
+{
+   char *pcName;
+   char *pcValue;
+   unsigned long ulHash;
+   struct VarEntry *psNext;
+};
+
+/* the buckets start at this many and double whenever there are more
+   variables than buckets */
+enum {VAR_INITIAL_BUCKETS = 64};
+
+/* the table, NULL until first used */
+static struct VarEntry **ppsVarBuckets;
+static size_t uVarBucketCount;
+static size_t uVarCount;
+
+/* the last exit status, and the values of $? and $$, big enough for
+   any int */
+enum {VAR_NUMBER_LENGTH = 24};
+static int iVarStatus;
+static char acVarStatus[VAR_NUMBER_LENGTH] = "0";
+static char acVarPid[VAR_NUMBER_LENGTH];
+
+/*--------------------------------------------------------------------*/
+
+/* return the 32-bit FNV-1a hash of the uLength chars at pcName */
+static unsigned long var_hash(const char *pcName, size_t uLength)
+{
+   const unsigned long ulFnvOffset = 2166136261UL;
+   const unsigned long ulFnvPrime = 16777619UL;
+
+   unsigned long ulHash = ulFnvOffset;
+   size_t uIndex;
+
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+   {
+      ulHash ^= (unsigned long)(unsigned char)pcName[uIndex];
+      ulHash = (ulHash * ulFnvPrime) & 0xffffffffUL;
+   }
+   return ulHash;
+}
+
+/* return a copy of the uLength chars at pcChars, which the caller
+   owns */
+static char *var_copy(const char *pcChars, size_t uLength)
+{
+   char *pcCopy;
+
+   pcCopy = (char*)Mem_alloc(MEM_VAR, uLength + 1);
+   memcpy(pcCopy, pcChars, uLength);
+   pcCopy[uLength] = '\0';
+   return pcCopy;
+}
+
+/* return the entry of the variable whose name is the uLength chars at
+   pcName and whose hash is ulHash, or NULL if it isn't set */
+static struct VarEntry *var_find(const char *pcName, size_t uLength,
+                                 unsigned long ulHash)
+{
+   struct VarEntry *psEntry;
+
+   psEntry = ppsVarBuckets[ulHash % uVarBucketCount];
+   for (; psEntry != NULL; psEntry = psEntry->psNext)
+      if ((psEntry->ulHash == ulHash) &&
+          (strncmp(psEntry->pcName, pcName, uLength) == 0) &&
+          (psEntry->pcName[uLength] == '\0'))
+         return psEntry;
+   return NULL;
+}
+
+/* move every entry into a table of twice as many buckets */
+static void var_grow(void)
+{
+   struct VarEntry **ppsBuckets;
+   struct VarEntry *psEntry;
+   struct VarEntry *psNext;
+   size_t uBucketCount;
+   size_t uIndex;
+
+   uBucketCount = uVarBucketCount * 2;
+   ppsBuckets = (struct VarEntry**)Mem_calloc(MEM_VAR, uBucketCount,
+                                               sizeof(*ppsBuckets));
+   for (uIndex = 0; uIndex < uVarBucketCount; uIndex++)
+      for (psEntry = ppsVarBuckets[uIndex]; psEntry != NULL;
+           psEntry = psNext)
+      {
+         psNext = psEntry->psNext;
+         psEntry->psNext = ppsBuckets[psEntry->ulHash % uBucketCount];
+         ppsBuckets[psEntry->ulHash % uBucketCount] = psEntry;
+      }
+   Mem_free(ppsVarBuckets);
+   ppsVarBuckets = ppsBuckets;
+   uVarBucketCount = uBucketCount;
+}
+
+/* set the variable whose name is the uLength chars at pcName to
+   pcValue in the table */
+static void var_put(const char *pcName, size_t uLength,
+                    const char *pcValue)
+{
+   struct VarEntry *psEntry;
+   unsigned long ulHash;
+
+   ulHash = var_hash(pcName, uLength);
+   psEntry = var_find(pcName, uLength, ulHash);
+   if (psEntry != NULL)
+   {
+      Mem_free(psEntry->pcValue);
+      psEntry->pcValue = var_copy(pcValue, strlen(pcValue));
+      return;
+   }
+
+   psEntry = (struct VarEntry*)Mem_alloc(MEM_VAR, sizeof(*psEntry));
+   psEntry->pcName = var_copy(pcName, uLength);
+   psEntry->pcValue = var_copy(pcValue, strlen(pcValue));
+   psEntry->ulHash = ulHash;
+   psEntry->psNext = ppsVarBuckets[ulHash % uVarBucketCount];
+   ppsVarBuckets[ulHash % uVarBucketCount] = psEntry;
+   uVarCount++;
+   if (uVarCount > uVarBucketCount)
+      var_grow();
+}
+
+/* build the table from the environment, unless it is built already */
+static void var_init(void)
+{
+   char **ppcEnv;
+   char *pcEquals;
+
+   if (ppsVarBuckets != NULL)
+      return;
+
+   uVarBucketCount = VAR_INITIAL_BUCKETS;
+   uVarCount = 0;
+   ppsVarBuckets = (struct VarEntry**)Mem_calloc(MEM_VAR,
+                                                  uVarBucketCount,
+                                                  sizeof(*ppsVarBuckets));
+   for (ppcEnv = environ; *ppcEnv != NULL; ppcEnv++)
+   {
+      pcEquals = strchr(*ppcEnv, '=');
+      if (pcEquals != NULL)
+         var_put(*ppcEnv, (size_t)(pcEquals - *ppcEnv), pcEquals + 1);
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+/* return the value of the variable named by the uLength chars at
+   pcName */
+const char *Var_get(const char *pcName, size_t uLength)
+{
+   struct VarEntry *psEntry;
+
+   assert(pcName != NULL);
+
+   if ((uLength == 1) && (*pcName == '?'))
+      return acVarStatus;
+   if ((uLength == 1) && (*pcName == '$'))
+   {
+      sprintf(acVarPid, "%ld", (long)getpid());
+      return acVarPid;
+   }
+
+   var_init();
+   psEntry = var_find(pcName, uLength, var_hash(pcName, uLength));
+   if (psEntry == NULL)
+      return NULL;
+   return psEntry->pcValue;
+}
+
+/* set the variable pcName to pcValue */
+int Var_set(const char *pcName, const char *pcValue)
+{
+   assert(pcName != NULL);
+   assert(pcValue != NULL);
+
+   var_init();
+   if (setenv(pcName, pcValue, 1) == -1)
+      return -1;
+   var_put(pcName, strlen(pcName), pcValue);
+   return 0;
+}
+
+/* unset the variable pcName */
+int Var_unset(const char *pcName)
+{
+   struct VarEntry **ppsLink;
+   struct VarEntry *psEntry;
+   unsigned long ulHash;
+   size_t uLength;
+
+   assert(pcName != NULL);
+
+   var_init();
+   if (unsetenv(pcName) == -1)
+      return -1;
+
+   uLength = strlen(pcName);
+   ulHash = var_hash(pcName, uLength);
+   ppsLink = &ppsVarBuckets[ulHash % uVarBucketCount];
+   for (; *ppsLink != NULL; ppsLink = &(*ppsLink)->psNext)
+   {
+      psEntry = *ppsLink;
+      if ((psEntry->ulHash == ulHash) &&
+          (strcmp(psEntry->pcName, pcName) == 0))
+      {
+         *ppsLink = psEntry->psNext;
+         Mem_free(psEntry->pcName);
+         Mem_free(psEntry->pcValue);
+         Mem_free(psEntry);
+         uVarCount--;
+         return 0;
+      }
+   }
+   return 0;
+}
+
+/* record iStatus as the value of $? */
+void Var_setStatus(int iStatus)
+{
+   iVarStatus = iStatus;
+   sprintf(acVarStatus, "%d", iStatus);
+}
+
+/* return the last exit status */
+int Var_getStatus(void)
+{
+   return iVarStatus;
+}
+
+/* free the table */
+void Var_free(void)
+{
+   struct VarEntry *psEntry;
+   struct VarEntry *psNext;
+   size_t uIndex;
+
+   if (ppsVarBuckets == NULL)
+      return;
+   for (uIndex = 0; uIndex < uVarBucketCount; uIndex++)
+      for (psEntry = ppsVarBuckets[uIndex]; psEntry != NULL;
+           psEntry = psNext)
+      {
+         psNext = psEntry->psNext;
+         Mem_free(psEntry->pcName);
+         Mem_free(psEntry->pcValue);
+         Mem_free(psEntry);
+      }
+   Mem_free(ppsVarBuckets);
+   ppsVarBuckets = NULL;
+   uVarBucketCount = 0;
+   uVarCount = 0;
+}
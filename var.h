@@ -0,0 +1,40 @@
+/*--------------------------------------------------------------------*/
+/* var.h                                                              */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef VAR_INCLUDED
+#define VAR_INCLUDED
+
+#include <stddef.h>
+
+/* the shell's variables. the table starts as a copy of the
+   environment, and every variable set through it is exported, so that
+   children see the same values as the shell's own expansions */
+
+/* return the value of the variable whose name is the uLength chars at
+   pcName, or NULL if it isn't set. the special names are ? for the
+   last exit status and $ for the shell's pid. the value is good until
+   the variable is next set */
+const char *Var_get(const char *pcName, size_t uLength);
+
+/* set the variable pcName to pcValue, in the table and in the
+   environment. return 0 if successful, or -1 with errno set if
+   pcName isn't a valid name */
+int Var_set(const char *pcName, const char *pcValue);
+
+/* unset the variable pcName, in the table and in the environment.
+   return 0 if successful, or -1 with errno set if pcName isn't a valid
+   name */
+int Var_unset(const char *pcName);
+
+/* record iStatus as the last exit status, the value of $? */
+void Var_setStatus(int iStatus);
+
+/* return the last exit status, the value of $? */
+int Var_getStatus(void);
+
+/* free the table. it is rebuilt from the environment if used again */
+void Var_free(void);
+
+#endif
@@ -0,0 +1,549 @@
+/*--------------------------------------------------------------------
+  xargs.c
+  Author: Nate Wilson
+  Description: the xargs builtin. reads arguments from a file and
+  runs a command template on them, packing as many arguments into
+  each exec as the kernel's ARG_MAX and the current environment allow
+  --------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "token.h"
+#include "xargs.h"
+#include "command.h"
+#include "ish.h"
+#include "dynarray.h"
+#include "redirect.h"
+#include "event.h"
+#include "mem.h"
+#include "path.h"
+#include "spawn.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* in lieu of a true boolean type */
+enum {FALSE, TRUE};
+
+/* POSIX asks xargs to leave this many bytes of ARG_MAX unused */
+enum {ARG_HEADROOM = 2048};
+
+/* linux refuses any single argument longer than this many pages */
+enum {MAX_ARG_PAGES = 32};
+
+/* exit statuses, same as GNU xargs, along with ISH_CANNOT_RUN and
+   ISH_NOT_FOUND. larger is more severe */
+enum {XARGS_USAGE = 1, XARGS_CMD_FAILED = 123, XARGS_CMD_255 = 124,
+      XARGS_CMD_KILLED = 125};
+
+/* options given on the xargs command line */
+struct XargsOptions
+{
+   /* are input arguments separated by '\0' instead of whitespace? */
+   int iNulSeparated;
+   /* don't run the command at all if there are no input arguments */
+   int iNoRunIfEmpty;
+   /* most input arguments per exec, 0 for no limit but ARG_MAX */
+   size_t uMaxArgs;
+   /* most batches running at once */
+   size_t uMaxProcs;
+   /* file to read arguments from, NULL if not given */
+   const char *pcArgFile;
+   /* index into the command's tokens of the template's first token */
+   size_t uCmdIndex;
+};
+
+/* the batches that have been started */
+struct XargsBatches
+{
+   /* number of batches still running */
+   size_t uRunning;
+   /* most severe xargs exit status of the batches done */
+   int iResult;
+};
+
+/* parse pcValue as a positive count, storing it in *puCount.
+   return TRUE if successful, FALSE if pcValue is not a count */
+static int xargs_parseCount(const char *pcValue, size_t *puCount)
+{
+   char *pcEnd;
+   unsigned long ulCount;
+
+   assert(pcValue != NULL);
+   assert(puCount != NULL);
+
+   if (! isdigit((unsigned char)pcValue[0]))
+      return FALSE;
+   errno = 0;
+   ulCount = strtoul(pcValue, &pcEnd, 10);
+   if ((errno != 0) || (*pcEnd != '\0') || (ulCount == 0))
+      return FALSE;
+   *puCount = (size_t)ulCount;
+   return TRUE;
+}
+
+/* fill psOptions from the leading option tokens of oTokens.
+   return TRUE if successful, FALSE (after writing a message to
+   stderr) if the options are malformed */
+static int xargs_parseOptions(DynArray_T oTokens,
+                              struct XargsOptions *psOptions)
+{
+   size_t uIndex;
+   size_t uLength;
+   const char *pcOption;
+   const char *pcValue;
+   const char *pcPgmName = getPgmName();
+
+   assert(oTokens != NULL);
+   assert(psOptions != NULL);
+
+   psOptions->iNulSeparated = FALSE;
+   psOptions->iNoRunIfEmpty = FALSE;
+   psOptions->uMaxArgs = 0;
+   psOptions->uMaxProcs = 1;
+   psOptions->pcArgFile = NULL;
+
+   uLength = DynArray_getLength(oTokens);
+   /* token 0 is "xargs" itself */
+   for (uIndex = 1; uIndex < uLength; uIndex++)
+   {
+      pcOption = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (pcOption[0] != '-')
+         break;
+      if (strcmp(pcOption, "-0") == 0)
+      {
+         psOptions->iNulSeparated = TRUE;
+         continue;
+      }
+      if (strcmp(pcOption, "-r") == 0)
+      {
+         psOptions->iNoRunIfEmpty = TRUE;
+         continue;
+      }
+      if ((strcmp(pcOption, "-n") != 0) &&
+          (strcmp(pcOption, "-P") != 0) &&
+          (strcmp(pcOption, "-a") != 0))
+      {
+         fprintf(stderr, "%s: xargs: invalid option %s\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      /* the remaining options all take a value */
+      if (uIndex + 1 == uLength)
+      {
+         fprintf(stderr, "%s: xargs: option %s requires a value\n",
+                 pcPgmName, pcOption);
+         return FALSE;
+      }
+      uIndex++;
+      pcValue = Token_getValue(DynArray_get(oTokens, uIndex));
+      if (strcmp(pcOption, "-a") == 0)
+         psOptions->pcArgFile = pcValue;
+      else if (! xargs_parseCount(pcValue,
+                                  (pcOption[1] == 'n') ?
+                                  &psOptions->uMaxArgs :
+                                  &psOptions->uMaxProcs))
+      {
+         fprintf(stderr, "%s: xargs: invalid count for %s: %s\n",
+                 pcPgmName, pcOption, pcValue);
+         return FALSE;
+      }
+   }
+   psOptions->uCmdIndex = uIndex;
+   return TRUE;
+}
+
+/* read all of psFile into a newly allocated, null terminated buffer,
+   storing the number of bytes read in *puLength. the caller owns the
+   buffer. return NULL if a read error occurs */
+static char *xargs_readAll(FILE *psFile, size_t *puLength)
+{
+   enum {INITIAL_BUFFER_LENGTH = 65536};
+   enum {GROWTH_FACTOR = 2};
+
+   size_t uLength = 0;
+   size_t uPhysLength = INITIAL_BUFFER_LENGTH;
+   size_t uRead;
+   char *pcBuffer;
+
+   assert(psFile != NULL);
+   assert(puLength != NULL);
+
+   pcBuffer = (char*)Mem_alloc(MEM_BUILTIN, uPhysLength);
+
+   /* large freads, leaving room for the null terminator */
+   for (;;)
+   {
+      if (uLength + 1 == uPhysLength)
+      {
+         uPhysLength *= GROWTH_FACTOR;
+         pcBuffer = (char*)Mem_realloc(MEM_BUILTIN,
+                                       pcBuffer, uPhysLength);
+      }
+      uRead = fread(pcBuffer + uLength, 1,
+                    uPhysLength - uLength - 1, psFile);
+      uLength += uRead;
+      if (uRead == 0)
+         break;
+   }
+   if (ferror(psFile))
+   {
+      Mem_free(pcBuffer);
+      return NULL;
+   }
+   pcBuffer[uLength] = '\0';
+   *puLength = uLength;
+   return pcBuffer;
+}
+
+/* split the uLength bytes of pcBuffer in place into arguments
+   separated by whitespace, or by '\0' if iNulSeparated, and return
+   an array of pointers to them. the array does not own the strings */
+static DynArray_T xargs_splitArgs(char *pcBuffer, size_t uLength,
+                                  int iNulSeparated)
+{
+   size_t uIndex;
+   int iInArg = FALSE;
+   int iSeparator;
+   DynArray_T oArgs;
+   const char *pcPgmName = getPgmName();
+
+   assert(pcBuffer != NULL);
+
+   oArgs = DynArray_new(0);
+   if (oArgs == NULL)
+   {
+      fprintf(stderr, "%s: insufficient memory\n", pcPgmName);
+      exit(EXIT_FAILURE);
+   }
+
+   for (uIndex = 0; uIndex < uLength; uIndex++)
+   {
+      if (iNulSeparated)
+         iSeparator = (pcBuffer[uIndex] == '\0');
+      else
+         iSeparator = isspace((unsigned char)pcBuffer[uIndex]);
+
+      if (iSeparator)
+      {
+         pcBuffer[uIndex] = '\0';
+         iInArg = FALSE;
+      }
+      else if (! iInArg)
+      {
+         if (! DynArray_add(oArgs, pcBuffer + uIndex))
+         {
+            fprintf(stderr, "%s: insufficient memory\n", pcPgmName);
+            exit(EXIT_FAILURE);
+         }
+         iInArg = TRUE;
+      }
+   }
+   return oArgs;
+}
+
+/* return the number of bytes of argument strings and pointers that
+   one exec may use: ARG_MAX, less what the environment occupies, less
+   the POSIX headroom. return 0 if the environment alone is too big */
+static size_t xargs_getArgBudget(void)
+{
+   long lArgMax;
+   size_t uEnvSize = sizeof(char *);
+   char **ppcEnv;
+
+   lArgMax = sysconf(_SC_ARG_MAX);
+   if (lArgMax <= 0)
+      lArgMax = _POSIX_ARG_MAX;
+
+   for (ppcEnv = environ; *ppcEnv != NULL; ppcEnv++)
+      uEnvSize += strlen(*ppcEnv) + 1 + sizeof(char *);
+
+   if (uEnvSize + ARG_HEADROOM >= (size_t)lArgMax)
+      return 0;
+   return (size_t)lArgMax - uEnvSize - ARG_HEADROOM;
+}
+
+/* the event loop's handler for a batch that exited with wait status
+   iStatus: fold the status into the struct XargsBatches pvExtra,
+   keeping the most severe xargs exit status seen */
+static void xargs_reapBatch(pid_t iPid, int iStatus, void *pvExtra)
+{
+   struct XargsBatches *psBatches = (struct XargsBatches*)pvExtra;
+   int iResult;
+
+   (void)iPid;
+   assert(psBatches != NULL);
+
+   if (WIFSIGNALED(iStatus))
+      iResult = XARGS_CMD_KILLED;
+   else if (WEXITSTATUS(iStatus) == 0)
+      iResult = 0;
+   else if (WEXITSTATUS(iStatus) == 255)
+      iResult = XARGS_CMD_255;
+   else if ((WEXITSTATUS(iStatus) == ISH_CANNOT_RUN) ||
+            (WEXITSTATUS(iStatus) == ISH_NOT_FOUND))
+      iResult = WEXITSTATUS(iStatus);
+   else
+      iResult = XARGS_CMD_FAILED;
+
+   if (iResult > psBatches->iResult)
+      psBatches->iResult = iResult;
+   psBatches->uRunning--;
+}
+
+/* run oEvent until fewer than uMaxRunning of psBatches are running */
+static void xargs_waitForBatches(Event_T oEvent,
+                                 struct XargsBatches *psBatches,
+                                 size_t uMaxRunning)
+{
+   assert(oEvent != NULL);
+   assert(psBatches != NULL);
+
+   while (psBatches->uRunning >= uMaxRunning)
+      if (Event_runOnce(oEvent, -1) == -1)
+      {perror(getPgmName()); exit(EXIT_FAILURE);}
+}
+
+/* run the template in apcArgv[0..uTemplateLength-1], whose command
+   is the file pcFile (see Spawn_command), on the strings in oArgs,
+   uMaxProcs batches at a time, each batch holding at most uMaxArgs
+   arguments (0 for no limit) and uBudget bytes of strings and
+   pointers, and with stdin moved to iStdin, unless it is -1, and then
+   oPlan's redirections applied. oEvent reaps the batches. return the
+   xargs exit status */
+static int xargs_runBatches(char *apcArgv[], size_t uTemplateLength,
+                            const char *pcFile, DynArray_T oArgs,
+                            const struct XargsOptions *psOptions,
+                            size_t uBudget, RedirectPlan_T oPlan,
+                            int iStdin, Event_T oEvent)
+{
+   struct XargsBatches sBatches;
+   size_t uArgIndex = 0;
+   size_t uArgCount;
+   size_t uBatchLength;
+   size_t uBatchSize;
+   size_t uArgSize;
+   size_t uTemplateSize = sizeof(char *);
+   size_t uIndex;
+   char *pcArg;
+   pid_t iPid;
+   int aiFds[3];
+   int iTooLong = FALSE;
+   size_t uMaxArgSize;
+   long lPageSize;
+   const char *pcPgmName = getPgmName();
+
+   assert(apcArgv != NULL);
+   assert(oArgs != NULL);
+   assert(psOptions != NULL);
+
+   lPageSize = sysconf(_SC_PAGESIZE);
+   uMaxArgSize = MAX_ARG_PAGES * (size_t)((lPageSize > 0) ? lPageSize
+                                                          : 4096);
+
+   for (uIndex = 0; uIndex < uTemplateLength; uIndex++)
+      uTemplateSize += strlen(apcArgv[uIndex]) + 1 + sizeof(char *);
+   if (uTemplateSize >= uBudget)
+   {
+      fprintf(stderr, "%s: xargs: command too long\n", pcPgmName);
+      return XARGS_USAGE;
+   }
+
+   aiFds[0] = iStdin;
+   aiFds[1] = -1;
+   aiFds[2] = -1;
+   sBatches.uRunning = 0;
+   sBatches.iResult = 0;
+   uArgCount = DynArray_getLength(oArgs);
+   do
+   {
+      /* pack arguments until the next one would not fit */
+      uBatchLength = uTemplateLength;
+      uBatchSize = uTemplateSize;
+      while (uArgIndex < uArgCount)
+      {
+         if ((psOptions->uMaxArgs != 0) &&
+             (uBatchLength - uTemplateLength == psOptions->uMaxArgs))
+            break;
+         pcArg = DynArray_get(oArgs, uArgIndex);
+         uArgSize = strlen(pcArg) + 1;
+         /* an argument that can't fit even in an empty batch */
+         if ((uArgSize > uMaxArgSize) ||
+             ((uBatchLength == uTemplateLength) &&
+              (uBatchSize + uArgSize + sizeof(char *) > uBudget)))
+         {
+            iTooLong = TRUE;
+            break;
+         }
+         if (uBatchSize + uArgSize + sizeof(char *) > uBudget)
+            break;
+         apcArgv[uBatchLength++] = pcArg;
+         uBatchSize += uArgSize + sizeof(char *);
+         uArgIndex++;
+      }
+      if (iTooLong)
+      {
+         fprintf(stderr, "%s: xargs: argument too long\n", pcPgmName);
+         sBatches.iResult = XARGS_USAGE;
+         break;
+      }
+      apcArgv[uBatchLength] = NULL;
+
+      /* wait for a slot, then start the batch */
+      xargs_waitForBatches(oEvent, &sBatches, psOptions->uMaxProcs);
+      iPid = Spawn_command(apcArgv, pcFile, aiFds, oPlan, NULL, NULL);
+      if (iPid == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+      sBatches.uRunning++;
+      if (Event_reapChild(oEvent, iPid, xargs_reapBatch, &sBatches) == -1)
+      {perror(pcPgmName); exit(EXIT_FAILURE); }
+   } while (uArgIndex < uArgCount);
+
+   xargs_waitForBatches(oEvent, &sBatches, 1);
+   return sBatches.iResult;
+}
+
+/* run the xargs builtin described by oCommand, with oEvent reaping
+   the batches. return 0 if every batch succeeded, or an xargs style
+   exit status otherwise. stdin is the shell's input if iStdinIsInput */
+int Xargs_run(Command_T oCommand, Event_T oEvent, int iStdinIsInput)
+{
+   struct XargsOptions sOptions;
+   DynArray_T oTokens;
+   DynArray_T oArgs;
+   RedirectPlan_T oPlan;
+   FILE *psArgFile;
+   char *pcBuffer;
+   char **apcArgv;
+   const char *pcFile;
+   size_t uLength;
+   size_t uTemplateLength;
+   size_t uIndex;
+   size_t uBudget;
+   int iStdin = -1;
+   int iArgFd;
+   int iResult;
+   const char *pcPgmName = getPgmName();
+
+   assert(oCommand != NULL);
+
+   oTokens = Command_getTokens(oCommand);
+   if (! xargs_parseOptions(oTokens, &sOptions))
+      return XARGS_USAGE;
+
+   uBudget = xargs_getArgBudget();
+   if (uBudget == 0)
+   {
+      fprintf(stderr, "%s: xargs: environment is too large for exec\n",
+              pcPgmName);
+      return XARGS_USAGE;
+   }
+
+   /* open the redirections once, so that batches append to one
+      another's output rather than each truncating it */
+   oPlan = Redirect_createPlan(Command_getRedirects(oCommand));
+   if (oPlan == NULL)
+      return XARGS_USAGE;
+   /* "> a > b" is copied while the batches run */
+   if (Redirect_watchPlan(oPlan, oEvent) == -1)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      return XARGS_USAGE;
+   }
+
+   /* the -a file wins over a stdin redirection, which wins over
+      reading the shell's own stdin */
+   if (sOptions.pcArgFile != NULL)
+      psArgFile = fopen(sOptions.pcArgFile, "r");
+   else if (Redirect_getPlanFd(oPlan, 0) != -1)
+   {  /* the batches share the offset, so they find it at EOF */
+      iArgFd = dup(Redirect_getPlanFd(oPlan, 0));
+      psArgFile = (iArgFd == -1) ? NULL : fdopen(iArgFd, "r");
+   }
+   else if (iStdinIsInput && (! isatty(0)))
+   {
+      fprintf(stderr, "%s: xargs: stdin is the shell's input; "
+              "use -a or <\n", pcPgmName);
+      Redirect_freePlan(oPlan);
+      return XARGS_USAGE;
+   }
+   else
+      psArgFile = stdin;
+   if (psArgFile == NULL)
+   {
+      perror((sOptions.pcArgFile != NULL) ?
+             sOptions.pcArgFile : pcPgmName);
+      Redirect_freePlan(oPlan);
+      return XARGS_USAGE;
+   }
+
+   pcBuffer = xargs_readAll(psArgFile, &uLength);
+   if (psArgFile != stdin)
+      (void)fclose(psArgFile);
+   else /* so that the shell reads on after the end of file typed */
+      clearerr(stdin);
+   if (pcBuffer == NULL)
+   {
+      perror(pcPgmName);
+      Redirect_freePlan(oPlan);
+      return XARGS_USAGE;
+   }
+   oArgs = xargs_splitArgs(pcBuffer, uLength, sOptions.iNulSeparated);
+
+   if ((DynArray_getLength(oArgs) == 0) && sOptions.iNoRunIfEmpty)
+   {
+      Redirect_freePlan(oPlan);
+      DynArray_free(oArgs);
+      Mem_free(pcBuffer);
+      return 0;
+   }
+
+   /* the batches' stdin must not be the arguments we just consumed */
+   if (psArgFile == stdin)
+   {
+      iStdin = open("/dev/null", O_RDONLY | O_CLOEXEC);
+      if (iStdin == -1) {perror(pcPgmName); exit(EXIT_FAILURE); }
+   }
+
+   /* template plus every argument plus the null terminator is the
+      largest any batch can be */
+   uTemplateLength = DynArray_getLength(oTokens) - sOptions.uCmdIndex;
+   apcArgv = (char**)Mem_alloc(MEM_BUILTIN, sizeof(char *) *
+                               (uTemplateLength +
+                                DynArray_getLength(oArgs) + 2));
+   if (uTemplateLength == 0) /* default command is echo */
+   {
+      apcArgv[0] = "echo";
+      uTemplateLength = 1;
+      pcFile = NULL; /* not pooled, so left to execvp */
+   }
+   else
+   {
+      for (uIndex = 0; uIndex < uTemplateLength; uIndex++)
+         apcArgv[uIndex] = (char*)Token_getValue(
+            DynArray_get(oTokens, sOptions.uCmdIndex + uIndex));
+      /* searched in the shell, so that the search is remembered */
+      pcFile = Path_find(apcArgv[0]);
+   }
+
+   iResult = xargs_runBatches(apcArgv, uTemplateLength, pcFile, oArgs,
+                              &sOptions, uBudget, oPlan, iStdin, oEvent);
+
+   if (iStdin != -1)
+      (void)close(iStdin);
+   Redirect_freePlan(oPlan);
+   Mem_free(apcArgv);
+   DynArray_free(oArgs);
+   Mem_free(pcBuffer);
+   return iResult;
+}
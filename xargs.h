@@ -0,0 +1,25 @@
+/*--------------------------------------------------------------------*/
+/* xargs.h                                                            */
+/* Author: Nate Wilson                                                */
+/*--------------------------------------------------------------------*/
+
+#ifndef XARGS_INCLUDED
+#define XARGS_INCLUDED
+
+#include "command.h"
+#include "event.h"
+
+/* run the xargs builtin described by oCommand:
+      xargs [-0] [-n max-args] [-P max-procs] [-a file] cmd [args]
+   arguments are read from the -a file, else from oCommand's stdin
+   redirection, else from stdin, and are packed into as few execs of
+   cmd as ARG_MAX allows. if iStdinIsInput, stdin is where the shell
+   reads its commands from: at a terminal the arguments are read up to
+   the end of the file typed, after which the shell reads on, and
+   otherwise xargs refuses to read stdin rather than take the rest of
+   the shell's input. the batches are reaped, and their output copied,
+   by oEvent. return 0 if every batch succeeded, or an xargs style
+   exit status otherwise */
+int Xargs_run(Command_T oCommand, Event_T oEvent, int iStdinIsInput);
+
+#endif